@@ -3,11 +3,19 @@
  * Milo832 GPU Assembler - Implementation
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "milo_asm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /*---------------------------------------------------------------------------
  * Opcode Table
@@ -133,10 +141,46 @@ static const opcode_entry_t opcode_table[] = {
  * Helper Functions
  *---------------------------------------------------------------------------*/
 
-static const opcode_entry_t *find_opcode(const char *name) {
+/* FNV-1a, used for the opcode and label indexes */
+static uint32_t hash_str(const char *str, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)str[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Opcode indexes, built once and read-only afterwards: mnemonic hash
+ * (table index + 1, 0 = empty) and opcode number to first table entry */
+#define OPCODE_HASH_SIZE 256
+
+static uint8_t opcode_hash[OPCODE_HASH_SIZE];
+static uint8_t opcode_by_num[256];
+static pthread_once_t opcode_once = PTHREAD_ONCE_INIT;
+
+static void build_opcode_index(void) {
     for (int i = 0; opcode_table[i].name != NULL; i++) {
-        if (strcasecmp(opcode_table[i].name, name) == 0) {
-            return &opcode_table[i];
+        const char *name = opcode_table[i].name;
+        uint32_t b = hash_str(name, strlen(name)) & (OPCODE_HASH_SIZE - 1);
+        while (opcode_hash[b]) b = (b + 1) & (OPCODE_HASH_SIZE - 1);
+        opcode_hash[b] = (uint8_t)(i + 1);
+        
+        if (!opcode_by_num[opcode_table[i].opcode]) {
+            opcode_by_num[opcode_table[i].opcode] = (uint8_t)(i + 1);
+        }
+    }
+}
+
+/* Look up a lower-case mnemonic */
+static const opcode_entry_t *find_opcode(const char *name) {
+    pthread_once(&opcode_once, build_opcode_index);
+    
+    uint32_t b = hash_str(name, strlen(name)) & (OPCODE_HASH_SIZE - 1);
+    for (; opcode_hash[b]; b = (b + 1) & (OPCODE_HASH_SIZE - 1)) {
+        const opcode_entry_t *op = &opcode_table[opcode_hash[b] - 1];
+        if (strcmp(op->name, name) == 0) {
+            return op;
         }
     }
     return NULL;
@@ -251,20 +295,163 @@ void milo_asm_init(milo_asm_t *as) {
     memset(as, 0, sizeof(*as));
 }
 
-/* Forward declaration for unresolved labels */
-typedef struct {
-    uint32_t address;
-    char     label[64];
-    int      line;
-} unresolved_t;
+void milo_asm_free(milo_asm_t *as) {
+    free(as->code);
+    free(as->labels);
+    free(as->label_index);
+    free(as->names);
+    free(as->refs);
+    free(as->data);
+    free(as->line_buf);
+    memset(as, 0, sizeof(*as));
+}
 
-static unresolved_t unresolved[MILO_MAX_LABELS];
-static int unresolved_count = 0;
+/* Record an error; the message keeps the line number for get_error */
+static void asm_error(milo_asm_t *as, int line, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(as->error, sizeof(as->error), fmt, args);
+    va_end(args);
+    as->error_line = line;
+    snprintf(as->message, sizeof(as->message), "Line %d: %s", line, as->error);
+}
 
-bool milo_asm_line(milo_asm_t *as, const char *line, int line_num) {
-    char buf[MILO_MAX_LINE_LEN];
-    strncpy(buf, line, sizeof(buf) - 1);
-    buf[sizeof(buf) - 1] = '\0';
+/* Grow an array to hold at least need elements */
+static bool grow(void **buf, uint32_t *capacity, uint32_t need, size_t elem) {
+    if (need <= *capacity) return true;
+    uint32_t cap = *capacity ? *capacity : 64;
+    while (cap < need) cap *= 2;
+    void *p = realloc(*buf, (size_t)cap * elem);
+    if (!p) return false;
+    *buf = p;
+    *capacity = cap;
+    return true;
+}
+
+static void index_label(milo_asm_t *as, uint32_t id) {
+    const char *name = as->names + as->labels[id].name;
+    uint32_t mask = as->label_index_size - 1;
+    uint32_t b = hash_str(name, strlen(name)) & mask;
+    while (as->label_index[b]) b = (b + 1) & mask;
+    as->label_index[b] = id + 1;
+}
+
+/* Find or create the label called name; returns its index or -1 */
+static int64_t intern_label(milo_asm_t *as, const char *name) {
+    size_t len = strlen(name);
+    uint32_t h = hash_str(name, len);
+    
+    if (as->label_index_size) {
+        uint32_t mask = as->label_index_size - 1;
+        for (uint32_t b = h & mask; as->label_index[b]; b = (b + 1) & mask) {
+            uint32_t id = as->label_index[b] - 1;
+            if (strcmp(as->names + as->labels[id].name, name) == 0) return id;
+        }
+    }
+    
+    /* New label: copy the name into the pool */
+    if (as->names_len + len + 1 > as->names_capacity) {
+        size_t cap = as->names_capacity ? as->names_capacity : 1024;
+        while (cap < as->names_len + len + 1) cap *= 2;
+        char *names = realloc(as->names, cap);
+        if (!names) return -1;
+        as->names = names;
+        as->names_capacity = cap;
+    }
+    if (!grow((void **)&as->labels, &as->label_capacity, as->label_count + 1,
+              sizeof(milo_label_t))) {
+        return -1;
+    }
+    
+    /* Keep the index at most half full */
+    if ((as->label_count + 1) * 2 > as->label_index_size) {
+        uint32_t n = as->label_index_size ? as->label_index_size * 2 : 64;
+        uint32_t *index = calloc(n, sizeof(uint32_t));
+        if (!index) return -1;
+        free(as->label_index);
+        as->label_index = index;
+        as->label_index_size = n;
+        for (uint32_t i = 0; i < as->label_count; i++) index_label(as, i);
+    }
+    
+    uint32_t id = as->label_count++;
+    as->labels[id].name = (uint32_t)as->names_len;
+    as->labels[id].address = MILO_LABEL_UNDEFINED;
+    as->labels[id].flags = 0;
+    memcpy(as->names + as->names_len, name, len + 1);
+    as->names_len += len + 1;
+    index_label(as, id);
+    return id;
+}
+
+/* .data <address>, <value> | .global <label> | .extern <label> */
+static bool asm_directive(milo_asm_t *as, const char *name, char *args, int line_num) {
+    args = trim(args);
+    
+    if (strcmp(name, ".data") == 0) {
+        char *comma = strchr(args, ',');
+        uint32_t address, value;
+        if (!comma) {
+            asm_error(as, line_num, "Expected .data <address>, <value>");
+            return false;
+        }
+        *comma = '\0';
+        char *addr_str = trim(args);
+        char *value_str = trim(comma + 1);
+        if (!parse_immediate(addr_str, &address) || (address & 3)) {
+            asm_error(as, line_num, "Invalid data address: %s", addr_str);
+            return false;
+        }
+        if (!parse_immediate(value_str, &value)) {
+            asm_error(as, line_num, "Invalid data value: %s", value_str);
+            return false;
+        }
+        if (!grow((void **)&as->data, &as->data_capacity, as->data_count + 1,
+                  sizeof(milo_asm_data_t))) {
+            asm_error(as, line_num, "Out of memory");
+            return false;
+        }
+        as->data[as->data_count].address = address;
+        as->data[as->data_count].value = value;
+        as->data_count++;
+        return true;
+    }
+    
+    uint32_t flag = strcmp(name, ".global") == 0 ? MILO_LABEL_GLOBAL :
+                    strcmp(name, ".extern") == 0 ? MILO_LABEL_EXTERN : 0;
+    if (!flag) {
+        asm_error(as, line_num, "Unknown directive: %s", name);
+        return false;
+    }
+    if (*args == '\0') {
+        asm_error(as, line_num, "%s requires a label name", name);
+        return false;
+    }
+    int64_t id = intern_label(as, args);
+    if (id < 0) {
+        asm_error(as, line_num, "Out of memory");
+        return false;
+    }
+    as->labels[id].flags |= flag;
+    return true;
+}
+
+/* Assemble one line of len bytes */
+static bool asm_line_n(milo_asm_t *as, const char *line, size_t len, int line_num) {
+    if (len + 1 > as->line_capacity) {
+        size_t cap = as->line_capacity ? as->line_capacity : 256;
+        while (cap < len + 1) cap *= 2;
+        char *buf = realloc(as->line_buf, cap);
+        if (!buf) {
+            asm_error(as, line_num, "Out of memory");
+            return false;
+        }
+        as->line_buf = buf;
+        as->line_capacity = cap;
+    }
+    char *buf = as->line_buf;
+    memcpy(buf, line, len);
+    buf[len] = '\0';
     
     /* Remove comments */
     char *comment = strchr(buf, ';');
@@ -281,15 +468,15 @@ bool milo_asm_line(milo_asm_t *as, const char *line, int line_num) {
         *colon = '\0';
         char *label = trim(p);
         
-        if (as->label_count >= MILO_MAX_LABELS) {
-            snprintf(as->error, sizeof(as->error), "Too many labels");
-            as->error_line = line_num;
+        int64_t id = intern_label(as, label);
+        if (id < 0) {
+            asm_error(as, line_num, "Out of memory");
             return false;
         }
-        
-        strncpy(as->labels[as->label_count].name, label, 63);
-        as->labels[as->label_count].address = as->code_size;
-        as->label_count++;
+        /* The first definition wins */
+        if (as->labels[id].address == MILO_LABEL_UNDEFINED) {
+            as->labels[id].address = as->code_size;
+        }
         
         p = trim(colon + 1);
         if (*p == '\0') return true;  /* Label only line */
@@ -303,15 +490,14 @@ bool milo_asm_line(milo_asm_t *as, const char *line, int line_num) {
     }
     mnemonic[i] = '\0';
     
-    /* Skip data directives (handled by VM loader separately) */
-    if (strcmp(mnemonic, ".data") == 0) {
-        return true;  /* Not an error, just skip */
+    /* Directives */
+    if (mnemonic[0] == '.') {
+        return asm_directive(as, mnemonic, p, line_num);
     }
     
     const opcode_entry_t *op = find_opcode(mnemonic);
     if (!op) {
-        snprintf(as->error, sizeof(as->error), "Unknown instruction: %s", mnemonic);
-        as->error_line = line_num;
+        asm_error(as, line_num, "Unknown instruction: %s", mnemonic);
         return false;
     }
     
@@ -358,9 +544,7 @@ bool milo_asm_line(milo_asm_t *as, const char *line, int line_num) {
                 {
                     uint8_t reg;
                     if (!parse_register(arg, &reg)) {
-                        snprintf(as->error, sizeof(as->error), 
-                                "Invalid register: %s", arg);
-                        as->error_line = line_num;
+                        asm_error(as, line_num, "Invalid register: %s", arg);
                         return false;
                     }
                     if (j == 0) inst.rd = reg;
@@ -376,15 +560,11 @@ bool milo_asm_line(milo_asm_t *as, const char *line, int line_num) {
                     /* Try float first if it has a decimal point */
                     if (strchr(arg, '.')) {
                         if (!parse_float(arg, &imm)) {
-                            snprintf(as->error, sizeof(as->error),
-                                    "Invalid float: %s", arg);
-                            as->error_line = line_num;
+                            asm_error(as, line_num, "Invalid float: %s", arg);
                             return false;
                         }
                     } else if (!parse_immediate(arg, &imm)) {
-                        snprintf(as->error, sizeof(as->error),
-                                "Invalid immediate: %s", arg);
-                        as->error_line = line_num;
+                        asm_error(as, line_num, "Invalid immediate: %s", arg);
                         return false;
                     }
                     inst.imm = imm;
@@ -395,16 +575,16 @@ bool milo_asm_line(milo_asm_t *as, const char *line, int line_num) {
             case 'l':  /* Label */
                 {
                     /* Store for later resolution */
-                    if (unresolved_count >= MILO_MAX_LABELS) {
-                        snprintf(as->error, sizeof(as->error), 
-                                "Too many unresolved labels");
-                        as->error_line = line_num;
+                    int64_t id = intern_label(as, arg);
+                    if (id < 0 || !grow((void **)&as->refs, &as->ref_capacity,
+                                        as->ref_count + 1, sizeof(milo_label_ref_t))) {
+                        asm_error(as, line_num, "Out of memory");
                         return false;
                     }
-                    unresolved[unresolved_count].address = as->code_size;
-                    strncpy(unresolved[unresolved_count].label, arg, 63);
-                    unresolved[unresolved_count].line = line_num;
-                    unresolved_count++;
+                    as->refs[as->ref_count].address = as->code_size;
+                    as->refs[as->ref_count].label = (uint32_t)id;
+                    as->refs[as->ref_count].line = line_num;
+                    as->ref_count++;
                     inst.imm = 0;  /* Placeholder */
                     inst.has_imm = true;
                 }
@@ -413,9 +593,8 @@ bool milo_asm_line(milo_asm_t *as, const char *line, int line_num) {
     }
     
     /* Emit instruction */
-    if (as->code_size >= MILO_MAX_CODE_SIZE) {
-        snprintf(as->error, sizeof(as->error), "Code too large");
-        as->error_line = line_num;
+    if (!grow((void **)&as->code, &as->code_capacity, as->code_size + 1, sizeof(uint64_t))) {
+        asm_error(as, line_num, "Out of memory");
         return false;
     }
     
@@ -423,65 +602,108 @@ bool milo_asm_line(milo_asm_t *as, const char *line, int line_num) {
     return true;
 }
 
+bool milo_asm_line(milo_asm_t *as, const char *line, int line_num) {
+    return asm_line_n(as, line, strlen(line), line_num);
+}
+
 bool milo_asm_resolve(milo_asm_t *as) {
-    for (int i = 0; i < unresolved_count; i++) {
-        bool found = false;
-        for (uint32_t j = 0; j < as->label_count; j++) {
-            if (strcmp(unresolved[i].label, as->labels[j].name) == 0) {
-                /* Patch the instruction */
-                uint64_t word = as->code[unresolved[i].address];
-                word = (word & 0xFFFFFFFF00000000ULL) | as->labels[j].address;
-                as->code[unresolved[i].address] = word;
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
-            snprintf(as->error, sizeof(as->error), 
-                    "Undefined label: %s", unresolved[i].label);
-            as->error_line = unresolved[i].line;
+    for (uint32_t i = 0; i < as->ref_count; i++) {
+        const milo_label_ref_t *u = &as->refs[i];
+        const milo_label_t *label = &as->labels[u->label];
+        if (label->address == MILO_LABEL_UNDEFINED) {
+            if (label->flags & MILO_LABEL_EXTERN) continue;
+            asm_error(as, u->line, "Undefined label: %s", as->names + label->name);
             return false;
         }
+        /* Patch the instruction (idempotent, so resolving twice is safe) */
+        uint64_t word = as->code[u->address];
+        word = (word & 0xFFFFFFFF00000000ULL) | label->address;
+        as->code[u->address] = word;
     }
-    unresolved_count = 0;
     return true;
 }
 
-bool milo_asm_source(milo_asm_t *as, const char *source) {
+bool milo_asm_buffer(milo_asm_t *as, const char *source, size_t len) {
     const char *p = source;
-    char line[MILO_MAX_LINE_LEN];
+    const char *end = source + len;
     int line_num = 1;
     
-    unresolved_count = 0;
-    
-    while (*p) {
+    while (p < end) {
         /* Extract line */
-        int i = 0;
-        while (*p && *p != '\n' && i < MILO_MAX_LINE_LEN - 1) {
-            line[i++] = *p++;
-        }
-        line[i] = '\0';
-        if (*p == '\n') p++;
+        const char *nl = memchr(p, '\n', end - p);
+        size_t n = nl ? (size_t)(nl - p) : (size_t)(end - p);
         
-        if (!milo_asm_line(as, line, line_num)) {
+        if (!asm_line_n(as, p, n, line_num)) {
             return false;
         }
+        p += n + (nl ? 1 : 0);
         line_num++;
     }
     
     return milo_asm_resolve(as);
 }
 
+bool milo_asm_source(milo_asm_t *as, const char *source) {
+    return milo_asm_buffer(as, source, strlen(source));
+}
+
+bool milo_asm_file(milo_asm_t *as, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        asm_error(as, 0, "Cannot open '%s'", path);
+        return false;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        asm_error(as, 0, "Cannot stat '%s'", path);
+        return false;
+    }
+    
+    size_t size = (size_t)st.st_size;
+    if (size == 0) {
+        close(fd);
+        return milo_asm_buffer(as, "", 0);
+    }
+    
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        asm_error(as, 0, "Cannot map '%s'", path);
+        return false;
+    }
+    
+    /* Lines are consumed front to back; let the kernel read ahead */
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+    bool ok = milo_asm_buffer(as, map, size);
+    munmap(map, size);
+    return ok;
+}
+
 const uint64_t *milo_asm_get_code(const milo_asm_t *as, uint32_t *size) {
     if (size) *size = as->code_size;
     return as->code;
 }
 
+const milo_asm_data_t *milo_asm_get_data(const milo_asm_t *as, uint32_t *count) {
+    if (count) *count = as->data_count;
+    return as->data;
+}
+
+const char *milo_asm_get_undefined(const milo_asm_t *as) {
+    for (uint32_t i = 0; i < as->ref_count; i++) {
+        const milo_label_t *label = &as->labels[as->refs[i].label];
+        if (label->address == MILO_LABEL_UNDEFINED) {
+            return as->names + label->name;
+        }
+    }
+    return NULL;
+}
+
 const char *milo_asm_get_error(const milo_asm_t *as) {
     if (as->error[0]) {
-        static char buf[512];
-        snprintf(buf, sizeof(buf), "Line %d: %s", as->error_line, as->error);
-        return buf;
+        return as->message;
     }
     return NULL;
 }
@@ -494,12 +716,11 @@ void milo_disasm_inst(uint64_t word, char *buf, size_t buf_size) {
     milo_inst_t inst;
     milo_decode_inst(word, &inst);
     
+    pthread_once(&opcode_once, build_opcode_index);
+    
     const char *name = "???";
-    for (int i = 0; opcode_table[i].name != NULL; i++) {
-        if (opcode_table[i].opcode == inst.opcode) {
-            name = opcode_table[i].name;
-            break;
-        }
+    if (opcode_by_num[inst.opcode]) {
+        name = opcode_table[opcode_by_num[inst.opcode] - 1].name;
     }
     
     snprintf(buf, buf_size, "%-6s r%d, r%d, r%d, 0x%08X",
@@ -507,10 +728,26 @@ void milo_disasm_inst(uint64_t word, char *buf, size_t buf_size) {
 }
 
 void milo_disasm_program(const uint64_t *code, uint32_t size, FILE *out) {
+    milo_disasm_annotated(code, size, out, NULL, NULL);
+}
+
+void milo_disasm_annotated(const uint64_t *code, uint32_t size, FILE *out,
+                           milo_disasm_annotate_t annotate, void *ctx) {
     char buf[128];
+    char prefix[128] = "";
+    char suffix[256] = "";
     for (uint32_t i = 0; i < size; i++) {
         milo_disasm_inst(code[i], buf, sizeof(buf));
-        fprintf(out, "%04X: %016llX  %s\n", i, 
-                (unsigned long long)code[i], buf);
+        if (annotate) {
+            prefix[0] = suffix[0] = '\0';
+            annotate(ctx, i, prefix, sizeof(prefix), suffix, sizeof(suffix));
+        }
+        if (suffix[0]) {
+            fprintf(out, "%s%04X: %016llX  %-40s  %s\n", prefix, i,
+                    (unsigned long long)code[i], buf, suffix);
+        } else {
+            fprintf(out, "%s%04X: %016llX  %s\n", prefix, i,
+                    (unsigned long long)code[i], buf);
+        }
     }
 }
@@ -153,39 +153,98 @@ void milo_decode_inst(uint64_t word, milo_inst_t *inst);
  * Assembler Interface
  *---------------------------------------------------------------------------*/
 
-#define MILO_MAX_LABELS     256
-#define MILO_MAX_CODE_SIZE  4096
-#define MILO_MAX_LINE_LEN   256
+/* Label address before its definition has been seen */
+#define MILO_LABEL_UNDEFINED 0xFFFFFFFFu
+
+/* Label flags */
+#define MILO_LABEL_GLOBAL   0x01    /* Exported by ".global name" */
+#define MILO_LABEL_EXTERN   0x02    /* Imported by ".extern name" */
 
 typedef struct {
-    char     name[64];
-    uint32_t address;
+    uint32_t name;          /* Offset into the name pool */
+    uint32_t address;       /* MILO_LABEL_UNDEFINED until defined */
+    uint32_t flags;         /* MILO_LABEL_* */
 } milo_label_t;
 
+/* Instruction referencing a label. Patched by milo_asm_resolve and kept
+ * afterwards, so object writers can emit relocations. */
+typedef struct {
+    uint32_t address;
+    uint32_t label;         /* Index into labels */
+    int      line;
+} milo_label_ref_t;
+
+/* Word of constant data from ".data <address>, <value>" */
+typedef struct {
+    uint32_t address;       /* Byte address */
+    uint32_t value;
+} milo_asm_data_t;
+
+/* All assembler state lives here; separate contexts may be used from
+ * separate threads concurrently. Every table grows on demand. */
 typedef struct {
-    uint64_t     code[MILO_MAX_CODE_SIZE];
+    uint64_t     *code;
     uint32_t     code_size;
-    milo_label_t labels[MILO_MAX_LABELS];
+    uint32_t     code_capacity;
+    
+    /* Labels, hashed by name (index + 1, 0 = empty) */
+    milo_label_t *labels;
     uint32_t     label_count;
+    uint32_t     label_capacity;
+    uint32_t     *label_index;
+    uint32_t     label_index_size;  /* Power of two */
+    char         *names;
+    size_t       names_len;
+    size_t       names_capacity;
+    
+    milo_label_ref_t *refs;
+    uint32_t     ref_count;
+    uint32_t     ref_capacity;
+    
+    milo_asm_data_t *data;
+    uint32_t     data_count;
+    uint32_t     data_capacity;
+    
+    /* Scratch copy of the line being assembled */
+    char         *line_buf;
+    size_t       line_capacity;
+    
     char         error[256];
     int          error_line;
+    char         message[320];  /* "Line N: error" */
 } milo_asm_t;
 
 /* Initialize assembler state */
 void milo_asm_init(milo_asm_t *as);
 
+/* Release assembler buffers */
+void milo_asm_free(milo_asm_t *as);
+
 /* Assemble a single line (returns false on error) */
 bool milo_asm_line(milo_asm_t *as, const char *line, int line_num);
 
 /* Assemble complete source (returns false on error) */
 bool milo_asm_source(milo_asm_t *as, const char *source);
 
-/* Resolve labels after first pass */
+/* Assemble a source buffer of len bytes (need not be NUL terminated) */
+bool milo_asm_buffer(milo_asm_t *as, const char *source, size_t len);
+
+/* Assemble a source file, streamed from an mmap of the file */
+bool milo_asm_file(milo_asm_t *as, const char *path);
+
+/* Resolve labels after first pass. Labels declared ".extern" may stay
+ * undefined; their references are left for the linker. */
 bool milo_asm_resolve(milo_asm_t *as);
 
 /* Get assembled binary */
 const uint64_t *milo_asm_get_code(const milo_asm_t *as, uint32_t *size);
 
+/* Get ".data" words in source order */
+const milo_asm_data_t *milo_asm_get_data(const milo_asm_t *as, uint32_t *count);
+
+/* Name of the first referenced but undefined ".extern" label, or NULL */
+const char *milo_asm_get_undefined(const milo_asm_t *as);
+
 /* Get error message */
 const char *milo_asm_get_error(const milo_asm_t *as);
 
@@ -199,4 +258,15 @@ void milo_disasm_inst(uint64_t word, char *buf, size_t buf_size);
 /* Disassemble program to file */
 void milo_disasm_program(const uint64_t *code, uint32_t size, FILE *out);
 
+/* Annotation hook for milo_disasm_annotated: fills the text printed before
+ * and after the listing line of the instruction at pc */
+typedef void (*milo_disasm_annotate_t)(void *ctx, uint32_t pc,
+                                       char *prefix, size_t prefix_size,
+                                       char *suffix, size_t suffix_size);
+
+/* Disassemble program to file, decorating each line through annotate
+ * (NULL for the plain listing of milo_disasm_program) */
+void milo_disasm_annotated(const uint64_t *code, uint32_t size, FILE *out,
+                           milo_disasm_annotate_t annotate, void *ctx);
+
 #endif /* MILO_ASM_H */
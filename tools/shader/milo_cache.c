@@ -0,0 +1,242 @@
+/*
+ * milo_cache.c
+ * Milo832 Compiled Shader Cache - Implementation
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "milo_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*---------------------------------------------------------------------------
+ * Key Hashing (FNV-1a 64)
+ *---------------------------------------------------------------------------*/
+
+#define FNV_OFFSET  0xCBF29CE484222325ULL
+#define FNV_PRIME   0x100000001B3ULL
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static int cmp_spec(const void *a, const void *b) {
+    const milo_spec_const_t *sa = a, *sb = b;
+    return (sa->id > sb->id) - (sa->id < sb->id);
+}
+
+uint64_t milo_cache_key(const milo_compiler_t *c, const char *source, bool is_vertex) {
+    uint64_t h = FNV_OFFSET;
+    
+    uint32_t version = MILO_GLSL_VERSION;
+    uint8_t stage = is_vertex ? 1 : 0;
+    h = fnv1a(h, &version, sizeof(version));
+    h = fnv1a(h, &stage, sizeof(stage));
+    
+    /* Spec constants, sorted by id so option order does not matter */
+    milo_spec_const_t spec[MILO_MAX_SPEC_CONSTANTS];
+    int n = c->spec_count;
+    memcpy(spec, c->spec, n * sizeof(spec[0]));
+    qsort(spec, n, sizeof(spec[0]), cmp_spec);
+    for (int i = 0; i < n; i++) {
+        h = fnv1a(h, &spec[i].id, sizeof(spec[i].id));
+        h = fnv1a(h, &spec[i].value, sizeof(spec[i].value));
+    }
+    
+    return fnv1a(h, source, strlen(source));
+}
+
+/*---------------------------------------------------------------------------
+ * Entry Files
+ *---------------------------------------------------------------------------*/
+
+static void entry_path(char *buf, size_t size, const char *dir, uint64_t key) {
+    snprintf(buf, size, "%s/%016llx.mlc", dir, (unsigned long long)key);
+}
+
+/* Point entry fields into a serialized image; validates the layout */
+static bool bind_image(void *image, size_t size, uint64_t key, milo_cache_entry_t *entry) {
+    if (size < sizeof(milo_cache_header_t)) return false;
+    
+    const milo_cache_header_t *hdr = image;
+    size_t expect = sizeof(*hdr) + (size_t)hdr->object_size + hdr->listing_size;
+    if (hdr->magic != MILO_CACHE_MAGIC || hdr->version != MILO_CACHE_VERSION ||
+        hdr->key != key || expect != size || hdr->listing_size == 0) {
+        return false;
+    }
+    
+    const uint8_t *p = (const uint8_t *)image + sizeof(*hdr);
+    if (!milo_obj_bind(&entry->obj, p, hdr->object_size)) return false;
+    
+    const milo_obj_t *obj = &entry->obj;
+    entry->key = key;
+    entry->object = p;
+    entry->object_size = hdr->object_size;
+    entry->code = obj->code;
+    entry->code_size = obj->code_size;
+    entry->constants = obj->constants;
+    entry->const_count = obj->const_count;
+    entry->const_base = obj->const_base;
+    entry->symbols = obj->reflect;
+    entry->symbol_count = obj->reflect_count;
+    entry->listing = (const char *)p + hdr->object_size;
+    
+    return entry->listing[hdr->listing_size - 1] == '\0';
+}
+
+bool milo_cache_lookup(const char *dir, uint64_t key, milo_cache_entry_t *entry) {
+    char path[1024];
+    entry_path(path, sizeof(path), dir, key);
+    memset(entry, 0, sizeof(*entry));
+    
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+    
+    if (!bind_image(map, size, key, entry)) {
+        munmap(map, size);
+        memset(entry, 0, sizeof(*entry));
+        return false;
+    }
+    entry->map = map;
+    entry->map_size = size;
+    return true;
+}
+
+/* Serialize compiler output into a malloc'd cache image */
+static void *build_image(uint64_t key, const milo_compiler_t *c, size_t *out_size) {
+    milo_obj_builder_t b;
+    milo_obj_builder_init(&b);
+    size_t object_size = 0;
+    void *object = milo_obj_from_compiler(&b, c) ? milo_obj_serialize(&b, &object_size) : NULL;
+    milo_obj_builder_free(&b);
+    if (!object) return NULL;
+    
+    const char *listing = milo_glsl_get_asm((milo_compiler_t *)c);
+    
+    milo_cache_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = MILO_CACHE_MAGIC;
+    hdr.version = MILO_CACHE_VERSION;
+    hdr.key = key;
+    hdr.object_size = (uint32_t)object_size;
+    hdr.listing_size = (uint32_t)strlen(listing) + 1;
+    
+    size_t size = sizeof(hdr) + object_size + hdr.listing_size;
+    uint8_t *image = malloc(size);
+    if (!image) {
+        free(object);
+        return NULL;
+    }
+    
+    uint8_t *p = image;
+    memcpy(p, &hdr, sizeof(hdr));              p += sizeof(hdr);
+    memcpy(p, object, object_size);            p += object_size;
+    memcpy(p, listing, hdr.listing_size);
+    free(object);
+    
+    *out_size = size;
+    return image;
+}
+
+static bool write_image(const char *dir, uint64_t key, const void *image, size_t size) {
+    mkdir(dir, 0777);
+    
+    char path[1024], tmp[1100];
+    entry_path(path, sizeof(path), dir, key);
+    snprintf(tmp, sizeof(tmp), "%s.tmp.XXXXXX", path);
+    
+    /* Unique temp name, so threads storing the same key don't collide */
+    int fd = mkstemp(tmp);
+    if (fd < 0) return false;
+    fchmod(fd, 0644);
+    FILE *f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        unlink(tmp);
+        return false;
+    }
+    
+    bool ok = fwrite(image, 1, size, f) == size;
+    ok = (fclose(f) == 0) && ok;
+    
+    if (!ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+bool milo_cache_store(const char *dir, uint64_t key, const milo_compiler_t *c) {
+    size_t size;
+    void *image = build_image(key, c, &size);
+    if (!image) return false;
+    
+    bool ok = write_image(dir, key, image, size);
+    free(image);
+    return ok;
+}
+
+void milo_cache_release(milo_cache_entry_t *entry) {
+    if (entry->map) {
+        munmap(entry->map, entry->map_size);
+    } else {
+        free(entry->heap);
+    }
+    memset(entry, 0, sizeof(*entry));
+}
+
+/*---------------------------------------------------------------------------
+ * Compile Through Cache
+ *---------------------------------------------------------------------------*/
+
+bool milo_cache_compile(const char *dir, milo_compiler_t *c, const char *source,
+                        bool is_vertex, milo_cache_entry_t *entry) {
+    uint64_t key = milo_cache_key(c, source, is_vertex);
+    if (milo_cache_lookup(dir, key, entry)) {
+        return true;
+    }
+    
+    if (!milo_glsl_compile(c, source, is_vertex)) {
+        return false;
+    }
+    
+    size_t image_size;
+    void *image = build_image(key, c, &image_size);
+    if (!image) return false;
+    
+    if (!write_image(dir, key, image, image_size)) {
+        fprintf(stderr, "Warning: cannot write shader cache entry in '%s'\n", dir);
+    }
+    
+    /* Serve the miss from the in-memory image */
+    memset(entry, 0, sizeof(*entry));
+    bind_image(image, image_size, key, entry);
+    entry->heap = image;
+    return true;
+}
+
+const char *milo_cache_dir_from_env(void) {
+    const char *dir = getenv(MILO_CACHE_ENV);
+    return (dir && *dir) ? dir : NULL;
+}
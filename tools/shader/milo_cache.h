@@ -0,0 +1,98 @@
+/*
+ * milo_cache.h
+ * Milo832 Compiled Shader Cache - Header
+ *
+ * Content-addressed on-disk cache of compiled shaders. Entries are keyed by
+ * a hash of the GLSL source, the compiler version and the compile options
+ * (shader stage, specialization constants) and hold the shader's object
+ * image (see milo_obj.h) followed by the assembly listing. Entries are
+ * loaded by mmap, so a cache hit costs one open() and no compilation.
+ *
+ * Cache files are written to a temporary name and renamed into place, so
+ * concurrent tools sharing a cache directory never see partial entries.
+ */
+
+#ifndef MILO_CACHE_H
+#define MILO_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "milo_glsl.h"
+#include "milo_obj.h"
+
+/*---------------------------------------------------------------------------
+ * Cache File Format
+ *---------------------------------------------------------------------------
+ * All fields little-endian, sections back to back in this order:
+ *   milo_cache_header_t
+ *   uint8_t             object[object_size]    (milo_obj image, 8-aligned)
+ *   char                listing[listing_size]   (NUL terminated)
+ */
+
+#define MILO_CACHE_MAGIC    0x48434C4D  /* "MLCH" */
+#define MILO_CACHE_VERSION  2
+
+/* Environment variable naming the cache directory used by the tools */
+#define MILO_CACHE_ENV      "MILO_SHADER_CACHE"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t object_size;       /* Bytes, multiple of 8 */
+    uint32_t listing_size;      /* Bytes including NUL */
+} milo_cache_header_t;
+
+/* Reflection record for one global (uniform, in, out or const) */
+typedef milo_obj_reflect_t milo_cache_symbol_t;
+
+/* Loaded cache entry; all pointers reference the backing image */
+typedef struct {
+    uint64_t                   key;
+    milo_obj_t                 obj;         /* View of the object image */
+    const void                *object;      /* Object image, for writing out */
+    size_t                     object_size;
+    const uint64_t            *code;
+    uint32_t                   code_size;
+    const uint32_t            *constants;
+    uint32_t                   const_count;
+    uint32_t                   const_base;
+    const milo_cache_symbol_t *symbols;
+    uint32_t                   symbol_count;
+    const char                *listing;
+
+    /* Backing storage (private): file mapping on a hit, heap on a miss */
+    void                      *map;
+    size_t                     map_size;
+    void                      *heap;
+} milo_cache_entry_t;
+
+/*---------------------------------------------------------------------------
+ * API
+ *---------------------------------------------------------------------------*/
+
+/* Compute cache key for source + compiler version + options. The spec
+ * constants are those currently set on the compiler (order-independent). */
+uint64_t milo_cache_key(const milo_compiler_t *c, const char *source, bool is_vertex);
+
+/* Map the entry for key from dir; returns false on miss or corrupt entry */
+bool milo_cache_lookup(const char *dir, uint64_t key, milo_cache_entry_t *entry);
+
+/* Write an entry for a successfully generated compiler state */
+bool milo_cache_store(const char *dir, uint64_t key, const milo_compiler_t *c);
+
+/* Unmap or free an entry */
+void milo_cache_release(milo_cache_entry_t *entry);
+
+/* Compile through the cache: on a hit the compiler is not run; on a miss
+ * the source is compiled, assembled and stored. Uses the spec constants
+ * already set on c. On compile failure returns false and the errors are
+ * available from milo_glsl_get_errors(c). */
+bool milo_cache_compile(const char *dir, milo_compiler_t *c, const char *source,
+                        bool is_vertex, milo_cache_entry_t *entry);
+
+/* Cache directory from MILO_SHADER_CACHE, or NULL if unset/empty */
+const char *milo_cache_dir_from_env(void);
+
+#endif /* MILO_CACHE_H */
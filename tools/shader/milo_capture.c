@@ -0,0 +1,468 @@
+/*
+ * milo_capture.c
+ * Milo832 Frame Capture and Replay - Implementation
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "milo_capture.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Granule ranges read are compared against the shadow in */
+#define DIFF_BLOCK  64
+
+static void set_error(char *error, size_t size, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(error, size, fmt, args);
+    va_end(args);
+}
+
+uint32_t milo_capture_checksum(const uint8_t *data, uint32_t bytes) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < bytes; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t padded(uint32_t bytes) {
+    return (bytes + 7) & ~7u;
+}
+
+/*---------------------------------------------------------------------------
+ * Capture
+ *---------------------------------------------------------------------------*/
+
+/* Append a record, and data of rec->bytes for MEMORY, to the pending ones */
+static void add_record(milo_capture_t *cap, const milo_capture_record_t *rec,
+                       const uint8_t *data) {
+    size_t size = sizeof(*rec) + (data ? padded(rec->bytes) : 0);
+    if (cap->pending_size + size > cap->pending_cap) {
+        size_t grown = cap->pending_cap ? cap->pending_cap : 4096;
+        while (grown < cap->pending_size + size) grown *= 2;
+        uint8_t *p = realloc(cap->pending, grown);
+        if (!p) {
+            cap->failed = true;
+            set_error(cap->error, sizeof(cap->error), "out of memory");
+            return;
+        }
+        cap->pending = p;
+        cap->pending_cap = grown;
+    }
+    uint8_t *p = cap->pending + cap->pending_size;
+    memcpy(p, rec, sizeof(*rec));
+    if (data) {
+        memcpy(p + sizeof(*rec), data, rec->bytes);
+        memset(p + sizeof(*rec) + rec->bytes, 0, padded(rec->bytes) - rec->bytes);
+        cap->memory_bytes += rec->bytes;
+    }
+    cap->pending_size += size;
+    cap->pending_records++;
+}
+
+/* Record the bytes of a range read that the shadow does not hold yet, in
+ * runs of differing blocks */
+static void record_read(milo_capture_t *cap, uint32_t addr, uint32_t bytes) {
+    const uint8_t *mem = cap->gpu->mem;
+    uint32_t end = addr + bytes, run = 0;
+    bool in_run = false;
+    for (uint32_t at = addr; at < end;) {
+        uint32_t next = (at / DIFF_BLOCK + 1) * DIFF_BLOCK;
+        if (next > end) next = end;
+        bool differs = memcmp(mem + at, cap->shadow + at, next - at) != 0;
+        if (differs && !in_run) run = at;
+        if (!differs && in_run) {
+            milo_capture_record_t rec = { MILO_REC_MEMORY, run, at - run, 0 };
+            add_record(cap, &rec, mem + run);
+            memcpy(cap->shadow + run, mem + run, at - run);
+        }
+        in_run = differs;
+        at = next;
+    }
+    if (in_run) {
+        milo_capture_record_t rec = { MILO_REC_MEMORY, run, end - run, 0 };
+        add_record(cap, &rec, mem + run);
+        memcpy(cap->shadow + run, mem + run, end - run);
+    }
+}
+
+static void on_access(void *user, uint32_t addr, uint32_t bytes, bool write) {
+    milo_capture_t *cap = user;
+    if (!write) {
+        record_read(cap, addr, bytes);
+        return;
+    }
+    for (uint32_t i = 0; i < cap->write_count; i++) {
+        if (cap->writes[i].addr == addr && cap->writes[i].bytes == bytes) return;
+    }
+    if (cap->write_count == cap->write_cap) {
+        uint32_t grown = cap->write_cap ? cap->write_cap * 2 : 8;
+        milo_capture_record_t *p = realloc(cap->writes, grown * sizeof(*p));
+        if (!p) {
+            cap->failed = true;
+            set_error(cap->error, sizeof(cap->error), "out of memory");
+            return;
+        }
+        cap->writes = p;
+        cap->write_cap = grown;
+    }
+    milo_capture_record_t rec = { MILO_REC_WRITE, addr, bytes, 0 };
+    cap->writes[cap->write_count++] = rec;
+}
+
+static bool flush_pending(milo_capture_t *cap) {
+    if (cap->pending_size && fwrite(cap->pending, 1, cap->pending_size, cap->file) !=
+                             cap->pending_size) {
+        cap->failed = true;
+        set_error(cap->error, sizeof(cap->error), "cannot write the capture");
+    }
+    cap->file_bytes += cap->pending_size;
+    cap->header.record_count += cap->pending_records;
+    cap->pending_size = 0;
+    cap->pending_records = 0;
+    return !cap->failed;
+}
+
+bool milo_capture_open(milo_capture_t *cap, const char *path, milo_gpu_t *gpu) {
+    memset(cap, 0, sizeof(*cap));
+    cap->gpu = gpu;
+    cap->shadow = calloc(gpu->mem_size, 1);
+    cap->file = fopen(path, "wb");
+    if (!cap->shadow || !cap->file) {
+        set_error(cap->error, sizeof(cap->error), "Cannot create '%s'", path);
+        if (cap->file) fclose(cap->file);
+        free(cap->shadow);
+        cap->file = NULL;
+        cap->shadow = NULL;
+        return false;
+    }
+    milo_capture_header_t *hdr = &cap->header;
+    hdr->magic = MILO_CAPTURE_MAGIC;
+    hdr->version = MILO_CAPTURE_VERSION;
+    hdr->flags = (gpu->fs_vm->early_z ? MILO_CAPTURE_EARLY_Z : 0) |
+                 (gpu->fs_vm->hiz ? MILO_CAPTURE_HIZ : 0);
+    hdr->mem_size = gpu->mem_size;
+    hdr->tile_size = gpu->tbdr.tile_size;
+    hdr->max_tris_per_tile = gpu->tbdr.max_tris_per_tile;
+    if (fwrite(hdr, sizeof(*hdr), 1, cap->file) != 1) {
+        cap->failed = true;
+        set_error(cap->error, sizeof(cap->error), "cannot write the capture");
+    }
+    cap->file_bytes = sizeof(*hdr);
+    gpu->trace = on_access;
+    gpu->trace_user = cap;
+    return !cap->failed;
+}
+
+bool milo_capture_execute(milo_capture_t *cap, uint32_t addr) {
+    milo_gpu_t *gpu = cap->gpu;
+    cap->write_count = 0;
+    bool ok = milo_gpu_execute(gpu, addr);
+    
+    /* What it read, the execution, then what it wrote, which a replay will
+     * write alike */
+    milo_capture_record_t rec = { MILO_REC_EXECUTE, addr, 0, 0 };
+    add_record(cap, &rec, NULL);
+    for (uint32_t i = 0; i < cap->write_count; i++) {
+        const milo_capture_record_t *w = &cap->writes[i];
+        add_record(cap, w, NULL);
+        memcpy(cap->shadow + w->addr, gpu->mem + w->addr, w->bytes);
+    }
+    flush_pending(cap);
+    return ok;
+}
+
+bool milo_capture_frame(milo_capture_t *cap) {
+    const milo_gpu_t *gpu = cap->gpu;
+    milo_capture_record_t rec = { MILO_REC_FRAME, 0, 0, 0 };
+    if (gpu->target) {
+        rec.addr = gpu->target_addr;
+        rec.bytes = (uint32_t)gpu->target_width * (uint32_t)gpu->target_height * 4;
+        rec.value = milo_capture_checksum(gpu->mem + rec.addr, rec.bytes);
+    }
+    add_record(cap, &rec, NULL);
+    cap->header.frame_count++;
+    return flush_pending(cap);
+}
+
+bool milo_capture_close(milo_capture_t *cap) {
+    if (cap->gpu && cap->gpu->trace_user == cap) {
+        cap->gpu->trace = NULL;
+        cap->gpu->trace_user = NULL;
+    }
+    if (cap->file) {
+        if (fseek(cap->file, 0, SEEK_SET) != 0 ||
+            fwrite(&cap->header, sizeof(cap->header), 1, cap->file) != 1) {
+            cap->failed = true;
+        }
+        if (fclose(cap->file) != 0) cap->failed = true;
+        if (cap->failed && !cap->error[0]) {
+            set_error(cap->error, sizeof(cap->error), "cannot write the capture");
+        }
+        cap->file = NULL;
+    }
+    free(cap->shadow);
+    free(cap->pending);
+    free(cap->writes);
+    cap->shadow = cap->pending = NULL;
+    cap->writes = NULL;
+    return !cap->failed;
+}
+
+/*---------------------------------------------------------------------------
+ * Replay
+ *---------------------------------------------------------------------------*/
+
+/* Check every record of image; false with rp->error set if one is bad */
+static bool check_records(milo_replay_t *rp) {
+    const milo_capture_header_t *hdr = rp->header;
+    size_t at = 0;
+    uint32_t records = 0, frames = 0;
+    while (at < rp->records_size) {
+        const milo_capture_record_t *rec = (const milo_capture_record_t *)(rp->records + at);
+        if (rp->records_size - at < sizeof(*rec)) break;
+        at += sizeof(*rec);
+        bool ok;
+        switch (rec->type) {
+            case MILO_REC_MEMORY:
+                ok = (uint64_t)rec->addr + rec->bytes <= hdr->mem_size &&
+                     padded(rec->bytes) <= rp->records_size - at;
+                at += ok ? padded(rec->bytes) : 0;
+                break;
+            case MILO_REC_EXECUTE:
+                ok = rec->addr < hdr->mem_size;
+                break;
+            case MILO_REC_FRAME:
+                frames++;
+                /* Fall through */
+            case MILO_REC_WRITE:
+                ok = (uint64_t)rec->addr + rec->bytes <= hdr->mem_size;
+                break;
+            default:
+                ok = false;
+        }
+        if (!ok) {
+            set_error(rp->error, sizeof(rp->error), "Bad record %u", records);
+            return false;
+        }
+        records++;
+    }
+    if (at != rp->records_size || records != hdr->record_count || frames != hdr->frame_count) {
+        set_error(rp->error, sizeof(rp->error), "Truncated capture");
+        return false;
+    }
+    return true;
+}
+
+bool milo_replay_map(milo_replay_t *rp, const char *path) {
+    memset(rp, 0, sizeof(*rp));
+    
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        set_error(rp->error, sizeof(rp->error), "Cannot open '%s'", path);
+        return false;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(milo_capture_header_t)) {
+        close(fd);
+        set_error(rp->error, sizeof(rp->error), "Not a Milo832 capture: '%s'", path);
+        return false;
+    }
+    
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        set_error(rp->error, sizeof(rp->error), "Cannot map '%s'", path);
+        return false;
+    }
+    
+    const milo_capture_header_t *hdr = map;
+    rp->map = map;
+    rp->map_size = size;
+    rp->header = hdr;
+    rp->records = (const uint8_t *)(hdr + 1);
+    rp->records_size = size - sizeof(*hdr);
+    if (hdr->magic != MILO_CAPTURE_MAGIC) {
+        set_error(rp->error, sizeof(rp->error), "Not a Milo832 capture: '%s'", path);
+    } else if (hdr->version != MILO_CAPTURE_VERSION) {
+        set_error(rp->error, sizeof(rp->error), "Unsupported capture version %u", hdr->version);
+    } else if (hdr->tile_size == 0 || hdr->tile_size > MILO_TBDR_MAX_TILE_SIZE) {
+        set_error(rp->error, sizeof(rp->error), "Bad tile size %u", hdr->tile_size);
+    } else if (check_records(rp)) {
+        return true;
+    }
+    char error[256];
+    memcpy(error, rp->error, sizeof(error));
+    milo_replay_release(rp);
+    memcpy(rp->error, error, sizeof(error));
+    return false;
+}
+
+void milo_replay_release(milo_replay_t *rp) {
+    if (rp->map) munmap(rp->map, rp->map_size);
+    memset(rp, 0, sizeof(*rp));
+}
+
+bool milo_replay_run(const milo_replay_t *rp, milo_gpu_t *gpu, uint32_t frames,
+                     milo_replay_stats_t *stats) {
+    const milo_capture_header_t *hdr = rp->header;
+    if (gpu->mem_size < hdr->mem_size) {
+        set_error(gpu->error, sizeof(gpu->error), "capture needs %u bytes of GPU memory",
+                  hdr->mem_size);
+        return false;
+    }
+    milo_gpu_reset(gpu);
+    gpu->tbdr.tile_size = hdr->tile_size;
+    gpu->tbdr.max_tris_per_tile = hdr->max_tris_per_tile;
+    gpu->fs_vm->early_z = hdr->flags & MILO_CAPTURE_EARLY_Z;
+    gpu->fs_vm->hiz = hdr->flags & MILO_CAPTURE_HIZ;
+    
+    /* Back to the memory the capture started from */
+    for (size_t at = 0; at < rp->records_size;) {
+        const milo_capture_record_t *rec = (const milo_capture_record_t *)(rp->records + at);
+        if (rec->type != MILO_REC_EXECUTE) memset(gpu->mem + rec->addr, 0, rec->bytes);
+        at += sizeof(*rec) + (rec->type == MILO_REC_MEMORY ? padded(rec->bytes) : 0);
+    }
+    
+    uint32_t frame = 0;
+    if (frames == 0 || frames > hdr->frame_count) frames = hdr->frame_count;
+    for (size_t at = 0; at < rp->records_size && frame < frames;) {
+        const milo_capture_record_t *rec = (const milo_capture_record_t *)(rp->records + at);
+        at += sizeof(*rec);
+        switch (rec->type) {
+            case MILO_REC_MEMORY:
+                memcpy(gpu->mem + rec->addr, rp->records + at, rec->bytes);
+                at += padded(rec->bytes);
+                stats->memory_bytes += rec->bytes;
+                break;
+            case MILO_REC_EXECUTE:
+                stats->executions++;
+                if (!milo_gpu_execute(gpu, rec->addr)) return false;
+                break;
+            case MILO_REC_FRAME:
+                if (milo_capture_checksum(gpu->mem + rec->addr, rec->bytes) != rec->value) {
+                    stats->mismatches++;
+                }
+                stats->frames++;
+                frame++;
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    const milo_replay_t *rp;
+    uint32_t    frames, repeat;
+    milo_replay_stats_t stats;
+    bool        ok;
+    char        error[256];
+} worker_t;
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    milo_gpu_t gpu;
+    if (!milo_gpu_init(&gpu, w->rp->header->mem_size)) {
+        set_error(w->error, sizeof(w->error), "out of memory");
+        return NULL;
+    }
+    w->ok = true;
+    for (uint32_t r = 0; r < w->repeat && w->ok; r++) {
+        w->ok = milo_replay_run(w->rp, &gpu, w->frames, &w->stats);
+    }
+    if (!w->ok) {
+        set_error(w->error, sizeof(w->error), "fault at 0x%08X: %s", gpu.fault_addr, gpu.error);
+    }
+    milo_gpu_free(&gpu);
+    return NULL;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double milo_replay_threads(milo_replay_t *rp, int threads, uint32_t frames, uint32_t repeat,
+                           milo_replay_stats_t *stats) {
+    if (threads < 1) threads = 1;
+    worker_t *workers = calloc((size_t)threads, sizeof(worker_t));
+    pthread_t *ids = calloc((size_t)threads, sizeof(pthread_t));
+    if (!workers || !ids) {
+        free(workers);
+        free(ids);
+        set_error(rp->error, sizeof(rp->error), "out of memory");
+        return -1.0;
+    }
+    
+    double start = now();
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        workers[i].rp = rp;
+        workers[i].frames = frames;
+        workers[i].repeat = repeat;
+        if (threads == 1 || pthread_create(&ids[i], NULL, worker_main, &workers[i]) != 0) break;
+        started++;
+    }
+    if (started == 0) worker_main(&workers[0]);
+    for (int i = 0; i < started; i++) pthread_join(ids[i], NULL);
+    double seconds = now() - start;
+    
+    int ran = started ? started : 1;
+    for (int i = 0; i < ran; i++) {
+        const worker_t *w = &workers[i];
+        stats->frames += w->stats.frames;
+        stats->executions += w->stats.executions;
+        stats->memory_bytes += w->stats.memory_bytes;
+        stats->mismatches += w->stats.mismatches;
+        if (!w->ok && seconds >= 0.0) {
+            memcpy(rp->error, w->error, sizeof(rp->error));
+            seconds = -1.0;
+        }
+    }
+    free(workers);
+    free(ids);
+    return seconds;
+}
+
+void milo_replay_dump(const milo_replay_t *rp, FILE *out) {
+    const milo_capture_header_t *hdr = rp->header;
+    fprintf(out, "Capture v%u, %u frames, %u records, %zu bytes, %u bytes of GPU memory\n",
+            hdr->version, hdr->frame_count, hdr->record_count, rp->map_size, hdr->mem_size);
+    fprintf(out, "  tiles %ux%u, %u triangles per tile%s%s\n", hdr->tile_size, hdr->tile_size,
+            hdr->max_tris_per_tile, hdr->flags & MILO_CAPTURE_EARLY_Z ? ", early-Z" : "",
+            hdr->flags & MILO_CAPTURE_HIZ ? ", hi-Z" : "");
+    uint32_t frame = 0, executions = 0, memory = 0;
+    uint64_t bytes = 0;
+    for (size_t at = 0; at < rp->records_size;) {
+        const milo_capture_record_t *rec = (const milo_capture_record_t *)(rp->records + at);
+        at += sizeof(*rec);
+        if (rec->type == MILO_REC_MEMORY) {
+            at += padded(rec->bytes);
+            memory++;
+            bytes += rec->bytes;
+        } else if (rec->type == MILO_REC_EXECUTE) {
+            executions++;
+        } else if (rec->type == MILO_REC_FRAME) {
+            fprintf(out, "  frame %u: %u executions, %llu bytes in %u memory records, "
+                    "checksum 0x%08X\n", frame++, executions, (unsigned long long)bytes, memory,
+                    rec->value);
+            executions = memory = 0;
+            bytes = 0;
+        }
+    }
+}
@@ -0,0 +1,154 @@
+/*
+ * milo_capture.h
+ * Milo832 Frame Capture and Replay - Header
+ *
+ * A capture records what the command processor (milo_cmd.h) read while
+ * frames executed: the commands, shaders, uniforms, textures, vertices and
+ * indices, and render targets as they were before being drawn to. It
+ * compares every range read against a shadow of the memory a replay will
+ * have, and writes only the bytes that differ, so resources uploaded once
+ * are stored once and a later frame stores what the host changed, such as
+ * its uniforms and commands. Each frame ends with a checksum of the
+ * render target, which a replay must reproduce.
+ *
+ * The file is one image in the style of milo_obj.h, used in place from a
+ * mapping. A replay starts from a processor fresh from milo_gpu_reset and
+ * memory that is zero but for what the capture writes, so it is
+ * deterministic: frames captured from a processor that already held state
+ * reproduce only if their buffers set the state they use, as
+ * milo_cmdbuf does.
+ */
+
+#ifndef MILO_CAPTURE_H
+#define MILO_CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "milo_cmd.h"
+
+/*---------------------------------------------------------------------------
+ * Capture File Format
+ *---------------------------------------------------------------------------
+ * All fields little-endian:
+ *   milo_capture_header_t
+ *   records in order, each a milo_capture_record_t followed for MEMORY by
+ *   its bytes, padded to 8
+ *
+ * A frame is the records up to and including its FRAME record.
+ */
+
+#define MILO_CAPTURE_MAGIC      0x50434C4D  /* "MLCP" */
+#define MILO_CAPTURE_VERSION    1
+
+/* Header flags: the fragment VM settings the frames ran with */
+#define MILO_CAPTURE_EARLY_Z    0x0001
+#define MILO_CAPTURE_HIZ        0x0002
+
+/* Record types */
+#define MILO_REC_MEMORY         1       /* bytes of data at addr */
+#define MILO_REC_EXECUTE        2       /* milo_gpu_execute(addr) */
+#define MILO_REC_WRITE          3       /* The execution before wrote bytes at
+                                         * addr */
+#define MILO_REC_FRAME          4       /* End of frame; value is the checksum
+                                         * of the bytes at addr */
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;                     /* MILO_CAPTURE_* */
+    uint32_t mem_size;                  /* GPU memory the records address */
+    uint32_t frame_count;
+    uint32_t record_count;
+    uint32_t tile_size;                 /* milo_tbdr_config_t of the frames */
+    uint32_t max_tris_per_tile;
+    uint32_t reserved;
+} milo_capture_header_t;
+
+typedef struct {
+    uint32_t type;                      /* MILO_REC_* */
+    uint32_t addr;
+    uint32_t bytes;
+    uint32_t value;
+} milo_capture_record_t;
+
+/* FNV-1a of the render target a FRAME record names */
+uint32_t milo_capture_checksum(const uint8_t *data, uint32_t bytes);
+
+/*---------------------------------------------------------------------------
+ * Capture
+ *---------------------------------------------------------------------------*/
+
+typedef struct {
+    FILE       *file;
+    milo_gpu_t *gpu;
+    uint8_t    *shadow;                 /* Memory as a replay will have it */
+    milo_capture_header_t header;
+    
+    /* Records of the execution under way */
+    uint8_t    *pending;                /* Records as written to the file */
+    size_t      pending_size, pending_cap;
+    uint32_t    pending_records;
+    milo_capture_record_t *writes;
+    uint32_t    write_count, write_cap;
+    
+    uint64_t    file_bytes;
+    uint64_t    memory_bytes;           /* In MEMORY records */
+    bool        failed;
+    char        error[256];
+} milo_capture_t;
+
+/* Start capturing gpu's executions to path. The tile and fragment VM
+ * settings are taken from gpu now and must not change while capturing. */
+bool milo_capture_open(milo_capture_t *cap, const char *path, milo_gpu_t *gpu);
+
+/* milo_gpu_execute(gpu, addr), recorded */
+bool milo_capture_execute(milo_capture_t *cap, uint32_t addr);
+
+/* End a frame, its checksum taken of the current render target */
+bool milo_capture_frame(milo_capture_t *cap);
+
+/* Finish the file and stop tracing; false if anything failed */
+bool milo_capture_close(milo_capture_t *cap);
+
+/*---------------------------------------------------------------------------
+ * Replay
+ *---------------------------------------------------------------------------*/
+
+typedef struct {
+    const milo_capture_header_t *header;
+    const uint8_t *records;
+    size_t      records_size;
+    void       *map;
+    size_t      map_size;
+    char        error[256];
+} milo_replay_t;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t executions;
+    uint64_t memory_bytes;              /* Copied from the capture */
+    uint64_t mismatches;                /* Frames whose checksum differs */
+} milo_replay_stats_t;
+
+/* Map and check a capture */
+bool milo_replay_map(milo_replay_t *rp, const char *path);
+void milo_replay_release(milo_replay_t *rp);
+
+/* Replay the first frames of the capture (0: all) on gpu, which needs
+ * header->mem_size bytes of memory: the processor is reset and set up as
+ * the capture was, and the memory the capture writes zeroed first. False
+ * on a fault, with gpu->error saying why; stats are added to. */
+bool milo_replay_run(const milo_replay_t *rp, milo_gpu_t *gpu, uint32_t frames,
+                     milo_replay_stats_t *stats);
+
+/* Replay repeat times on each of threads processors of their own; the
+ * wall time in seconds, or a negative value if a replay failed (error
+ * says why) */
+double milo_replay_threads(milo_replay_t *rp, int threads, uint32_t frames, uint32_t repeat,
+                           milo_replay_stats_t *stats);
+
+void milo_replay_dump(const milo_replay_t *rp, FILE *out);
+
+#endif /* MILO_CAPTURE_H */
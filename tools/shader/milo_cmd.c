@@ -0,0 +1,827 @@
+/*
+ * milo_cmd.c
+ * Milo832 Command Processor - Implementation
+ */
+
+#include "milo_cmd.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+/*---------------------------------------------------------------------------
+ * Setup
+ *---------------------------------------------------------------------------*/
+
+bool milo_gpu_init(milo_gpu_t *gpu, uint32_t mem_size) {
+    memset(gpu, 0, sizeof(*gpu));
+    gpu->mem = calloc(mem_size, 1);
+    gpu->vs_vm = malloc(sizeof(milo_vm_t));
+    gpu->fs_vm = malloc(sizeof(milo_vm_t));
+    if (!gpu->mem || !gpu->vs_vm || !gpu->fs_vm) {
+        milo_gpu_free(gpu);
+        return false;
+    }
+    gpu->mem_size = mem_size;
+    milo_vm_init(gpu->vs_vm);
+    milo_vm_init(gpu->fs_vm);
+    milo_tbdr_defaults(&gpu->tbdr);
+    gpu->max_commands = 1u << 24;
+    milo_gpu_reset(gpu);
+    return true;
+}
+
+void milo_gpu_free(milo_gpu_t *gpu) {
+    if (gpu->target) milo_fb_free(gpu->target);
+    free(gpu->pass_vertices);
+    free(gpu->pass_indices);
+    free(gpu->pass_draws);
+    free(gpu->fetch_indices);
+    free(gpu->vs_vm);
+    free(gpu->fs_vm);
+    free(gpu->mem);
+    memset(gpu, 0, sizeof(*gpu));
+}
+
+void milo_gpu_reset(milo_gpu_t *gpu) {
+    if (gpu->target) milo_fb_free(gpu->target);
+    gpu->target = NULL;
+    gpu->target_addr = 0;
+    gpu->target_width = gpu->target_height = 0;
+    gpu->vb_addr = gpu->vb_stride = 0;
+    milo_fetch_default_layout(&gpu->vb_layout);
+    gpu->ib_addr = 0;
+    gpu->ib_format = MILO_INDEX_U16;
+    memset(gpu->viewport, 0, sizeof(gpu->viewport));
+    memset(gpu->scissor, 0, sizeof(gpu->scissor));
+    gpu->cull_ctrl = 0x2;                       /* RENDER_STATE_DEFAULT: CULL_BACK, CCW */
+    memset(&gpu->vs, 0, sizeof(gpu->vs));
+    memset(&gpu->fs, 0, sizeof(gpu->fs));
+    milo_render_state_preset(&gpu->fs.state, MILO_STATE_DEFAULT);
+    gpu->clear_color = 0xFF000000;
+    gpu->clear_depth = 1.0f;
+    gpu->pending_clear = 0;
+    gpu->vs_valid = gpu->fs_valid = false;
+    gpu->in_pass = false;
+    gpu->pass_vertex_count = gpu->pass_index_count = gpu->pass_draw_count = 0;
+    gpu->read_ptr = 0;
+    gpu->call_sp = 0;
+    gpu->irq_status = 0;
+    gpu->fault = false;
+    gpu->fault_addr = 0;
+    gpu->error[0] = '\0';
+}
+
+static bool in_memory(const milo_gpu_t *gpu, uint32_t addr, uint64_t bytes) {
+    return (uint64_t)addr + bytes <= gpu->mem_size;
+}
+
+bool milo_gpu_upload(milo_gpu_t *gpu, uint32_t addr, const void *data, uint32_t bytes) {
+    if (!in_memory(gpu, addr, bytes)) return false;
+    memcpy(gpu->mem + addr, data, bytes);
+    return true;
+}
+
+bool milo_gpu_upload_vertices(milo_gpu_t *gpu, uint32_t addr, const milo_vertex_in_t *vertices,
+                              uint32_t count) {
+    if (!in_memory(gpu, addr, (uint64_t)count * MILO_CMD_VERTEX_BYTES)) return false;
+    for (uint32_t i = 0; i < count; i++) {
+        const milo_vertex_in_t *v = &vertices[i];
+        float packed[MILO_CMD_VERTEX_BYTES / 4] = {
+            v->x, v->y, v->z, v->u, v->v, v->nx, v->ny, v->nz
+        };
+        memcpy(gpu->mem + addr + i * MILO_CMD_VERTEX_BYTES, packed, sizeof(packed));
+    }
+    return true;
+}
+
+bool milo_gpu_upload_indices(milo_gpu_t *gpu, uint32_t addr, const uint32_t *indices,
+                             uint32_t count, milo_index_format_t format) {
+    uint32_t size = milo_fetch_index_size(format);
+    if (!in_memory(gpu, addr, (uint64_t)count * size)) return false;
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t *p = gpu->mem + addr + (size_t)i * size;
+        if (size == 1) {
+            *p = (uint8_t)indices[i];
+        } else if (size == 2) {
+            uint16_t index = (uint16_t)indices[i];
+            memcpy(p, &index, 2);
+        } else {
+            memcpy(p, &indices[i], 4);
+        }
+    }
+    return true;
+}
+
+/*---------------------------------------------------------------------------
+ * Helpers
+ *---------------------------------------------------------------------------*/
+
+static bool fail(milo_gpu_t *gpu, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(gpu->error, sizeof(gpu->error), fmt, args);
+    va_end(args);
+    return false;
+}
+
+static void trace(milo_gpu_t *gpu, uint32_t addr, uint64_t bytes, bool write) {
+    if (gpu->trace && bytes) gpu->trace(gpu->trace_user, addr, (uint32_t)bytes, write);
+}
+
+static uint32_t rd32(const milo_gpu_t *gpu, uint32_t addr) {
+    uint32_t word;
+    memcpy(&word, gpu->mem + addr, 4);
+    return word;
+}
+
+static const char *opcode_name(uint32_t op) {
+    switch (op) {
+        case MILO_CMD_NOP:                  return "NOP";
+        case MILO_CMD_FENCE:                return "FENCE";
+        case MILO_CMD_IRQ:                  return "IRQ";
+        case MILO_CMD_SET_VERTEX_BUFFER:    return "SET_VERTEX_BUFFER";
+        case MILO_CMD_SET_INDEX_BUFFER:     return "SET_INDEX_BUFFER";
+        case MILO_CMD_SET_UNIFORM_BUFFER:   return "SET_UNIFORM_BUFFER";
+        case MILO_CMD_SET_TEXTURE:          return "SET_TEXTURE";
+        case MILO_CMD_SET_RENDER_TARGET:    return "SET_RENDER_TARGET";
+        case MILO_CMD_SET_VIEWPORT:         return "SET_VIEWPORT";
+        case MILO_CMD_SET_SCISSOR:          return "SET_SCISSOR";
+        case MILO_CMD_SET_RENDER_STATE:     return "SET_RENDER_STATE";
+        case MILO_CMD_SET_VERTEX_LAYOUT:    return "SET_VERTEX_LAYOUT";
+        case MILO_CMD_BIND_VERTEX_SHADER:   return "BIND_VERTEX_SHADER";
+        case MILO_CMD_BIND_FRAGMENT_SHADER: return "BIND_FRAGMENT_SHADER";
+        case MILO_CMD_CLEAR:                return "CLEAR";
+        case MILO_CMD_DRAW:                 return "DRAW";
+        case MILO_CMD_DRAW_INDEXED:         return "DRAW_INDEXED";
+        case MILO_CMD_BEGIN_TILE_PASS:      return "BEGIN_TILE_PASS";
+        case MILO_CMD_END_TILE_PASS:        return "END_TILE_PASS";
+        case MILO_CMD_JUMP:                 return "JUMP";
+        case MILO_CMD_CALL:                 return "CALL";
+        case MILO_CMD_END:                  return "END";
+        default:                            return NULL;
+    }
+}
+
+/* Payload dwords each opcode needs */
+static uint32_t payload_length(uint32_t op) {
+    switch (op) {
+        case MILO_CMD_IRQ:
+        case MILO_CMD_JUMP:
+        case MILO_CMD_CALL:                 return 1;
+        case MILO_CMD_SET_VERTEX_BUFFER:
+        case MILO_CMD_SET_INDEX_BUFFER:
+        case MILO_CMD_SET_UNIFORM_BUFFER:
+        case MILO_CMD_SET_RENDER_TARGET:
+        case MILO_CMD_SET_RENDER_STATE:
+        case MILO_CMD_BIND_VERTEX_SHADER:
+        case MILO_CMD_BIND_FRAGMENT_SHADER:
+        case MILO_CMD_DRAW:
+        case MILO_CMD_DRAW_INDEXED:         return 2;
+        case MILO_CMD_CLEAR:                return 3;
+        case MILO_CMD_SET_TEXTURE:
+        case MILO_CMD_SET_VERTEX_LAYOUT:
+        case MILO_CMD_SET_VIEWPORT:
+        case MILO_CMD_SET_SCISSOR:          return 4;
+        default:                            return 0;
+    }
+}
+
+/* RTL RGBA (0xRRGGBBAA) to the framebuffer layout (0xAABBGGRR) */
+static uint32_t rtl_to_fb(uint32_t rgba) {
+    return (rgba >> 24) | ((rgba >> 8) & 0xFF00) | ((rgba << 8) & 0xFF0000) | (rgba << 24);
+}
+
+static uint64_t warps(uint64_t threads) {
+    return (threads + MILO_CMD_WARP_SIZE - 1) / MILO_CMD_WARP_SIZE;
+}
+
+/* Grow a pass array to hold need elements */
+static bool reserve(void **array, uint32_t *cap, uint64_t need, size_t size) {
+    if (need <= *cap) return true;
+    if (need > UINT32_MAX / 2) return false;
+    uint32_t grown = *cap ? *cap : 256;
+    while (grown < need) grown *= 2;
+    void *p = realloc(*array, (size_t)grown * size);
+    if (!p) return false;
+    *array = p;
+    *cap = grown;
+    return true;
+}
+
+/*---------------------------------------------------------------------------
+ * State
+ *---------------------------------------------------------------------------*/
+
+static bool set_program(milo_gpu_t *gpu, milo_gpu_shader_state_t *s, const uint32_t *p) {
+    if (p[1] != 0 && (p[0] % 8 != 0 || p[1] % 8 != 0 || !in_memory(gpu, p[0], p[1]))) {
+        return fail(gpu, "program of %u bytes at 0x%08X is not whole aligned words in memory",
+                    p[1], p[0]);
+    }
+    s->program_addr = p[0];
+    s->program_bytes = p[1];
+    return true;
+}
+
+static bool set_uniforms(milo_gpu_t *gpu, const uint32_t *p) {
+    if (p[1] > VM_MEM_SIZE || p[0] % 4 != 0 || !in_memory(gpu, p[0], p[1])) {
+        return fail(gpu, "uniform buffer of %u bytes at 0x%08X (at most %u, aligned)",
+                    p[1], p[0], VM_MEM_SIZE);
+    }
+    gpu->vs.uniform_addr = gpu->fs.uniform_addr = p[0];
+    gpu->vs.uniform_bytes = gpu->fs.uniform_bytes = p[1];
+    return true;
+}
+
+static bool set_texture(milo_gpu_t *gpu, const uint32_t *p) {
+    uint32_t unit = p[0], addr = p[1], width = p[2] & 0xFFFF, height = p[2] >> 16;
+    if (unit >= VM_MAX_TEXTURES) return fail(gpu, "texture unit %u", unit);
+    milo_texture_t *tex = &gpu->fs.textures[unit];
+    memset(tex, 0, sizeof(*tex));
+    if (width == 0 || height == 0) return true;
+    if (p[3] != MILO_TEX_RGBA8) return fail(gpu, "texture format %u not modelled", p[3]);
+    if (addr % 4 != 0 || !in_memory(gpu, addr, (uint64_t)width * height * 4)) {
+        return fail(gpu, "%ux%u texture at 0x%08X outside memory", width, height, addr);
+    }
+    tex->pixels = (uint32_t *)(gpu->mem + addr);
+    tex->width = (int)width;
+    tex->height = (int)height;
+    tex->wrap_s = tex->wrap_t = true;
+    tex->filter = true;
+    return true;
+}
+
+/* A register write of render_state_regs.vhd */
+static bool write_state(milo_gpu_t *gpu, uint32_t reg, uint32_t value) {
+    milo_render_state_t *st = &gpu->fs.state;
+    switch (reg) {
+        case MILO_REG_DEPTH_CTRL:
+            st->depth_test = value & 1;
+            st->depth_write = (value >> 1) & 1;
+            st->depth_func = (milo_depth_func_t)((value >> 2) & 7);
+            return true;
+        case MILO_REG_CULL_CTRL:
+            gpu->cull_ctrl = value & 7;
+            return true;
+        case MILO_REG_BLEND_RGB:
+        case MILO_REG_BLEND_ALPHA: {
+            bool rgb = reg == MILO_REG_BLEND_RGB;
+            uint32_t fields = rgb ? value >> 1 : value;
+            uint32_t src = fields & 0xF, dst = (fields >> 4) & 0xF, eq = (fields >> 8) & 7;
+            if (src > MILO_BLEND_SRC_ALPHA_SAT || dst > MILO_BLEND_SRC_ALPHA_SAT ||
+                eq > MILO_BLEND_EQ_MAX) {
+                return fail(gpu, "blend register 0x%08X out of range", value);
+            }
+            if (rgb) {
+                st->blend = value & 1;
+                st->src_rgb = (milo_blend_factor_t)src;
+                st->dst_rgb = (milo_blend_factor_t)dst;
+                st->eq_rgb = (milo_blend_eq_t)eq;
+            } else {
+                st->src_a = (milo_blend_factor_t)src;
+                st->dst_a = (milo_blend_factor_t)dst;
+                st->eq_a = (milo_blend_eq_t)eq;
+            }
+            return true;
+        }
+        case MILO_REG_COLOR_MASK:
+            st->color_mask = value & 0xF;
+            return true;
+        case MILO_REG_BLEND_COLOR:
+            st->blend_color = value;
+            return true;
+        case MILO_REG_DEPTH_CLEAR:
+            st->depth_clear = value & MILO_DEPTH_MAX;
+            return true;
+        case MILO_REG_COLOR_CLEAR:
+            st->color_clear = value;
+            return true;
+        default:
+            return fail(gpu, "render state register 0x%02X", reg);
+    }
+}
+
+/* Apply a waiting CLEAR to the target */
+static void flush_clear(milo_gpu_t *gpu) {
+    milo_framebuffer_t *fb = gpu->target;
+    if (!gpu->pending_clear || !fb) return;
+    int pixels = fb->width * fb->height;
+    if (gpu->pending_clear == (MILO_CLEAR_COLOR | MILO_CLEAR_DEPTH)) {
+        milo_fb_clear(fb, gpu->clear_color, gpu->clear_depth);
+    } else if (gpu->pending_clear & MILO_CLEAR_COLOR) {
+        for (int i = 0; i < pixels; i++) fb->color[i] = gpu->clear_color;
+    } else {
+        int blocks = fb->hiz_stride * ((fb->height + MILO_RASTER_BLOCK - 1) / MILO_RASTER_BLOCK);
+        for (int i = 0; i < pixels; i++) fb->depth[i] = gpu->clear_depth;
+        for (int i = 0; i < blocks; i++) fb->hiz_min[i] = fb->hiz_max[i] = gpu->clear_depth;
+    }
+    gpu->stats.clears++;
+    gpu->pending_clear = 0;
+}
+
+static bool set_target(milo_gpu_t *gpu, uint32_t addr, uint32_t size) {
+    int width = (int)(size & 0xFFFF), height = (int)(size >> 16);
+    if (gpu->in_pass) return fail(gpu, "render target changed inside a tile pass");
+    if (width == 0 || height == 0 || addr % 4 != 0 ||
+        !in_memory(gpu, addr, (uint64_t)width * height * 4)) {
+        return fail(gpu, "%dx%d render target at 0x%08X outside memory", width, height, addr);
+    }
+    flush_clear(gpu);
+    trace(gpu, addr, (uint64_t)width * height * 4, false);
+    trace(gpu, addr, (uint64_t)width * height * 4, true);
+    if (gpu->target) milo_fb_free(gpu->target);
+    gpu->target = milo_fb_wrap((uint32_t *)(gpu->mem + addr), width, height);
+    if (!gpu->target) return fail(gpu, "out of memory");
+    gpu->target_addr = addr;
+    gpu->target_width = width;
+    gpu->target_height = height;
+    int32_t full[4] = { 0, 0, width, height };
+    memcpy(gpu->viewport, full, sizeof(full));
+    memcpy(gpu->scissor, full, sizeof(full));
+    return true;
+}
+
+static bool texture_equal(const milo_texture_t *a, const milo_texture_t *b) {
+    return a->pixels == b->pixels && a->width == b->width && a->height == b->height &&
+           a->wrap_s == b->wrap_s && a->wrap_t == b->wrap_t && a->filter == b->filter;
+}
+
+static bool state_equal(const milo_render_state_t *a, const milo_render_state_t *b) {
+    return a->depth_test == b->depth_test && a->depth_write == b->depth_write &&
+           a->depth_func == b->depth_func && a->depth_clear == b->depth_clear &&
+           a->blend == b->blend && a->src_rgb == b->src_rgb && a->dst_rgb == b->dst_rgb &&
+           a->eq_rgb == b->eq_rgb && a->src_a == b->src_a && a->dst_a == b->dst_a &&
+           a->eq_a == b->eq_a && a->blend_color == b->blend_color &&
+           a->color_mask == b->color_mask && a->color_clear == b->color_clear;
+}
+
+/* Trace the programs, uniforms and textures a draw reads. The bind
+ * commands only validate them: the host may rewrite them between draws
+ * that use one binding. */
+static void trace_bound(milo_gpu_t *gpu) {
+    trace(gpu, gpu->vs.program_addr, gpu->vs.program_bytes, false);
+    trace(gpu, gpu->fs.program_addr, gpu->fs.program_bytes, false);
+    trace(gpu, gpu->fs.uniform_addr, gpu->fs.uniform_bytes, false);
+    for (int unit = 0; unit < VM_MAX_TEXTURES; unit++) {
+        const milo_texture_t *tex = &gpu->fs.textures[unit];
+        if (tex->pixels) {
+            trace(gpu, (uint32_t)((const uint8_t *)tex->pixels - gpu->mem),
+                  (uint64_t)tex->width * tex->height * 4, false);
+        }
+    }
+}
+
+/* Load what changed of want into vm; loaded keeps what the VM holds */
+static void load_vm(milo_gpu_t *gpu, milo_vm_t *vm, const milo_gpu_shader_state_t *want,
+                    milo_gpu_shader_state_t *loaded, bool *valid, bool fragment) {
+    if (!*valid || want->program_addr != loaded->program_addr ||
+        want->program_bytes != loaded->program_bytes) {
+        vm->code = (const uint64_t *)(gpu->mem + want->program_addr);
+        vm->code_size = want->program_bytes / 8;
+        vm->entry = 0;
+        loaded->program_addr = want->program_addr;
+        loaded->program_bytes = want->program_bytes;
+        gpu->stats.shader_loads++;
+    }
+    if (!*valid || want->uniform_addr != loaded->uniform_addr ||
+        want->uniform_bytes != loaded->uniform_bytes) {
+        memcpy(vm->mem, gpu->mem + want->uniform_addr, want->uniform_bytes);
+        memset((uint8_t *)vm->mem + want->uniform_bytes, 0, VM_MEM_SIZE - want->uniform_bytes);
+        loaded->uniform_addr = want->uniform_addr;
+        loaded->uniform_bytes = want->uniform_bytes;
+        gpu->stats.uniform_loads++;
+    }
+    if (fragment) {
+        for (int unit = 0; unit < VM_MAX_TEXTURES; unit++) {
+            if (!*valid || !texture_equal(&want->textures[unit], &loaded->textures[unit])) {
+                loaded->textures[unit] = want->textures[unit];
+                vm->textures[unit] = want->textures[unit].pixels ? &loaded->textures[unit] : NULL;
+                gpu->stats.texture_loads++;
+            }
+        }
+        if (!*valid || !state_equal(&want->state, &loaded->state)) {
+            loaded->state = want->state;
+            milo_vm_set_render_state(vm, &want->state);
+            gpu->stats.state_loads++;
+        }
+    }
+    *valid = true;
+}
+
+/*---------------------------------------------------------------------------
+ * Draws
+ *---------------------------------------------------------------------------*/
+
+static void bind_pass_draw(void *user, milo_vm_t *vm, uint32_t draw) {
+    milo_gpu_t *gpu = user;
+    load_vm(gpu, vm, &gpu->pass_draws[draw].fs, &gpu->fs_loaded, &gpu->fs_valid, true);
+}
+
+static bool render_pass(milo_gpu_t *gpu) {
+    milo_tbdr_draw_t *draws = malloc((gpu->pass_draw_count + 1) * sizeof(milo_tbdr_draw_t));
+    if (!draws) return fail(gpu, "out of memory");
+    for (uint32_t d = 0; d < gpu->pass_draw_count; d++) {
+        const milo_gpu_pass_draw_t *pd = &gpu->pass_draws[d];
+        draws[d].vertices = &gpu->pass_vertices[pd->first_vertex];
+        draws[d].indices = &gpu->pass_indices[pd->first_index];
+        draws[d].index_count = pd->index_count;
+        draws[d].cull = pd->cull;
+    }
+    
+    milo_tbdr_config_t cfg = gpu->tbdr;
+    cfg.clear_color = gpu->clear_color;
+    cfg.clear_depth = gpu->clear_depth;
+    uint64_t shaded = gpu->fs_vm->depth_stats.shaded;
+    milo_tbdr_stats_t st;
+    bool ok = milo_tbdr_render(gpu->fs_vm, gpu->target, &cfg, draws, gpu->pass_draw_count,
+                               bind_pass_draw, gpu, &st);
+    free(draws);
+    if (!ok) return fail(gpu, "tile pass failed (tile size %u)", cfg.tile_size);
+    gpu->stats.tile_passes++;
+    gpu->stats.tiles += (uint64_t)st.tiles_x * st.tiles_y;
+    gpu->stats.binned += st.binned;
+    gpu->stats.dropped += st.dropped;
+    gpu->stats.fs_warps += warps(gpu->fs_vm->depth_stats.shaded - shaded);
+    return true;
+}
+
+static bool cull_mode(const milo_gpu_t *gpu, milo_cull_t *cull) {
+    bool cw = gpu->cull_ctrl & 4;
+    switch (gpu->cull_ctrl & 3) {
+        case 0:  *cull = MILO_CULL_NONE; return true;
+        case 1:  *cull = cw ? MILO_CULL_BACK : MILO_CULL_FRONT; return true;
+        case 2:  *cull = cw ? MILO_CULL_FRONT : MILO_CULL_BACK; return true;
+        default: return false;                  /* CULL_BOTH */
+    }
+}
+
+/* Triangles count vertices of prim make, with no restart */
+static uint32_t prim_triangles(uint32_t prim, uint32_t count) {
+    switch (prim) {
+        case MILO_PRIM_TRIANGLES:           return count / 3;
+        case MILO_PRIM_TRIANGLE_STRIP:
+        case MILO_PRIM_TRIANGLE_FAN:        return count > 2 ? count - 2 : 0;
+        default:                            return 0;
+    }
+}
+
+/* Shaded vertices of a warp with no vertex shader bound */
+static void pass_through(const milo_vertex_warp_t *warp, milo_vertex_out_t *out) {
+    for (uint32_t lane = 0; lane < warp->count; lane++) {
+        milo_vertex_out_t *o = &out[lane];
+        o->x = warp->in[0][lane];
+        o->y = warp->in[1][lane];
+        o->z = warp->in[2][lane];
+        o->w = 1.0f;
+        o->u = warp->in[3][lane];
+        o->v = warp->in[4][lane];
+        o->r = warp->in[5][lane];
+        o->g = warp->in[6][lane];
+        o->b = warp->in[7][lane];
+        o->a = warp->in[8][lane];
+        o->nx = warp->in[9][lane];
+        o->ny = warp->in[10][lane];
+        o->nz = warp->in[11][lane];
+    }
+}
+
+/* Fetch and shade count vertices (those of indices, or from first) into
+ * out, a warp at a time */
+static bool shade_vertices(milo_gpu_t *gpu, const milo_vertex_layout_t *layout,
+                           const uint32_t *indices, uint32_t first, uint32_t count,
+                           milo_vertex_out_t *out) {
+    milo_vertex_warp_t warp;
+    bool shade = gpu->vs.program_bytes != 0;
+    for (uint32_t v = 0; v < count; v += MILO_VERTEX_WARP) {
+        milo_fetch_warp(layout, gpu->mem + gpu->vb_addr, indices ? indices + v : NULL,
+                        first + v, count - v, &warp);
+        if (!shade) {
+            pass_through(&warp, &out[v]);
+        } else if (!milo_vm_exec_vertex_warp(gpu->vs_vm, &warp, &out[v])) {
+            return fail(gpu, "vertex shader: %s", milo_vm_get_error(gpu->vs_vm));
+        }
+    }
+    if (shade) {
+        gpu->stats.vertices += count;
+        gpu->stats.vs_warps += warps(count);
+    }
+    return true;
+}
+
+/* Run count indices through the emptied vertex cache, shading its misses
+ * into out a warp at a time; each index becomes the vertex of out it
+ * uses. *shaded is set to the vertices shaded. */
+static bool shade_cached(milo_gpu_t *gpu, const milo_vertex_layout_t *layout, uint32_t *indices,
+                         uint32_t count, milo_vertex_out_t *out, uint32_t *shaded) {
+    milo_vcache_t *cache = &gpu->vcache;
+    uint64_t hits = cache->hits, misses = cache->misses;
+    uint32_t pending[MILO_VERTEX_WARP], n = 0, first = 0;
+    milo_vcache_flush(cache);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t vertex;
+        if (!milo_vcache_lookup(cache, indices[i], &vertex)) {
+            if (n == MILO_VERTEX_WARP) {
+                if (!shade_vertices(gpu, layout, pending, 0, n, &out[first])) return false;
+                first += n;
+                n = 0;
+            }
+            vertex = first + n;
+            pending[n++] = indices[i];
+            milo_vcache_insert(cache, indices[i], vertex);
+        }
+        indices[i] = vertex;
+    }
+    if (!shade_vertices(gpu, layout, pending, 0, n, &out[first])) return false;
+    *shaded = first + n;
+    gpu->stats.vcache_hits += cache->hits - hits;
+    gpu->stats.vcache_misses += cache->misses - misses;
+    return true;
+}
+
+/* Fetch count indices of prim (sequential from first when not indexed,
+ * base added when indexed), shade their vertices into the pass arrays
+ * and assemble them into triangles as one draw; render it at once
+ * outside a tile pass */
+static bool draw(milo_gpu_t *gpu, bool indexed, uint32_t prim, uint32_t first, uint32_t base,
+                 uint32_t count) {
+    if (!gpu->target) return fail(gpu, "draw without a render target");
+    const int32_t *vp = gpu->viewport, *sc = gpu->scissor;
+    if (vp[0] != 0 || vp[1] != 0 || vp[2] != gpu->target_width ||
+        vp[3] != gpu->target_height) {
+        return fail(gpu, "viewport %d,%d %dx%d is not the whole target", vp[0], vp[1], vp[2],
+                    vp[3]);
+    }
+    if (sc[0] > 0 || sc[1] > 0 || (int64_t)sc[0] + sc[2] < gpu->target_width ||
+        (int64_t)sc[1] + sc[3] < gpu->target_height) {
+        return fail(gpu, "scissor %d,%d %dx%d does not cover the target", sc[0], sc[1], sc[2],
+                    sc[3]);
+    }
+    if (gpu->fs.program_bytes == 0) return fail(gpu, "draw without a fragment shader");
+    if (prim >= MILO_PRIM_COUNT) return fail(gpu, "primitive type %u not modelled", prim);
+    gpu->stats.draws++;
+    uint32_t tris = prim_triangles(prim, count);
+    gpu->stats.triangles += tris;
+    milo_cull_t cull;
+    if (prim == MILO_PRIM_TRIANGLES) count = tris * 3;
+    if (count == 0 || !cull_mode(gpu, &cull)) return true;
+    
+    /* Indices: a triangle list's are fetched in place */
+    if (!reserve((void **)&gpu->pass_indices, &gpu->pass_index_cap,
+                 (uint64_t)gpu->pass_index_count + (uint64_t)tris * 3, sizeof(uint32_t)) ||
+        !reserve((void **)&gpu->fetch_indices, &gpu->fetch_index_cap, count,
+                 sizeof(uint32_t))) {
+        return fail(gpu, "out of memory");
+    }
+    uint32_t *indices = &gpu->pass_indices[gpu->pass_index_count];
+    uint32_t *fetched = prim == MILO_PRIM_TRIANGLES ? indices : gpu->fetch_indices;
+    if (indexed) {
+        if (gpu->ib_format >= MILO_INDEX_COUNT) {
+            return fail(gpu, "index format %u not modelled", gpu->ib_format);
+        }
+        uint32_t size = milo_fetch_index_size(gpu->ib_format);
+        uint64_t start = (uint64_t)gpu->ib_addr + (uint64_t)first * size;
+        if (start % size != 0 || start > UINT32_MAX ||
+            !in_memory(gpu, (uint32_t)start, (uint64_t)count * size)) {
+            return fail(gpu, "%u indices at 0x%08llX outside memory", count,
+                        (unsigned long long)start);
+        }
+        trace(gpu, (uint32_t)start, (uint64_t)count * size, false);
+        milo_fetch_indices(gpu->mem + start, gpu->ib_format, count, base, fetched);
+    } else {
+        for (uint32_t i = 0; i < count; i++) fetched[i] = first + i;
+    }
+    uint32_t lo = UINT32_MAX, hi = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (fetched[i] < lo) lo = fetched[i];
+        if (fetched[i] > hi) hi = fetched[i];
+    }
+    
+    /* Vertices */
+    milo_vertex_layout_t layout = gpu->vb_layout;
+    uint32_t stride = layout.stride = gpu->vb_stride;
+    if (!milo_fetch_layout_valid(&layout)) {
+        return fail(gpu, "vertex layout invalid for stride %u", stride);
+    }
+    uint32_t span = milo_fetch_vertex_span(&layout);
+    if (gpu->vb_addr % 4 != 0 ||
+        !in_memory(gpu, gpu->vb_addr, (uint64_t)hi * stride + span)) {
+        return fail(gpu, "vertices %u..%u of stride %u at 0x%08X outside memory", lo, hi,
+                    stride, gpu->vb_addr);
+    }
+    uint64_t range = (uint64_t)hi - lo + 1;
+    if (range > UINT32_MAX / 2) {
+        return fail(gpu, "vertices %u..%u exceed a pass", lo, hi);
+    }
+    uint32_t n = (uint32_t)range;
+    trace(gpu, gpu->vb_addr + lo * stride, (uint64_t)(n - 1) * stride + span, false);
+    bool cached = gpu->vcache.size > 0;
+    if (!reserve((void **)&gpu->pass_vertices, &gpu->pass_vertex_cap,
+                 (uint64_t)gpu->pass_vertex_count + (cached ? count : n),
+                 sizeof(milo_vertex_out_t)) ||
+        !reserve((void **)&gpu->pass_draws, &gpu->pass_draw_cap,
+                 (uint64_t)gpu->pass_draw_count + 1, sizeof(milo_gpu_pass_draw_t))) {
+        return fail(gpu, "out of memory");
+    }
+    milo_vertex_out_t *out = &gpu->pass_vertices[gpu->pass_vertex_count];
+    trace_bound(gpu);
+    if (gpu->vs.program_bytes != 0) {
+        load_vm(gpu, gpu->vs_vm, &gpu->vs, &gpu->vs_loaded, &gpu->vs_valid, false);
+    }
+    if (cached) {
+        if (!shade_cached(gpu, &layout, fetched, count, out, &n)) return false;
+        gpu->stats.vcache_triangles += tris;
+    } else {
+        if (!shade_vertices(gpu, &layout, NULL, lo, n, out)) return false;
+        for (uint32_t i = 0; i < count; i++) fetched[i] -= lo;
+    }
+    count = milo_assemble(prim, fetched, count, false, 0, indices);
+    if (count == 0) return true;
+    
+    if (!gpu->in_pass) {
+        flush_clear(gpu);
+        load_vm(gpu, gpu->fs_vm, &gpu->fs, &gpu->fs_loaded, &gpu->fs_valid, true);
+        uint64_t shaded = gpu->fs_vm->depth_stats.shaded;
+        milo_render_mesh(gpu->fs_vm, gpu->target, out, indices, count, cull);
+        gpu->stats.fs_warps += warps(gpu->fs_vm->depth_stats.shaded - shaded);
+        return true;
+    }
+    milo_gpu_pass_draw_t *pd = &gpu->pass_draws[gpu->pass_draw_count++];
+    pd->first_vertex = gpu->pass_vertex_count;
+    pd->first_index = gpu->pass_index_count;
+    pd->index_count = count;
+    pd->cull = cull;
+    pd->fs = gpu->fs;
+    gpu->pass_vertex_count += n;
+    gpu->pass_index_count += count;
+    return true;
+}
+
+/*---------------------------------------------------------------------------
+ * Execution
+ *---------------------------------------------------------------------------*/
+
+/* Run one command; done is set by the top-level END */
+static bool run_command(milo_gpu_t *gpu, uint32_t op, const uint32_t *p, uint32_t length,
+                        bool *done) {
+    switch (op) {
+        case MILO_CMD_NOP:
+            return true;
+        case MILO_CMD_FENCE:
+            if (!gpu->in_pass) flush_clear(gpu);
+            gpu->vs_valid = gpu->fs_valid = false;
+            gpu->stats.fences++;
+            return true;
+        case MILO_CMD_IRQ:
+            gpu->irq_status |= 1u << (p[0] & 31);
+            gpu->stats.irqs++;
+            return true;
+        case MILO_CMD_SET_VERTEX_BUFFER:
+            gpu->vb_addr = p[0];
+            gpu->vb_stride = p[1];
+            return true;
+        case MILO_CMD_SET_VERTEX_LAYOUT:
+            for (int a = 0; a < MILO_ATTR_COUNT; a++) {
+                gpu->vb_layout.attrs[a].offset = p[a] & 0xFF;
+                gpu->vb_layout.attrs[a].format = (milo_attr_format_t)((p[a] >> 8) & 0xFF);
+            }
+            return true;
+        case MILO_CMD_SET_INDEX_BUFFER:
+            gpu->ib_addr = p[0];
+            gpu->ib_format = p[1];
+            return true;
+        case MILO_CMD_SET_UNIFORM_BUFFER:
+            return set_uniforms(gpu, p);
+        case MILO_CMD_SET_TEXTURE:
+            return set_texture(gpu, p);
+        case MILO_CMD_SET_RENDER_TARGET:
+            return set_target(gpu, p[0], p[1]);
+        case MILO_CMD_SET_VIEWPORT:
+            memcpy(gpu->viewport, p, sizeof(gpu->viewport));
+            return true;
+        case MILO_CMD_SET_SCISSOR:
+            memcpy(gpu->scissor, p, sizeof(gpu->scissor));
+            return true;
+        case MILO_CMD_SET_RENDER_STATE:
+            for (uint32_t i = 0; i + 1 < length; i += 2) {
+                if (!write_state(gpu, p[i], p[i + 1])) return false;
+            }
+            return true;
+        case MILO_CMD_BIND_VERTEX_SHADER:
+            return set_program(gpu, &gpu->vs, p);
+        case MILO_CMD_BIND_FRAGMENT_SHADER:
+            return set_program(gpu, &gpu->fs, p);
+        case MILO_CMD_CLEAR:
+            if (p[0] & MILO_CLEAR_COLOR) gpu->clear_color = rtl_to_fb(p[1]);
+            if (p[0] & MILO_CLEAR_DEPTH) {
+                gpu->clear_depth = milo_rop_depth_float(p[2] & MILO_DEPTH_MAX);
+            }
+            if (!gpu->in_pass) gpu->pending_clear |= p[0] & (MILO_CLEAR_COLOR | MILO_CLEAR_DEPTH);
+            return true;
+        case MILO_CMD_DRAW: {
+            uint32_t prim = length > 2 ? p[2] : MILO_PRIM_TRIANGLES;
+            uint32_t first = length > 3 ? p[3] : 0;
+            for (uint32_t i = 0; i < p[1]; i++) {
+                if (!draw(gpu, false, prim, first, 0, p[0])) return false;
+            }
+            return true;
+        }
+        case MILO_CMD_DRAW_INDEXED:
+            return draw(gpu, true, length > 2 ? p[2] : MILO_PRIM_TRIANGLES, p[1],
+                        length > 3 ? p[3] : 0, p[0]);
+        case MILO_CMD_BEGIN_TILE_PASS:
+            if (gpu->in_pass) return fail(gpu, "tile pass already begun");
+            if (!gpu->target) return fail(gpu, "tile pass without a render target");
+            gpu->in_pass = true;
+            gpu->pending_clear &= ~(uint32_t)MILO_CLEAR_COLOR;
+            gpu->pass_vertex_count = gpu->pass_index_count = gpu->pass_draw_count = 0;
+            return true;
+        case MILO_CMD_END_TILE_PASS: {
+            if (!gpu->in_pass) return fail(gpu, "no tile pass to end");
+            bool ok = render_pass(gpu);
+            gpu->in_pass = false;
+            gpu->pass_vertex_count = gpu->pass_index_count = gpu->pass_draw_count = 0;
+            return ok;
+        }
+        case MILO_CMD_CALL:
+            if (gpu->call_sp == MILO_CMD_CALL_DEPTH) {
+                return fail(gpu, "calls nested deeper than %d", MILO_CMD_CALL_DEPTH);
+            }
+            gpu->call_stack[gpu->call_sp++] = gpu->read_ptr;
+            gpu->read_ptr = p[0];
+            return true;
+        case MILO_CMD_JUMP:
+            gpu->read_ptr = p[0];
+            return true;
+        case MILO_CMD_END:
+            if (gpu->call_sp > 0) {
+                gpu->read_ptr = gpu->call_stack[--gpu->call_sp];
+                return true;
+            }
+            if (gpu->in_pass) return fail(gpu, "END inside a tile pass");
+            flush_clear(gpu);
+            *done = true;
+            return true;
+        default:
+            return fail(gpu, "unknown opcode 0x%02X", op);
+    }
+}
+
+bool milo_gpu_execute(milo_gpu_t *gpu, uint32_t addr) {
+    gpu->fault = false;
+    gpu->error[0] = '\0';
+    gpu->read_ptr = addr;
+    gpu->call_sp = 0;
+    gpu->vs_valid = gpu->fs_valid = false;
+    gpu->in_pass = false;                       /* A faulted pass is dropped */
+    
+    bool done = false;
+    for (uint64_t n = 0; !done; n++) {
+        uint32_t at = gpu->read_ptr;
+        bool ok;
+        if (gpu->max_commands && n == gpu->max_commands) {
+            ok = fail(gpu, "more than %llu commands", (unsigned long long)gpu->max_commands);
+        } else if (at % 4 != 0 || !in_memory(gpu, at, 4)) {
+            ok = fail(gpu, "command read at 0x%08X outside memory", at);
+        } else {
+            uint32_t header = rd32(gpu, at);
+            uint32_t op = header & 0xFF, length = (header >> 8) & 0xFF;
+            if (!in_memory(gpu, at + 4, (uint64_t)length * 4)) {
+                ok = fail(gpu, "command at 0x%08X runs past memory", at);
+            } else if (opcode_name(op) && length < payload_length(op)) {
+                ok = fail(gpu, "%s with %u payload dwords, needs %u", opcode_name(op), length,
+                          payload_length(op));
+            } else {
+                gpu->read_ptr = at + 4 + length * 4;
+                gpu->stats.commands++;
+                trace(gpu, at, 4 + (uint64_t)length * 4, false);
+                ok = run_command(gpu, op, (const uint32_t *)(gpu->mem + at + 4), length, &done);
+            }
+        }
+        if (!ok) {
+            gpu->fault = true;
+            gpu->fault_addr = at;
+            return false;
+        }
+    }
+    return true;
+}
+
+void milo_gpu_report(const milo_gpu_t *gpu, uint32_t frames, FILE *out) {
+    const milo_gpu_stats_t *s = &gpu->stats;
+    double n = frames ? (double)frames : 1.0;
+    fprintf(out, "Commands: %.0f, %.1f draws, %.0f triangles, %.1f clears, %.1f fences, "
+            "%.1f IRQs per frame\n", s->commands / n, s->draws / n, s->triangles / n,
+            s->clears / n, s->fences / n, s->irqs / n);
+    fprintf(out, "  shading      %.0f vertices (%.0f VS warps), %.0f FS warps\n",
+            s->vertices / n, s->vs_warps / n, s->fs_warps / n);
+    if (s->vcache_triangles) {
+        fprintf(out, "  vertex cache %u-entry %s, %.0f hits, %.0f misses, ACMR %.3f\n",
+                gpu->vcache.size, gpu->vcache.policy == MILO_VCACHE_LRU ? "LRU" : "FIFO",
+                s->vcache_hits / n, s->vcache_misses / n,
+                (double)s->vcache_misses / (double)s->vcache_triangles);
+    }
+    fprintf(out, "  tile passes  %.1f, %.0f tiles, %.0f triangles binned, %.0f entries dropped\n",
+            s->tile_passes / n, s->tiles / n, s->binned / n, s->dropped / n);
+    fprintf(out, "  state loads  %.1f shader, %.1f texture, %.1f uniform, %.1f render state\n",
+            s->shader_loads / n, s->texture_loads / n, s->uniform_loads / n,
+            s->state_loads / n);
+}
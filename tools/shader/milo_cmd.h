@@ -0,0 +1,283 @@
+/*
+ * milo_cmd.h
+ * Milo832 Command Processor - Header
+ *
+ * Host model of the GPU front end: executes the binary command buffers of
+ * docs/command_model.md out of a model of GPU memory and drives the
+ * software pipeline behind them (vertex fetch, vertex shading on one VM,
+ * immediate or tile-based rasterization, fragment shading on another VM
+ * and the ROP), so that captured frames replay end to end on the host.
+ *
+ * A command is a header dword, OPCODE in bits 7..0 (as in
+ * command_processor.vhd) and LENGTH, the payload dwords that follow, in
+ * bits 15..8; bits 31..16 are reserved. Payloads:
+ *   FENCE, BEGIN_TILE_PASS, END_TILE_PASS, END, NOP    none (NOP: any)
+ *   IRQ                   code (sets bit code & 31 of irq_status)
+ *   SET_VERTEX_BUFFER     addr, stride
+ *   SET_VERTEX_LAYOUT     position, texcoord, color, normal: each
+ *                         MILO_VERTEX_ATTR(offset, format)
+ *   SET_INDEX_BUFFER      addr, format (MILO_INDEX_*)
+ *   SET_UNIFORM_BUFFER    addr, bytes
+ *   SET_TEXTURE           unit, addr, width | height << 16, format
+ *   SET_RENDER_TARGET     addr, width | height << 16
+ *   SET_VIEWPORT          x, y, width, height
+ *   SET_SCISSOR           x, y, width, height
+ *   SET_RENDER_STATE      register offset, value, ... (render_state_regs)
+ *   BIND_*_SHADER         addr, bytes
+ *   CLEAR                 flags (MILO_CLEAR_*), color (0xRRGGBBAA), depth
+ *   DRAW                  vertex count, instance count[, prim, first vertex]
+ *   DRAW_INDEXED          index count, first index[, prim, base vertex]
+ *   JUMP, CALL            addr
+ * Extra payload dwords are ignored; missing ones are a fault, but for the
+ * bracketed ones, which default to MILO_PRIM_TRIANGLES and 0.
+ *
+ * What the model fixes where the document leaves it open:
+ *   - vertices are fetched as milo_fetch.h decodes them, in the layout of
+ *     the last SET_VERTEX_LAYOUT; until then (or after a reset) that of
+ *     milo_gpu_upload_vertices: MILO_CMD_VERTEX_BYTES of position (3
+ *     floats), texture coordinates (2) and normal (3) at the start of
+ *     each stride, color opaque white;
+ *   - the vertices a draw's indices span are shaded once each; given a
+ *     size, the post-transform cache (milo_vcache.h) takes the indices in
+ *     order instead, and only its misses are shaded, a warp at a time;
+ *   - primitives are assembled as primitive_assembly.vhd does, with no
+ *     primitive restart; points and lines are shaded but not drawn;
+ *   - the vertex shader sees them in the registers of milo_vm_exec_vertex
+ *     and writes only the clip position; the other varyings pass through.
+ *     With no vertex shader bound the position is the clip position, w 1;
+ *   - the uniform buffer is the shaders' VM memory from byte 0 (what ldr
+ *     reads), so a compiled shader's constant table goes at its
+ *     MILO_CONST_BASE_ADDR offset;
+ *   - shader code is the 64-bit instruction words, executed in place from
+ *     GPU memory from the first instruction;
+ *   - textures are RGBA8 texels in the layout of milo_texture_t;
+ *   - the render target is width x height RGBA8 pixels in GPU memory, in
+ *     the framebuffer layout; depth and hi-Z stay in the processor;
+ *   - draws outside a tile pass render at once; draws inside one are
+ *     vertex shaded and recorded, and END_TILE_PASS bins and renders them
+ *     all (milo_tbdr_render), the tiles starting from the last CLEAR;
+ *   - a CLEAR waits until something reads or writes the target: a tile
+ *     pass makes its color clear unnecessary;
+ *   - CALL nests MILO_CMD_CALL_DEPTH deep and END returns from it;
+ *   - CULL_BOTH drops draws whole; viewports other than the whole target
+ *     and scissors that do not cover it are not modelled and fault.
+ * SET_RENDER_STATE writes the registers of render_state_regs.vhd, which the
+ * RTL maps on the bus; the command stream had no way to set them.
+ *
+ * The shaders, textures, uniforms and render state of a draw are those
+ * current at the draw. A VM is only reloaded with state that changed since
+ * it last shaded, as the state cache would; every execution and FENCE start
+ * it afresh, since the host may have rewritten the memory in between.
+ */
+
+#ifndef MILO_CMD_H
+#define MILO_CMD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "milo_vm.h"
+#include "milo_fetch.h"
+#include "milo_vcache.h"
+#include "milo_tbdr.h"
+
+/*---------------------------------------------------------------------------
+ * Command Stream
+ *---------------------------------------------------------------------------*/
+
+#define MILO_CMD_NOP                    0x01
+#define MILO_CMD_FENCE                  0x02
+#define MILO_CMD_IRQ                    0x03
+#define MILO_CMD_SET_VERTEX_BUFFER      0x10
+#define MILO_CMD_SET_INDEX_BUFFER       0x11
+#define MILO_CMD_SET_UNIFORM_BUFFER     0x12
+#define MILO_CMD_SET_TEXTURE            0x13
+#define MILO_CMD_SET_RENDER_TARGET      0x14
+#define MILO_CMD_SET_VIEWPORT           0x15
+#define MILO_CMD_SET_SCISSOR            0x16
+#define MILO_CMD_SET_RENDER_STATE       0x17
+#define MILO_CMD_SET_VERTEX_LAYOUT      0x18
+#define MILO_CMD_BIND_VERTEX_SHADER     0x20
+#define MILO_CMD_BIND_FRAGMENT_SHADER   0x21
+#define MILO_CMD_CLEAR                  0x30
+#define MILO_CMD_DRAW                   0x31
+#define MILO_CMD_DRAW_INDEXED           0x32
+#define MILO_CMD_BEGIN_TILE_PASS        0x40
+#define MILO_CMD_END_TILE_PASS          0x41
+#define MILO_CMD_JUMP                   0xF0
+#define MILO_CMD_CALL                   0xF1
+#define MILO_CMD_END                    0xFF
+
+#define MILO_CMD_HEADER(op, length)     ((uint32_t)(op) | (uint32_t)(length) << 8)
+
+/* CLEAR flags */
+#define MILO_CLEAR_COLOR                0x1
+#define MILO_CLEAR_DEPTH                0x2
+
+/* SET_VERTEX_LAYOUT attribute: byte offset in the vertex (attr_*_offset
+ * of vertex_fetch.vhd) and MILO_FMT_*, MILO_FMT_NONE to not fetch it */
+#define MILO_VERTEX_ATTR(offset, format) ((uint32_t)(offset) | (uint32_t)(format) << 8)
+
+/* Texture formats */
+#define MILO_TEX_RGBA8                  0
+
+/* render_state_regs.vhd register offsets */
+#define MILO_REG_DEPTH_CTRL             0x00    /* [0] test, [1] write, [4:2] func */
+#define MILO_REG_CULL_CTRL              0x04    /* [1:0] mode, [2] front face CW */
+#define MILO_REG_BLEND_RGB              0x08    /* [0] blend, [4:1] src, [8:5] dst,
+                                                 * [11:9] eq */
+#define MILO_REG_BLEND_ALPHA            0x0C    /* [3:0] src, [7:4] dst, [10:8] eq */
+#define MILO_REG_COLOR_MASK             0x10
+#define MILO_REG_BLEND_COLOR            0x14
+#define MILO_REG_DEPTH_CLEAR            0x18
+#define MILO_REG_COLOR_CLEAR            0x1C
+
+/* GPU memory map of docs/command_model.md */
+#define MILO_GPU_CMD_BASE               0x00001000
+#define MILO_GPU_VERTEX_BASE            0x00010000
+#define MILO_GPU_INDEX_BASE             0x00100000
+#define MILO_GPU_UNIFORM_BASE           0x00140000
+#define MILO_GPU_SHADER_BASE            0x00150000
+#define MILO_GPU_TEXTURE_BASE           0x00190000
+#define MILO_GPU_FRAMEBUFFER_BASE       0x02990000
+#define MILO_GPU_MEM_SIZE               0x049A0000
+
+#define MILO_CMD_VERTEX_BYTES           32
+#define MILO_CMD_CALL_DEPTH             8
+#define MILO_CMD_WARP_SIZE              32      /* Threads per shader warp */
+
+/*---------------------------------------------------------------------------
+ * Processor
+ *---------------------------------------------------------------------------*/
+
+/* PERF_* counters and more, summed over executions until cleared */
+typedef struct {
+    uint64_t commands;
+    uint64_t draws;
+    uint64_t vertices;                  /* Vertex shader runs */
+    uint64_t vs_warps;                  /* PERF_VS_WARPS: per draw */
+    uint64_t fs_warps;                  /* PERF_FS_WARPS: fragment shader runs
+                                         * per draw or tile pass */
+    uint64_t triangles;                 /* PERF_TRIS: submitted */
+    uint64_t vcache_hits;               /* Post-transform cache lookups */
+    uint64_t vcache_misses;
+    uint64_t vcache_triangles;          /* Of the draws that used it */
+    uint64_t tiles;                     /* PERF_TILES */
+    uint64_t tile_passes;
+    uint64_t binned;                    /* Tile pass triangles binned */
+    uint64_t dropped;                   /* and bin-list entries dropped */
+    uint64_t shader_loads;              /* VM reloads on a change */
+    uint64_t texture_loads;
+    uint64_t uniform_loads;
+    uint64_t state_loads;
+    uint64_t clears;                    /* Applied to the target */
+    uint64_t fences;
+    uint64_t irqs;
+} milo_gpu_stats_t;
+
+/* What a shader runs with; the vertex shader uses the program and the
+ * uniforms only */
+typedef struct {
+    uint32_t            program_addr, program_bytes;    /* 0 bytes: unbound */
+    uint32_t            uniform_addr, uniform_bytes;
+    milo_texture_t      textures[VM_MAX_TEXTURES];      /* pixels NULL: unbound */
+    milo_render_state_t state;
+} milo_gpu_shader_state_t;
+
+/* Called with each range of memory a command reads (write false) and
+ * with a render target, which draws write (write true) */
+typedef void (*milo_gpu_trace_fn)(void *user, uint32_t addr, uint32_t bytes, bool write);
+
+/* A draw recorded in a tile pass */
+typedef struct {
+    uint32_t                first_vertex;   /* In the pass vertex array */
+    uint32_t                first_index;    /* In the pass index array */
+    uint32_t                index_count;
+    milo_cull_t             cull;
+    milo_gpu_shader_state_t fs;
+} milo_gpu_pass_draw_t;
+
+typedef struct {
+    uint8_t    *mem;
+    uint32_t    mem_size;
+    
+    milo_vm_t  *vs_vm;                  /* Shades vertices */
+    milo_vm_t  *fs_vm;                  /* Shades fragments: set early_z, hiz
+                                         * or profile on it */
+    milo_tbdr_config_t tbdr;            /* Tile passes; clear values and cull
+                                         * come from the commands */
+    milo_vcache_t vcache;               /* Size 0 (the default): not used */
+    milo_gpu_trace_fn trace;            /* Memory accesses, if set */
+    void       *trace_user;
+    
+    /* Registers the commands set */
+    uint32_t    vb_addr, vb_stride;
+    milo_vertex_layout_t vb_layout;     /* Its stride unused */
+    uint32_t    ib_addr;
+    uint32_t    ib_format;
+    uint32_t    target_addr;
+    int         target_width, target_height;
+    int32_t     viewport[4], scissor[4];
+    uint32_t    cull_ctrl;
+    milo_gpu_shader_state_t vs, fs;
+    uint32_t    clear_color;            /* Framebuffer layout */
+    float       clear_depth;
+    uint32_t    pending_clear;          /* MILO_CLEAR_* not yet applied */
+    
+    /* The target (color in mem), and what the VMs hold */
+    milo_framebuffer_t *target;
+    milo_gpu_shader_state_t vs_loaded, fs_loaded;
+    bool        vs_valid, fs_valid;
+    
+    /* Tile pass being recorded */
+    bool        in_pass;
+    milo_vertex_out_t    *pass_vertices;
+    uint32_t              pass_vertex_count, pass_vertex_cap;
+    uint32_t             *pass_indices;
+    uint32_t              pass_index_count, pass_index_cap;
+    milo_gpu_pass_draw_t *pass_draws;
+    uint32_t              pass_draw_count, pass_draw_cap;
+    uint32_t             *fetch_indices;    /* A draw's indices before assembly */
+    uint32_t              fetch_index_cap;
+    
+    /* Execution */
+    uint32_t    read_ptr;               /* CMD_READ_PTR */
+    uint32_t    call_stack[MILO_CMD_CALL_DEPTH];
+    int         call_sp;
+    uint64_t    max_commands;           /* Per execution, 0 for no limit */
+    uint32_t    irq_status;
+    milo_gpu_stats_t stats;
+    
+    /* Fault: STATUS bit 1 */
+    bool        fault;
+    uint32_t    fault_addr;             /* Command that faulted */
+    char        error[256];
+} milo_gpu_t;
+
+/* Allocate mem_size bytes of zeroed GPU memory and reset the state */
+bool milo_gpu_init(milo_gpu_t *gpu, uint32_t mem_size);
+void milo_gpu_free(milo_gpu_t *gpu);
+
+/* Back to the state after init, memory and statistics kept */
+void milo_gpu_reset(milo_gpu_t *gpu);
+
+/* Copy data into GPU memory; false if it does not fit */
+bool milo_gpu_upload(milo_gpu_t *gpu, uint32_t addr, const void *data, uint32_t bytes);
+
+/* Upload vertices in the layout the processor fetches (stride
+ * MILO_CMD_VERTEX_BYTES), and indices in an index format */
+bool milo_gpu_upload_vertices(milo_gpu_t *gpu, uint32_t addr, const milo_vertex_in_t *vertices,
+                              uint32_t count);
+bool milo_gpu_upload_indices(milo_gpu_t *gpu, uint32_t addr, const uint32_t *indices,
+                             uint32_t count, milo_index_format_t format);
+
+/* Execute the command buffer at addr up to its top-level END. False on a
+ * fault (error and fault_addr say which), which leaves the state as the
+ * faulting command found it, but for a tile pass that was being recorded:
+ * the next execution drops it. */
+bool milo_gpu_execute(milo_gpu_t *gpu, uint32_t addr);
+
+/* Print the counters, per frame over frames */
+void milo_gpu_report(const milo_gpu_t *gpu, uint32_t frames, FILE *out);
+
+#endif /* MILO_CMD_H */
@@ -0,0 +1,391 @@
+/*
+ * milo_cmdbuf.c
+ * Milo832 Command Buffer Builder - Implementation
+ */
+
+#include "milo_cmdbuf.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Bits of the state fields in set and known */
+#define FIELD_REG(r)        (1u << (r))
+#define FIELD_FS            (1u << 8)
+#define FIELD_VS            (1u << 9)
+#define FIELD_TEXTURE(u)    (1u << (10 + (u)))
+#define FIELD_UNIFORMS      (1u << 18)
+#define FIELD_VERTEX_BUFFER (1u << 19)
+#define FIELD_INDEX_BUFFER  (1u << 20)
+#define FIELD_VERTEX_LAYOUT (1u << 21)
+
+/*---------------------------------------------------------------------------
+ * Ring
+ *---------------------------------------------------------------------------*/
+
+bool milo_cmdbuf_init(milo_cmdbuf_t *cb, uint32_t *ring, uint32_t base, uint32_t dwords,
+                      uint32_t sort_draws) {
+    memset(cb, 0, sizeof(*cb));
+    if (!ring || dwords < 8 || base % 4 != 0) return false;
+    if (sort_draws) {
+        cb->draws = malloc((size_t)sort_draws * sizeof(milo_cmdbuf_draw_t));
+        if (!cb->draws) return false;
+    }
+    cb->ring = ring;
+    cb->base = base;
+    cb->size = dwords;
+    cb->draw_cap = sort_draws;
+    return true;
+}
+
+void milo_cmdbuf_free(milo_cmdbuf_t *cb) {
+    free(cb->draws);
+    memset(cb, 0, sizeof(*cb));
+}
+
+/* Room for n dwords at the write pointer, wrapping to the start of the
+ * ring with a JUMP when they do not fit before its end. The end always
+ * keeps room for the JUMP, and write never catches up with read. */
+static uint32_t *reserve(milo_cmdbuf_t *cb, uint32_t n) {
+    if (cb->overflow) return NULL;
+    if (cb->write >= cb->read) {
+        if (cb->write + n + 2 <= cb->size) {
+            cb->write += n;
+            return &cb->ring[cb->write - n];
+        }
+        if (n < cb->read) {
+            cb->ring[cb->write] = MILO_CMD_HEADER(MILO_CMD_JUMP, 1);
+            cb->ring[cb->write + 1] = cb->base;
+            cb->stats.commands++;
+            cb->stats.dwords += 2;
+            cb->stats.wraps++;
+            cb->write = n;
+            return cb->ring;
+        }
+    } else if (cb->write + n < cb->read) {
+        cb->write += n;
+        return &cb->ring[cb->write - n];
+    }
+    cb->overflow = true;
+    return NULL;
+}
+
+static void emit(milo_cmdbuf_t *cb, uint32_t op, const uint32_t *payload, uint32_t n) {
+    uint32_t *p = reserve(cb, 1 + n);
+    if (!p) return;
+    p[0] = MILO_CMD_HEADER(op, n);
+    if (n) memcpy(p + 1, payload, n * sizeof(uint32_t));
+    cb->stats.commands++;
+    cb->stats.dwords += 1 + n;
+}
+
+static void forget(milo_cmdbuf_t *cb) {
+    memset(&cb->want, 0, sizeof(cb->want));
+    cb->set = cb->known = 0;
+    cb->target_known = cb->viewport_known = cb->scissor_known = false;
+}
+
+uint32_t milo_cmdbuf_begin(milo_cmdbuf_t *cb) {
+    if (cb->open) cb->write = cb->start;
+    cb->open = true;
+    cb->overflow = false;
+    cb->start = cb->write;
+    cb->draw_count = 0;
+    forget(cb);
+    return cb->base + cb->start * 4;
+}
+
+void milo_cmdbuf_retire(milo_cmdbuf_t *cb, uint32_t read_addr) {
+    uint32_t offset = (read_addr - cb->base) / 4;
+    if (read_addr >= cb->base && offset <= cb->size) cb->read = offset % cb->size;
+}
+
+/*---------------------------------------------------------------------------
+ * State
+ *---------------------------------------------------------------------------*/
+
+/* Whether a field set in want differs from what the processor holds; if so
+ * it is taken to hold it from now on */
+static bool changed(milo_cmdbuf_t *cb, uint32_t field, uint32_t set, uint32_t *current,
+                    const uint32_t *want, uint32_t n) {
+    if (!(set & field)) return false;
+    if ((cb->known & field) && memcmp(current, want, n * sizeof(uint32_t)) == 0) return false;
+    memcpy(current, want, n * sizeof(uint32_t));
+    cb->known |= field;
+    cb->stats.state_commands++;
+    return true;
+}
+
+/* Write the fields of set that the processor does not hold yet */
+static void emit_state(milo_cmdbuf_t *cb, const milo_cmdbuf_state_t *want, uint32_t set) {
+    milo_cmdbuf_state_t *cur = &cb->current;
+    uint32_t regs[MILO_CMDBUF_REGS * 2], pairs = 0;
+    for (uint32_t r = 0; r < MILO_CMDBUF_REGS; r++) {
+        uint32_t field = FIELD_REG(r);
+        if ((set & field) && (!(cb->known & field) || cur->regs[r] != want->regs[r])) {
+            regs[pairs * 2] = r * 4;
+            regs[pairs * 2 + 1] = cur->regs[r] = want->regs[r];
+            cb->known |= field;
+            pairs++;
+        }
+    }
+    if (pairs) {
+        emit(cb, MILO_CMD_SET_RENDER_STATE, regs, pairs * 2);
+        cb->stats.state_commands++;
+    }
+    if (changed(cb, FIELD_FS, set, cur->fs, want->fs, 2)) {
+        emit(cb, MILO_CMD_BIND_FRAGMENT_SHADER, want->fs, 2);
+    }
+    if (changed(cb, FIELD_VS, set, cur->vs, want->vs, 2)) {
+        emit(cb, MILO_CMD_BIND_VERTEX_SHADER, want->vs, 2);
+    }
+    for (uint32_t unit = 0; unit < VM_MAX_TEXTURES; unit++) {
+        if (changed(cb, FIELD_TEXTURE(unit), set, cur->textures[unit], want->textures[unit], 3)) {
+            const uint32_t *t = want->textures[unit];
+            uint32_t payload[4] = { unit, t[0], t[1], t[2] };
+            emit(cb, MILO_CMD_SET_TEXTURE, payload, 4);
+        }
+    }
+    if (changed(cb, FIELD_UNIFORMS, set, cur->uniforms, want->uniforms, 2)) {
+        emit(cb, MILO_CMD_SET_UNIFORM_BUFFER, want->uniforms, 2);
+    }
+    if (changed(cb, FIELD_VERTEX_BUFFER, set, cur->vertex_buffer, want->vertex_buffer, 2)) {
+        emit(cb, MILO_CMD_SET_VERTEX_BUFFER, want->vertex_buffer, 2);
+    }
+    if (changed(cb, FIELD_INDEX_BUFFER, set, cur->index_buffer, want->index_buffer, 2)) {
+        emit(cb, MILO_CMD_SET_INDEX_BUFFER, want->index_buffer, 2);
+    }
+    if (changed(cb, FIELD_VERTEX_LAYOUT, set, cur->vertex_layout, want->vertex_layout,
+                MILO_ATTR_COUNT)) {
+        emit(cb, MILO_CMD_SET_VERTEX_LAYOUT, want->vertex_layout, MILO_ATTR_COUNT);
+    }
+}
+
+static void record(milo_cmdbuf_t *cb, uint32_t field, uint32_t *want, const uint32_t *value,
+                   uint32_t n) {
+    memcpy(want, value, n * sizeof(uint32_t));
+    cb->set |= field;
+    cb->stats.state_calls++;
+}
+
+void milo_cmdbuf_bind_vertex_shader(milo_cmdbuf_t *cb, uint32_t addr, uint32_t bytes) {
+    const uint32_t v[2] = { addr, bytes };
+    record(cb, FIELD_VS, cb->want.vs, v, 2);
+}
+
+void milo_cmdbuf_bind_fragment_shader(milo_cmdbuf_t *cb, uint32_t addr, uint32_t bytes) {
+    const uint32_t v[2] = { addr, bytes };
+    record(cb, FIELD_FS, cb->want.fs, v, 2);
+}
+
+void milo_cmdbuf_set_texture(milo_cmdbuf_t *cb, uint32_t unit, uint32_t addr, uint32_t width,
+                             uint32_t height, uint32_t format) {
+    if (unit >= VM_MAX_TEXTURES) {
+        /* Not state the builder tracks: the processor faults on it */
+        const uint32_t payload[4] = { unit, addr, (width & 0xFFFF) | height << 16, format };
+        milo_cmdbuf_flush(cb);
+        emit(cb, MILO_CMD_SET_TEXTURE, payload, 4);
+        return;
+    }
+    const uint32_t v[3] = { addr, (width & 0xFFFF) | height << 16, format };
+    record(cb, FIELD_TEXTURE(unit), cb->want.textures[unit], v, 3);
+}
+
+void milo_cmdbuf_set_uniform_buffer(milo_cmdbuf_t *cb, uint32_t addr, uint32_t bytes) {
+    const uint32_t v[2] = { addr, bytes };
+    record(cb, FIELD_UNIFORMS, cb->want.uniforms, v, 2);
+}
+
+void milo_cmdbuf_set_vertex_buffer(milo_cmdbuf_t *cb, uint32_t addr, uint32_t stride) {
+    const uint32_t v[2] = { addr, stride };
+    record(cb, FIELD_VERTEX_BUFFER, cb->want.vertex_buffer, v, 2);
+}
+
+void milo_cmdbuf_set_vertex_layout(milo_cmdbuf_t *cb, uint32_t position, uint32_t texcoord,
+                                   uint32_t color, uint32_t normal) {
+    const uint32_t v[MILO_ATTR_COUNT] = { position, texcoord, color, normal };
+    record(cb, FIELD_VERTEX_LAYOUT, cb->want.vertex_layout, v, MILO_ATTR_COUNT);
+}
+
+void milo_cmdbuf_set_index_buffer(milo_cmdbuf_t *cb, uint32_t addr, milo_index_format_t format) {
+    const uint32_t v[2] = { addr, (uint32_t)format };
+    record(cb, FIELD_INDEX_BUFFER, cb->want.index_buffer, v, 2);
+}
+
+void milo_cmdbuf_set_render_state(milo_cmdbuf_t *cb, uint32_t reg, uint32_t value) {
+    if (reg % 4 != 0 || reg / 4 >= MILO_CMDBUF_REGS) {
+        const uint32_t payload[2] = { reg, value };
+        milo_cmdbuf_flush(cb);
+        emit(cb, MILO_CMD_SET_RENDER_STATE, payload, 2);
+        return;
+    }
+    record(cb, FIELD_REG(reg / 4), &cb->want.regs[reg / 4], &value, 1);
+}
+
+/*---------------------------------------------------------------------------
+ * Draws
+ *---------------------------------------------------------------------------*/
+
+static int compare_draws(const void *a, const void *b) {
+    const milo_cmdbuf_draw_t *da = a, *db = b;
+    int order = memcmp(&da->state, &db->state, sizeof(da->state));
+    if (order) return order;
+    return da->seq < db->seq ? -1 : da->seq > db->seq;
+}
+
+void milo_cmdbuf_flush(milo_cmdbuf_t *cb) {
+    if (cb->draw_count == 0) return;
+    qsort(cb->draws, cb->draw_count, sizeof(milo_cmdbuf_draw_t), compare_draws);
+    for (uint32_t i = 0; i < cb->draw_count; i++) {
+        const milo_cmdbuf_draw_t *d = &cb->draws[i];
+        emit_state(cb, &d->state, d->set);
+        emit(cb, d->op, d->args, d->length);
+    }
+    cb->draw_count = 0;
+    cb->stats.sorted_batches++;
+}
+
+void milo_cmdbuf_set_sort(milo_cmdbuf_t *cb, bool sort) {
+    milo_cmdbuf_flush(cb);
+    cb->sort = sort && cb->draw_cap > 0;
+}
+
+static void draw(milo_cmdbuf_t *cb, uint32_t op, uint32_t a, uint32_t b, milo_prim_t prim,
+                 uint32_t start) {
+    const uint32_t args[4] = { a, b, (uint32_t)prim, start };
+    uint32_t length = prim == MILO_PRIM_TRIANGLES && start == 0 ? 2 : 4;
+    cb->stats.draws++;
+    if (!cb->sort) {
+        emit_state(cb, &cb->want, cb->set);
+        emit(cb, op, args, length);
+        return;
+    }
+    if (cb->draw_count == cb->draw_cap) milo_cmdbuf_flush(cb);
+    milo_cmdbuf_draw_t *d = &cb->draws[cb->draw_count];
+    d->state = cb->want;
+    d->set = cb->set;
+    d->op = op;
+    memcpy(d->args, args, sizeof(args));
+    d->length = length;
+    d->seq = cb->draw_count++;
+}
+
+void milo_cmdbuf_draw(milo_cmdbuf_t *cb, uint32_t vertex_count, uint32_t instance_count) {
+    draw(cb, MILO_CMD_DRAW, vertex_count, instance_count, MILO_PRIM_TRIANGLES, 0);
+}
+
+void milo_cmdbuf_draw_indexed(milo_cmdbuf_t *cb, uint32_t index_count, uint32_t first_index) {
+    draw(cb, MILO_CMD_DRAW_INDEXED, index_count, first_index, MILO_PRIM_TRIANGLES, 0);
+}
+
+void milo_cmdbuf_draw_primitives(milo_cmdbuf_t *cb, milo_prim_t prim, uint32_t vertex_count,
+                                 uint32_t first_vertex) {
+    draw(cb, MILO_CMD_DRAW, vertex_count, 1, prim, first_vertex);
+}
+
+void milo_cmdbuf_draw_indexed_primitives(milo_cmdbuf_t *cb, milo_prim_t prim,
+                                         uint32_t index_count, uint32_t first_index,
+                                         uint32_t base_vertex) {
+    draw(cb, MILO_CMD_DRAW_INDEXED, index_count, first_index, prim, base_vertex);
+}
+
+/*---------------------------------------------------------------------------
+ * Target
+ *---------------------------------------------------------------------------*/
+
+void milo_cmdbuf_set_render_target(milo_cmdbuf_t *cb, uint32_t addr, uint32_t width,
+                                   uint32_t height) {
+    const uint32_t v[2] = { addr, (width & 0xFFFF) | height << 16 };
+    cb->stats.state_calls++;
+    if (cb->target_known && memcmp(cb->target, v, sizeof(v)) == 0) return;
+    milo_cmdbuf_flush(cb);
+    emit(cb, MILO_CMD_SET_RENDER_TARGET, v, 2);
+    cb->stats.state_commands++;
+    const uint32_t full[4] = { 0, 0, width & 0xFFFF, height };
+    memcpy(cb->target, v, sizeof(v));
+    memcpy(cb->viewport, full, sizeof(full));
+    memcpy(cb->scissor, full, sizeof(full));
+    cb->target_known = cb->viewport_known = cb->scissor_known = true;
+}
+
+static void set_rect(milo_cmdbuf_t *cb, uint32_t op, uint32_t *current, bool *known,
+                     int32_t x, int32_t y, int32_t width, int32_t height) {
+    const uint32_t v[4] = { (uint32_t)x, (uint32_t)y, (uint32_t)width, (uint32_t)height };
+    cb->stats.state_calls++;
+    if (*known && memcmp(current, v, sizeof(v)) == 0) return;
+    milo_cmdbuf_flush(cb);
+    emit(cb, op, v, 4);
+    cb->stats.state_commands++;
+    memcpy(current, v, sizeof(v));
+    *known = true;
+}
+
+void milo_cmdbuf_set_viewport(milo_cmdbuf_t *cb, int32_t x, int32_t y, int32_t width,
+                              int32_t height) {
+    set_rect(cb, MILO_CMD_SET_VIEWPORT, cb->viewport, &cb->viewport_known, x, y, width, height);
+}
+
+void milo_cmdbuf_set_scissor(milo_cmdbuf_t *cb, int32_t x, int32_t y, int32_t width,
+                             int32_t height) {
+    set_rect(cb, MILO_CMD_SET_SCISSOR, cb->scissor, &cb->scissor_known, x, y, width, height);
+}
+
+/*---------------------------------------------------------------------------
+ * Other Commands
+ *---------------------------------------------------------------------------*/
+
+void milo_cmdbuf_clear(milo_cmdbuf_t *cb, uint32_t flags, uint32_t color, uint32_t depth) {
+    const uint32_t payload[3] = { flags, color, depth };
+    milo_cmdbuf_flush(cb);
+    emit(cb, MILO_CMD_CLEAR, payload, 3);
+}
+
+void milo_cmdbuf_begin_tile_pass(milo_cmdbuf_t *cb) {
+    milo_cmdbuf_flush(cb);
+    emit(cb, MILO_CMD_BEGIN_TILE_PASS, NULL, 0);
+}
+
+void milo_cmdbuf_end_tile_pass(milo_cmdbuf_t *cb) {
+    milo_cmdbuf_flush(cb);
+    emit(cb, MILO_CMD_END_TILE_PASS, NULL, 0);
+}
+
+void milo_cmdbuf_fence(milo_cmdbuf_t *cb) {
+    milo_cmdbuf_flush(cb);
+    emit(cb, MILO_CMD_FENCE, NULL, 0);
+}
+
+void milo_cmdbuf_irq(milo_cmdbuf_t *cb, uint32_t code) {
+    milo_cmdbuf_flush(cb);
+    emit(cb, MILO_CMD_IRQ, &code, 1);
+}
+
+void milo_cmdbuf_call(milo_cmdbuf_t *cb, uint32_t addr) {
+    milo_cmdbuf_flush(cb);
+    emit_state(cb, &cb->want, cb->set);
+    emit(cb, MILO_CMD_CALL, &addr, 1);
+    forget(cb);
+}
+
+bool milo_cmdbuf_end(milo_cmdbuf_t *cb) {
+    milo_cmdbuf_flush(cb);
+    emit_state(cb, &cb->want, cb->set);
+    emit(cb, MILO_CMD_END, NULL, 0);
+    cb->open = false;
+    if (cb->overflow) {
+        cb->write = cb->start;
+        cb->stats.overflows++;
+        return false;
+    }
+    cb->stats.buffers++;
+    return true;
+}
+
+void milo_cmdbuf_report(const milo_cmdbuf_t *cb, FILE *out) {
+    const milo_cmdbuf_stats_t *s = &cb->stats;
+    double n = s->buffers ? (double)s->buffers : 1.0;
+    fprintf(out, "Command buffers: %llu, %.1f commands (%.0f bytes), %.1f draws per buffer\n",
+            (unsigned long long)s->buffers, s->commands / n, s->dwords * 4 / n, s->draws / n);
+    fprintf(out, "  state        %.1f of %.1f set and bind calls written, %.1f sorted batches\n",
+            s->state_commands / n, s->state_calls / n, s->sorted_batches / n);
+    fprintf(out, "  ring         %u bytes, %llu wraps, %llu overflows\n", cb->size * 4,
+            (unsigned long long)s->wraps, (unsigned long long)s->overflows);
+}
@@ -0,0 +1,180 @@
+/*
+ * milo_cmdbuf.h
+ * Milo832 Command Buffer Builder - Header
+ *
+ * The driver side of docs/command_model.md: the cmd_* calls of its
+ * examples as a library that writes command buffers for milo_cmd.h (or
+ * the RTL) straight into a ring of command memory the caller maps, with
+ * no allocation per command. It calls nothing but the C library, so it
+ * can run on the m65832 as well as on the host.
+ *
+ * A buffer runs from milo_cmdbuf_begin to milo_cmdbuf_end, which appends
+ * END; the processor executes it from the address begin returned. When a
+ * command does not fit before the end of the ring a JUMP takes the buffer
+ * back to its start, provided the processor has read that far: the caller
+ * hands over the processor's read pointer with milo_cmdbuf_retire. A
+ * buffer that runs into unread commands overflows, and end drops it.
+ *
+ * Draw state (shaders, textures, uniforms, buffers, render state
+ * registers) is written lazily: a set or bind call only records the
+ * value, and the next draw emits the values that differ from what the
+ * processor already holds, so repeated and overwritten settings never
+ * reach the ring. A CALL and the END emit what is recorded, so the
+ * called buffer and the next one find everything the caller set. What
+ * the processor holds is known from begin on, and forgotten at a CALL.
+ *
+ * In sort mode draws are held back, with the state they were issued
+ * with, until a command other than a draw or a state setting (or a full
+ * batch); they are then emitted ordered by that state, render state
+ * registers first, then the fragment and vertex shader, textures,
+ * uniforms, buffers and vertex layout, so that draws sharing state
+ * follow each other. Draws with the same state keep their order. Only
+ * draws whose order does not matter should be sorted: opaque, depth
+ * tested geometry.
+ */
+
+#ifndef MILO_CMDBUF_H
+#define MILO_CMDBUF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "milo_cmd.h"
+
+/*---------------------------------------------------------------------------
+ * State
+ *---------------------------------------------------------------------------*/
+
+#define MILO_CMDBUF_REGS        8       /* render_state_regs by offset / 4 */
+
+/* The draw state, in sort key order */
+typedef struct {
+    uint32_t regs[MILO_CMDBUF_REGS];
+    uint32_t fs[2];                     /* addr, bytes */
+    uint32_t vs[2];
+    uint32_t textures[VM_MAX_TEXTURES][3];  /* addr, width | height << 16, format */
+    uint32_t uniforms[2];               /* addr, bytes */
+    uint32_t vertex_buffer[2];          /* addr, stride */
+    uint32_t vertex_layout[MILO_ATTR_COUNT];    /* MILO_VERTEX_ATTR */
+    uint32_t index_buffer[2];           /* addr, format */
+} milo_cmdbuf_state_t;
+
+/* A held back draw */
+typedef struct {
+    milo_cmdbuf_state_t state;
+    uint32_t            set;            /* Fields of state the caller set */
+    uint32_t            op;             /* DRAW or DRAW_INDEXED */
+    uint32_t            args[4];
+    uint32_t            length;         /* Of args */
+    uint32_t            seq;
+} milo_cmdbuf_draw_t;
+
+typedef struct {
+    uint64_t buffers;                   /* Ended */
+    uint64_t commands;                  /* Written, JUMPs included */
+    uint64_t dwords;
+    uint64_t state_calls;               /* Set and bind calls */
+    uint64_t state_commands;            /* Commands they became */
+    uint64_t draws;
+    uint64_t sorted_batches;
+    uint64_t wraps;
+    uint64_t overflows;
+} milo_cmdbuf_stats_t;
+
+typedef struct {
+    /* Ring: size dwords at ring, which the processor sees at base */
+    uint32_t   *ring;
+    uint32_t    base;
+    uint32_t    size;
+    uint32_t    write;                  /* Next dword written */
+    uint32_t    read;                   /* Oldest dword not yet read */
+    uint32_t    start;                  /* The open buffer */
+    bool        open, overflow;
+    
+    /* What the caller set, and what the processor holds */
+    milo_cmdbuf_state_t want, current;
+    uint32_t    set, known;             /* Bit per state field */
+    uint32_t    target[2], viewport[4], scissor[4];
+    bool        target_known, viewport_known, scissor_known;
+    
+    /* Sort mode */
+    bool        sort;
+    milo_cmdbuf_draw_t *draws;
+    uint32_t    draw_count, draw_cap;
+    
+    milo_cmdbuf_stats_t stats;
+} milo_cmdbuf_t;
+
+/*---------------------------------------------------------------------------
+ * Ring
+ *---------------------------------------------------------------------------*/
+
+/* Build into the dwords dwords at ring, mapped at GPU address base (4
+ * byte aligned); sort_draws is how many draws sort mode holds back (0:
+ * no sorting). False if ring is too small or out of memory. */
+bool milo_cmdbuf_init(milo_cmdbuf_t *cb, uint32_t *ring, uint32_t base, uint32_t dwords,
+                      uint32_t sort_draws);
+void milo_cmdbuf_free(milo_cmdbuf_t *cb);
+
+/* Open a buffer; returns the address to execute it from */
+uint32_t milo_cmdbuf_begin(milo_cmdbuf_t *cb);
+
+/* Emit what is held back and END; false if the buffer overflowed, which
+ * drops it */
+bool milo_cmdbuf_end(milo_cmdbuf_t *cb);
+
+/* The processor has read up to read_addr (its CMD_READ_PTR, in the ring) */
+void milo_cmdbuf_retire(milo_cmdbuf_t *cb, uint32_t read_addr);
+
+/* Hold back and sort draws from here on; turning it off emits the batch */
+void milo_cmdbuf_set_sort(milo_cmdbuf_t *cb, bool sort);
+
+/* Emit the held back draws */
+void milo_cmdbuf_flush(milo_cmdbuf_t *cb);
+
+/*---------------------------------------------------------------------------
+ * Commands
+ *---------------------------------------------------------------------------*/
+
+/* Draw state, written lazily */
+void milo_cmdbuf_bind_vertex_shader(milo_cmdbuf_t *cb, uint32_t addr, uint32_t bytes);
+void milo_cmdbuf_bind_fragment_shader(milo_cmdbuf_t *cb, uint32_t addr, uint32_t bytes);
+void milo_cmdbuf_set_texture(milo_cmdbuf_t *cb, uint32_t unit, uint32_t addr, uint32_t width,
+                             uint32_t height, uint32_t format);
+void milo_cmdbuf_set_uniform_buffer(milo_cmdbuf_t *cb, uint32_t addr, uint32_t bytes);
+void milo_cmdbuf_set_vertex_buffer(milo_cmdbuf_t *cb, uint32_t addr, uint32_t stride);
+void milo_cmdbuf_set_vertex_layout(milo_cmdbuf_t *cb, uint32_t position, uint32_t texcoord,
+                                   uint32_t color, uint32_t normal);
+void milo_cmdbuf_set_index_buffer(milo_cmdbuf_t *cb, uint32_t addr, milo_index_format_t format);
+void milo_cmdbuf_set_render_state(milo_cmdbuf_t *cb, uint32_t reg, uint32_t value);
+
+/* Draws; those of triangle lists from vertex 0 take the short form */
+void milo_cmdbuf_draw(milo_cmdbuf_t *cb, uint32_t vertex_count, uint32_t instance_count);
+void milo_cmdbuf_draw_indexed(milo_cmdbuf_t *cb, uint32_t index_count, uint32_t first_index);
+void milo_cmdbuf_draw_primitives(milo_cmdbuf_t *cb, milo_prim_t prim, uint32_t vertex_count,
+                                 uint32_t first_vertex);
+void milo_cmdbuf_draw_indexed_primitives(milo_cmdbuf_t *cb, milo_prim_t prim,
+                                         uint32_t index_count, uint32_t first_index,
+                                         uint32_t base_vertex);
+
+/* Target state, dropped when it repeats; a new target resets the
+ * viewport and scissor to the whole of it, as the processor does */
+void milo_cmdbuf_set_render_target(milo_cmdbuf_t *cb, uint32_t addr, uint32_t width,
+                                   uint32_t height);
+void milo_cmdbuf_set_viewport(milo_cmdbuf_t *cb, int32_t x, int32_t y, int32_t width,
+                              int32_t height);
+void milo_cmdbuf_set_scissor(milo_cmdbuf_t *cb, int32_t x, int32_t y, int32_t width,
+                             int32_t height);
+
+/* Everything else, as written */
+void milo_cmdbuf_clear(milo_cmdbuf_t *cb, uint32_t flags, uint32_t color, uint32_t depth);
+void milo_cmdbuf_begin_tile_pass(milo_cmdbuf_t *cb);
+void milo_cmdbuf_end_tile_pass(milo_cmdbuf_t *cb);
+void milo_cmdbuf_fence(milo_cmdbuf_t *cb);
+void milo_cmdbuf_irq(milo_cmdbuf_t *cb, uint32_t code);
+void milo_cmdbuf_call(milo_cmdbuf_t *cb, uint32_t addr);
+
+/* Print the counters, per buffer */
+void milo_cmdbuf_report(const milo_cmdbuf_t *cb, FILE *out);
+
+#endif /* MILO_CMDBUF_H */
@@ -0,0 +1,218 @@
+/*
+ * milo_fetch.c
+ * Milo832 Vertex Fetch and Primitive Assembly - Implementation
+ */
+
+#include "milo_fetch.h"
+#include <string.h>
+
+/*---------------------------------------------------------------------------
+ * Primitives and Indices
+ *---------------------------------------------------------------------------*/
+
+uint32_t milo_fetch_index_size(milo_index_format_t format) {
+    return format == MILO_INDEX_U8 ? 1 : format == MILO_INDEX_U16 ? 2 : 4;
+}
+
+void milo_fetch_indices(const uint8_t *src, milo_index_format_t format, uint32_t count,
+                        uint32_t base_vertex, uint32_t *indices) {
+    if (format == MILO_INDEX_U8) {
+        for (uint32_t i = 0; i < count; i++) indices[i] = base_vertex + src[i];
+    } else if (format == MILO_INDEX_U16) {
+        for (uint32_t i = 0; i < count; i++) {
+            uint16_t index;
+            memcpy(&index, src + (size_t)i * 2, 2);
+            indices[i] = base_vertex + index;
+        }
+    } else {
+        memcpy(indices, src, (size_t)count * 4);
+        if (base_vertex) {
+            for (uint32_t i = 0; i < count; i++) indices[i] += base_vertex;
+        }
+    }
+}
+
+uint32_t milo_assemble(milo_prim_t prim, const uint32_t *indices, uint32_t count,
+                       bool use_restart, uint32_t restart, uint32_t *tris) {
+    uint32_t n = 0;
+    uint32_t held = 0;                  /* Vertices held: v[0], v[1] */
+    uint32_t v[2] = { 0, 0 };
+    uint32_t strip = 0;                 /* Triangles of the strip so far */
+    
+    if (prim != MILO_PRIM_TRIANGLES && prim != MILO_PRIM_TRIANGLE_STRIP &&
+        prim != MILO_PRIM_TRIANGLE_FAN) {
+        return 0;
+    }
+    if (prim == MILO_PRIM_TRIANGLES && !use_restart) {
+        count -= count % 3;
+        if (tris != indices) memmove(tris, indices, (size_t)count * sizeof(uint32_t));
+        return count;
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t index = indices[i];
+        if (use_restart && index == restart) {
+            held = strip = 0;
+            continue;
+        }
+        switch (prim) {
+            case MILO_PRIM_TRIANGLES:
+                if (held < 2) {
+                    v[held++] = index;
+                    break;
+                }
+                tris[n++] = v[0];
+                tris[n++] = v[1];
+                tris[n++] = index;
+                held = 0;
+                break;
+            case MILO_PRIM_TRIANGLE_STRIP:
+                if (held < 2) {
+                    v[held++] = index;
+                    break;
+                }
+                /* Odd triangles swap their first two vertices to keep the
+                 * winding of the first */
+                tris[n++] = v[strip & 1];
+                tris[n++] = v[~strip & 1];
+                tris[n++] = index;
+                v[0] = v[1];
+                v[1] = index;
+                strip++;
+                break;
+            default:
+                /* Fan: v[0] is the hub, v[1] the previous spoke */
+                if (held < 2) {
+                    v[held++] = index;
+                    break;
+                }
+                tris[n++] = v[0];
+                tris[n++] = v[1];
+                tris[n++] = index;
+                v[1] = index;
+                break;
+        }
+    }
+    return n;
+}
+
+/*---------------------------------------------------------------------------
+ * Vertex Layout
+ *---------------------------------------------------------------------------*/
+
+/* First input register row and component count of each attribute */
+static const uint32_t attr_row[MILO_ATTR_COUNT] = { 0, 3, 5, 9 };
+static const uint32_t attr_comps[MILO_ATTR_COUNT] = { 3, 2, 4, 3 };
+static const float attr_default[MILO_ATTR_COUNT] = { 0.0f, 0.0f, 1.0f, 0.0f };
+
+void milo_fetch_default_layout(milo_vertex_layout_t *layout) {
+    memset(layout, 0, sizeof(*layout));
+    layout->stride = 32;
+    layout->attrs[MILO_ATTR_POSITION] = (milo_vertex_attr_t){ 0, MILO_FMT_FLOAT3 };
+    layout->attrs[MILO_ATTR_TEXCOORD] = (milo_vertex_attr_t){ 12, MILO_FMT_FLOAT2 };
+    layout->attrs[MILO_ATTR_NORMAL] = (milo_vertex_attr_t){ 20, MILO_FMT_FLOAT3 };
+}
+
+uint32_t milo_fetch_format_size(milo_attr_format_t format) {
+    switch (format) {
+        case MILO_FMT_FLOAT1:       return 4;
+        case MILO_FMT_FLOAT2:       return 8;
+        case MILO_FMT_FLOAT3:       return 12;
+        case MILO_FMT_FLOAT4:       return 16;
+        case MILO_FMT_UNORM8X4:
+        case MILO_FMT_UNORM16X2:
+        case MILO_FMT_SNORM16X2:    return 4;
+        case MILO_FMT_SNORM16X4:    return 8;
+        default:                    return 0;
+    }
+}
+
+uint32_t milo_fetch_vertex_span(const milo_vertex_layout_t *layout) {
+    uint32_t span = 0;
+    for (int a = 0; a < MILO_ATTR_COUNT; a++) {
+        const milo_vertex_attr_t *attr = &layout->attrs[a];
+        uint32_t size = milo_fetch_format_size(attr->format);
+        if (size && attr->offset + size > span) span = attr->offset + size;
+    }
+    return span;
+}
+
+bool milo_fetch_layout_valid(const milo_vertex_layout_t *layout) {
+    bool enabled = false;
+    if (layout->stride == 0 || layout->stride % 4 != 0) return false;
+    for (int a = 0; a < MILO_ATTR_COUNT; a++) {
+        const milo_vertex_attr_t *attr = &layout->attrs[a];
+        if ((uint32_t)attr->format >= MILO_FMT_COUNT) return false;
+        if (attr->format == MILO_FMT_NONE) continue;
+        if (attr->offset % 4 != 0 ||
+            (uint64_t)attr->offset + milo_fetch_format_size(attr->format) > layout->stride) {
+            return false;
+        }
+        enabled = true;
+    }
+    return enabled;
+}
+
+/*---------------------------------------------------------------------------
+ * Fetch
+ *---------------------------------------------------------------------------*/
+
+/* Decode one attribute at p into c; returns the components it has */
+static uint32_t decode(milo_attr_format_t format, const uint8_t *p, float c[4]) {
+    switch (format) {
+        case MILO_FMT_FLOAT1:
+        case MILO_FMT_FLOAT2:
+        case MILO_FMT_FLOAT3:
+        case MILO_FMT_FLOAT4: {
+            uint32_t n = format - MILO_FMT_FLOAT1 + 1;
+            memcpy(c, p, n * sizeof(float));
+            return n;
+        }
+        case MILO_FMT_UNORM8X4: {
+            uint32_t word;
+            memcpy(&word, p, 4);
+            for (int i = 0; i < 4; i++) c[i] = (float)((word >> (24 - 8 * i)) & 0xFF) / 255.0f;
+            return 4;
+        }
+        case MILO_FMT_UNORM16X2: {
+            uint16_t h[2];
+            memcpy(h, p, 4);
+            for (int i = 0; i < 2; i++) c[i] = (float)h[i] / 65535.0f;
+            return 2;
+        }
+        case MILO_FMT_SNORM16X2:
+        case MILO_FMT_SNORM16X4: {
+            uint32_t n = format == MILO_FMT_SNORM16X2 ? 2 : 4;
+            int16_t h[4];
+            memcpy(h, p, n * 2);
+            for (uint32_t i = 0; i < n; i++) {
+                float f = (float)h[i] / 32767.0f;
+                c[i] = f < -1.0f ? -1.0f : f;
+            }
+            return n;
+        }
+        default:
+            return 0;
+    }
+}
+
+void milo_fetch_warp(const milo_vertex_layout_t *layout, const uint8_t *vertices,
+                     const uint32_t *indices, uint32_t first, uint32_t count,
+                     milo_vertex_warp_t *warp) {
+    if (count > MILO_VERTEX_WARP) count = MILO_VERTEX_WARP;
+    warp->count = count;
+    for (int a = 0; a < MILO_ATTR_COUNT; a++) {
+        const milo_vertex_attr_t *attr = &layout->attrs[a];
+        uint32_t row = attr_row[a], comps = attr_comps[a];
+        const uint8_t *base = vertices + attr->offset;
+        for (uint32_t lane = 0; lane < count; lane++) {
+            float c[4];
+            uint32_t index = indices ? indices[lane] : first + lane;
+            uint32_t n = attr->format == MILO_FMT_NONE ? 0 :
+                         decode(attr->format, base + (size_t)index * layout->stride, c);
+            for (uint32_t i = 0; i < comps; i++) {
+                warp->in[row + i][lane] = i < n ? c[i] : attr_default[a];
+            }
+        }
+    }
+}
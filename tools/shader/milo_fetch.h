@@ -0,0 +1,130 @@
+/*
+ * milo_fetch.h
+ * Milo832 Vertex Fetch and Primitive Assembly - Header
+ *
+ * Host model of vertex_fetch.vhd and primitive_assembly.vhd. Indices are
+ * read in any of the index formats with the base vertex added, vertices
+ * are decoded from an arbitrary layout (stride, and an offset and format
+ * per attribute) straight out of the buffer into the lanes of a warp, one
+ * array per input register, which milo_vm_exec_vertex_warp shades in
+ * place. Nothing is staged on the way: the only copy of a vertex the
+ * pipeline makes is the decoded warp.
+ *
+ * Primitive assembly turns the indices of a draw into a triangle list
+ * as the RTL does: strips alternate their winding back to that of the
+ * first triangle, fans share the first vertex, and a restart index
+ * starts a new strip or fan. Points and lines are fetched and shaded
+ * but make no triangles; the RTL has no rasterizer for them either.
+ */
+
+#ifndef MILO_FETCH_H
+#define MILO_FETCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "milo_vm.h"
+
+/*---------------------------------------------------------------------------
+ * Primitives and Indices
+ *---------------------------------------------------------------------------*/
+
+/* prim_type of primitive_assembly.vhd */
+typedef enum {
+    MILO_PRIM_TRIANGLES,
+    MILO_PRIM_TRIANGLE_STRIP,
+    MILO_PRIM_TRIANGLE_FAN,
+    MILO_PRIM_POINTS,                   /* Not rasterized */
+    MILO_PRIM_LINES,                    /* Not rasterized */
+    MILO_PRIM_COUNT
+} milo_prim_t;
+
+/* Index formats (idx_buf_format of vertex_fetch.vhd) */
+typedef enum {
+    MILO_INDEX_U8,
+    MILO_INDEX_U16,
+    MILO_INDEX_U32,
+    MILO_INDEX_COUNT
+} milo_index_format_t;
+
+/* Bytes per index */
+uint32_t milo_fetch_index_size(milo_index_format_t format);
+
+/* Read count indices of format at src (any alignment), base_vertex
+ * added to each */
+void milo_fetch_indices(const uint8_t *src, milo_index_format_t format, uint32_t count,
+                        uint32_t base_vertex, uint32_t *indices);
+
+/* Assemble count vertex indices of prim into the triangle list tris,
+ * which needs room for 3 * count indices; an index equal to restart
+ * ends the strip or fan when use_restart is set. Returns the indices
+ * written, a multiple of 3. tris may be indices for MILO_PRIM_TRIANGLES
+ * only. */
+uint32_t milo_assemble(milo_prim_t prim, const uint32_t *indices, uint32_t count,
+                       bool use_restart, uint32_t restart, uint32_t *tris);
+
+/*---------------------------------------------------------------------------
+ * Vertex Layout
+ *---------------------------------------------------------------------------*/
+
+/* Attributes, in the order of the vertex shader input registers */
+typedef enum {
+    MILO_ATTR_POSITION,                 /* r2-r4, default 0 */
+    MILO_ATTR_TEXCOORD,                 /* r5-r6, default 0 */
+    MILO_ATTR_COLOR,                    /* r7-r10, default opaque white */
+    MILO_ATTR_NORMAL,                   /* r11-r13, default 0 */
+    MILO_ATTR_COUNT
+} milo_attr_t;
+
+/* Attribute formats; components past those of the attribute are not
+ * read, and those the format lacks take the default */
+typedef enum {
+    MILO_FMT_NONE,                      /* Not fetched (attr_enable clear) */
+    MILO_FMT_FLOAT1,
+    MILO_FMT_FLOAT2,
+    MILO_FMT_FLOAT3,
+    MILO_FMT_FLOAT4,
+    MILO_FMT_UNORM8X4,                  /* 0xRRGGBBAA word, as the RTL reads
+                                         * color */
+    MILO_FMT_UNORM16X2,
+    MILO_FMT_SNORM16X2,
+    MILO_FMT_SNORM16X4,
+    MILO_FMT_COUNT
+} milo_attr_format_t;
+
+typedef struct {
+    uint32_t            offset;         /* Bytes into the vertex */
+    milo_attr_format_t  format;
+} milo_vertex_attr_t;
+
+typedef struct {
+    uint32_t            stride;
+    milo_vertex_attr_t  attrs[MILO_ATTR_COUNT];
+} milo_vertex_layout_t;
+
+/* The layout of milo_gpu_upload_vertices: position, texture coordinates
+ * and normal as floats in 32 bytes, no color */
+void milo_fetch_default_layout(milo_vertex_layout_t *layout);
+
+/* Bytes a format reads (0 for NONE), and bytes from the start of a
+ * vertex to the end of its last attribute */
+uint32_t milo_fetch_format_size(milo_attr_format_t format);
+uint32_t milo_fetch_vertex_span(const milo_vertex_layout_t *layout);
+
+/* Whether the vertex unit can fetch the layout: at least one attribute,
+ * known formats at offsets and a nonzero stride that are multiples of 4,
+ * within the stride */
+bool milo_fetch_layout_valid(const milo_vertex_layout_t *layout);
+
+/*---------------------------------------------------------------------------
+ * Fetch
+ *---------------------------------------------------------------------------*/
+
+/* Decode count (at most MILO_VERTEX_WARP) vertices of a valid layout
+ * from the buffer at vertices into warp: those of the given indices, or
+ * the sequence from first when indices is NULL. The caller checks that
+ * they lie inside the buffer. */
+void milo_fetch_warp(const milo_vertex_layout_t *layout, const uint8_t *vertices,
+                     const uint32_t *indices, uint32_t first, uint32_t count,
+                     milo_vertex_warp_t *warp);
+
+#endif /* MILO_FETCH_H */
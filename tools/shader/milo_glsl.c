@@ -10,6 +10,68 @@
 #include <ctype.h>
 #include <stdarg.h>
 
+/*---------------------------------------------------------------------------
+ * Arena Allocator
+ *---------------------------------------------------------------------------*/
+
+#define ARENA_ALIGN  16
+#define ARENA_HEADER ((sizeof(milo_arena_block_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static milo_arena_block_t *arena_new_block(milo_arena_t *a, size_t min_size) {
+    size_t size = min_size > MILO_ARENA_BLOCK_SIZE ? min_size : MILO_ARENA_BLOCK_SIZE;
+    milo_arena_block_t *b = malloc(ARENA_HEADER + size);
+    if (!b) return NULL;
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    a->reserved += size;
+    return b;
+}
+
+static void *arena_alloc(milo_arena_t *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    
+    milo_arena_block_t *b = a->current;
+    if (!b || b->size - b->used < size) {
+        /* Reuse the next retained block if it fits, else chain a new one */
+        if (b && b->next && b->next->size >= size) {
+            b = b->next;
+        } else {
+            milo_arena_block_t *nb = arena_new_block(a, size);
+            if (!nb) return NULL;
+            if (b) {
+                nb->next = b->next;
+                b->next = nb;
+            } else {
+                a->first = nb;
+            }
+            b = nb;
+        }
+        b->used = 0;
+        a->current = b;
+    }
+    
+    void *p = (char *)b + ARENA_HEADER + b->used;
+    b->used += size;
+    return p;
+}
+
+/* Release everything allocated so far; blocks are kept for reuse */
+static void arena_reset(milo_arena_t *a) {
+    a->current = a->first;
+    if (a->first) a->first->used = 0;
+}
+
+static void arena_free(milo_arena_t *a) {
+    milo_arena_block_t *b = a->first;
+    while (b) {
+        milo_arena_block_t *next = b->next;
+        free(b);
+        b = next;
+    }
+    memset(a, 0, sizeof(*a));
+}
+
 /*---------------------------------------------------------------------------
  * Error Reporting
  *---------------------------------------------------------------------------*/
@@ -23,8 +85,15 @@ static void error(milo_compiler_t *c, const char *fmt, ...) {
     vsnprintf(buf, sizeof(buf), fmt, args);
     va_end(args);
     
-    snprintf(c->errors[c->error_count], 256, "Line %d: %s", c->line, buf);
-    c->error_count++;
+    char line[256];
+    int n = snprintf(line, sizeof(line), "Line %d: %s", c->line, buf);
+    char *msg = arena_alloc(&c->arena, (size_t)n + 1);
+    if (msg) {
+        memcpy(msg, line, (size_t)n + 1);
+        c->errors[c->error_count++] = msg;
+    } else {
+        c->errors[c->error_count++] = "Out of memory";
+    }
 }
 
 /*---------------------------------------------------------------------------
@@ -69,7 +138,7 @@ static milo_token_t make_token(milo_compiler_t *c, milo_token_type_t type, const
 
 static milo_token_type_t check_keyword(const char *start, int len) {
     static const struct { const char *kw; milo_token_type_t type; } keywords[] = {
-        {"void", TOK_VOID}, {"float", TOK_FLOAT}, {"int", TOK_INT},
+        {"void", TOK_VOID}, {"float", TOK_FLOAT}, {"int", TOK_INT}, {"bool", TOK_BOOL},
         {"vec2", TOK_VEC2}, {"vec3", TOK_VEC3}, {"vec4", TOK_VEC4},
         {"mat3", TOK_MAT3}, {"mat4", TOK_MAT4}, {"sampler2D", TOK_SAMPLER2D},
         {"in", TOK_IN}, {"out", TOK_OUT}, {"uniform", TOK_UNIFORM},
@@ -80,6 +149,7 @@ static milo_token_type_t check_keyword(const char *start, int len) {
         {"precision", TOK_PRECISION}, {"highp", TOK_HIGHP},
         {"mediump", TOK_MEDIUMP}, {"lowp", TOK_LOWP},
         {"layout", TOK_LAYOUT}, {"location", TOK_LOCATION},
+        {"constant_id", TOK_CONSTANT_ID},
         {NULL, TOK_EOF}
     };
     
@@ -225,11 +295,12 @@ static bool expect(milo_compiler_t *c, milo_token_type_t type, const char *msg)
  *---------------------------------------------------------------------------*/
 
 static milo_node_t *alloc_node(milo_compiler_t *c, milo_node_type_t type) {
-    milo_node_t *node = calloc(1, sizeof(milo_node_t));
+    milo_node_t *node = arena_alloc(&c->arena, sizeof(milo_node_t));
     if (!node) {
         error(c, "Out of memory");
         return NULL;
     }
+    memset(node, 0, sizeof(*node));
     node->type = type;
     node->line = c->current_token.line;
     return node;
@@ -255,6 +326,7 @@ static milo_type_t parse_type(milo_compiler_t *c) {
         case TOK_VOID:      return TYPE_VOID;
         case TOK_FLOAT:     return TYPE_FLOAT;
         case TOK_INT:       return TYPE_INT;
+        case TOK_BOOL:      return TYPE_BOOL;
         case TOK_VEC2:      return TYPE_VEC2;
         case TOK_VEC3:      return TYPE_VEC3;
         case TOK_VEC4:      return TYPE_VEC4;
@@ -268,7 +340,7 @@ static milo_type_t parse_type(milo_compiler_t *c) {
 }
 
 static bool is_type_token(milo_token_type_t t) {
-    return t == TOK_VOID || t == TOK_FLOAT || t == TOK_INT ||
+    return t == TOK_VOID || t == TOK_FLOAT || t == TOK_INT || t == TOK_BOOL ||
            t == TOK_VEC2 || t == TOK_VEC3 || t == TOK_VEC4 ||
            t == TOK_MAT3 || t == TOK_MAT4 || t == TOK_SAMPLER2D;
 }
@@ -526,6 +598,7 @@ static milo_node_t *parse_var_decl(milo_compiler_t *c, bool is_uniform, bool is_
     node->var_decl.is_in = is_in;
     node->var_decl.is_out = is_out;
     node->var_decl.location = location;
+    node->var_decl.spec_id = -1;
     advance(c);
     
     if (match(c, TOK_ASSIGN)) {
@@ -729,6 +802,7 @@ static void parse_program(milo_compiler_t *c) {
     while (!check(c, TOK_EOF)) {
         milo_node_t *decl = NULL;
         int location = -1;
+        int spec_id = -1;
         
         /* Skip #version and precision */
         if (match(c, TOK_HASH)) {
@@ -748,16 +822,25 @@ static void parse_program(milo_compiler_t *c) {
             continue;
         }
         
-        /* layout(location = N) */
+        /* layout(location = N) / layout(constant_id = N) */
         if (match(c, TOK_LAYOUT)) {
             expect(c, TOK_LPAREN, "'('");
-            if (match(c, TOK_LOCATION)) {
+            do {
+                int *slot = NULL;
+                if (match(c, TOK_LOCATION)) {
+                    slot = &location;
+                } else if (match(c, TOK_CONSTANT_ID)) {
+                    slot = &spec_id;
+                } else {
+                    error(c, "Expected layout qualifier");
+                    break;
+                }
                 expect(c, TOK_ASSIGN, "'='");
                 if (check(c, TOK_INT_LIT)) {
-                    location = c->current_token.int_val;
+                    *slot = c->current_token.int_val;
                     advance(c);
                 }
-            }
+            } while (match(c, TOK_COMMA));
             expect(c, TOK_RPAREN, "')'");
         }
         
@@ -766,7 +849,10 @@ static void parse_program(milo_compiler_t *c) {
         bool is_in = match(c, TOK_IN);
         bool is_out = match(c, TOK_OUT);
         bool is_const = match(c, TOK_CONST);
-        (void)is_const;  /* TODO: handle const */
+        
+        if (spec_id >= 0 && !is_const) {
+            error(c, "constant_id requires a const declaration");
+        }
         
         if (is_type_token(c->current_token.type)) {
             /* Check if function or variable */
@@ -792,6 +878,13 @@ static void parse_program(milo_compiler_t *c) {
                 decl = parse_function(c);
             } else {
                 decl = parse_var_decl(c, is_uniform, is_in, is_out, location);
+                if (decl) {
+                    decl->var_decl.is_const = is_const;
+                    decl->var_decl.spec_id = spec_id;
+                    if (is_const && !decl->var_decl.init) {
+                        error(c, "const '%s' requires an initializer", decl->var_decl.name);
+                    }
+                }
             }
         } else {
             error(c, "Expected declaration");
@@ -811,16 +904,274 @@ static void parse_program(milo_compiler_t *c) {
  * Code Generation
  *---------------------------------------------------------------------------*/
 
-static void emit(milo_compiler_t *c, const char *fmt, ...) {
-    if (c->code_count >= MILO_MAX_CODE) {
-        error(c, "Code too large");
-        return;
+/* Grow a generated-code array to hold at least need elements */
+static void *grow_array(milo_compiler_t *c, void *buf, int *capacity, int need, size_t elem) {
+    if (need <= *capacity) return buf;
+    
+    int cap = *capacity ? *capacity : 64;
+    while (cap < need) cap *= 2;
+    void *p = realloc(buf, (size_t)cap * elem);
+    if (!p) {
+        error(c, "Out of memory");
+        return NULL;
+    }
+    *capacity = cap;
+    return p;
+}
+
+/* Append formatted text to the listing */
+static void listing_vappend(milo_compiler_t *c, const char *fmt, va_list args) {
+    for (;;) {
+        size_t avail = c->listing_capacity - c->listing_len;
+        if (avail > 0) {
+            va_list copy;
+            va_copy(copy, args);
+            int n = vsnprintf(c->listing + c->listing_len, avail, fmt, copy);
+            va_end(copy);
+            if (n < 0) return;
+            if ((size_t)n < avail) {
+                c->listing_len += n;
+                return;
+            }
+        }
+        
+        size_t cap = c->listing_capacity ? c->listing_capacity * 2 : 4096;
+        char *p = realloc(c->listing, cap);
+        if (!p) {
+            error(c, "Out of memory");
+            return;
+        }
+        c->listing = p;
+        c->listing_capacity = cap;
     }
+}
+
+static void listing_append(milo_compiler_t *c, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    listing_vappend(c, fmt, args);
+    va_end(args);
+}
+
+/* Listing-only line (comments, blank lines, function labels) */
+static void emit_text(milo_compiler_t *c, const char *fmt, ...) {
+    if (!c->listing_enabled) return;
     va_list args;
     va_start(args, fmt);
-    vsnprintf(c->code[c->code_count], 128, fmt, args);
+    listing_vappend(c, fmt, args);
     va_end(args);
-    c->code_count++;
+    listing_append(c, "\n");
+}
+
+/* Attach a trailing comment to the last listing line */
+static void annotate(milo_compiler_t *c, const char *fmt, ...) {
+    if (!c->listing_enabled || c->listing_len == 0) return;
+    c->listing_len--;  /* Drop newline */
+    listing_append(c, "  ; ");
+    va_list args;
+    va_start(args, fmt);
+    listing_vappend(c, fmt, args);
+    va_end(args);
+    listing_append(c, "\n");
+}
+
+static uint8_t reg_field(milo_compiler_t *c, int r) {
+    if (r < 0 || r > 63) {
+        error(c, "Out of registers (r%d)", r);
+        return 0;
+    }
+    return (uint8_t)r;
+}
+
+static void emit_inst(milo_compiler_t *c, const milo_inst_t *inst) {
+    if (c->code_count >= MILO_MAX_CODE) {
+        error(c, "Code too large");
+        return;
+    }
+    uint64_t *code = grow_array(c, c->code, &c->code_capacity,
+                                c->code_count + 1, sizeof(uint64_t));
+    if (!code) return;
+    c->code = code;
+    int *lines = grow_array(c, c->code_lines, &c->line_capacity,
+                            c->code_count + 1, sizeof(int));
+    if (!lines) return;
+    c->code_lines = lines;
+    c->code_lines[c->code_count] = c->gen_line;
+    c->code[c->code_count++] = milo_encode_inst(inst);
+}
+
+static void emit_op(milo_compiler_t *c, uint8_t opcode, const char *mn) {
+    milo_inst_t inst = {0};
+    inst.opcode = opcode;
+    emit_inst(c, &inst);
+    if (c->listing_enabled) listing_append(c, "    %s\n", mn);
+}
+
+static void emit_rr(milo_compiler_t *c, uint8_t opcode, const char *mn, int rd, int rs1) {
+    milo_inst_t inst = {0};
+    inst.opcode = opcode;
+    inst.rd = reg_field(c, rd);
+    inst.rs1 = reg_field(c, rs1);
+    emit_inst(c, &inst);
+    if (c->listing_enabled) listing_append(c, "    %s r%d, r%d\n", mn, rd, rs1);
+}
+
+static void emit_rrr(milo_compiler_t *c, uint8_t opcode, const char *mn,
+                     int rd, int rs1, int rs2) {
+    milo_inst_t inst = {0};
+    inst.opcode = opcode;
+    inst.rd = reg_field(c, rd);
+    inst.rs1 = reg_field(c, rs1);
+    inst.rs2 = reg_field(c, rs2);
+    emit_inst(c, &inst);
+    if (c->listing_enabled) listing_append(c, "    %s r%d, r%d, r%d\n", mn, rd, rs1, rs2);
+}
+
+static void emit_rrrr(milo_compiler_t *c, uint8_t opcode, const char *mn,
+                      int rd, int rs1, int rs2, int rs3) {
+    milo_inst_t inst = {0};
+    inst.opcode = opcode;
+    inst.rd = reg_field(c, rd);
+    inst.rs1 = reg_field(c, rs1);
+    inst.rs2 = reg_field(c, rs2);
+    inst.rs3 = reg_field(c, rs3);
+    inst.has_rs3 = true;
+    emit_inst(c, &inst);
+    if (c->listing_enabled) {
+        listing_append(c, "    %s r%d, r%d, r%d, r%d\n", mn, rd, rs1, rs2, rs3);
+    }
+}
+
+static void emit_rri(milo_compiler_t *c, uint8_t opcode, const char *mn,
+                     int rd, int rs1, int32_t imm) {
+    milo_inst_t inst = {0};
+    inst.opcode = opcode;
+    inst.rd = reg_field(c, rd);
+    inst.rs1 = reg_field(c, rs1);
+    inst.imm = (uint32_t)imm;
+    inst.has_imm = true;
+    emit_inst(c, &inst);
+    if (c->listing_enabled) listing_append(c, "    %s r%d, r%d, %d\n", mn, rd, rs1, imm);
+}
+
+/* Branch to label; rs < 0 for the unconditional forms (bra, ssy) */
+static void emit_branch(milo_compiler_t *c, uint8_t opcode, const char *mn, int rs, int label) {
+    milo_fixup_t *fixups = grow_array(c, c->fixups, &c->fixup_capacity,
+                                      c->fixup_count + 1, sizeof(milo_fixup_t));
+    if (!fixups) return;
+    c->fixups = fixups;
+    c->fixups[c->fixup_count].address = c->code_count;
+    c->fixups[c->fixup_count].label = label;
+    c->fixup_count++;
+    
+    milo_inst_t inst = {0};
+    inst.opcode = opcode;
+    inst.has_imm = true;
+    if (rs >= 0) inst.rd = reg_field(c, rs);
+    emit_inst(c, &inst);
+    
+    if (!c->listing_enabled) return;
+    if (rs >= 0) listing_append(c, "    %s r%d, r0, L%d\n", mn, rs, label);
+    else listing_append(c, "    %s L%d\n", mn, label);
+}
+
+static void emit_label(milo_compiler_t *c, int label) {
+    c->label_addr[label] = c->code_count;
+    if (c->listing_enabled) listing_append(c, "L%d:\n", label);
+}
+
+/* Patch branch targets. As in milo_asm_resolve, the label address
+ * replaces the whole low word of the instruction. */
+static void resolve_labels(milo_compiler_t *c) {
+    for (int i = 0; i < c->fixup_count; i++) {
+        const milo_fixup_t *f = &c->fixups[i];
+        int addr = c->label_addr[f->label];
+        if (addr < 0) {
+            error(c, "Undefined label: L%d", f->label);
+            continue;
+        }
+        uint64_t word = c->code[f->address];
+        c->code[f->address] = (word & 0xFFFFFFFF00000000ULL) | (uint32_t)addr;
+    }
+}
+
+/*---------------------------------------------------------------------------
+ * Symbol Table
+ *---------------------------------------------------------------------------*/
+
+static uint32_t hash_name(const char *name) {
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (uint8_t)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void symtab_clear(milo_symtab_t *t) {
+    t->count = 0;
+    if (t->buckets) memset(t->buckets, 0, t->bucket_count * sizeof(int));
+}
+
+static void symtab_free(milo_symtab_t *t) {
+    free(t->symbols);
+    free(t->buckets);
+    memset(t, 0, sizeof(*t));
+}
+
+/* Index symbol i unless an earlier symbol already has its name */
+static void symtab_index(milo_symtab_t *t, int i) {
+    uint32_t mask = t->bucket_count - 1;
+    for (uint32_t b = hash_name(t->symbols[i].name) & mask; ; b = (b + 1) & mask) {
+        int slot = t->buckets[b];
+        if (slot == 0) {
+            t->buckets[b] = i + 1;
+            return;
+        }
+        if (strcmp(t->symbols[slot - 1].name, t->symbols[i].name) == 0) return;
+    }
+}
+
+static milo_symbol_t *find_symbol(milo_compiler_t *c, const char *name) {
+    milo_symtab_t *t = &c->symtab;
+    if (t->bucket_count == 0) return NULL;
+    
+    uint32_t mask = t->bucket_count - 1;
+    for (uint32_t b = hash_name(name) & mask; t->buckets[b]; b = (b + 1) & mask) {
+        milo_symbol_t *sym = &t->symbols[t->buckets[b] - 1];
+        if (strcmp(sym->name, name) == 0) return sym;
+    }
+    return NULL;
+}
+
+/* Append a zeroed symbol named name */
+static milo_symbol_t *add_symbol(milo_compiler_t *c, const char *name) {
+    milo_symtab_t *t = &c->symtab;
+    
+    milo_symbol_t *syms = grow_array(c, t->symbols, &t->capacity,
+                                     t->count + 1, sizeof(milo_symbol_t));
+    if (!syms) return NULL;
+    t->symbols = syms;
+    
+    /* Keep the index at most half full */
+    if ((t->count + 1) * 2 > t->bucket_count) {
+        int n = t->bucket_count ? t->bucket_count * 2 : 64;
+        int *buckets = calloc(n, sizeof(int));
+        if (!buckets) {
+            error(c, "Out of memory");
+            return NULL;
+        }
+        free(t->buckets);
+        t->buckets = buckets;
+        t->bucket_count = n;
+        for (int i = 0; i < t->count; i++) symtab_index(t, i);
+    }
+    
+    milo_symbol_t *sym = &t->symbols[t->count];
+    memset(sym, 0, sizeof(*sym));
+    snprintf(sym->name, sizeof(sym->name), "%s", name);
+    symtab_index(t, t->count++);
+    return sym;
 }
 
 static int alloc_reg(milo_compiler_t *c) {
@@ -828,6 +1179,11 @@ static int alloc_reg(milo_compiler_t *c) {
 }
 
 static int alloc_label(milo_compiler_t *c) {
+    int *addr = grow_array(c, c->label_addr, &c->label_capacity,
+                           c->next_label + 1, sizeof(int));
+    if (!addr) return 0;
+    c->label_addr = addr;
+    c->label_addr[c->next_label] = -1;
     return c->next_label++;
 }
 
@@ -852,7 +1208,8 @@ static int add_constant(milo_compiler_t *c, uint32_t value) {
 static int type_size(milo_type_t t) {
     switch (t) {
         case TYPE_FLOAT:
-        case TYPE_INT:      return 1;
+        case TYPE_INT:
+        case TYPE_BOOL:     return 1;
         case TYPE_VEC2:     return 2;
         case TYPE_VEC3:     return 3;
         case TYPE_VEC4:     return 4;
@@ -866,40 +1223,396 @@ static int type_size(milo_type_t t) {
 static int gen_expr(milo_compiler_t *c, milo_node_t *node);
 static void gen_stmt(milo_compiler_t *c, milo_node_t *node);
 
-static int gen_expr(milo_compiler_t *c, milo_node_t *node) {
-    if (!node) return -1;
+static int gen_int_const(milo_compiler_t *c, int32_t val) {
+    int r = alloc_reg(c);
+    /* Check if value fits in 20-bit signed immediate (-524288 to 524287) */
+    if (val >= -524288 && val <= 524287) {
+        emit_rri(c, OP_ADD, "addi", r, 0, val);
+    } else {
+        /* Load from constant table */
+        int addr = add_constant(c, (uint32_t)val);
+        emit_rri(c, OP_LDR, "ldr", r, 0, addr);
+        annotate(c, "int %d", val);
+    }
+    return r;
+}
+
+static int gen_float_const(milo_compiler_t *c, float val) {
+    int r = alloc_reg(c);
+    union { float f; uint32_t u; } conv;
+    conv.f = val;
+    /* Float constants must be loaded from constant table (32-bit values) */
+    int addr = add_constant(c, conv.u);
+    emit_rri(c, OP_LDR, "ldr", r, 0, addr);
+    annotate(c, "%.6f", val);
+    return r;
+}
+
+/*---------------------------------------------------------------------------
+ * Constant Folding
+ *
+ * Literal arithmetic, global consts and specialization constants are
+ * evaluated at generation time. Values are carried as doubles, which hold
+ * every int exactly, with is_int telling ints (and bools, 0 or 1) from
+ * floats: int arithmetic wraps to 32 bits and float arithmetic rounds to
+ * float as the shader would compute it.
+ *---------------------------------------------------------------------------*/
+
+#define MAX_FOLD_DEPTH 32
+
+/* Index the global declarations, the first of each name, so lookups from
+ * folding and reference marking do not walk the AST */
+static void index_globals(milo_compiler_t *c) {
+    if (c->globals) memset(c->globals, 0, c->global_bucket_count * sizeof(milo_node_t *));
+    if (!c->ast) return;
+    
+    int count = 0;
+    for (milo_node_t *decl = c->ast->block.stmts; decl; decl = decl->next) {
+        if (decl->type == NODE_VAR_DECL) count++;
+    }
+    int n = 64;
+    while (n < count * 2) n *= 2;
+    if (n > c->global_bucket_count) {
+        milo_node_t **globals = realloc(c->globals, n * sizeof(milo_node_t *));
+        if (!globals) {
+            error(c, "Out of memory");
+            return;
+        }
+        memset(globals, 0, n * sizeof(milo_node_t *));
+        c->globals = globals;
+        c->global_bucket_count = n;
+    }
+    
+    uint32_t mask = c->global_bucket_count - 1;
+    for (milo_node_t *decl = c->ast->block.stmts; decl; decl = decl->next) {
+        if (decl->type != NODE_VAR_DECL) continue;
+        for (uint32_t b = hash_name(decl->var_decl.name) & mask; ; b = (b + 1) & mask) {
+            milo_node_t *slot = c->globals[b];
+            if (!slot) {
+                c->globals[b] = decl;
+                break;
+            }
+            if (strcmp(slot->var_decl.name, decl->var_decl.name) == 0) break;
+        }
+    }
+}
+
+static milo_node_t *find_global(milo_compiler_t *c, const char *name) {
+    if (c->global_bucket_count == 0) return NULL;
+    
+    uint32_t mask = c->global_bucket_count - 1;
+    for (uint32_t b = hash_name(name) & mask; c->globals[b]; b = (b + 1) & mask) {
+        if (strcmp(c->globals[b]->var_decl.name, name) == 0) return c->globals[b];
+    }
+    return NULL;
+}
+
+/* Constants fold wherever their name appears, and lookups do not follow
+ * scopes, so a local or parameter may not take the name of one */
+static void check_shadowing(milo_compiler_t *c, milo_node_t *node) {
+    for (; node; node = node->next) {
+        switch (node->type) {
+            case NODE_FUNCTION:
+                check_shadowing(c, node->func.params);
+                check_shadowing(c, node->func.body);
+                break;
+            case NODE_VAR_DECL:
+            case NODE_PARAM: {
+                milo_node_t *decl = find_global(c, node->var_decl.name);
+                if (decl && decl != node && decl->var_decl.is_const) {
+                    int line = c->line;
+                    c->line = node->line;
+                    error(c, "'%s' shadows a constant", node->var_decl.name);
+                    c->line = line;
+                }
+                break;
+            }
+            case NODE_BLOCK:
+                check_shadowing(c, node->block.stmts);
+                break;
+            case NODE_IF:
+                check_shadowing(c, node->if_stmt.then_branch);
+                check_shadowing(c, node->if_stmt.else_branch);
+                break;
+            case NODE_FOR:
+                check_shadowing(c, node->for_stmt.init);
+                check_shadowing(c, node->for_stmt.body);
+                break;
+            case NODE_WHILE:
+                check_shadowing(c, node->while_stmt.body);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static bool eval_const(milo_compiler_t *c, milo_node_t *node, double *value, bool *is_int,
+                       int depth);
+
+/* An int from a value in the int range, wrapped to 32 bits */
+static double wrap_int(int64_t v) {
+    return (double)(int32_t)(uint32_t)v;
+}
+
+/* A float or int value converted to int, clamped to the int range */
+static double to_int(double v) {
+    if (v >= 2147483647.0) return 2147483647.0;
+    if (v <= -2147483648.0) return -2147483648.0;
+    return (double)(int32_t)v;
+}
+
+static bool eval_global_const(milo_compiler_t *c, milo_node_t *decl, double *value, bool *is_int,
+                              int depth) {
+    if (!decl->var_decl.is_const) return false;
+    
+    milo_type_t type = decl->var_decl.var_type;
+    if (type != TYPE_FLOAT && type != TYPE_INT && type != TYPE_BOOL) return false;
+    
+    double v;
+    bool v_int;
+    bool found = false;
+    if (decl->var_decl.spec_id >= 0) {
+        for (int i = 0; i < c->spec_count; i++) {
+            if (c->spec[i].id == decl->var_decl.spec_id) {
+                v = c->spec[i].value;
+                found = true;
+                break;
+            }
+        }
+    }
+    if (!found && !eval_const(c, decl->var_decl.init, &v, &v_int, depth + 1)) {
+        return false;
+    }
+    
+    switch (type) {
+        case TYPE_BOOL: *value = v != 0.0 ? 1.0 : 0.0; break;
+        case TYPE_INT:  *value = to_int(v); break;
+        default:        *value = (float)v; break;
+    }
+    *is_int = type != TYPE_FLOAT;
+    return true;
+}
+
+static bool eval_const(milo_compiler_t *c, milo_node_t *node, double *value, bool *is_int,
+                       int depth) {
+    if (!node || depth > MAX_FOLD_DEPTH) return false;
     
     switch (node->type) {
-        case NODE_INT_LIT: {
-            int r = alloc_reg(c);
-            int32_t val = node->int_val;
-            /* Check if value fits in 20-bit signed immediate (-524288 to 524287) */
-            if (val >= -524288 && val <= 524287) {
-                emit(c, "    addi r%d, r0, %d", r, val);
-            } else {
-                /* Load from constant table */
-                int addr = add_constant(c, (uint32_t)val);
-                emit(c, "    ldr r%d, r0, %d  ; int %d", r, addr, val);
+        case NODE_INT_LIT:
+            *value = node->int_val;
+            *is_int = true;
+            return true;
+            
+        case NODE_FLOAT_LIT:
+            *value = node->float_val;
+            *is_int = false;
+            return true;
+            
+        case NODE_IDENT: {
+            milo_node_t *decl = find_global(c, node->ident.name);
+            return decl && eval_global_const(c, decl, value, is_int, depth);
+        }
+        
+        case NODE_UNARY: {
+            double a;
+            bool a_int;
+            if (!eval_const(c, node->unary.operand, &a, &a_int, depth + 1)) return false;
+            switch (node->unary.op) {
+                case TOK_MINUS:
+                    *value = a_int ? wrap_int(-(int64_t)a) : -a;
+                    *is_int = a_int;
+                    return true;
+                case TOK_NOT:
+                    *value = (a == 0.0) ? 1.0 : 0.0;
+                    *is_int = true;
+                    return true;
+                default:
+                    return false;
             }
-            return r;
         }
         
-        case NODE_FLOAT_LIT: {
-            int r = alloc_reg(c);
-            union { float f; uint32_t u; } conv;
-            conv.f = node->float_val;
-            /* Float constants must be loaded from constant table (32-bit values) */
-            int addr = add_constant(c, conv.u);
-            emit(c, "    ldr r%d, r0, %d  ; %.6f", r, addr, node->float_val);
-            return r;
+        case NODE_BINARY: {
+            double a, b;
+            bool a_int, b_int;
+            if (!eval_const(c, node->binary.left, &a, &a_int, depth + 1) ||
+                !eval_const(c, node->binary.right, &b, &b_int, depth + 1)) {
+                return false;
+            }
+            bool both_int = a_int && b_int;
+            int64_t ia = (int64_t)a, ib = (int64_t)b;
+            float fa = (float)a, fb = (float)b;
+            *is_int = true;
+            switch (node->binary.op) {
+                case TOK_PLUS:
+                    *value = both_int ? wrap_int(ia + ib) : (double)(fa + fb);
+                    *is_int = both_int;
+                    return true;
+                case TOK_MINUS:
+                    *value = both_int ? wrap_int(ia - ib) : (double)(fa - fb);
+                    *is_int = both_int;
+                    return true;
+                case TOK_STAR:
+                    *value = both_int ? wrap_int(ia * ib) : (double)(fa * fb);
+                    *is_int = both_int;
+                    return true;
+                case TOK_SLASH:
+                    if (b == 0.0 || (both_int && ia == INT32_MIN && ib == -1)) return false;
+                    *value = both_int ? (double)(ia / ib) : (double)(fa / fb);
+                    *is_int = both_int;
+                    return true;
+                case TOK_LT:  *value = (a <  b) ? 1.0 : 0.0; return true;
+                case TOK_LE:  *value = (a <= b) ? 1.0 : 0.0; return true;
+                case TOK_GT:  *value = (a >  b) ? 1.0 : 0.0; return true;
+                case TOK_GE:  *value = (a >= b) ? 1.0 : 0.0; return true;
+                case TOK_EQ:  *value = (a == b) ? 1.0 : 0.0; return true;
+                case TOK_NE:  *value = (a != b) ? 1.0 : 0.0; return true;
+                case TOK_AND: *value = (a != 0.0 && b != 0.0) ? 1.0 : 0.0; return true;
+                case TOK_OR:  *value = (a != 0.0 || b != 0.0) ? 1.0 : 0.0; return true;
+                default:      return false;
+            }
+        }
+        
+        case NODE_TERNARY: {
+            double cond;
+            bool cond_int;
+            if (!eval_const(c, node->ternary.cond, &cond, &cond_int, depth + 1)) return false;
+            return eval_const(c, cond != 0.0 ? node->ternary.then_expr : node->ternary.else_expr,
+                              value, is_int, depth + 1);
+        }
+        
+        default:
+            return false;
+    }
+}
+
+/* Evaluate a branch condition; returns false if it is not a constant */
+static bool fold_cond(milo_compiler_t *c, milo_node_t *cond, bool *taken) {
+    double value;
+    bool is_int;
+    if (!eval_const(c, cond, &value, &is_int, 0)) return false;
+    *taken = value != 0.0;
+    return true;
+}
+
+/* Mark globals reachable from live code, skipping branches that fold away.
+ * Unreferenced uniforms get no register in the generated variant. */
+static void mark_refs(milo_compiler_t *c, milo_node_t *node);
+
+static void mark_list(milo_compiler_t *c, milo_node_t *list) {
+    for (; list; list = list->next) {
+        mark_refs(c, list);
+    }
+}
+
+static void mark_refs(milo_compiler_t *c, milo_node_t *node) {
+    if (!node) return;
+    
+    bool taken;
+    switch (node->type) {
+        case NODE_FUNCTION:
+            mark_refs(c, node->func.body);
+            break;
+        case NODE_BLOCK:
+            mark_list(c, node->block.stmts);
+            break;
+        case NODE_VAR_DECL:
+            mark_refs(c, node->var_decl.init);
+            break;
+        case NODE_IF:
+            if (fold_cond(c, node->if_stmt.cond, &taken)) {
+                mark_refs(c, taken ? node->if_stmt.then_branch : node->if_stmt.else_branch);
+            } else {
+                mark_refs(c, node->if_stmt.cond);
+                mark_refs(c, node->if_stmt.then_branch);
+                mark_refs(c, node->if_stmt.else_branch);
+            }
+            break;
+        case NODE_FOR:
+            mark_refs(c, node->for_stmt.init);
+            if (fold_cond(c, node->for_stmt.cond, &taken) && !taken) break;
+            mark_refs(c, node->for_stmt.cond);
+            mark_refs(c, node->for_stmt.body);
+            mark_refs(c, node->for_stmt.post);
+            break;
+        case NODE_WHILE:
+            if (fold_cond(c, node->while_stmt.cond, &taken) && !taken) break;
+            mark_refs(c, node->while_stmt.cond);
+            mark_refs(c, node->while_stmt.body);
+            break;
+        case NODE_RETURN:
+        case NODE_EXPR_STMT:
+            mark_refs(c, node->ret.value);
+            break;
+        case NODE_BINARY:
+            mark_refs(c, node->binary.left);
+            mark_refs(c, node->binary.right);
+            break;
+        case NODE_UNARY:
+            mark_refs(c, node->unary.operand);
+            break;
+        case NODE_CALL:
+            mark_list(c, node->call.args);
+            break;
+        case NODE_CONSTRUCTOR:
+            mark_list(c, node->constructor.args);
+            break;
+        case NODE_MEMBER:
+            mark_refs(c, node->member.object);
+            break;
+        case NODE_INDEX:
+            mark_refs(c, node->index.object);
+            mark_refs(c, node->index.index);
+            break;
+        case NODE_ASSIGN:
+            mark_refs(c, node->assign.target);
+            mark_refs(c, node->assign.value);
+            break;
+        case NODE_TERNARY:
+            if (fold_cond(c, node->ternary.cond, &taken)) {
+                mark_refs(c, taken ? node->ternary.then_expr : node->ternary.else_expr);
+            } else {
+                mark_refs(c, node->ternary.cond);
+                mark_refs(c, node->ternary.then_expr);
+                mark_refs(c, node->ternary.else_expr);
+            }
+            break;
+        case NODE_IDENT: {
+            milo_node_t *decl = find_global(c, node->ident.name);
+            if (decl) decl->var_decl.referenced = true;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static int gen_expr(milo_compiler_t *c, milo_node_t *node) {
+    if (!node) return -1;
+    if (node->line) c->gen_line = node->line;
+    
+    /* Fold compile-time constant expressions (literals, consts, spec constants) */
+    if (node->type == NODE_IDENT || node->type == NODE_UNARY ||
+        node->type == NODE_BINARY || node->type == NODE_TERNARY) {
+        double value;
+        bool is_int;
+        if (eval_const(c, node, &value, &is_int, 0)) {
+            return is_int ? gen_int_const(c, (int32_t)value) : gen_float_const(c, (float)value);
         }
+    }
+    
+    switch (node->type) {
+        case NODE_INT_LIT:
+            return gen_int_const(c, node->int_val);
+        
+        case NODE_FLOAT_LIT:
+            return gen_float_const(c, node->float_val);
         
         case NODE_IDENT: {
             /* Look up in symbol table */
-            for (int i = 0; i < c->symtab.count; i++) {
-                if (strcmp(c->symtab.symbols[i].name, node->ident.name) == 0) {
-                    return c->symtab.symbols[i].reg;
-                }
+            milo_symbol_t *sym = find_symbol(c, node->ident.name);
+            if (sym) {
+                return sym->reg;
             }
             error(c, "Undefined variable: %s", node->ident.name);
             return alloc_reg(c);
@@ -911,22 +1624,23 @@ static int gen_expr(milo_compiler_t *c, milo_node_t *node) {
             int r = alloc_reg(c);
             
             const char *op;
+            uint8_t opcode;
             switch (node->binary.op) {
-                case TOK_PLUS:  op = "fadd"; break;
-                case TOK_MINUS: op = "fsub"; break;
-                case TOK_STAR:  op = "fmul"; break;
-                case TOK_SLASH: op = "fdiv"; break;
-                case TOK_LT:    op = "fslt"; break;
-                case TOK_LE:    op = "fsle"; break;
-                case TOK_GT:    emit(c, "    fslt r%d, r%d, r%d", r, right, left); return r;
-                case TOK_GE:    emit(c, "    fsle r%d, r%d, r%d", r, right, left); return r;
-                case TOK_EQ:    op = "fseq"; break;
-                case TOK_NE:    emit(c, "    fseq r%d, r%d, r%d", r, left, right);
-                                emit(c, "    xori r%d, r%d, 1", r, r);
+                case TOK_PLUS:  op = "fadd"; opcode = OP_FADD; break;
+                case TOK_MINUS: op = "fsub"; opcode = OP_FSUB; break;
+                case TOK_STAR:  op = "fmul"; opcode = OP_FMUL; break;
+                case TOK_SLASH: op = "fdiv"; opcode = OP_FDIV; break;
+                case TOK_LT:    op = "fslt"; opcode = OP_FSLT; break;
+                case TOK_LE:    op = "fsle"; opcode = OP_FSLE; break;
+                case TOK_GT:    emit_rrr(c, OP_FSLT, "fslt", r, right, left); return r;
+                case TOK_GE:    emit_rrr(c, OP_FSLE, "fsle", r, right, left); return r;
+                case TOK_EQ:    op = "fseq"; opcode = OP_FSEQ; break;
+                case TOK_NE:    emit_rrr(c, OP_FSEQ, "fseq", r, left, right);
+                                emit_rri(c, OP_XOR, "xori", r, r, 1);
                                 return r;
-                default:        op = "add"; break;
+                default:        op = "add"; opcode = OP_ADD; break;
             }
-            emit(c, "    %s r%d, r%d, r%d", op, r, left, right);
+            emit_rrr(c, opcode, op, r, left, right);
             return r;
         }
         
@@ -936,13 +1650,13 @@ static int gen_expr(milo_compiler_t *c, milo_node_t *node) {
             
             switch (node->unary.op) {
                 case TOK_MINUS:
-                    emit(c, "    fneg r%d, r%d", r, operand);
+                    emit_rr(c, OP_FNEG, "fneg", r, operand);
                     break;
                 case TOK_NOT:
-                    emit(c, "    xori r%d, r%d, 1", r, operand);
+                    emit_rri(c, OP_XOR, "xori", r, operand, 1);
                     break;
                 default:
-                    emit(c, "    mov r%d, r%d", r, operand);
+                    emit_rr(c, OP_MOV, "mov", r, operand);
                     break;
             }
             return r;
@@ -960,44 +1674,44 @@ static int gen_expr(milo_compiler_t *c, milo_node_t *node) {
             int r = alloc_reg(c);
             
             if (strcmp(name, "sin") == 0) {
-                emit(c, "    sin r%d, r%d", r, arg_regs[0]);
+                emit_rr(c, OP_SFU_SIN, "sin", r, arg_regs[0]);
             } else if (strcmp(name, "cos") == 0) {
-                emit(c, "    cos r%d, r%d", r, arg_regs[0]);
+                emit_rr(c, OP_SFU_COS, "cos", r, arg_regs[0]);
             } else if (strcmp(name, "sqrt") == 0) {
-                emit(c, "    sqrt r%d, r%d", r, arg_regs[0]);
+                emit_rr(c, OP_SFU_SQRT, "sqrt", r, arg_regs[0]);
             } else if (strcmp(name, "abs") == 0) {
-                emit(c, "    fabs r%d, r%d", r, arg_regs[0]);
+                emit_rr(c, OP_FABS, "fabs", r, arg_regs[0]);
             } else if (strcmp(name, "min") == 0) {
-                emit(c, "    fmin r%d, r%d, r%d", r, arg_regs[0], arg_regs[1]);
+                emit_rrr(c, OP_FMIN, "fmin", r, arg_regs[0], arg_regs[1]);
             } else if (strcmp(name, "max") == 0) {
-                emit(c, "    fmax r%d, r%d, r%d", r, arg_regs[0], arg_regs[1]);
+                emit_rrr(c, OP_FMAX, "fmax", r, arg_regs[0], arg_regs[1]);
             } else if (strcmp(name, "clamp") == 0) {
-                emit(c, "    fmax r%d, r%d, r%d", r, arg_regs[0], arg_regs[1]);
-                emit(c, "    fmin r%d, r%d, r%d", r, r, arg_regs[2]);
+                emit_rrr(c, OP_FMAX, "fmax", r, arg_regs[0], arg_regs[1]);
+                emit_rrr(c, OP_FMIN, "fmin", r, r, arg_regs[2]);
             } else if (strcmp(name, "dot") == 0) {
                 /* Simplified 3-component dot product */
                 int t1 = alloc_reg(c);
                 int t2 = alloc_reg(c);
-                emit(c, "    fmul r%d, r%d, r%d", r, arg_regs[0], arg_regs[1]);
-                emit(c, "    fmul r%d, r%d, r%d", t1, arg_regs[0]+1, arg_regs[1]+1);
-                emit(c, "    fmul r%d, r%d, r%d", t2, arg_regs[0]+2, arg_regs[1]+2);
-                emit(c, "    fadd r%d, r%d, r%d", r, r, t1);
-                emit(c, "    fadd r%d, r%d, r%d", r, r, t2);
+                emit_rrr(c, OP_FMUL, "fmul", r, arg_regs[0], arg_regs[1]);
+                emit_rrr(c, OP_FMUL, "fmul", t1, arg_regs[0]+1, arg_regs[1]+1);
+                emit_rrr(c, OP_FMUL, "fmul", t2, arg_regs[0]+2, arg_regs[1]+2);
+                emit_rrr(c, OP_FADD, "fadd", r, r, t1);
+                emit_rrr(c, OP_FADD, "fadd", r, r, t2);
             } else if (strcmp(name, "normalize") == 0) {
                 /* Simplified normalize */
                 int len = alloc_reg(c);
-                emit(c, "    ; normalize (simplified)");
-                emit(c, "    fmul r%d, r%d, r%d", len, arg_regs[0], arg_regs[0]);
-                emit(c, "    rsq r%d, r%d", len, len);
-                emit(c, "    fmul r%d, r%d, r%d", r, arg_regs[0], len);
+                emit_text(c, "    ; normalize (simplified)");
+                emit_rrr(c, OP_FMUL, "fmul", len, arg_regs[0], arg_regs[0]);
+                emit_rr(c, OP_SFU_RSQ, "rsq", len, len);
+                emit_rrr(c, OP_FMUL, "fmul", r, arg_regs[0], len);
             } else if (strcmp(name, "texture") == 0) {
-                emit(c, "    tex r%d, r%d, r%d", r, arg_regs[0], arg_regs[1]);
+                emit_rrr(c, OP_TEX, "tex", r, arg_regs[0], arg_regs[1]);
             } else if (strcmp(name, "mix") == 0) {
                 /* mix(a, b, t) = a + t * (b - a) */
                 int t = alloc_reg(c);
-                emit(c, "    fsub r%d, r%d, r%d", t, arg_regs[1], arg_regs[0]);
-                emit(c, "    fmul r%d, r%d, r%d", t, t, arg_regs[2]);
-                emit(c, "    fadd r%d, r%d, r%d", r, arg_regs[0], t);
+                emit_rrr(c, OP_FSUB, "fsub", t, arg_regs[1], arg_regs[0]);
+                emit_rrr(c, OP_FMUL, "fmul", t, t, arg_regs[2]);
+                emit_rrr(c, OP_FADD, "fadd", r, arg_regs[0], t);
             } else {
                 error(c, "Unknown function: %s", name);
             }
@@ -1016,7 +1730,7 @@ static int gen_expr(milo_compiler_t *c, milo_node_t *node) {
             int i = 0;
             for (milo_node_t *arg = node->constructor.args; arg && i < size; arg = arg->next) {
                 int a = gen_expr(c, arg);
-                emit(c, "    mov r%d, r%d", r + i, a);
+                emit_rr(c, OP_MOV, "mov", r + i, a);
                 i++;
             }
             return r;
@@ -1034,7 +1748,8 @@ static int gen_expr(milo_compiler_t *c, milo_node_t *node) {
             else if (m[0] == 'z' || m[0] == 'b' || m[0] == 'p') offset = 2;
             else if (m[0] == 'w' || m[0] == 'a' || m[0] == 'q') offset = 3;
             
-            emit(c, "    mov r%d, r%d  ; .%s", r, obj + offset, m);
+            emit_rr(c, OP_MOV, "mov", r, obj + offset);
+            annotate(c, ".%s", m);
             return r;
         }
         
@@ -1043,35 +1758,38 @@ static int gen_expr(milo_compiler_t *c, milo_node_t *node) {
             
             if (node->assign.target->type == NODE_IDENT) {
                 const char *name = node->assign.target->ident.name;
-                for (int i = 0; i < c->symtab.count; i++) {
-                    if (strcmp(c->symtab.symbols[i].name, name) == 0) {
-                        int r = c->symtab.symbols[i].reg;
-                        int size = type_size(c->symtab.symbols[i].type);
-                        
-                        if (node->assign.op == TOK_ASSIGN) {
-                            /* Copy all components for vector types */
-                            for (int j = 0; j < size; j++) {
-                                emit(c, "    mov r%d, r%d", r + j, val + j);
-                            }
-                        } else if (node->assign.op == TOK_PLUS_ASSIGN) {
-                            for (int j = 0; j < size; j++) {
-                                emit(c, "    fadd r%d, r%d, r%d", r + j, r + j, val + j);
-                            }
-                        } else if (node->assign.op == TOK_MINUS_ASSIGN) {
-                            for (int j = 0; j < size; j++) {
-                                emit(c, "    fsub r%d, r%d, r%d", r + j, r + j, val + j);
-                            }
-                        } else if (node->assign.op == TOK_STAR_ASSIGN) {
-                            for (int j = 0; j < size; j++) {
-                                emit(c, "    fmul r%d, r%d, r%d", r + j, r + j, val + j);
-                            }
-                        } else if (node->assign.op == TOK_SLASH_ASSIGN) {
-                            for (int j = 0; j < size; j++) {
-                                emit(c, "    fdiv r%d, r%d, r%d", r + j, r + j, val + j);
-                            }
+                milo_symbol_t *sym = find_symbol(c, name);
+                if (sym) {
+                    if (sym->is_const) {
+                        error(c, "Assignment to const: %s", name);
+                        return val;
+                    }
+                    int r = sym->reg;
+                    int size = type_size(sym->type);
+                    
+                    if (node->assign.op == TOK_ASSIGN) {
+                        /* Copy all components for vector types */
+                        for (int j = 0; j < size; j++) {
+                            emit_rr(c, OP_MOV, "mov", r + j, val + j);
+                        }
+                    } else if (node->assign.op == TOK_PLUS_ASSIGN) {
+                        for (int j = 0; j < size; j++) {
+                            emit_rrr(c, OP_FADD, "fadd", r + j, r + j, val + j);
+                        }
+                    } else if (node->assign.op == TOK_MINUS_ASSIGN) {
+                        for (int j = 0; j < size; j++) {
+                            emit_rrr(c, OP_FSUB, "fsub", r + j, r + j, val + j);
+                        }
+                    } else if (node->assign.op == TOK_STAR_ASSIGN) {
+                        for (int j = 0; j < size; j++) {
+                            emit_rrr(c, OP_FMUL, "fmul", r + j, r + j, val + j);
+                        }
+                    } else if (node->assign.op == TOK_SLASH_ASSIGN) {
+                        for (int j = 0; j < size; j++) {
+                            emit_rrr(c, OP_FDIV, "fdiv", r + j, r + j, val + j);
                         }
-                        return r;
                     }
+                    return r;
                 }
                 error(c, "Undefined variable: %s", name);
             }
@@ -1079,11 +1797,15 @@ static int gen_expr(milo_compiler_t *c, milo_node_t *node) {
         }
         
         case NODE_TERNARY: {
+            bool taken;
+            if (fold_cond(c, node->ternary.cond, &taken)) {
+                return gen_expr(c, taken ? node->ternary.then_expr : node->ternary.else_expr);
+            }
             int cond = gen_expr(c, node->ternary.cond);
             int then_val = gen_expr(c, node->ternary.then_expr);
             int else_val = gen_expr(c, node->ternary.else_expr);
             int r = alloc_reg(c);
-            emit(c, "    selp r%d, r%d, r%d, r%d", r, then_val, else_val, cond);
+            emit_rrrr(c, OP_SELP, "selp", r, then_val, else_val, cond);
             return r;
         }
         
@@ -1095,6 +1817,7 @@ static int gen_expr(milo_compiler_t *c, milo_node_t *node) {
 
 static void gen_stmt(milo_compiler_t *c, milo_node_t *node) {
     if (!node) return;
+    if (node->line) c->gen_line = node->line;
     
     switch (node->type) {
         case NODE_BLOCK:
@@ -1109,16 +1832,16 @@ static void gen_stmt(milo_compiler_t *c, milo_node_t *node) {
             for (int i = 1; i < size; i++) alloc_reg(c);
             
             /* Add to symbol table */
-            if (c->symtab.count < MILO_MAX_SYMBOLS) {
-                strcpy(c->symtab.symbols[c->symtab.count].name, node->var_decl.name);
-                c->symtab.symbols[c->symtab.count].type = node->var_decl.var_type;
-                c->symtab.symbols[c->symtab.count].reg = r;
-                c->symtab.count++;
+            milo_symbol_t *sym = add_symbol(c, node->var_decl.name);
+            if (sym) {
+                sym->type = node->var_decl.var_type;
+                sym->reg = r;
             }
             
             if (node->var_decl.init) {
                 int val = gen_expr(c, node->var_decl.init);
-                emit(c, "    mov r%d, r%d  ; %s", r, val, node->var_decl.name);
+                emit_rr(c, OP_MOV, "mov", r, val);
+                annotate(c, "%s", node->var_decl.name);
             }
             break;
         }
@@ -1130,34 +1853,43 @@ static void gen_stmt(milo_compiler_t *c, milo_node_t *node) {
         case NODE_RETURN:
             if (node->ret.value) {
                 int val = gen_expr(c, node->ret.value);
-                emit(c, "    mov r1, r%d  ; return value", val);
+                emit_rr(c, OP_MOV, "mov", 1, val);
+                annotate(c, "return value");
             }
-            emit(c, "    ret");
+            emit_op(c, OP_RET, "ret");
             break;
             
         case NODE_DISCARD:
-            emit(c, "    ; discard fragment");
-            emit(c, "    exit");
+            emit_text(c, "    ; discard fragment");
+            emit_op(c, OP_EXIT, "exit");
             break;
             
         case NODE_IF: {
+            bool taken;
+            if (fold_cond(c, node->if_stmt.cond, &taken)) {
+                /* Dead branch eliminated */
+                gen_stmt(c, taken ? node->if_stmt.then_branch : node->if_stmt.else_branch);
+                break;
+            }
+            
             int cond = gen_expr(c, node->if_stmt.cond);
             int else_label = alloc_label(c);
             int end_label = alloc_label(c);
             
-            emit(c, "    ssy L%d  ; if", else_label);
-            emit(c, "    beq r%d, r0, L%d", cond, else_label);
+            emit_branch(c, OP_SSY, "ssy", -1, else_label);
+            annotate(c, "if");
+            emit_branch(c, OP_BEQ, "beq", cond, else_label);
             gen_stmt(c, node->if_stmt.then_branch);
             
             if (node->if_stmt.else_branch) {
-                emit(c, "    bra L%d", end_label);
-                emit(c, "L%d:", else_label);
+                emit_branch(c, OP_BRA, "bra", -1, end_label);
+                emit_label(c, else_label);
                 gen_stmt(c, node->if_stmt.else_branch);
-                emit(c, "L%d:", end_label);
+                emit_label(c, end_label);
             } else {
-                emit(c, "L%d:", else_label);
+                emit_label(c, else_label);
             }
-            emit(c, "    join");
+            emit_op(c, OP_JOIN, "join");
             break;
         }
         
@@ -1169,12 +1901,18 @@ static void gen_stmt(milo_compiler_t *c, milo_node_t *node) {
                 gen_stmt(c, node->for_stmt.init);
             }
             
-            emit(c, "L%d:  ; for loop", loop_label);
-            emit(c, "    ssy L%d", end_label);
+            bool taken;
+            if (fold_cond(c, node->for_stmt.cond, &taken) && !taken) {
+                break;
+            }
+            
+            emit_label(c, loop_label);
+            annotate(c, "for loop");
+            emit_branch(c, OP_SSY, "ssy", -1, end_label);
             
             if (node->for_stmt.cond) {
                 int cond = gen_expr(c, node->for_stmt.cond);
-                emit(c, "    beq r%d, r0, L%d", cond, end_label);
+                emit_branch(c, OP_BEQ, "beq", cond, end_label);
             }
             
             gen_stmt(c, node->for_stmt.body);
@@ -1183,37 +1921,44 @@ static void gen_stmt(milo_compiler_t *c, milo_node_t *node) {
                 gen_expr(c, node->for_stmt.post);
             }
             
-            emit(c, "    bra L%d", loop_label);
-            emit(c, "L%d:", end_label);
-            emit(c, "    join");
+            emit_branch(c, OP_BRA, "bra", -1, loop_label);
+            emit_label(c, end_label);
+            emit_op(c, OP_JOIN, "join");
             break;
         }
         
         case NODE_WHILE: {
+            bool taken;
+            if (fold_cond(c, node->while_stmt.cond, &taken) && !taken) {
+                break;
+            }
+            
             int loop_label = alloc_label(c);
             int end_label = alloc_label(c);
             
-            emit(c, "L%d:  ; while loop", loop_label);
-            emit(c, "    ssy L%d", end_label);
+            emit_label(c, loop_label);
+            annotate(c, "while loop");
+            emit_branch(c, OP_SSY, "ssy", -1, end_label);
             
             int cond = gen_expr(c, node->while_stmt.cond);
-            emit(c, "    beq r%d, r0, L%d", cond, end_label);
+            emit_branch(c, OP_BEQ, "beq", cond, end_label);
             
             gen_stmt(c, node->while_stmt.body);
             
-            emit(c, "    bra L%d", loop_label);
-            emit(c, "L%d:", end_label);
-            emit(c, "    join");
+            emit_branch(c, OP_BRA, "bra", -1, loop_label);
+            emit_label(c, end_label);
+            emit_op(c, OP_JOIN, "join");
             break;
         }
         
         case NODE_BREAK:
-            emit(c, "    join  ; break");
+            emit_op(c, OP_JOIN, "join");
+            annotate(c, "break");
             break;
             
         case NODE_CONTINUE:
             /* TODO: need to track loop start label */
-            emit(c, "    ; continue (TODO)");
+            emit_text(c, "    ; continue (TODO)");
             break;
             
         default:
@@ -1222,17 +1967,16 @@ static void gen_stmt(milo_compiler_t *c, milo_node_t *node) {
 }
 
 static void gen_function(milo_compiler_t *c, milo_node_t *node) {
-    emit(c, "; Function: %s", node->func.name);
-    emit(c, "%s:", node->func.name);
+    emit_text(c, "; Function: %s", node->func.name);
+    emit_text(c, "%s:", node->func.name);
     
     /* Parameters - add to symbol table but don't reset next_reg */
     int param_reg = c->next_reg;
     for (milo_node_t *p = node->func.params; p; p = p->next) {
-        if (c->symtab.count < MILO_MAX_SYMBOLS) {
-            strcpy(c->symtab.symbols[c->symtab.count].name, p->var_decl.name);
-            c->symtab.symbols[c->symtab.count].type = p->var_decl.var_type;
-            c->symtab.symbols[c->symtab.count].reg = param_reg;
-            c->symtab.count++;
+        milo_symbol_t *sym = add_symbol(c, p->var_decl.name);
+        if (sym) {
+            sym->type = p->var_decl.var_type;
+            sym->reg = param_reg;
             param_reg += type_size(p->var_decl.var_type);
         }
     }
@@ -1244,34 +1988,62 @@ static void gen_function(milo_compiler_t *c, milo_node_t *node) {
     gen_stmt(c, node->func.body);
     
     if (strcmp(node->func.name, "main") == 0) {
-        emit(c, "    exit");
+        emit_op(c, OP_EXIT, "exit");
     } else {
-        emit(c, "    ret");
+        emit_op(c, OP_RET, "ret");
     }
-    emit(c, "");
+    emit_text(c, "");
 }
 
 static void gen_program(milo_compiler_t *c) {
-    emit(c, "; Milo832 GPU Shader");
-    emit(c, "; Generated by milo_glsl compiler");
-    emit(c, "");
+    emit_text(c, "; Milo832 GPU Shader");
+    emit_text(c, "; Generated by milo_glsl compiler");
+    emit_text(c, "");
     
     /* First pass: declare uniforms and inputs/outputs */
     for (milo_node_t *decl = c->ast->block.stmts; decl; decl = decl->next) {
         if (decl->type == NODE_VAR_DECL) {
+            double value;
+            bool is_int;
+            if (eval_global_const(c, decl, &value, &is_int, 0)) {
+                /* Folded constant - no register */
+                milo_symbol_t *sym = add_symbol(c, decl->var_decl.name);
+                if (sym) {
+                    sym->type = decl->var_decl.var_type;
+                    sym->reg = -1;
+                    sym->is_const = true;
+                    sym->const_val = value;
+                    sym->location = decl->var_decl.location;
+                }
+                const char *fmt = is_int ? "%.0f" : "%g";
+                char text[32];
+                snprintf(text, sizeof(text), fmt, value);
+                if (decl->var_decl.spec_id >= 0) {
+                    emit_text(c, "; spec const %s (constant_id %d) = %s", 
+                         decl->var_decl.name, decl->var_decl.spec_id, text);
+                } else {
+                    emit_text(c, "; const %s = %s", decl->var_decl.name, text);
+                }
+                continue;
+            }
+            
+            if (decl->var_decl.is_uniform && !decl->var_decl.referenced) {
+                emit_text(c, "; uniform %s eliminated (unused)", decl->var_decl.name);
+                continue;
+            }
+            
             int r = alloc_reg(c);
             int size = type_size(decl->var_decl.var_type);
             for (int i = 1; i < size; i++) alloc_reg(c);
             
-            if (c->symtab.count < MILO_MAX_SYMBOLS) {
-                strcpy(c->symtab.symbols[c->symtab.count].name, decl->var_decl.name);
-                c->symtab.symbols[c->symtab.count].type = decl->var_decl.var_type;
-                c->symtab.symbols[c->symtab.count].reg = r;
-                c->symtab.symbols[c->symtab.count].is_uniform = decl->var_decl.is_uniform;
-                c->symtab.symbols[c->symtab.count].is_in = decl->var_decl.is_in;
-                c->symtab.symbols[c->symtab.count].is_out = decl->var_decl.is_out;
-                c->symtab.symbols[c->symtab.count].location = decl->var_decl.location;
-                c->symtab.count++;
+            milo_symbol_t *sym = add_symbol(c, decl->var_decl.name);
+            if (sym) {
+                sym->type = decl->var_decl.var_type;
+                sym->reg = r;
+                sym->is_uniform = decl->var_decl.is_uniform;
+                sym->is_in = decl->var_decl.is_in;
+                sym->is_out = decl->var_decl.is_out;
+                sym->location = decl->var_decl.location;
             }
             
             const char *qual = "";
@@ -1279,10 +2051,10 @@ static void gen_program(milo_compiler_t *c) {
             else if (decl->var_decl.is_in) qual = "in ";
             else if (decl->var_decl.is_out) qual = "out ";
             
-            emit(c, "; %s%s -> r%d", qual, decl->var_decl.name, r);
+            emit_text(c, "; %s%s -> r%d", qual, decl->var_decl.name, r);
         }
     }
-    emit(c, "");
+    emit_text(c, "");
     
     /* Second pass: generate function code */
     for (milo_node_t *decl = c->ast->block.stmts; decl; decl = decl->next) {
@@ -1299,9 +2071,16 @@ static void gen_program(milo_compiler_t *c) {
 void milo_glsl_init(milo_compiler_t *c) {
     memset(c, 0, sizeof(*c));
     c->next_reg = 2;  /* r0 = zero, r1 = return */
+    c->listing_enabled = true;
 }
 
-bool milo_glsl_compile(milo_compiler_t *c, const char *source, bool is_vertex) {
+bool milo_glsl_parse(milo_compiler_t *c, const char *source, bool is_vertex) {
+    /* Drop the previous AST and errors in one step */
+    arena_reset(&c->arena);
+    c->ast = NULL;
+    c->error_count = 0;
+    symtab_clear(&c->symtab);
+    
     c->source = source;
     c->current = source;
     c->line = 1;
@@ -1314,45 +2093,106 @@ bool milo_glsl_compile(milo_compiler_t *c, const char *source, bool is_vertex) {
     
     /* Parse */
     parse_program(c);
+    index_globals(c);
+    if (c->ast) check_shadowing(c, c->ast->block.stmts);
     
-    if (c->error_count > 0) {
-        return false;
+    return c->error_count == 0;
+}
+
+bool milo_glsl_generate(milo_compiler_t *c) {
+    if (!c->ast) return false;
+    
+    /* Reset per-variant code generation state; the AST is shared */
+    c->code_count = 0;
+    c->fixup_count = 0;
+    c->listing_len = 0;
+    if (c->listing) c->listing[0] = '\0';
+    c->next_reg = 2;
+    c->next_label = 0;
+    c->gen_line = 0;
+    c->const_count = 0;
+    symtab_clear(&c->symtab);
+    c->error_count = 0;
+    
+    /* Find globals reachable from live code for this variant */
+    for (milo_node_t *decl = c->ast->block.stmts; decl; decl = decl->next) {
+        if (decl->type == NODE_VAR_DECL) {
+            decl->var_decl.referenced = false;
+        }
+    }
+    for (milo_node_t *decl = c->ast->block.stmts; decl; decl = decl->next) {
+        if (decl->type == NODE_FUNCTION) {
+            mark_refs(c, decl);
+        }
     }
     
     /* Generate code */
     gen_program(c);
+    resolve_labels(c);
     
-    return c->error_count == 0;
-}
-
-const char *milo_glsl_get_asm(milo_compiler_t *c) {
-    static char buf[MILO_MAX_CODE * 128];
-    buf[0] = '\0';
-    
-    /* Output code */
-    for (int i = 0; i < c->code_count; i++) {
-        strcat(buf, c->code[i]);
-        strcat(buf, "\n");
-    }
-    
-    /* Output constant table data section */
-    if (c->const_count > 0) {
-        strcat(buf, "\n; Constant data section\n");
-        char line[128];
-        snprintf(line, sizeof(line), "; Base address: 0x%04X (%d constants)\n", 
-                MILO_CONST_BASE_ADDR, c->const_count);
-        strcat(buf, line);
-        
+    /* Constant table data section, for assemblers and readers of the listing */
+    if (c->listing_enabled && c->const_count > 0) {
+        listing_append(c, "\n; Constant data section\n");
+        listing_append(c, "; Base address: 0x%04X (%d constants)\n", 
+                       MILO_CONST_BASE_ADDR, c->const_count);
         for (int i = 0; i < c->const_count; i++) {
             union { uint32_t u; float f; } conv;
             conv.u = c->constants[i];
-            snprintf(line, sizeof(line), ".data 0x%04X, 0x%08X  ; %.6f\n", 
-                    MILO_CONST_BASE_ADDR + (i * 4), c->constants[i], conv.f);
-            strcat(buf, line);
+            listing_append(c, ".data 0x%04X, 0x%08X  ; %.6f\n", 
+                           MILO_CONST_BASE_ADDR + (i * 4), c->constants[i], conv.f);
         }
     }
     
-    return buf;
+    return c->error_count == 0;
+}
+
+bool milo_glsl_compile(milo_compiler_t *c, const char *source, bool is_vertex) {
+    if (!milo_glsl_parse(c, source, is_vertex)) {
+        return false;
+    }
+    return milo_glsl_generate(c);
+}
+
+void milo_glsl_set_spec_constant(milo_compiler_t *c, int id, double value) {
+    for (int i = 0; i < c->spec_count; i++) {
+        if (c->spec[i].id == id) {
+            c->spec[i].value = value;
+            return;
+        }
+    }
+    if (c->spec_count < MILO_MAX_SPEC_CONSTANTS) {
+        c->spec[c->spec_count].id = id;
+        c->spec[c->spec_count].value = value;
+        c->spec_count++;
+    }
+}
+
+void milo_glsl_clear_spec_constants(milo_compiler_t *c) {
+    c->spec_count = 0;
+}
+
+void milo_glsl_set_listing(milo_compiler_t *c, bool enabled) {
+    c->listing_enabled = enabled;
+}
+
+const char *milo_glsl_get_asm(milo_compiler_t *c) {
+    if (!c->listing || !c->listing_enabled) return "";
+    return c->listing;
+}
+
+const uint64_t *milo_glsl_get_code(const milo_compiler_t *c, uint32_t *size) {
+    if (size) *size = (uint32_t)c->code_count;
+    return c->code;
+}
+
+const int *milo_glsl_get_lines(const milo_compiler_t *c, uint32_t *size) {
+    if (size) *size = (uint32_t)c->code_count;
+    return c->code_lines;
+}
+
+const uint32_t *milo_glsl_get_constants(const milo_compiler_t *c, uint32_t *count) {
+    if (count) *count = (uint32_t)c->const_count;
+    return c->constants;
 }
 
 int milo_glsl_get_errors(milo_compiler_t *c, const char **errors, int max) {
@@ -1364,8 +2204,28 @@ int milo_glsl_get_errors(milo_compiler_t *c, const char **errors, int max) {
 }
 
 void milo_glsl_free(milo_compiler_t *c) {
-    /* TODO: free AST nodes */
-    (void)c;
+    arena_free(&c->arena);
+    symtab_free(&c->symtab);
+    free(c->globals);
+    c->globals = NULL;
+    c->global_bucket_count = 0;
+    c->ast = NULL;
+    c->error_count = 0;
+    free(c->code);
+    free(c->code_lines);
+    free(c->label_addr);
+    free(c->fixups);
+    free(c->listing);
+    c->code = NULL;
+    c->code_lines = NULL;
+    c->label_addr = NULL;
+    c->fixups = NULL;
+    c->listing = NULL;
+    c->code_count = c->code_capacity = 0;
+    c->line_capacity = 0;
+    c->label_capacity = 0;
+    c->fixup_count = c->fixup_capacity = 0;
+    c->listing_len = c->listing_capacity = 0;
 }
 
 void milo_glsl_dump_ast(milo_compiler_t *c, FILE *out) {
@@ -5,13 +5,15 @@
  * Compiles a subset of GLSL ES 3.0 to Milo832 assembly.
  * 
  * Supported features:
- *   - Basic types: float, int, vec2, vec3, vec4, mat3, mat4
+ *   - Basic types: float, int, bool, vec2, vec3, vec4, mat3, mat4
  *   - Uniforms, inputs (in), outputs (out)
  *   - Arithmetic: +, -, *, /
  *   - Built-in functions: sin, cos, sqrt, abs, min, max, dot, normalize, etc.
  *   - Texture sampling: texture()
  *   - Control flow: if/else, for loops
  *   - Swizzling: .xyzw, .rgba
+ *   - Specialization constants: layout(constant_id = N) const float x = 1.0;
+ *     float, int (exact over the whole int range) or bool
  */
 
 #ifndef MILO_GLSL_H
@@ -38,6 +40,7 @@ typedef enum {
     TOK_VOID,
     TOK_FLOAT,
     TOK_INT,
+    TOK_BOOL,
     TOK_VEC2,
     TOK_VEC3,
     TOK_VEC4,
@@ -65,6 +68,7 @@ typedef enum {
     TOK_VERSION,
     TOK_LAYOUT,
     TOK_LOCATION,
+    TOK_CONSTANT_ID,
     
     /* Operators */
     TOK_PLUS,
@@ -130,6 +134,7 @@ typedef enum {
     TYPE_MAT3,
     TYPE_MAT4,
     TYPE_SAMPLER2D,
+    TYPE_BOOL,          /* An int, 0 or 1 */
 } milo_type_t;
 
 typedef enum {
@@ -185,6 +190,8 @@ struct milo_node {
             bool        is_out;
             bool        is_const;
             int         location;
+            int         spec_id;     /* constant_id, -1 if not a spec constant */
+            bool        referenced;  /* Reached from live code (per variant) */
             milo_node_t *init;
         } var_decl;
         
@@ -299,27 +306,72 @@ typedef struct {
     bool        is_uniform;
     bool        is_in;
     bool        is_out;
+    bool        is_const;   /* Folded at compile time, no register */
+    double      const_val;
     int         location;
     int         scope;
 } milo_symbol_t;
 
-#define MILO_MAX_SYMBOLS 256
-
+/* Growable symbol array with an open-addressed name index. Lookups return
+ * the first symbol declared with a name. */
 typedef struct {
-    milo_symbol_t symbols[MILO_MAX_SYMBOLS];
+    milo_symbol_t *symbols;
     int           count;
+    int           capacity;
+    int          *buckets;      /* Symbol index + 1, 0 = empty */
+    int           bucket_count; /* Power of two */
     int           current_scope;
 } milo_symtab_t;
 
+/*---------------------------------------------------------------------------
+ * Arena Allocator
+ *---------------------------------------------------------------------------
+ * AST nodes and error strings are bump-allocated from a chain of blocks.
+ * Parsing a new source rewinds the arena in O(1) and reuses its blocks, so
+ * a compiler reused across many shaders reaches a steady memory footprint.
+ */
+
+#define MILO_ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct milo_arena_block milo_arena_block_t;
+
+struct milo_arena_block {
+    milo_arena_block_t *next;
+    size_t              size;   /* Usable bytes after the header */
+    size_t              used;
+};
+
+typedef struct {
+    milo_arena_block_t *first;
+    milo_arena_block_t *current;
+    size_t              reserved;   /* Total bytes held by all blocks */
+} milo_arena_t;
+
 /*---------------------------------------------------------------------------
  * Compiler State
  *---------------------------------------------------------------------------*/
 
+/* Bump whenever code generation changes; part of the shader cache key */
+#define MILO_GLSL_VERSION 5
+
 #define MILO_MAX_CODE 4096
 #define MILO_MAX_ERRORS 32
 #define MILO_MAX_CONSTANTS 256
+#define MILO_MAX_SPEC_CONSTANTS 32
 #define MILO_CONST_BASE_ADDR 0x1000  /* Memory address for constant table */
 
+/* Branch target awaiting its label address */
+typedef struct {
+    int         address;    /* Instruction to patch */
+    int         label;      /* Label number (L<n>) */
+} milo_fixup_t;
+
+/* Specialization constant override, applied at variant generation time */
+typedef struct {
+    int         id;
+    double      value;      /* Exact for every int */
+} milo_spec_const_t;
+
 typedef struct {
     /* Source */
     const char *source;
@@ -330,24 +382,52 @@ typedef struct {
     milo_token_t current_token;
     milo_token_t peek_token;
     
-    /* AST */
+    /* AST (allocated from the arena) */
+    milo_arena_t arena;
     milo_node_t *ast;
     
     /* Symbol table */
     milo_symtab_t symtab;
     
-    /* Code generation */
-    char        code[MILO_MAX_CODE][128];
+    /* Global declarations of the AST by name, indexed once per parse */
+    milo_node_t **globals;      /* Open-addressed, NULL = empty */
+    int           global_bucket_count;
+    
+    /* Code generation - machine code is emitted directly */
+    uint64_t   *code;
     int         code_count;
+    int         code_capacity;
     int         next_reg;
     int         next_label;
     
+    /* Source line of each instruction (0 if none) */
+    int        *code_lines;
+    int         line_capacity;
+    int         gen_line;
+    
+    /* Label addresses (-1 until placed) and pending branch fixups */
+    int        *label_addr;
+    int         label_capacity;
+    milo_fixup_t *fixups;
+    int         fixup_count;
+    int         fixup_capacity;
+    
+    /* Optional assembly listing, built alongside the code */
+    bool        listing_enabled;
+    char       *listing;
+    size_t      listing_len;
+    size_t      listing_capacity;
+    
     /* Constant table - float constants loaded from memory */
     uint32_t    constants[MILO_MAX_CONSTANTS];
     int         const_count;
     
-    /* Errors */
-    char        errors[MILO_MAX_ERRORS][256];
+    /* Specialization constant overrides for the current variant */
+    milo_spec_const_t spec[MILO_MAX_SPEC_CONSTANTS];
+    int         spec_count;
+    
+    /* Errors (strings allocated from the arena) */
+    const char *errors[MILO_MAX_ERRORS];
     int         error_count;
     
     /* Shader type */
@@ -359,15 +439,45 @@ typedef struct {
  * API
  *---------------------------------------------------------------------------*/
 
-/* Initialize compiler */
+/* Initialize compiler. A compiler may be reused for any number of
+ * compiles; call milo_glsl_free once when done with it. */
 void milo_glsl_init(milo_compiler_t *c);
 
-/* Compile GLSL source to assembly */
+/* Compile GLSL source to assembly (parse + generate) */
 bool milo_glsl_compile(milo_compiler_t *c, const char *source, bool is_vertex);
 
-/* Get generated assembly */
+/* Parse GLSL source into an AST without generating code. Releases the
+ * previous AST; the source must outlive the compiler's use of it. */
+bool milo_glsl_parse(milo_compiler_t *c, const char *source, bool is_vertex);
+
+/* Generate code from the parsed AST using the current specialization
+ * constants. May be called repeatedly to build several variants from one
+ * parse; each call replaces the previous variant's code and constants. */
+bool milo_glsl_generate(milo_compiler_t *c);
+
+/* Override specialization constant (layout(constant_id = id)) */
+void milo_glsl_set_spec_constant(milo_compiler_t *c, int id, double value);
+
+/* Remove all specialization constant overrides (use declared defaults) */
+void milo_glsl_clear_spec_constants(milo_compiler_t *c);
+
+/* Enable or disable the assembly listing (enabled by default). Disabling
+ * it skips all text formatting during code generation. */
+void milo_glsl_set_listing(milo_compiler_t *c, bool enabled);
+
+/* Get generated assembly listing (empty if the listing is disabled) */
 const char *milo_glsl_get_asm(milo_compiler_t *c);
 
+/* Get generated machine code */
+const uint64_t *milo_glsl_get_code(const milo_compiler_t *c, uint32_t *size);
+
+/* Get the GLSL source line each instruction was generated from (0 for
+ * none); parallel to the machine code */
+const int *milo_glsl_get_lines(const milo_compiler_t *c, uint32_t *size);
+
+/* Get constant table (loaded at MILO_CONST_BASE_ADDR) */
+const uint32_t *milo_glsl_get_constants(const milo_compiler_t *c, uint32_t *count);
+
 /* Get error messages */
 int milo_glsl_get_errors(milo_compiler_t *c, const char **errors, int max);
 
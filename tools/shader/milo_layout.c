@@ -0,0 +1,604 @@
+/*
+ * milo_layout.c
+ * Milo832 Shader Code Layout Optimizer - Implementation
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "milo_layout.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#define IMM32_MASK      0xFFFFFFFFULL
+
+/* Static weight: executions per entry grow 8x per loop level, capped */
+#define LOOP_WEIGHT     8.0
+#define MAX_LOOP_DEPTH  5
+
+#define NONE            (-1)
+
+typedef struct {
+    uint32_t start;             /* First instruction */
+    uint32_t end;               /* One past the last instruction */
+    int32_t  fall;              /* Block reached by falling through */
+    int32_t  target;            /* Block a bra/beq/bne goes to */
+    int32_t  proc;
+    uint32_t depth;             /* Loop nesting (static estimate) */
+    double   weight;            /* Estimated executions */
+    double   taken;             /* Probability a beq/bne is taken */
+    bool     cold;
+    bool     placed;
+    uint32_t new_start;
+    int32_t  next;              /* Block laid out after this one */
+} block_t;
+
+typedef struct {
+    int32_t  entry;             /* Entry block */
+    bool     placed;
+} proc_t;
+
+/* Working state of one run */
+typedef struct {
+    milo_layout_t   *lo;
+    const milo_obj_t *obj;
+    uint8_t         *reloc;     /* Relocation type per instruction, 0 if none */
+    bool            *leader;
+    int32_t         *block_of;  /* Block containing each instruction */
+    block_t         *blocks;
+    uint32_t         block_count;
+    proc_t          *procs;
+    uint32_t         proc_count;
+    int32_t         *order;     /* Blocks in output order */
+    uint32_t         order_count;
+} layout_state_t;
+
+static void set_error(milo_layout_t *lo, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(lo->error, sizeof(lo->error), fmt, args);
+    va_end(args);
+}
+
+static uint8_t op_of(uint64_t word) {
+    return (uint8_t)(word >> 56);
+}
+
+static bool is_branch(uint8_t op) {
+    return op == OP_BRA || op == OP_BEQ || op == OP_BNE;
+}
+
+/* Instructions after which execution does not fall through */
+static bool ends_flow(uint8_t op) {
+    return op == OP_BRA || op == OP_RET || op == OP_EXIT;
+}
+
+static bool has_code_target(uint8_t op) {
+    return is_branch(op) || op == OP_SSY || op == OP_CALL;
+}
+
+/*---------------------------------------------------------------------------
+ * Profiles
+ *---------------------------------------------------------------------------*/
+
+void milo_layout_init(milo_layout_t *lo) {
+    memset(lo, 0, sizeof(*lo));
+    lo->cold_percent = 1;
+    milo_obj_builder_init(&lo->out);
+}
+
+void milo_layout_free(milo_layout_t *lo) {
+    milo_obj_builder_free(&lo->out);
+    free(lo->profile_store);
+    lo->profile_store = NULL;
+    lo->profile = NULL;
+    lo->profile_size = 0;
+}
+
+bool milo_layout_load_profile(milo_layout_t *lo, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        set_error(lo, "Cannot open profile '%s'", path);
+        return false;
+    }
+    
+    uint64_t *counts = NULL;
+    uint32_t size = 0;
+    char line[256];
+    int line_num = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f)) {
+        line_num++;
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') continue;
+        
+        char *pc_end, *count_end;
+        unsigned long pc = strtoul(p, &pc_end, 16);
+        unsigned long long count = strtoull(pc_end, &count_end, 10);
+        if (pc_end == p || count_end == pc_end ||
+            pc >= MILO_SHADER_REGION_SIZE / sizeof(uint64_t)) {
+            set_error(lo, "%.150s:%d: Expected \"<pc hex> <count>\"", path, line_num);
+            ok = false;
+            break;
+        }
+        if (pc >= size) {
+            uint64_t *grown = realloc(counts, (pc + 1) * sizeof(uint64_t));
+            if (!grown) {
+                set_error(lo, "Out of memory");
+                ok = false;
+                break;
+            }
+            memset(grown + size, 0, (pc + 1 - size) * sizeof(uint64_t));
+            counts = grown;
+            size = (uint32_t)pc + 1;
+        }
+        counts[pc] = count;
+    }
+    fclose(f);
+    
+    if (!ok) {
+        free(counts);
+        return false;
+    }
+    free(lo->profile_store);
+    lo->profile_store = counts;
+    lo->profile = counts;
+    lo->profile_size = size;
+    return true;
+}
+
+/*---------------------------------------------------------------------------
+ * Control Flow Graph
+ *---------------------------------------------------------------------------*/
+
+static uint32_t target_of(const layout_state_t *st, uint32_t pc) {
+    return (uint32_t)st->obj->code[pc];
+}
+
+static bool build_blocks(layout_state_t *st) {
+    const milo_obj_t *obj = st->obj;
+    uint32_t n = obj->code_size;
+    
+    for (uint32_t i = 0; i < obj->reloc_count; i++) {
+        const milo_obj_reloc_t *r = &obj->relocs[i];
+        if (r->type == MILO_RELOC_SYMBOL) {
+            set_error(st->lo, "Unresolved symbol reference at 0x%04X; link first", r->address);
+            return false;
+        }
+        st->reloc[r->address] = (uint8_t)r->type;
+    }
+    
+    st->leader[0] = true;
+    if (obj->header->entry < n) st->leader[obj->header->entry] = true;
+    for (uint32_t i = 0; i < obj->symbol_count; i++) {
+        uint32_t value = obj->symbols[i].value;
+        if (!(obj->symbols[i].flags & MILO_SYMF_UNDEF) && value < n) st->leader[value] = true;
+    }
+    for (uint32_t pc = 0; pc < n; pc++) {
+        uint8_t op = op_of(obj->code[pc]);
+        if (has_code_target(op) && st->reloc[pc] != MILO_RELOC_CODE) {
+            set_error(st->lo, "Branch at 0x%04X has no code relocation", pc);
+            return false;
+        }
+        if (st->reloc[pc] == MILO_RELOC_CODE) {
+            if (target_of(st, pc) >= n) {
+                set_error(st->lo, "Code reference at 0x%04X to 0x%04X outside code",
+                          pc, target_of(st, pc));
+                return false;
+            }
+            st->leader[target_of(st, pc)] = true;
+        }
+        if ((is_branch(op) || ends_flow(op)) && pc + 1 < n) st->leader[pc + 1] = true;
+    }
+    
+    for (uint32_t pc = 0; pc < n; pc++) {
+        if (st->leader[pc]) {
+            block_t *b = &st->blocks[st->block_count++];
+            memset(b, 0, sizeof(*b));
+            b->start = pc;
+            b->proc = NONE;
+            b->next = NONE;
+        }
+        st->blocks[st->block_count - 1].end = pc + 1;
+        st->block_of[pc] = (int32_t)st->block_count - 1;
+    }
+    
+    for (uint32_t i = 0; i < st->block_count; i++) {
+        block_t *b = &st->blocks[i];
+        uint32_t last = b->end - 1;
+        uint8_t op = op_of(obj->code[last]);
+        b->target = is_branch(op) ? st->block_of[target_of(st, last)] : NONE;
+        if (ends_flow(op)) {
+            b->fall = NONE;
+        } else if (b->end < n) {
+            b->fall = (int32_t)i + 1;
+        } else {
+            set_error(st->lo, "Execution falls off the end of code at 0x%04X", last);
+            return false;
+        }
+        
+        /* Backward branches close a loop over [target, here] */
+        if (b->target != NONE && b->target <= (int32_t)i) {
+            for (int32_t j = b->target; j <= (int32_t)i; j++) st->blocks[j].depth++;
+        }
+    }
+    return true;
+}
+
+static void add_proc(layout_state_t *st, uint32_t pc) {
+    int32_t block = st->block_of[pc];
+    for (uint32_t i = 0; i < st->proc_count; i++) {
+        if (st->procs[i].entry == block) return;
+    }
+    st->procs[st->proc_count].entry = block;
+    st->procs[st->proc_count].placed = false;
+    st->proc_count++;
+}
+
+static int compare_procs(const void *a, const void *b) {
+    const proc_t *pa = a, *pb = b;
+    return (pa->entry > pb->entry) - (pa->entry < pb->entry);
+}
+
+/* Procedures start at the entry, at symbols and at call targets; each
+ * claims the blocks it reaches (branches and sync points, not calls) that
+ * no earlier procedure claimed */
+static void find_procs(layout_state_t *st, int32_t *queue) {
+    const milo_obj_t *obj = st->obj;
+    add_proc(st, obj->header->entry < obj->code_size ? obj->header->entry : 0);
+    for (uint32_t i = 0; i < obj->symbol_count; i++) {
+        if (!(obj->symbols[i].flags & MILO_SYMF_UNDEF) && obj->symbols[i].value < obj->code_size) {
+            add_proc(st, obj->symbols[i].value);
+        }
+    }
+    for (uint32_t pc = 0; pc < obj->code_size; pc++) {
+        if (op_of(obj->code[pc]) == OP_CALL) add_proc(st, target_of(st, pc));
+    }
+    qsort(st->procs, st->proc_count, sizeof(proc_t), compare_procs);
+    
+    uint32_t kept = 0;
+    for (uint32_t p = 0; p < st->proc_count; p++) {
+        int32_t entry = st->procs[p].entry;
+        if (st->blocks[entry].proc != NONE) continue;   /* Inside another */
+        st->procs[kept] = st->procs[p];
+        
+        uint32_t head = 0, tail = 0;
+        st->blocks[entry].proc = (int32_t)kept;
+        queue[tail++] = entry;
+        while (head < tail) {
+            const block_t *b = &st->blocks[queue[head++]];
+            for (uint32_t pc = b->start; pc < b->end; pc++) {
+                if (st->reloc[pc] != MILO_RELOC_CODE || op_of(obj->code[pc]) == OP_CALL) continue;
+                int32_t succ = st->block_of[target_of(st, pc)];
+                if (st->blocks[succ].proc == NONE) {
+                    st->blocks[succ].proc = (int32_t)kept;
+                    queue[tail++] = succ;
+                }
+            }
+            if (b->fall != NONE && st->blocks[b->fall].proc == NONE) {
+                st->blocks[b->fall].proc = (int32_t)kept;
+                queue[tail++] = b->fall;
+            }
+        }
+        kept++;
+    }
+    st->proc_count = kept;
+}
+
+/*---------------------------------------------------------------------------
+ * Hotness
+ *---------------------------------------------------------------------------*/
+
+static void estimate_weights(layout_state_t *st) {
+    const milo_layout_t *lo = st->lo;
+    
+    for (uint32_t i = 0; i < st->block_count; i++) {
+        block_t *b = &st->blocks[i];
+        if (lo->profile) {
+            b->weight = b->start < lo->profile_size ? (double)lo->profile[b->start] : 0.0;
+        } else {
+            uint32_t depth = b->depth < MAX_LOOP_DEPTH ? b->depth : MAX_LOOP_DEPTH;
+            b->weight = 1.0;
+            for (uint32_t d = 0; d < depth; d++) b->weight *= LOOP_WEIGHT;
+        }
+    }
+    
+    for (uint32_t i = 0; i < st->block_count; i++) {
+        block_t *b = &st->blocks[i];
+        if (b->proc == NONE) continue;
+        const block_t *entry = &st->blocks[st->procs[b->proc].entry];
+        if (b == entry) continue;
+        if (lo->profile) {
+            /* Procedures the profile never entered stay as they are */
+            b->cold = entry->weight > 0.0 &&
+                      b->weight * 100.0 < entry->weight * lo->cold_percent;
+        } else if (op_of(st->obj->code[b->end - 1]) == OP_EXIT) {
+            /* An exit before the procedure's last one is an early out */
+            for (uint32_t j = i + 1; j < st->block_count; j++) {
+                const block_t *later = &st->blocks[j];
+                if (later->proc == b->proc && op_of(st->obj->code[later->end - 1]) == OP_EXIT) {
+                    b->cold = true;
+                    b->weight = 0.0;
+                    break;
+                }
+            }
+        }
+    }
+    
+    for (uint32_t i = 0; i < st->block_count; i++) {
+        block_t *b = &st->blocks[i];
+        b->taken = 0.5;
+        if (b->target != NONE && b->fall != NONE) {
+            double wt = st->blocks[b->target].weight, wf = st->blocks[b->fall].weight;
+            if (wt + wf > 0.0) b->taken = wt / (wt + wf);
+        } else if (b->target != NONE) {
+            b->taken = 1.0;
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------
+ * Ordering
+ *---------------------------------------------------------------------------*/
+
+static void place_block(layout_state_t *st, int32_t block) {
+    st->blocks[block].placed = true;
+    st->order[st->order_count++] = block;
+}
+
+static bool is_candidate(const layout_state_t *st, int32_t block, int32_t proc) {
+    return block != NONE && !st->blocks[block].placed && !st->blocks[block].cold &&
+           st->blocks[block].proc == proc;
+}
+
+/* Chain a procedure's blocks so the hottest successor falls through */
+static void place_chain(layout_state_t *st, int32_t proc) {
+    int32_t cur = st->procs[proc].entry;
+    uint32_t scan = 0;
+    while (cur != NONE) {
+        place_block(st, cur);
+        const block_t *b = &st->blocks[cur];
+        
+        int32_t next = NONE;
+        if (is_candidate(st, b->fall, proc)) next = b->fall;
+        if (is_candidate(st, b->target, proc) &&
+            (next == NONE || st->blocks[b->target].weight > st->blocks[next].weight)) {
+            next = b->target;
+        }
+        while (next == NONE && scan < st->block_count) {
+            if (is_candidate(st, (int32_t)scan, proc)) next = (int32_t)scan;
+            scan++;
+        }
+        cur = next;
+    }
+}
+
+/* Place a procedure, then the procedures it calls right behind it */
+static void place_proc(layout_state_t *st, int32_t proc) {
+    if (st->procs[proc].placed) return;
+    st->procs[proc].placed = true;
+    place_chain(st, proc);
+    
+    const milo_obj_t *obj = st->obj;
+    for (uint32_t i = 0; i < st->block_count; i++) {
+        const block_t *b = &st->blocks[i];
+        if (b->proc != proc) continue;
+        for (uint32_t pc = b->start; pc < b->end; pc++) {
+            if (op_of(obj->code[pc]) != OP_CALL) continue;
+            int32_t callee = st->blocks[st->block_of[target_of(st, pc)]].proc;
+            if (callee != NONE) place_proc(st, callee);
+        }
+    }
+}
+
+static int32_t proc_of_symbol(const layout_state_t *st, const char *name) {
+    uint32_t value;
+    if (!milo_obj_find_symbol(st->obj, name, &value) || value >= st->obj->code_size) {
+        return NONE;
+    }
+    return st->blocks[st->block_of[value]].proc;
+}
+
+static bool order_blocks(layout_state_t *st) {
+    milo_layout_t *lo = st->lo;
+    
+    for (uint32_t i = 0; i < lo->frame_count; i++) {
+        int32_t proc = proc_of_symbol(st, lo->frame[i]);
+        if (proc == NONE) {
+            set_error(lo, "Frame shader '%s' not found", lo->frame[i]);
+            return false;
+        }
+        place_proc(st, proc);
+    }
+    
+    /* The rest hottest first when profiled, else in original order */
+    for (;;) {
+        int32_t best = NONE;
+        for (uint32_t p = 0; p < st->proc_count; p++) {
+            if (st->procs[p].placed) continue;
+            if (best == NONE) best = (int32_t)p;
+            if (!lo->profile) break;
+            if (st->blocks[st->procs[p].entry].weight >
+                st->blocks[st->procs[best].entry].weight) {
+                best = (int32_t)p;
+            }
+        }
+        if (best == NONE) break;
+        place_proc(st, best);
+    }
+    
+    /* Cold and unreachable blocks out of line, in original order */
+    for (uint32_t i = 0; i < st->block_count; i++) {
+        if (!st->blocks[i].placed) place_block(st, (int32_t)i);
+    }
+    
+    for (uint32_t i = 0; i + 1 < st->order_count; i++) {
+        st->blocks[st->order[i]].next = st->order[i + 1];
+    }
+    return true;
+}
+
+/* Weighted count of taken branches and inserted jumps, given each block's
+ * layout successor in next (original order: the block that follows) */
+static double count_breaks(const layout_state_t *st, bool original) {
+    double breaks = 0.0;
+    for (uint32_t i = 0; i < st->block_count; i++) {
+        const block_t *b = &st->blocks[i];
+        int32_t next = original ? (i + 1 < st->block_count ? (int32_t)i + 1 : NONE) : b->next;
+        if (b->target != NONE && b->target != next) {
+            breaks += b->weight * (b->fall != NONE ? b->taken : 1.0);
+        }
+        if (b->fall != NONE && b->fall != next) {
+            breaks += b->weight * (b->target != NONE ? 1.0 - b->taken : 1.0);
+        }
+    }
+    return breaks;
+}
+
+/*---------------------------------------------------------------------------
+ * Emission
+ *---------------------------------------------------------------------------*/
+
+/* Unconditional branch as the assembler encodes "bra <target>" */
+static uint64_t encode_bra(uint32_t target) {
+    milo_inst_t inst = {0};
+    inst.opcode = OP_BRA;
+    inst.has_imm = true;
+    return (milo_encode_inst(&inst) & ~IMM32_MASK) | target;
+}
+
+static bool needs_jump(const block_t *b) {
+    return b->fall != NONE && b->fall != b->next && b->target != b->next;
+}
+
+static bool emit(layout_state_t *st, uint32_t *new_pc) {
+    milo_layout_t *lo = st->lo;
+    milo_obj_builder_t *out = &lo->out;
+    const milo_obj_t *obj = st->obj;
+    
+    uint32_t addr = 0;
+    for (uint32_t i = 0; i < st->order_count; i++) {
+        block_t *b = &st->blocks[st->order[i]];
+        b->new_start = addr;
+        for (uint32_t pc = b->start; pc < b->end; pc++) new_pc[pc] = addr++;
+        if (needs_jump(b)) addr++;
+    }
+    
+    for (uint32_t i = 0; i < st->order_count; i++) {
+        const block_t *b = &st->blocks[st->order[i]];
+        for (uint32_t pc = b->start; pc < b->end; pc++) {
+            uint64_t word = obj->code[pc];
+            uint8_t type = st->reloc[pc];
+            if (type == MILO_RELOC_CODE) {
+                uint32_t target = new_pc[target_of(st, pc)];
+                uint8_t op = op_of(word);
+                if (pc == b->end - 1 && (op == OP_BEQ || op == OP_BNE) &&
+                    b->target == b->next && b->fall != b->next) {
+                    /* Hot path falls through: branch to the old fallthrough */
+                    word = (word & ~(0xFFULL << 56)) | ((uint64_t)(op ^ 1) << 56);
+                    target = st->blocks[b->fall].new_start;
+                    lo->inverted++;
+                }
+                word = (word & ~IMM32_MASK) | target;
+            }
+            if (!milo_obj_add_code(out, &word, 1)) return false;
+            if (type && !milo_obj_add_reloc(out, new_pc[pc], type, 0)) return false;
+        }
+        if (needs_jump(b)) {
+            uint64_t word = encode_bra(st->blocks[b->fall].new_start);
+            if (!milo_obj_add_code(out, &word, 1) ||
+                !milo_obj_add_reloc(out, out->code_size - 1, MILO_RELOC_CODE, 0)) {
+                return false;
+            }
+            lo->jumps_added++;
+        }
+    }
+    
+    for (uint32_t i = 0; i < obj->symbol_count; i++) {
+        const milo_obj_symbol_t *sym = &obj->symbols[i];
+        uint32_t value = sym->value;
+        if (!(sym->flags & MILO_SYMF_UNDEF)) {
+            value = value < obj->code_size ? new_pc[value] : out->code_size;
+        }
+        if (milo_obj_add_symbol(out, obj->strings + sym->name, value, sym->flags) < 0) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < obj->reflect_count; i++) {
+        if (!milo_obj_add_reflect(out, &obj->reflect[i])) return false;
+    }
+    if (!milo_obj_add_constants(out, obj->constants, obj->const_count)) return false;
+    
+    out->flags = obj->header->flags;
+    out->const_base = obj->const_base;
+    out->entry = obj->header->entry < obj->code_size ? new_pc[obj->header->entry] : 0;
+    return true;
+}
+
+/*---------------------------------------------------------------------------
+ * Public API
+ *---------------------------------------------------------------------------*/
+
+bool milo_layout_run(milo_layout_t *lo, const milo_obj_t *obj) {
+    milo_obj_reset(&lo->out);
+    lo->block_count = lo->proc_count = lo->cold_count = 0;
+    lo->inverted = lo->jumps_added = 0;
+    lo->breaks_before = lo->breaks_after = 0.0;
+    lo->error[0] = '\0';
+    
+    uint32_t n = obj->code_size;
+    if (n == 0) {
+        set_error(lo, "No code");
+        return false;
+    }
+    
+    layout_state_t st = {0};
+    st.lo = lo;
+    st.obj = obj;
+    st.reloc = calloc(n, sizeof(uint8_t));
+    st.leader = calloc(n, sizeof(bool));
+    st.block_of = calloc(n, sizeof(int32_t));
+    st.blocks = calloc(n, sizeof(block_t));
+    st.procs = calloc(n, sizeof(proc_t));
+    st.order = calloc(n, sizeof(int32_t));
+    int32_t *queue = calloc(n, sizeof(int32_t));
+    uint32_t *new_pc = calloc(n, sizeof(uint32_t));
+    
+    bool ok = st.reloc && st.leader && st.block_of && st.blocks && st.procs &&
+              st.order && queue && new_pc;
+    if (!ok) set_error(lo, "Out of memory");
+    
+    ok = ok && build_blocks(&st);
+    if (ok) {
+        find_procs(&st, queue);
+        estimate_weights(&st);
+        ok = order_blocks(&st);
+    }
+    if (ok) {
+        lo->block_count = st.block_count;
+        lo->proc_count = st.proc_count;
+        for (uint32_t i = 0; i < st.block_count; i++) {
+            if (st.blocks[i].cold) lo->cold_count++;
+        }
+        lo->breaks_before = count_breaks(&st, true);
+        lo->breaks_after = count_breaks(&st, false);
+        ok = emit(&st, new_pc);
+        if (!ok && !lo->error[0]) set_error(lo, "%s", lo->out.error);
+    }
+    
+    free(st.reloc);
+    free(st.leader);
+    free(st.block_of);
+    free(st.blocks);
+    free(st.procs);
+    free(st.order);
+    free(queue);
+    free(new_pc);
+    return ok;
+}
+
+const char *milo_layout_get_error(const milo_layout_t *lo) {
+    return lo->error;
+}
@@ -0,0 +1,66 @@
+/*
+ * milo_layout.h
+ * Milo832 Shader Code Layout Optimizer - Header
+ *
+ * Post-link pass over an object image that reorders basic blocks for
+ * instruction-fetch locality:
+ *   - within each procedure (shader entry or called routine), blocks are
+ *     chained so the hottest successor is the fall-through; conditional
+ *     branches are inverted (beq <-> bne) where that keeps the hot path
+ *     sequential and an unconditional bra is added where it cannot;
+ *   - cold blocks (early exits such as discard, or blocks rarely executed
+ *     in a profile) move out of line to the end of the image;
+ *   - procedures are packed so shaders used together in a frame, and the
+ *     routines they call, are adjacent.
+ *
+ * Hotness comes from a per-PC execution profile of the input image, or
+ * from static estimates (8x per loop nesting level, early exits cold).
+ * All code addresses are rewritten through the image's relocations, so
+ * the input must be fully linked or self-contained.
+ */
+
+#ifndef MILO_LAYOUT_H
+#define MILO_LAYOUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "milo_obj.h"
+
+typedef struct {
+    /* Options */
+    const uint64_t     *profile;        /* Executions per input PC, or NULL */
+    uint32_t            profile_size;
+    const char *const  *frame;          /* Entry symbols in order of use */
+    uint32_t            frame_count;
+    uint32_t            cold_percent;   /* Profiled blocks run less than this
+                                         * percentage of their entry are cold */
+    
+    /* Results */
+    milo_obj_builder_t  out;
+    uint32_t            block_count;
+    uint32_t            proc_count;
+    uint32_t            cold_count;
+    uint32_t            inverted;       /* Conditional branches flipped */
+    uint32_t            jumps_added;
+    double              breaks_before;  /* Estimated non-sequential fetches */
+    double              breaks_after;
+    
+    /* Private */
+    uint64_t           *profile_store;
+    char                error[256];
+} milo_layout_t;
+
+void milo_layout_init(milo_layout_t *lo);
+void milo_layout_free(milo_layout_t *lo);
+
+/* Load a profile: one "<pc hex> <count>" line per instruction; lines
+ * starting with '#' are ignored */
+bool milo_layout_load_profile(milo_layout_t *lo, const char *path);
+
+/* Lay out obj into lo->out */
+bool milo_layout_run(milo_layout_t *lo, const milo_obj_t *obj);
+
+/* Get error message */
+const char *milo_layout_get_error(const milo_layout_t *lo);
+
+#endif /* MILO_LAYOUT_H */
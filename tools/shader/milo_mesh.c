@@ -0,0 +1,289 @@
+/*
+ * milo_mesh.c
+ * Milo832 Test Meshes - Implementation
+ */
+
+#include "milo_mesh.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PI 3.14159265358979f
+
+static bool mesh_alloc(milo_mesh_t *mesh, uint32_t vertex_count, uint32_t index_count) {
+    memset(mesh, 0, sizeof(*mesh));
+    mesh->vertices = calloc(vertex_count, sizeof(milo_vertex_in_t));
+    mesh->indices = calloc(index_count, sizeof(uint32_t));
+    if (!mesh->vertices || !mesh->indices) {
+        milo_mesh_free(mesh);
+        return false;
+    }
+    return true;
+}
+
+void milo_mesh_free(milo_mesh_t *mesh) {
+    free(mesh->vertices);
+    free(mesh->indices);
+    memset(mesh, 0, sizeof(*mesh));
+}
+
+static void set_color(milo_vertex_in_t *v, uint32_t rgb) {
+    v->r = (float)((rgb >> 16) & 0xFF) / 255.0f;
+    v->g = (float)((rgb >> 8) & 0xFF) / 255.0f;
+    v->b = (float)(rgb & 0xFF) / 255.0f;
+    v->a = 1.0f;
+}
+
+/* Append a flat-shaded triangle, wound counter-clockwise seen from outside
+ * a convex mesh around the origin */
+static void add_face(milo_mesh_t *mesh, const float p[3][3], const float uv[3][2],
+                     uint32_t rgb) {
+    float e1[3], e2[3], n[3];
+    for (int k = 0; k < 3; k++) {
+        e1[k] = p[1][k] - p[0][k];
+        e2[k] = p[2][k] - p[0][k];
+    }
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    float out = n[0] * (p[0][0] + p[1][0] + p[2][0]) + n[1] * (p[0][1] + p[1][1] + p[2][1]) +
+                n[2] * (p[0][2] + p[1][2] + p[2][2]);
+    float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (out < 0.0f) len = -len;
+    
+    static const int keep[3] = { 0, 1, 2 }, swap[3] = { 0, 2, 1 };
+    const int *order = out < 0.0f ? swap : keep;
+    for (int i = 0; i < 3; i++) {
+        milo_vertex_in_t *v = &mesh->vertices[mesh->vertex_count];
+        const float *q = p[order[i]];
+        v->x = q[0];
+        v->y = q[1];
+        v->z = q[2];
+        v->u = uv[order[i]][0];
+        v->v = uv[order[i]][1];
+        v->nx = n[0] / len;
+        v->ny = n[1] / len;
+        v->nz = n[2] / len;
+        set_color(v, rgb);
+        mesh->indices[mesh->index_count++] = mesh->vertex_count++;
+    }
+}
+
+/*---------------------------------------------------------------------------
+ * Meshes
+ *---------------------------------------------------------------------------*/
+
+bool milo_mesh_cube(milo_mesh_t *mesh) {
+    /* Face normal and the two axes spanning it, in tb_render_cube.vhd face
+     * order (front, back, left, right, top, bottom) and colors */
+    static const float faces[6][3][3] = {
+        { {  0,  0,  1 }, {  1, 0, 0 }, { 0, 1,  0 } },
+        { {  0,  0, -1 }, { -1, 0, 0 }, { 0, 1,  0 } },
+        { { -1,  0,  0 }, {  0, 0, 1 }, { 0, 1,  0 } },
+        { {  1,  0,  0 }, {  0, 0, -1 }, { 0, 1,  0 } },
+        { {  0,  1,  0 }, {  1, 0, 0 }, { 0, 0, -1 } },
+        { {  0, -1,  0 }, {  1, 0, 0 }, { 0, 0,  1 } }
+    };
+    static const uint32_t colors[6] = {
+        0xFF4444, 0x44FF44, 0x4444FF, 0xFFFF44, 0xFF44FF, 0x44FFFF
+    };
+    static const float corner[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+    if (!mesh_alloc(mesh, 24, 36)) return false;
+    
+    for (int f = 0; f < 6; f++) {
+        uint32_t base = mesh->vertex_count;
+        for (int c = 0; c < 4; c++) {
+            milo_vertex_in_t *v = &mesh->vertices[mesh->vertex_count++];
+            float a = corner[c][0], b = corner[c][1];
+            v->x = faces[f][0][0] + a * faces[f][1][0] + b * faces[f][2][0];
+            v->y = faces[f][0][1] + a * faces[f][1][1] + b * faces[f][2][1];
+            v->z = faces[f][0][2] + a * faces[f][1][2] + b * faces[f][2][2];
+            v->u = (a + 1.0f) * 0.5f;
+            v->v = (1.0f - b) * 0.5f;
+            v->nx = faces[f][0][0];
+            v->ny = faces[f][0][1];
+            v->nz = faces[f][0][2];
+            set_color(v, colors[f]);
+        }
+        static const uint32_t quad[6] = { 0, 1, 2, 0, 2, 3 };
+        for (int i = 0; i < 6; i++) mesh->indices[mesh->index_count++] = base + quad[i];
+    }
+    mesh->radius = sqrtf(3.0f);
+    return true;
+}
+
+bool milo_mesh_pyramid(milo_mesh_t *mesh) {
+    static const float base[4][3] = {
+        { -16, -16, -16 }, { 16, -16, -16 }, { 16, -16, 16 }, { -16, -16, 16 }
+    };
+    static const float apex[3] = { 0, 16, 0 };
+    static const float side_uv[3][2] = { { 0, 1 }, { 1, 1 }, { 0.5f, 0 } };
+    static const uint32_t colors[5] = { 0xFF4444, 0x44FF44, 0x4444FF, 0xFFFF44, 0x808080 };
+    if (!mesh_alloc(mesh, 18, 18)) return false;
+    
+    for (int i = 0; i < 4; i++) {
+        float p[3][3];
+        memcpy(p[0], base[i], sizeof(p[0]));
+        memcpy(p[1], base[(i + 1) % 4], sizeof(p[1]));
+        memcpy(p[2], apex, sizeof(p[2]));
+        add_face(mesh, p, side_uv, colors[i]);
+    }
+    for (int i = 0; i < 2; i++) {
+        float p[3][3], uv[3][2];
+        static const int tri[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
+        for (int k = 0; k < 3; k++) {
+            memcpy(p[k], base[tri[i][k]], sizeof(p[k]));
+            uv[k][0] = (base[tri[i][k]][0] + 16.0f) / 32.0f;
+            uv[k][1] = (base[tri[i][k]][2] + 16.0f) / 32.0f;
+        }
+        add_face(mesh, p, uv, colors[4]);
+    }
+    mesh->radius = sqrtf(3.0f) * 16.0f;
+    return true;
+}
+
+bool milo_mesh_torus(milo_mesh_t *mesh, uint32_t ring_segments, uint32_t tube_segments) {
+    const float major = 16.0f, minor = 8.0f;
+    if (ring_segments < 3 || tube_segments < 3) return false;
+    
+    /* The seams repeat a row and column of vertices for the texture wrap */
+    uint32_t columns = tube_segments + 1;
+    if (!mesh_alloc(mesh, (ring_segments + 1) * columns, ring_segments * tube_segments * 6)) {
+        return false;
+    }
+    for (uint32_t i = 0; i <= ring_segments; i++) {
+        float phi = 2.0f * PI * (float)i / (float)ring_segments;
+        for (uint32_t j = 0; j <= tube_segments; j++) {
+            float theta = 2.0f * PI * (float)j / (float)tube_segments;
+            milo_vertex_in_t *v = &mesh->vertices[mesh->vertex_count++];
+            v->nx = cosf(theta) * cosf(phi);
+            v->ny = cosf(theta) * sinf(phi);
+            v->nz = sinf(theta);
+            v->x = (major + minor * cosf(theta)) * cosf(phi);
+            v->y = (major + minor * cosf(theta)) * sinf(phi);
+            v->z = minor * v->nz;
+            v->u = (float)i / (float)ring_segments;
+            v->v = (float)j / (float)tube_segments;
+            v->r = 0.5f + 0.5f * cosf(phi);
+            v->g = 0.5f + 0.5f * sinf(phi);
+            v->b = 0.5f + 0.5f * v->nz;
+            v->a = 1.0f;
+        }
+    }
+    
+    /* Ring then tube direction is counter-clockwise from outside */
+    for (uint32_t i = 0; i < ring_segments; i++) {
+        for (uint32_t j = 0; j < tube_segments; j++) {
+            uint32_t a = i * columns + j, b = (i + 1) * columns + j;
+            uint32_t quad[6] = { a, b, b + 1, a, b + 1, a + 1 };
+            for (int k = 0; k < 6; k++) mesh->indices[mesh->index_count++] = quad[k];
+        }
+    }
+    mesh->radius = major + minor;
+    return true;
+}
+
+/*---------------------------------------------------------------------------
+ * Transform
+ *---------------------------------------------------------------------------*/
+
+void milo_mesh_transform(const milo_mesh_t *mesh, const milo_mesh_view_t *view,
+                         milo_vertex_out_t *out) {
+    float cx = cosf(view->angle_x), sx = sinf(view->angle_x);
+    float cy = cosf(view->angle_y), sy = sinf(view->angle_y);
+    float f = 1.0f / tanf(view->fov_y * 0.5f);
+    float near = view->distance / 16.0f, far = view->distance * 4.0f;
+    
+    for (uint32_t i = 0; i < mesh->vertex_count; i++) {
+        const milo_vertex_in_t *v = &mesh->vertices[i];
+        milo_vertex_out_t *o = &out[i];
+        
+        /* Rotate about y, then x (as TB/visualize_*.py) */
+        float x1 = v->x * cy + v->z * sy;
+        float z1 = v->z * cy - v->x * sy;
+        float y2 = v->y * cx - z1 * sx;
+        float z2 = z1 * cx + v->y * sx;
+        float nx1 = v->nx * cy + v->nz * sy;
+        float nz1 = v->nz * cy - v->nx * sy;
+        
+        /* Eye looks down -z; OpenGL-style projection */
+        float ze = z2 - view->distance;
+        o->x = x1 * f / view->aspect;
+        o->y = y2 * f;
+        o->z = (far + near) / (near - far) * ze + 2.0f * far * near / (near - far);
+        o->w = -ze;
+        o->u = v->u;
+        o->v = v->v;
+        o->r = v->r;
+        o->g = v->g;
+        o->b = v->b;
+        o->a = v->a;
+        o->nx = nx1;
+        o->ny = v->ny * cx - nz1 * sx;
+        o->nz = nz1 * cx + v->ny * sx;
+    }
+}
+
+void milo_mesh_view_matrix(const milo_mesh_view_t *view, float m[16]) {
+    float cx = cosf(view->angle_x), sx = sinf(view->angle_x);
+    float cy = cosf(view->angle_y), sy = sinf(view->angle_y);
+    float f = 1.0f / tanf(view->fov_y * 0.5f);
+    float near = view->distance / 16.0f, far = view->distance * 4.0f;
+    float a = (far + near) / (near - far), b = 2.0f * far * near / (near - far);
+    
+    /* Rows of the rotation; eye z is row 2 minus the distance */
+    const float rot[3][3] = {
+        { cy, 0.0f, sy },
+        { sx * sy, cx, -sx * cy },
+        { -cx * sy, sx, cx * cy }
+    };
+    const float scale[4] = { f / view->aspect, f, a, -1.0f };
+    const float offset[4] = { 0.0f, 0.0f, b - a * view->distance, view->distance };
+    for (int row = 0; row < 4; row++) {
+        const float *r = rot[row < 2 ? row : 2];
+        for (int col = 0; col < 3; col++) m[col * 4 + row] = scale[row] * r[col];
+        m[12 + row] = offset[row];
+    }
+}
+
+/* Clip position = m * (x, y, z, 1) with m column-major at byte 0 of
+ * memory, each row accumulated from the last column with ffma */
+static const char *mvp_asm =
+    "main:\n"
+    "    ldr r20, r0, 48\n"
+    "    ldr r30, r0, 32\n"
+    "    ffma r20, r30, r4, r20\n"
+    "    ldr r30, r0, 16\n"
+    "    ffma r20, r30, r3, r20\n"
+    "    ldr r30, r0, 0\n"
+    "    ffma r20, r30, r2, r20\n"
+    "    ldr r21, r0, 52\n"
+    "    ldr r30, r0, 36\n"
+    "    ffma r21, r30, r4, r21\n"
+    "    ldr r30, r0, 20\n"
+    "    ffma r21, r30, r3, r21\n"
+    "    ldr r30, r0, 4\n"
+    "    ffma r21, r30, r2, r21\n"
+    "    ldr r22, r0, 56\n"
+    "    ldr r30, r0, 40\n"
+    "    ffma r22, r30, r4, r22\n"
+    "    ldr r30, r0, 24\n"
+    "    ffma r22, r30, r3, r22\n"
+    "    ldr r30, r0, 8\n"
+    "    ffma r22, r30, r2, r22\n"
+    "    ldr r23, r0, 60\n"
+    "    ldr r30, r0, 44\n"
+    "    ffma r23, r30, r4, r23\n"
+    "    ldr r30, r0, 28\n"
+    "    ffma r23, r30, r3, r23\n"
+    "    ldr r30, r0, 12\n"
+    "    ffma r23, r30, r2, r23\n"
+    "    mov r1, r20\n"
+    "    mov r2, r21\n"
+    "    mov r3, r22\n"
+    "    mov r4, r23\n"
+    "    exit\n";
+
+const char *milo_mesh_mvp_asm(void) {
+    return mvp_asm;
+}
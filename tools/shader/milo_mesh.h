@@ -0,0 +1,63 @@
+/*
+ * milo_mesh.h
+ * Milo832 Test Meshes - Header
+ *
+ * Indexed triangle meshes of the TB/ scenes (cube, pyramid, torus) and a
+ * host-side transform to clip space, standing in for a vertex shader, so
+ * the software renderer can draw them.
+ */
+
+#ifndef MILO_MESH_H
+#define MILO_MESH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "milo_vm.h"
+
+typedef struct {
+    milo_vertex_in_t *vertices;
+    uint32_t          vertex_count;
+    uint32_t         *indices;          /* Triangle list, counter-clockwise
+                                         * seen from outside */
+    uint32_t          index_count;
+    float             radius;           /* Bounding sphere about the origin */
+} milo_mesh_t;
+
+/* Cube of side 2 around the origin (tb_render_cube.vhd): four vertices
+ * per face, each face its own color and a 0..1 texture square */
+bool milo_mesh_cube(milo_mesh_t *mesh);
+
+/* Square pyramid of base 32 and height 32 (visualize_pyramid.py) */
+bool milo_mesh_pyramid(milo_mesh_t *mesh);
+
+/* Torus of major radius 16 and minor radius 8 in the z = 0 plane
+ * (visualize_torus.py: 32 x 16 grid); texture u runs around the ring, v
+ * around the tube */
+bool milo_mesh_torus(milo_mesh_t *mesh, uint32_t ring_segments, uint32_t tube_segments);
+
+void milo_mesh_free(milo_mesh_t *mesh);
+
+/* Camera for the TB scenes: the model turns about y, then about x
+ * (radians), sits distance in front of the eye and is projected with a
+ * vertical field of view (radians) */
+typedef struct {
+    float angle_x, angle_y;
+    float distance;
+    float fov_y;
+    float aspect;                       /* Width / height */
+} milo_mesh_view_t;
+
+/* Transform every vertex to clip space (vertex_count outputs); varyings
+ * pass through and normals turn with the model */
+void milo_mesh_transform(const milo_mesh_t *mesh, const milo_mesh_view_t *view,
+                         milo_vertex_out_t *out);
+
+/* The same transform as a column-major 4x4 clip matrix, for a vertex
+ * shader */
+void milo_mesh_view_matrix(const milo_mesh_view_t *view, float m[16]);
+
+/* Vertex shader assembly applying such a matrix, read from VM memory at
+ * byte 0, to the position */
+const char *milo_mesh_mvp_asm(void);
+
+#endif /* MILO_MESH_H */
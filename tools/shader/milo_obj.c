@@ -0,0 +1,804 @@
+/*
+ * milo_obj.c
+ * Milo832 Relocatable Object Format and Linker - Implementation
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "milo_obj.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define IMM20_MASK  0xFFFFFULL
+#define IMM32_MASK  0xFFFFFFFFULL
+
+/* Largest byte address an ldr immediate reaches (imm20 is sign extended) */
+#define MAX_CONST_ADDR  0x7FFFF
+
+/* Grow an array to hold at least need elements */
+static bool grow(void **buf, uint32_t *capacity, uint32_t need, size_t elem) {
+    if (need <= *capacity) return true;
+    uint32_t cap = *capacity ? *capacity : 64;
+    while (cap < need) cap *= 2;
+    void *p = realloc(*buf, (size_t)cap * elem);
+    if (!p) return false;
+    *buf = p;
+    *capacity = cap;
+    return true;
+}
+
+static void set_error(char *error, size_t size, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(error, size, fmt, args);
+    va_end(args);
+}
+
+/*---------------------------------------------------------------------------
+ * Reading Objects
+ *---------------------------------------------------------------------------*/
+
+static size_t section_elem_size(uint32_t type) {
+    switch (type) {
+        case MILO_SECT_CODE:    return sizeof(uint64_t);
+        case MILO_SECT_CONST:   return sizeof(uint32_t);
+        case MILO_SECT_RELOC:   return sizeof(milo_obj_reloc_t);
+        case MILO_SECT_SYMTAB:  return sizeof(milo_obj_symbol_t);
+        case MILO_SECT_STRTAB:  return 1;
+        case MILO_SECT_REFLECT: return sizeof(milo_obj_reflect_t);
+        default:                return 0;
+    }
+}
+
+bool milo_obj_bind(milo_obj_t *obj, const void *image, size_t size) {
+    memset(obj, 0, sizeof(*obj));
+    
+    const milo_obj_header_t *hdr = image;
+    if ((uintptr_t)image % 8 != 0 || size < sizeof(*hdr) || hdr->magic != MILO_OBJ_MAGIC) {
+        set_error(obj->error, sizeof(obj->error), "Not a Milo832 object");
+        return false;
+    }
+    if (hdr->version != MILO_OBJ_VERSION) {
+        set_error(obj->error, sizeof(obj->error), "Unsupported object version %u", hdr->version);
+        return false;
+    }
+    if (hdr->section_count > MILO_SECT_MAX ||
+        sizeof(*hdr) + hdr->section_count * sizeof(milo_obj_section_t) > size) {
+        set_error(obj->error, sizeof(obj->error), "Corrupt section table");
+        return false;
+    }
+    
+    const milo_obj_section_t *table = (const milo_obj_section_t *)(hdr + 1);
+    const void *data[MILO_SECT_MAX + 1] = {0};
+    uint32_t count[MILO_SECT_MAX + 1] = {0};
+    for (uint32_t i = 0; i < hdr->section_count; i++) {
+        const milo_obj_section_t *s = &table[i];
+        size_t elem = section_elem_size(s->type);
+        if (!elem || data[s->type] || s->offset % 8 != 0 ||
+            (uint64_t)s->offset + s->size > size || (uint64_t)s->count * elem != s->size) {
+            set_error(obj->error, sizeof(obj->error), "Corrupt section %u", i);
+            return false;
+        }
+        data[s->type] = (const uint8_t *)image + s->offset;
+        count[s->type] = s->count;
+    }
+    
+    obj->header = hdr;
+    obj->code = data[MILO_SECT_CODE];
+    obj->code_size = count[MILO_SECT_CODE];
+    obj->constants = data[MILO_SECT_CONST];
+    obj->const_count = count[MILO_SECT_CONST];
+    obj->const_base = hdr->const_base;
+    obj->relocs = data[MILO_SECT_RELOC];
+    obj->reloc_count = count[MILO_SECT_RELOC];
+    obj->symbols = data[MILO_SECT_SYMTAB];
+    obj->symbol_count = count[MILO_SECT_SYMTAB];
+    obj->strings = data[MILO_SECT_STRTAB];
+    obj->strings_size = count[MILO_SECT_STRTAB];
+    obj->reflect = data[MILO_SECT_REFLECT];
+    obj->reflect_count = count[MILO_SECT_REFLECT];
+    
+    /* Cross-section references */
+    if (obj->strings_size && obj->strings[obj->strings_size - 1] != '\0') {
+        set_error(obj->error, sizeof(obj->error), "Unterminated string table");
+        return false;
+    }
+    for (uint32_t i = 0; i < obj->symbol_count; i++) {
+        if (obj->symbols[i].name >= obj->strings_size) {
+            set_error(obj->error, sizeof(obj->error), "Bad name for symbol %u", i);
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < obj->reloc_count; i++) {
+        const milo_obj_reloc_t *r = &obj->relocs[i];
+        if (r->address >= obj->code_size ||
+            (r->type == MILO_RELOC_SYMBOL && r->symbol >= obj->symbol_count) ||
+            r->type < MILO_RELOC_CODE || r->type > MILO_RELOC_SYMBOL) {
+            set_error(obj->error, sizeof(obj->error), "Bad relocation %u", i);
+            return false;
+        }
+    }
+    if (obj->code_size && hdr->entry >= obj->code_size) {
+        set_error(obj->error, sizeof(obj->error), "Entry point out of range");
+        return false;
+    }
+    return true;
+}
+
+bool milo_obj_map(milo_obj_t *obj, const char *path) {
+    memset(obj, 0, sizeof(*obj));
+    
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        set_error(obj->error, sizeof(obj->error), "Cannot open '%s'", path);
+        return false;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        set_error(obj->error, sizeof(obj->error), "Cannot read '%s'", path);
+        return false;
+    }
+    
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        set_error(obj->error, sizeof(obj->error), "Cannot map '%s'", path);
+        return false;
+    }
+    
+    if (!milo_obj_bind(obj, map, size)) {
+        char error[256];
+        snprintf(error, sizeof(error), "%.100s: %.150s", path, obj->error);
+        munmap(map, size);
+        memset(obj, 0, sizeof(*obj));
+        snprintf(obj->error, sizeof(obj->error), "%s", error);
+        return false;
+    }
+    obj->map = map;
+    obj->map_size = size;
+    return true;
+}
+
+void milo_obj_release(milo_obj_t *obj) {
+    if (obj->map) {
+        munmap(obj->map, obj->map_size);
+    }
+    memset(obj, 0, sizeof(*obj));
+}
+
+const char *milo_obj_symbol_name(const milo_obj_t *obj, uint32_t index) {
+    return index < obj->symbol_count ? obj->strings + obj->symbols[index].name : NULL;
+}
+
+bool milo_obj_find_symbol(const milo_obj_t *obj, const char *name, uint32_t *value) {
+    for (uint32_t i = 0; i < obj->symbol_count; i++) {
+        const milo_obj_symbol_t *sym = &obj->symbols[i];
+        if (!(sym->flags & MILO_SYMF_UNDEF) && strcmp(obj->strings + sym->name, name) == 0) {
+            if (value) *value = sym->value;
+            return true;
+        }
+    }
+    return false;
+}
+
+void milo_obj_dump(const milo_obj_t *obj, FILE *out) {
+    static const char *const section_names[MILO_SECT_MAX + 1] = {
+        "?", "code", "const", "reloc", "symtab", "strtab", "reflect"
+    };
+    const milo_obj_header_t *hdr = obj->header;
+    const milo_obj_section_t *table = (const milo_obj_section_t *)(hdr + 1);
+    
+    fprintf(out, "Object v%u%s%s, entry 0x%04X, const base 0x%04X\n", hdr->version,
+            (hdr->flags & MILO_OBJ_LINKED) ? ", linked" : "",
+            (hdr->flags & MILO_OBJ_VERTEX) ? ", vertex" : "",
+            hdr->entry, hdr->const_base);
+    
+    fprintf(out, "Sections:\n");
+    for (uint32_t i = 0; i < hdr->section_count; i++) {
+        fprintf(out, "  %-8s offset 0x%06X  %6u bytes  %5u entries\n",
+                section_names[table[i].type], table[i].offset, table[i].size, table[i].count);
+    }
+    
+    fprintf(out, "Symbols:\n");
+    for (uint32_t i = 0; i < obj->symbol_count; i++) {
+        const milo_obj_symbol_t *sym = &obj->symbols[i];
+        if (sym->flags & MILO_SYMF_UNDEF) {
+            fprintf(out, "          U %s\n", obj->strings + sym->name);
+        } else {
+            fprintf(out, "  %04X    %c %s\n", sym->value,
+                    (sym->flags & MILO_SYMF_GLOBAL) ? 'T' : 't', obj->strings + sym->name);
+        }
+    }
+}
+
+const char *milo_obj_get_error(const milo_obj_t *obj) {
+    return obj->error;
+}
+
+/*---------------------------------------------------------------------------
+ * Writing Objects
+ *---------------------------------------------------------------------------*/
+
+void milo_obj_builder_init(milo_obj_builder_t *b) {
+    memset(b, 0, sizeof(*b));
+    b->const_base = MILO_CONST_BASE_ADDR;
+}
+
+void milo_obj_builder_free(milo_obj_builder_t *b) {
+    free(b->code);
+    free(b->constants);
+    free(b->relocs);
+    free(b->symbols);
+    free(b->strings);
+    free(b->reflect);
+    memset(b, 0, sizeof(*b));
+}
+
+void milo_obj_reset(milo_obj_builder_t *b) {
+    b->flags = 0;
+    b->entry = 0;
+    b->const_base = MILO_CONST_BASE_ADDR;
+    b->code_size = 0;
+    b->const_count = 0;
+    b->reloc_count = 0;
+    b->symbol_count = 0;
+    b->strings_size = 0;
+    b->reflect_count = 0;
+    b->error[0] = '\0';
+}
+
+static bool oom(milo_obj_builder_t *b) {
+    set_error(b->error, sizeof(b->error), "Out of memory");
+    return false;
+}
+
+bool milo_obj_add_code(milo_obj_builder_t *b, const uint64_t *code, uint32_t count) {
+    if (!grow((void **)&b->code, &b->code_capacity, b->code_size + count, sizeof(uint64_t))) {
+        return oom(b);
+    }
+    if (count) memcpy(b->code + b->code_size, code, count * sizeof(uint64_t));
+    b->code_size += count;
+    return true;
+}
+
+bool milo_obj_add_constants(milo_obj_builder_t *b, const uint32_t *values, uint32_t count) {
+    if (!grow((void **)&b->constants, &b->const_capacity, b->const_count + count,
+              sizeof(uint32_t))) {
+        return oom(b);
+    }
+    if (count) memcpy(b->constants + b->const_count, values, count * sizeof(uint32_t));
+    b->const_count += count;
+    return true;
+}
+
+bool milo_obj_add_reloc(milo_obj_builder_t *b, uint32_t address, uint16_t type,
+                       uint32_t symbol) {
+    if (!grow((void **)&b->relocs, &b->reloc_capacity, b->reloc_count + 1,
+              sizeof(milo_obj_reloc_t))) {
+        return oom(b);
+    }
+    milo_obj_reloc_t *r = &b->relocs[b->reloc_count++];
+    r->address = address;
+    r->type = type;
+    r->reserved = 0;
+    r->symbol = symbol;
+    return true;
+}
+
+int64_t milo_obj_add_symbol(milo_obj_builder_t *b, const char *name, uint32_t value,
+                            uint32_t flags) {
+    uint32_t len = (uint32_t)strlen(name) + 1;
+    if (!grow((void **)&b->strings, &b->strings_capacity, b->strings_size + len, 1) ||
+        !grow((void **)&b->symbols, &b->symbol_capacity, b->symbol_count + 1,
+              sizeof(milo_obj_symbol_t))) {
+        oom(b);
+        return -1;
+    }
+    milo_obj_symbol_t *sym = &b->symbols[b->symbol_count];
+    sym->name = b->strings_size;
+    sym->value = value;
+    sym->flags = flags;
+    memcpy(b->strings + b->strings_size, name, len);
+    b->strings_size += len;
+    return b->symbol_count++;
+}
+
+bool milo_obj_add_reflect(milo_obj_builder_t *b, const milo_obj_reflect_t *rec) {
+    if (!grow((void **)&b->reflect, &b->reflect_capacity, b->reflect_count + 1,
+              sizeof(milo_obj_reflect_t))) {
+        return oom(b);
+    }
+    b->reflect[b->reflect_count++] = *rec;
+    return true;
+}
+
+static bool is_const_load(uint64_t word) {
+    return (uint8_t)(word >> 56) == OP_LDR && (uint8_t)(word >> 40) == 0;
+}
+
+bool milo_obj_from_compiler(milo_obj_builder_t *b, const milo_compiler_t *c) {
+    milo_obj_reset(b);
+    if (c->is_vertex) b->flags |= MILO_OBJ_VERTEX;
+    
+    uint32_t code_size, const_count;
+    const uint64_t *code = milo_glsl_get_code((milo_compiler_t *)c, &code_size);
+    const uint32_t *constants = milo_glsl_get_constants((milo_compiler_t *)c, &const_count);
+    if (!milo_obj_add_code(b, code, code_size) ||
+        !milo_obj_add_constants(b, constants, const_count)) {
+        return false;
+    }
+    
+    /* Every branch the compiler emits goes through a label fixup */
+    for (int i = 0; i < c->fixup_count; i++) {
+        if (!milo_obj_add_reloc(b, c->fixups[i].address, MILO_RELOC_CODE, 0)) return false;
+    }
+    
+    /* ... and ldr is only used for constant table loads */
+    for (uint32_t i = 0; i < code_size; i++) {
+        if (is_const_load(code[i]) && !milo_obj_add_reloc(b, i, MILO_RELOC_CONST, 0)) return false;
+    }
+    
+    if (milo_obj_add_symbol(b, MILO_OBJ_ENTRY_SYMBOL, 0, 0) < 0) return false;
+    
+    /* Reflection: globals only (locals have no qualifier) */
+    for (int i = 0; i < c->symtab.count; i++) {
+        const milo_symbol_t *sym = &c->symtab.symbols[i];
+        uint32_t flags = (sym->is_uniform ? MILO_SYM_UNIFORM : 0) |
+                         (sym->is_in ? MILO_SYM_IN : 0) |
+                         (sym->is_out ? MILO_SYM_OUT : 0) |
+                         (sym->is_const ? MILO_SYM_CONST : 0);
+        if (!flags) continue;
+        
+        milo_obj_reflect_t rec;
+        memset(&rec, 0, sizeof(rec));
+        snprintf(rec.name, sizeof(rec.name), "%s", sym->name);
+        rec.type = sym->type;
+        rec.reg = sym->reg;
+        rec.location = sym->location;
+        rec.flags = flags;
+        if (!milo_obj_add_reflect(b, &rec)) return false;
+    }
+    return true;
+}
+
+/* Largest span of ".data" words accepted for one object */
+#define MAX_DATA_WORDS  65536
+
+bool milo_obj_from_asm(milo_obj_builder_t *b, const milo_asm_t *as) {
+    milo_obj_reset(b);
+    
+    uint32_t code_size, data_count;
+    const uint64_t *code = milo_asm_get_code(as, &code_size);
+    const milo_asm_data_t *data = milo_asm_get_data(as, &data_count);
+    if (!milo_obj_add_code(b, code, code_size)) return false;
+    
+    /* Constant section spans the lowest to highest .data address */
+    uint32_t lo = 0, hi = 0;
+    if (data_count) {
+        lo = hi = data[0].address;
+        for (uint32_t i = 1; i < data_count; i++) {
+            if (data[i].address < lo) lo = data[i].address;
+            if (data[i].address > hi) hi = data[i].address;
+        }
+        uint32_t words = (hi - lo) / 4 + 1;
+        if (words > MAX_DATA_WORDS || hi > MAX_CONST_ADDR) {
+            set_error(b->error, sizeof(b->error), "Data section 0x%X-0x%X too large", lo, hi);
+            return false;
+        }
+        if (!grow((void **)&b->constants, &b->const_capacity, words, sizeof(uint32_t))) {
+            return oom(b);
+        }
+        memset(b->constants, 0, words * sizeof(uint32_t));
+        for (uint32_t i = 0; i < data_count; i++) {
+            b->constants[(data[i].address - lo) / 4] = data[i].value;
+        }
+        b->const_count = words;
+        b->const_base = lo;
+    }
+    
+    /* Symbols for exported and imported labels */
+    int64_t *label_sym = malloc((as->label_count + 1) * sizeof(int64_t));
+    if (!label_sym) return oom(b);
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < as->label_count; i++) {
+        const milo_label_t *label = &as->labels[i];
+        const char *name = as->names + label->name;
+        bool defined = label->address != MILO_LABEL_UNDEFINED;
+        label_sym[i] = -1;
+        
+        if (label->flags & MILO_LABEL_GLOBAL) {
+            if (!defined) {
+                set_error(b->error, sizeof(b->error), "Global label '%s' is not defined", name);
+                ok = false;
+                break;
+            }
+            label_sym[i] = milo_obj_add_symbol(b, name, label->address, MILO_SYMF_GLOBAL);
+        } else if ((label->flags & MILO_LABEL_EXTERN) && !defined) {
+            label_sym[i] = milo_obj_add_symbol(b, name, 0, MILO_SYMF_GLOBAL | MILO_SYMF_UNDEF);
+        } else {
+            continue;
+        }
+        ok = label_sym[i] >= 0;
+    }
+    
+    for (uint32_t i = 0; ok && i < as->ref_count; i++) {
+        const milo_label_ref_t *ref = &as->refs[i];
+        if (as->labels[ref->label].address != MILO_LABEL_UNDEFINED) {
+            ok = milo_obj_add_reloc(b, ref->address, MILO_RELOC_CODE, 0);
+        } else if (label_sym[ref->label] >= 0) {
+            ok = milo_obj_add_reloc(b, ref->address, MILO_RELOC_SYMBOL,
+                                    (uint32_t)label_sym[ref->label]);
+        } else {
+            set_error(b->error, sizeof(b->error), "Undefined label: %s",
+                      as->names + as->labels[ref->label].name);
+            ok = false;
+        }
+    }
+    free(label_sym);
+    
+    /* Loads from r0 into the data range are constant references */
+    for (uint32_t i = 0; ok && data_count && i < code_size; i++) {
+        uint32_t addr = (uint32_t)(code[i] & IMM20_MASK);
+        if (is_const_load(code[i]) && addr >= lo && addr <= hi) {
+            ok = milo_obj_add_reloc(b, i, MILO_RELOC_CONST, 0);
+        }
+    }
+    return ok;
+}
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
+
+void *milo_obj_serialize(const milo_obj_builder_t *b, size_t *size) {
+    struct { uint32_t type, count; const void *data; } parts[MILO_SECT_MAX] = {
+        { MILO_SECT_CODE,    b->code_size,     b->code },
+        { MILO_SECT_CONST,   b->const_count,   b->constants },
+        { MILO_SECT_RELOC,   b->reloc_count,   b->relocs },
+        { MILO_SECT_SYMTAB,  b->symbol_count,  b->symbols },
+        { MILO_SECT_STRTAB,  b->strings_size,  b->strings },
+        { MILO_SECT_REFLECT, b->reflect_count, b->reflect },
+    };
+    
+    /* Only non-empty sections are written */
+    milo_obj_section_t table[MILO_SECT_MAX];
+    const void *data[MILO_SECT_MAX];
+    uint32_t n = 0;
+    for (int i = 0; i < MILO_SECT_MAX; i++) {
+        if (!parts[i].count) continue;
+        table[n].type = parts[i].type;
+        table[n].count = parts[i].count;
+        table[n].size = (uint32_t)(parts[i].count * section_elem_size(parts[i].type));
+        data[n++] = parts[i].data;
+    }
+    
+    size_t offset = ALIGN8(sizeof(milo_obj_header_t) + n * sizeof(milo_obj_section_t));
+    for (uint32_t i = 0; i < n; i++) {
+        table[i].offset = (uint32_t)offset;
+        offset = ALIGN8(offset + table[i].size);
+    }
+    
+    uint8_t *image = calloc(1, offset);
+    if (!image) return NULL;
+    
+    milo_obj_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = MILO_OBJ_MAGIC;
+    hdr.version = MILO_OBJ_VERSION;
+    hdr.flags = b->flags;
+    hdr.section_count = n;
+    hdr.entry = b->entry;
+    hdr.const_base = b->const_base;
+    memcpy(image, &hdr, sizeof(hdr));
+    memcpy(image + sizeof(hdr), table, n * sizeof(milo_obj_section_t));
+    for (uint32_t i = 0; i < n; i++) {
+        memcpy(image + table[i].offset, data[i], table[i].size);
+    }
+    
+    *size = offset;
+    return image;
+}
+
+bool milo_obj_write(const milo_obj_builder_t *b, const char *path) {
+    size_t size;
+    void *image = milo_obj_serialize(b, &size);
+    if (!image) return false;
+    
+    FILE *f = fopen(path, "wb");
+    bool ok = f && fwrite(image, 1, size, f) == size;
+    if (f) ok = (fclose(f) == 0) && ok;
+    free(image);
+    return ok;
+}
+
+/*---------------------------------------------------------------------------
+ * Linker
+ *---------------------------------------------------------------------------*/
+
+void milo_link_init(milo_link_t *ld) {
+    memset(ld, 0, sizeof(*ld));
+    milo_obj_builder_init(&ld->out);
+}
+
+void milo_link_free(milo_link_t *ld) {
+    for (uint32_t i = 0; i < ld->input_count; i++) {
+        free(ld->inputs[i].const_map);
+    }
+    free(ld->inputs);
+    milo_obj_builder_free(&ld->out);
+    memset(ld, 0, sizeof(*ld));
+}
+
+static bool add_input(milo_link_t *ld, const milo_obj_t *obj, const char *name, bool library) {
+    if (!grow((void **)&ld->inputs, &ld->input_capacity, ld->input_count + 1,
+              sizeof(milo_link_input_t))) {
+        set_error(ld->error, sizeof(ld->error), "Out of memory");
+        return false;
+    }
+    milo_link_input_t *in = &ld->inputs[ld->input_count++];
+    memset(in, 0, sizeof(*in));
+    in->obj = obj;
+    in->name = name;
+    in->library = library;
+    return true;
+}
+
+bool milo_link_add_object(milo_link_t *ld, const milo_obj_t *obj, const char *name) {
+    return add_input(ld, obj, name, false);
+}
+
+bool milo_link_add_library(milo_link_t *ld, const milo_obj_t *obj) {
+    return add_input(ld, obj, NULL, true);
+}
+
+/* Find the global definition of name among inputs, optionally only those
+ * already included; returns the input index or -1 */
+static int64_t find_definition(const milo_link_t *ld, const char *name, bool included,
+                               uint32_t *value) {
+    for (uint32_t i = 0; i < ld->input_count; i++) {
+        const milo_link_input_t *in = &ld->inputs[i];
+        if (in->included != included) continue;
+        for (uint32_t s = 0; s < in->obj->symbol_count; s++) {
+            const milo_obj_symbol_t *sym = &in->obj->symbols[s];
+            if ((sym->flags & (MILO_SYMF_GLOBAL | MILO_SYMF_UNDEF)) == MILO_SYMF_GLOBAL &&
+                strcmp(in->obj->strings + sym->name, name) == 0) {
+                if (value) *value = sym->value;
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+/* Include libraries until every undefined symbol has a definition */
+static bool resolve_inputs(milo_link_t *ld) {
+    for (uint32_t i = 0; i < ld->input_count; i++) {
+        ld->inputs[i].included = !ld->inputs[i].library;
+    }
+    
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t i = 0; i < ld->input_count; i++) {
+            const milo_link_input_t *in = &ld->inputs[i];
+            if (!in->included) continue;
+            for (uint32_t s = 0; s < in->obj->symbol_count; s++) {
+                if (!(in->obj->symbols[s].flags & MILO_SYMF_UNDEF)) continue;
+                const char *name = milo_obj_symbol_name(in->obj, s);
+                if (find_definition(ld, name, true, NULL) >= 0) continue;
+                
+                int64_t lib = find_definition(ld, name, false, NULL);
+                if (lib < 0) {
+                    set_error(ld->error, sizeof(ld->error), "Undefined symbol '%s'", name);
+                    return false;
+                }
+                ld->inputs[lib].included = true;
+                changed = true;
+            }
+        }
+    }
+    return true;
+}
+
+/* Add a global to the output, rejecting a second definition */
+static bool export_symbol(milo_link_t *ld, const char *name, uint32_t value) {
+    milo_obj_builder_t *out = &ld->out;
+    for (uint32_t i = 0; i < out->symbol_count; i++) {
+        if ((out->symbols[i].flags & MILO_SYMF_GLOBAL) &&
+            strcmp(out->strings + out->symbols[i].name, name) == 0) {
+            set_error(ld->error, sizeof(ld->error), "Duplicate symbol '%s'", name);
+            return false;
+        }
+    }
+    return milo_obj_add_symbol(out, name, value, MILO_SYMF_GLOBAL) >= 0;
+}
+
+/* Copy one input into the output and apply its relocations */
+static bool link_input(milo_link_t *ld, const milo_link_input_t *in) {
+    milo_obj_builder_t *out = &ld->out;
+    const milo_obj_t *obj = in->obj;
+    
+    if (!milo_obj_add_code(out, obj->code, obj->code_size)) return false;
+    
+    uint64_t *code = out->code + in->code_base;
+    for (uint32_t i = 0; i < obj->reloc_count; i++) {
+        const milo_obj_reloc_t *r = &obj->relocs[i];
+        uint64_t word = code[r->address];
+        uint32_t target;
+        
+        switch (r->type) {
+            case MILO_RELOC_CODE:
+                target = (uint32_t)word + in->code_base;
+                word = (word & ~IMM32_MASK) | target;
+                break;
+            
+            case MILO_RELOC_CONST:
+                target = (uint32_t)(word & IMM20_MASK);
+                if (target < obj->const_base || target - obj->const_base >= obj->const_count * 4) {
+                    set_error(ld->error, sizeof(ld->error),
+                              "Constant reference 0x%X at 0x%04X outside data", target, r->address);
+                    return false;
+                }
+                target -= obj->const_base;
+                target = out->const_base + in->const_map[target / 4] * 4 + target % 4;
+                word = (word & ~IMM20_MASK) | target;
+                break;
+            
+            default: {  /* MILO_RELOC_SYMBOL */
+                const milo_obj_symbol_t *sym = &obj->symbols[r->symbol];
+                if (sym->flags & MILO_SYMF_UNDEF) {
+                    int64_t def = find_definition(ld, obj->strings + sym->name, true, &target);
+                    target += ld->inputs[def].code_base;
+                } else {
+                    target = sym->value + in->code_base;
+                }
+                word = (word & ~IMM32_MASK) | target;
+                break;
+            }
+        }
+        
+        code[r->address] = word;
+        uint16_t type = r->type == MILO_RELOC_CONST ? MILO_RELOC_CONST : MILO_RELOC_CODE;
+        if (!milo_obj_add_reloc(out, in->code_base + r->address, type, 0)) return false;
+    }
+    
+    /* Defined symbols, rebased; imports are resolved and dropped */
+    for (uint32_t i = 0; i < obj->symbol_count; i++) {
+        const milo_obj_symbol_t *sym = &obj->symbols[i];
+        const char *name = obj->strings + sym->name;
+        if (sym->flags & MILO_SYMF_UNDEF) continue;
+        if (sym->flags & MILO_SYMF_GLOBAL) {
+            if (!export_symbol(ld, name, sym->value + in->code_base)) return false;
+        } else if (milo_obj_add_symbol(out, name, sym->value + in->code_base, 0) < 0) {
+            return false;
+        }
+    }
+    if (in->name && !export_symbol(ld, in->name, obj->header->entry + in->code_base)) {
+        return false;
+    }
+    
+    for (uint32_t i = 0; i < obj->reflect_count; i++) {
+        if (!milo_obj_add_reflect(out, &obj->reflect[i])) return false;
+    }
+    return true;
+}
+
+/* Build the merged constant table and each input's map into it. With
+ * dedup_constants, each distinct word is stored once (hashed on its bits,
+ * so 0.0 and -0.0 stay distinct). */
+static bool merge_constants(milo_link_t *ld) {
+    milo_obj_builder_t *out = &ld->out;
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < ld->input_count; i++) {
+        if (ld->inputs[i].included) total += ld->inputs[i].obj->const_count;
+    }
+    
+    uint32_t *buckets = NULL;
+    uint32_t mask = 0;
+    if (ld->dedup_constants && total) {
+        uint32_t n = 64;
+        while (n < total * 2) n *= 2;
+        buckets = calloc(n, sizeof(uint32_t));     /* Pool index + 1, 0 = empty */
+        if (!buckets) return oom(out);
+        mask = n - 1;
+    }
+    
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < ld->input_count; i++) {
+        milo_link_input_t *in = &ld->inputs[i];
+        if (!in->included || !in->obj->const_count) continue;
+        
+        const uint32_t *values = in->obj->constants;
+        in->const_map = malloc(in->obj->const_count * sizeof(uint32_t));
+        if (!in->const_map) {
+            ok = oom(out);
+            break;
+        }
+        for (uint32_t w = 0; ok && w < in->obj->const_count; w++) {
+            if (!buckets) {
+                in->const_map[w] = out->const_count;
+                ok = milo_obj_add_constants(out, &values[w], 1);
+                continue;
+            }
+            uint32_t b = (values[w] * 2654435761u) & mask;
+            while (buckets[b] && out->constants[buckets[b] - 1] != values[w]) {
+                b = (b + 1) & mask;
+            }
+            if (!buckets[b]) {
+                ok = milo_obj_add_constants(out, &values[w], 1);
+                buckets[b] = out->const_count;
+            }
+            in->const_map[w] = buckets[b] - 1;
+        }
+    }
+    free(buckets);
+    
+    ld->const_words_in = total;
+    ld->const_words_out = out->const_count;
+    return ok;
+}
+
+bool milo_link_run(milo_link_t *ld) {
+    milo_obj_reset(&ld->out);
+    ld->error[0] = '\0';
+    for (uint32_t i = 0; i < ld->input_count; i++) {
+        free(ld->inputs[i].const_map);
+        ld->inputs[i].const_map = NULL;
+    }
+    
+    const milo_link_input_t *first = NULL;
+    for (uint32_t i = 0; i < ld->input_count && !first; i++) {
+        if (!ld->inputs[i].library) first = &ld->inputs[i];
+    }
+    if (!first) {
+        set_error(ld->error, sizeof(ld->error), "No input objects");
+        return false;
+    }
+    if (!resolve_inputs(ld)) return false;
+    
+    /* Layout: included inputs back to back in the order given */
+    uint32_t code_size = 0;
+    for (uint32_t i = 0; i < ld->input_count; i++) {
+        milo_link_input_t *in = &ld->inputs[i];
+        if (!in->included) continue;
+        in->code_base = code_size;
+        code_size += in->obj->code_size;
+    }
+    
+    ld->out.const_base = first->obj->const_base;
+    if (!merge_constants(ld)) {
+        snprintf(ld->error, sizeof(ld->error), "%s", ld->out.error);
+        return false;
+    }
+    if ((uint64_t)ld->out.const_base + (uint64_t)ld->out.const_count * 4 > MAX_CONST_ADDR + 1) {
+        set_error(ld->error, sizeof(ld->error),
+                  "Constant data (%u words) exceeds the ldr address range", ld->out.const_count);
+        return false;
+    }
+    ld->out.flags = (first->obj->header->flags & MILO_OBJ_VERTEX) | MILO_OBJ_LINKED;
+    ld->out.entry = first->obj->header->entry + first->code_base;
+    
+    for (uint32_t i = 0; i < ld->input_count; i++) {
+        if (ld->inputs[i].included && !link_input(ld, &ld->inputs[i])) {
+            if (!ld->error[0]) snprintf(ld->error, sizeof(ld->error), "%s", ld->out.error);
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t milo_link_image_bytes(const milo_link_t *ld) {
+    return (size_t)ld->out.code_size * sizeof(uint64_t) +
+           (size_t)ld->out.const_count * sizeof(uint32_t);
+}
+
+const char *milo_link_get_error(const milo_link_t *ld) {
+    return ld->error;
+}
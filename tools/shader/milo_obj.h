@@ -0,0 +1,279 @@
+/*
+ * milo_obj.h
+ * Milo832 Relocatable Object Format and Linker - Header
+ *
+ * Compiled and assembled shaders are written as sectioned object images:
+ * code, constant data, relocations, symbols and reflection. The linker
+ * merges several objects, plus any objects pulled from helper libraries to
+ * satisfy undefined symbols, into one image with a single constant table.
+ *
+ * Images are position independent on disk: every section is 8-byte aligned
+ * relative to the start of the image, so a mapped file can be used in place
+ * and the VM executes directly out of the mapping.
+ */
+
+#ifndef MILO_OBJ_H
+#define MILO_OBJ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "milo_glsl.h"
+#include "milo_asm.h"
+
+/*---------------------------------------------------------------------------
+ * Object File Format
+ *---------------------------------------------------------------------------
+ * All fields little-endian:
+ *   milo_obj_header_t
+ *   milo_obj_section_t  sections[section_count]
+ *   section data, each at an 8-byte aligned offset
+ *
+ * Section types may appear at most once; absent sections are empty.
+ */
+
+#define MILO_OBJ_MAGIC      0x424F4C4D  /* "MLOB" */
+#define MILO_OBJ_VERSION    1
+
+/* Header flags */
+#define MILO_OBJ_VERTEX     0x0001      /* Vertex shader entry */
+#define MILO_OBJ_LINKED     0x0002      /* Linker output */
+
+/* Section types */
+#define MILO_SECT_CODE      1           /* uint64_t instructions */
+#define MILO_SECT_CONST     2           /* uint32_t words loaded at const_base */
+#define MILO_SECT_RELOC     3           /* milo_obj_reloc_t */
+#define MILO_SECT_SYMTAB    4           /* milo_obj_symbol_t */
+#define MILO_SECT_STRTAB    5           /* NUL terminated symbol names */
+#define MILO_SECT_REFLECT   6           /* milo_obj_reflect_t */
+#define MILO_SECT_MAX       6
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;             /* MILO_OBJ_* */
+    uint32_t section_count;
+    uint32_t entry;             /* Instruction address execution starts at */
+    uint32_t const_base;        /* Byte address of the CONST section */
+    uint32_t reserved;
+} milo_obj_header_t;
+
+typedef struct {
+    uint32_t type;              /* MILO_SECT_* */
+    uint32_t count;             /* Entries */
+    uint32_t offset;            /* Bytes from start of image */
+    uint32_t size;              /* Bytes */
+} milo_obj_section_t;
+
+/* Relocation types */
+#define MILO_RELOC_CODE     1   /* imm[31:0] is a code address in this object */
+#define MILO_RELOC_CONST    2   /* imm[19:0] is a byte address in CONST */
+#define MILO_RELOC_SYMBOL   3   /* imm[31:0] receives the symbol's address */
+
+typedef struct {
+    uint32_t address;           /* Instruction index */
+    uint16_t type;              /* MILO_RELOC_* */
+    uint16_t reserved;
+    uint32_t symbol;            /* Symbol index for MILO_RELOC_SYMBOL */
+} milo_obj_reloc_t;
+
+/* Symbol flags */
+#define MILO_SYMF_GLOBAL    0x01        /* Visible to other objects */
+#define MILO_SYMF_UNDEF     0x02        /* Defined in another object */
+
+typedef struct {
+    uint32_t name;              /* Offset into STRTAB */
+    uint32_t value;             /* Code address */
+    uint32_t flags;             /* MILO_SYMF_* */
+} milo_obj_symbol_t;
+
+/* Reflection flags */
+#define MILO_SYM_UNIFORM    0x01
+#define MILO_SYM_IN         0x02
+#define MILO_SYM_OUT        0x04
+#define MILO_SYM_CONST      0x08
+
+/* Reflection record for one global (uniform, in, out or const) */
+typedef struct {
+    char     name[64];
+    int32_t  type;              /* milo_type_t */
+    int32_t  reg;               /* First register, -1 if folded */
+    int32_t  location;
+    uint32_t flags;             /* MILO_SYM_* */
+} milo_obj_reflect_t;
+
+/* Shader program storage in GPU memory (docs/command_model.md) */
+#define MILO_SHADER_REGION_SIZE (256 * 1024)
+
+/* Symbol naming a compiled shader's entry point */
+#define MILO_OBJ_ENTRY_SYMBOL "main"
+
+/*---------------------------------------------------------------------------
+ * Reading Objects
+ *---------------------------------------------------------------------------*/
+
+/* View of an object image; all pointers reference the image */
+typedef struct {
+    const milo_obj_header_t  *header;
+    const uint64_t           *code;
+    uint32_t                  code_size;
+    const uint32_t           *constants;
+    uint32_t                  const_count;
+    uint32_t                  const_base;
+    const milo_obj_reloc_t   *relocs;
+    uint32_t                  reloc_count;
+    const milo_obj_symbol_t  *symbols;
+    uint32_t                  symbol_count;
+    const char               *strings;
+    uint32_t                  strings_size;
+    const milo_obj_reflect_t *reflect;
+    uint32_t                  reflect_count;
+    
+    /* Backing storage (private): file mapping from milo_obj_map */
+    void                     *map;
+    size_t                    map_size;
+    
+    char                      error[256];
+} milo_obj_t;
+
+/* Bind a view to an image in memory (8-byte aligned); validates the layout */
+bool milo_obj_bind(milo_obj_t *obj, const void *image, size_t size);
+
+/* Map an object file read-only and bind it */
+bool milo_obj_map(milo_obj_t *obj, const char *path);
+
+/* Unmap a mapped object */
+void milo_obj_release(milo_obj_t *obj);
+
+/* Name of symbol index */
+const char *milo_obj_symbol_name(const milo_obj_t *obj, uint32_t index);
+
+/* Look up a defined symbol's address */
+bool milo_obj_find_symbol(const milo_obj_t *obj, const char *name, uint32_t *value);
+
+/* Print header, sections and symbols */
+void milo_obj_dump(const milo_obj_t *obj, FILE *out);
+
+/* Get error message */
+const char *milo_obj_get_error(const milo_obj_t *obj);
+
+/*---------------------------------------------------------------------------
+ * Writing Objects
+ *---------------------------------------------------------------------------*/
+
+/* Growable section contents of an object under construction */
+typedef struct {
+    uint16_t            flags;
+    uint32_t            entry;
+    uint32_t            const_base;
+    
+    uint64_t           *code;
+    uint32_t            code_size;
+    uint32_t            code_capacity;
+    uint32_t           *constants;
+    uint32_t            const_count;
+    uint32_t            const_capacity;
+    milo_obj_reloc_t   *relocs;
+    uint32_t            reloc_count;
+    uint32_t            reloc_capacity;
+    milo_obj_symbol_t  *symbols;
+    uint32_t            symbol_count;
+    uint32_t            symbol_capacity;
+    char               *strings;
+    uint32_t            strings_size;
+    uint32_t            strings_capacity;
+    milo_obj_reflect_t *reflect;
+    uint32_t            reflect_count;
+    uint32_t            reflect_capacity;
+    
+    char                error[256];
+} milo_obj_builder_t;
+
+void milo_obj_builder_init(milo_obj_builder_t *b);
+void milo_obj_builder_free(milo_obj_builder_t *b);
+
+/* Empty all sections, keeping their buffers */
+void milo_obj_reset(milo_obj_builder_t *b);
+
+/* Append section entries; false (with b->error set) if out of memory */
+bool milo_obj_add_code(milo_obj_builder_t *b, const uint64_t *code, uint32_t count);
+bool milo_obj_add_constants(milo_obj_builder_t *b, const uint32_t *values, uint32_t count);
+bool milo_obj_add_reloc(milo_obj_builder_t *b, uint32_t address, uint16_t type,
+                       uint32_t symbol);
+bool milo_obj_add_reflect(milo_obj_builder_t *b, const milo_obj_reflect_t *rec);
+
+/* Append a symbol; returns its index or -1 */
+int64_t milo_obj_add_symbol(milo_obj_builder_t *b, const char *name, uint32_t value,
+                            uint32_t flags);
+
+/* Object for the compiler's last generated shader. Branch targets become
+ * code relocations, constant loads const relocations, and the entry point
+ * a local MILO_OBJ_ENTRY_SYMBOL. */
+bool milo_obj_from_compiler(milo_obj_builder_t *b, const milo_compiler_t *c);
+
+/* Object for a resolved assembler state. ".data" words form the constant
+ * section, "ldr rd, r0, <addr>" into that range gets a const relocation,
+ * ".global" labels are exported and ".extern" labels imported. */
+bool milo_obj_from_asm(milo_obj_builder_t *b, const milo_asm_t *as);
+
+/* Serialize into a malloc'd image */
+void *milo_obj_serialize(const milo_obj_builder_t *b, size_t *size);
+
+/* Serialize to a file */
+bool milo_obj_write(const milo_obj_builder_t *b, const char *path);
+
+/*---------------------------------------------------------------------------
+ * Linker
+ *---------------------------------------------------------------------------*/
+
+typedef struct {
+    const milo_obj_t *obj;
+    const char       *name;     /* Exported entry symbol, or NULL */
+    bool              library;
+    bool              included;
+    uint32_t          code_base;
+    uint32_t         *const_map;    /* Local word -> word in merged CONST */
+} milo_link_input_t;
+
+typedef struct {
+    milo_link_input_t  *inputs;
+    uint32_t            input_count;
+    uint32_t            input_capacity;
+    
+    /* Packaging: merge identical constant words of all inputs into one
+     * pool. Requires every constant access to be a relocated load. */
+    bool                dedup_constants;
+    
+    /* Filled by milo_link_run */
+    uint32_t            const_words_in;     /* Sum over linked inputs */
+    uint32_t            const_words_out;    /* Merged table */
+    
+    milo_obj_builder_t  out;
+    char                error[256];
+} milo_link_t;
+
+void milo_link_init(milo_link_t *ld);
+void milo_link_free(milo_link_t *ld);
+
+/* Add an object; always linked, in the order added. The first object's
+ * entry becomes the image entry. If name is given, the object's entry is
+ * exported under that global symbol, so several shaders can share one
+ * image. The object must stay valid until milo_link_run returns. */
+bool milo_link_add_object(milo_link_t *ld, const milo_obj_t *obj, const char *name);
+
+/* Add a library object; linked only if it defines a symbol that is
+ * otherwise undefined */
+bool milo_link_add_library(milo_link_t *ld, const milo_obj_t *obj);
+
+/* Resolve symbols, lay out code and constants and apply relocations into
+ * ld->out; relocations are kept (as CODE/CONST) for later passes */
+bool milo_link_run(milo_link_t *ld);
+
+/* Bytes of shader program storage the output occupies (code + constants) */
+size_t milo_link_image_bytes(const milo_link_t *ld);
+
+/* Get error message */
+const char *milo_link_get_error(const milo_link_t *ld);
+
+#endif /* MILO_OBJ_H */
@@ -0,0 +1,817 @@
+/*
+ * milo_prof.c
+ * Milo832 Shader Profiler - Implementation
+ */
+
+#include "milo_prof.h"
+#include "milo_asm.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_PC   UINT32_MAX
+
+/*---------------------------------------------------------------------------
+ * Functional Units
+ *---------------------------------------------------------------------------*/
+
+milo_unit_t milo_op_unit(uint8_t op) {
+    switch (op) {
+        case OP_FADD: case OP_FSUB: case OP_FMUL: case OP_FDIV: case OP_FFMA:
+        case OP_FTOI: case OP_ITOF: case OP_FMIN: case OP_FMAX: case OP_FABS:
+        case OP_FNEG: case OP_FSLT: case OP_FSLE: case OP_FSEQ: case OP_FSETP:
+            return MILO_UNIT_FPU;
+        
+        case OP_SFU_SIN: case OP_SFU_COS: case OP_SFU_EX2: case OP_SFU_LG2:
+        case OP_SFU_RCP: case OP_SFU_RSQ: case OP_SFU_SQRT: case OP_SFU_TANH:
+            return MILO_UNIT_SFU;
+        
+        case OP_LDR: case OP_STR: case OP_LDS: case OP_STS:
+            return MILO_UNIT_LSU;
+        
+        case OP_TEX: case OP_TXL: case OP_TXB:
+            return MILO_UNIT_TEX;
+        
+        case OP_BRA: case OP_BEQ: case OP_BNE: case OP_SSY: case OP_JOIN:
+        case OP_BAR: case OP_EXIT: case OP_CALL: case OP_RET:
+            return MILO_UNIT_CTRL;
+        
+        default:
+            return MILO_UNIT_ALU;
+    }
+}
+
+uint32_t milo_op_latency(uint8_t op) {
+    switch (milo_op_unit(op)) {
+        case MILO_UNIT_FPU: return MILO_LATENCY_FPU;
+        case MILO_UNIT_SFU: return MILO_LATENCY_SFU;
+        case MILO_UNIT_LSU: return MILO_LATENCY_LSU;
+        case MILO_UNIT_TEX: return MILO_LATENCY_TEX;
+        default:            return MILO_LATENCY_ALU;
+    }
+}
+
+const char *milo_unit_name(milo_unit_t unit) {
+    static const char *const names[MILO_UNIT_COUNT] = {
+        "alu", "fpu", "sfu", "lsu", "tex", "ctrl"
+    };
+    return unit < MILO_UNIT_COUNT ? names[unit] : "?";
+}
+
+/* Register write and read sets, after writes_reg / needs_rs* in
+ * RTL/Core/streaming_multiprocessor.vhd. Unused operand fields encode r0,
+ * which is never waited on. */
+int milo_op_writes(uint8_t op) {
+    switch (milo_op_unit(op)) {
+        case MILO_UNIT_CTRL:
+            return 0;
+        case MILO_UNIT_TEX:
+            return 4;
+        default:
+            return (op == OP_NOP || op == OP_STR || op == OP_STS) ? 0 : 1;
+    }
+}
+
+int milo_op_sources(uint64_t inst, uint8_t regs[4]) {
+    uint8_t op = (uint8_t)(inst >> 56);
+    uint8_t rs2 = (uint8_t)(inst >> 32);
+    uint8_t srcs[4] = { (uint8_t)(inst >> 40), rs2, 0, 0 };
+    if (op == OP_FFMA || op == OP_IMAD || op == OP_SELP || op == OP_TXL || op == OP_TXB) {
+        srcs[2] = (uint8_t)(inst >> 20);
+    }
+    if (op == OP_TEX || op == OP_TXL || op == OP_TXB) srcs[3] = (uint8_t)(rs2 + 1);
+    int n = 0;
+    for (int i = 0; i < 4; i++) {
+        if (srcs[i]) regs[n++] = srcs[i];
+    }
+    return n;
+}
+
+/*---------------------------------------------------------------------------
+ * Collection
+ *---------------------------------------------------------------------------*/
+
+bool milo_prof_init(milo_prof_t *p, uint32_t code_size) {
+    memset(p, 0, sizeof(*p));
+    p->warp_size = MILO_PROF_MAX_LANES;
+    p->size = code_size;
+    p->last_pc = NO_PC;
+    size_t n = code_size ? code_size : 1;
+    p->pcs = calloc(n, sizeof(milo_prof_pc_t));
+    p->thread_exec = calloc(n, sizeof(uint32_t));
+    p->thread_stall = calloc(n * MILO_UNIT_COUNT, sizeof(uint64_t));
+    p->thread_touched = calloc(n, sizeof(uint32_t));
+    p->warp_stall = calloc(n * MILO_UNIT_COUNT, sizeof(uint64_t));
+    p->warp_touched = calloc(n, sizeof(uint32_t));
+    p->warp_seen = calloc(n, sizeof(bool));
+    p->insts = calloc(n, sizeof(uint64_t));
+    if (!p->pcs || !p->thread_exec || !p->thread_stall || !p->thread_touched ||
+        !p->warp_stall || !p->warp_touched || !p->warp_seen || !p->insts) {
+        milo_prof_free(p);
+        return false;
+    }
+    return true;
+}
+
+void milo_prof_free(milo_prof_t *p) {
+    free(p->pcs);
+    free(p->draws);
+    free(p->events);
+    free(p->warp_events);
+    free(p->thread_exec);
+    free(p->thread_stall);
+    free(p->thread_touched);
+    free(p->warp_stall);
+    free(p->warp_touched);
+    free(p->warp_seen);
+    free(p->insts);
+    free(p->lane_events);
+    free(p->stack);
+    memset(p, 0, sizeof(*p));
+}
+
+void milo_prof_clear(milo_prof_t *p) {
+    uint32_t n = p->size;
+    memset(p->pcs, 0, n * sizeof(milo_prof_pc_t));
+    memset(p->thread_exec, 0, n * sizeof(uint32_t));
+    memset(p->thread_stall, 0, n * MILO_UNIT_COUNT * sizeof(uint64_t));
+    memset(p->warp_stall, 0, n * MILO_UNIT_COUNT * sizeof(uint64_t));
+    memset(p->warp_seen, 0, n * sizeof(bool));
+    memset(&p->draw, 0, sizeof(p->draw));
+    p->thread_touched_count = 0;
+    p->warp_touched_count = 0;
+    p->warp_lanes = 0;
+    p->lane_event_count = 0;
+    p->threads = 0;
+    p->warps = 0;
+    p->draw_count = 0;
+    p->event_count = 0;
+    p->lost = false;
+    p->in_thread = false;
+}
+
+/* Make room for needed elements, doubling */
+static bool reserve(void **items, uint64_t *capacity, uint64_t needed, size_t elem_size) {
+    if (needed <= *capacity) return true;
+    uint64_t new_capacity = *capacity ? *capacity * 2 : 256;
+    while (new_capacity < needed) new_capacity *= 2;
+    void *grown = realloc(*items, new_capacity * elem_size);
+    if (!grown) return false;
+    *items = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+static void stop_trace(milo_prof_t *p) {
+    free(p->events);
+    free(p->warp_events);
+    p->events = NULL;
+    p->warp_events = NULL;
+    p->event_capacity = p->warp_event_capacity = 0;
+    p->event_count = 0;
+    p->trace = false;
+}
+
+static uint32_t lanes_per_warp(const milo_prof_t *p) {
+    if (p->warp_size == 0) return 1;
+    return p->warp_size < MILO_PROF_MAX_LANES ? p->warp_size : MILO_PROF_MAX_LANES;
+}
+
+void milo_prof_thread_begin(milo_prof_t *p) {
+    memset(p->reg_ready, 0, sizeof(p->reg_ready));
+    p->clock = 0;
+    p->last_pc = NO_PC;
+    p->lane_start[p->warp_lanes] = p->lane_event_count;
+    p->in_thread = true;
+}
+
+void milo_prof_step(milo_prof_t *p, uint32_t pc, uint64_t inst) {
+    if (pc >= p->size) return;
+    uint8_t op = (uint8_t)(inst >> 56);
+    uint8_t rd = (uint8_t)(inst >> 48);
+    uint64_t *stall = &p->thread_stall[(size_t)pc * MILO_UNIT_COUNT];
+    
+    /* Redirected fetch after a taken branch, call or return */
+    uint64_t fetch = p->clock;
+    uint64_t issue = fetch;
+    if (p->last_pc != NO_PC && pc != p->last_pc + 1) {
+        issue += MILO_BRANCH_PENALTY;
+        stall[MILO_UNIT_CTRL] += MILO_BRANCH_PENALTY;
+    }
+    p->last_pc = pc;
+    
+    /* Scoreboard: wait for the latest source operand */
+    uint8_t srcs[4];
+    int src_count = milo_op_sources(inst, srcs);
+    uint64_t ready = issue;
+    int waited = -1;
+    for (int i = 0; i < src_count; i++) {
+        if (p->reg_ready[srcs[i]] > ready) {
+            ready = p->reg_ready[srcs[i]];
+            waited = srcs[i];
+        }
+    }
+    if (waited >= 0) {
+        stall[p->reg_unit[waited]] += ready - issue;
+        issue = ready;
+    }
+    
+    int writes = milo_op_writes(op);
+    uint64_t done = issue + milo_op_latency(op);
+    milo_unit_t unit = milo_op_unit(op);
+    for (int i = 0; i < writes && rd + i < 256; i++) {
+        if (rd + i == 0) continue;
+        p->reg_ready[rd + i] = done;
+        p->reg_unit[rd + i] = (uint8_t)unit;
+    }
+    p->clock = issue + 1;
+    
+    /* The lane's stream, replayed with the rest of its warp */
+    p->insts[pc] = inst;
+    if (!p->lost) {
+        if (reserve((void **)&p->lane_events, &p->lane_event_capacity,
+                    p->lane_event_count + 1, sizeof(milo_prof_event_t))) {
+            p->lane_events[p->lane_event_count++] =
+                (milo_prof_event_t){ pc, (uint32_t)(issue - fetch) };
+        } else {
+            p->lost = true;
+        }
+    }
+    
+    if (p->thread_exec[pc]++ == 0) p->thread_touched[p->thread_touched_count++] = pc;
+}
+
+static bool push_frame(milo_prof_t *p, uint32_t *sp, uint32_t mask, uint32_t origin,
+                       uint32_t rpc) {
+    if (!reserve((void **)&p->stack, &p->stack_capacity, (uint64_t)*sp + 1,
+                 sizeof(milo_prof_frame_t))) {
+        return false;
+    }
+    p->stack[(*sp)++] = (milo_prof_frame_t){ mask, origin, rpc };
+    return true;
+}
+
+/* Replay the warp's lane streams in lockstep. The active mask runs one path
+ * at a time: a branch whose lanes disagree continues with the taken lanes
+ * and leaves the rest on the stack, SSY remembers the mask to restore, and
+ * JOIN switches to a pending path or, once none is left, restores the SSY
+ * mask. The compiler issues SSY on every loop iteration; an SSY for the
+ * target already on the stack is not pushed again. Lanes found at different
+ * PCs under one mask (code not following that discipline) are split, the
+ * lowest PC first, so every lane still replays exactly its own stream. */
+static bool replay_warp(milo_prof_t *p) {
+    uint32_t lanes = p->warp_lanes;
+    uint64_t cursor[MILO_PROF_MAX_LANES];
+    uint32_t alive = 0;
+    for (uint32_t l = 0; l < lanes; l++) {
+        cursor[l] = p->lane_start[l];
+        if (cursor[l] < p->lane_start[l + 1]) alive |= 1u << l;
+    }
+    
+    uint32_t mask = alive, origin = NO_PC, sp = 0;
+    for (;;) {
+        mask &= alive;
+        if (!mask) {
+            if (sp == 0) break;
+            milo_prof_frame_t *f = &p->stack[--sp];
+            mask = f->mask;
+            origin = f->origin;
+            continue;
+        }
+        
+        uint32_t pc = NO_PC, rest = 0;
+        for (uint32_t l = 0; l < lanes; l++) {
+            if ((mask >> l & 1) && p->lane_events[cursor[l]].pc < pc) {
+                pc = p->lane_events[cursor[l]].pc;
+            }
+        }
+        for (uint32_t l = 0; l < lanes; l++) {
+            if ((mask >> l & 1) && p->lane_events[cursor[l]].pc != pc) rest |= 1u << l;
+        }
+        if (rest) {
+            if (!push_frame(p, &sp, rest, origin, NO_PC)) return false;
+            mask &= ~rest;
+        }
+        
+        /* Issue for the active lanes */
+        uint32_t stall = 0;
+        for (uint32_t l = 0; l < lanes; l++) {
+            if (!(mask >> l & 1)) continue;
+            const milo_prof_event_t *e = &p->lane_events[cursor[l]++];
+            if (e->stall > stall) stall = e->stall;
+            if (cursor[l] == p->lane_start[l + 1]) alive &= ~(1u << l);
+        }
+        p->pcs[pc].issues++;
+        p->draw.issues++;
+        if (origin != NO_PC) {
+            p->pcs[origin].serialized++;
+            p->draw.serialized++;
+        }
+        if (p->trace) {
+            if (reserve((void **)&p->events, &p->event_capacity, p->event_count + 1,
+                        sizeof(milo_prof_event_t))) {
+                p->events[p->event_count++] = (milo_prof_event_t){ pc, stall };
+            } else {
+                stop_trace(p);
+            }
+        }
+        
+        uint8_t op = (uint8_t)(p->insts[pc] >> 56);
+        uint32_t target = (uint32_t)p->insts[pc];
+        if (op == OP_SSY) {
+            int32_t top = (int32_t)sp - 1;
+            while (top >= 0 && p->stack[top].rpc == NO_PC) top--;
+            if (top < 0 || p->stack[top].rpc != target) {
+                if (!push_frame(p, &sp, mask, origin, target)) return false;
+            }
+        } else if (op == OP_JOIN && sp > 0) {
+            milo_prof_frame_t f = p->stack[--sp];
+            if (f.rpc == NO_PC) {
+                /* Wait here for the pending path, unless the enclosing SSY
+                 * mask will bring these lanes back anyway */
+                int32_t top = (int32_t)sp - 1;
+                while (top >= 0 && p->stack[top].rpc == NO_PC) top--;
+                if (top < 0 || (mask & ~p->stack[top].mask)) {
+                    if (!push_frame(p, &sp, mask, origin, NO_PC)) return false;
+                }
+            }
+            mask = f.mask;
+            origin = f.origin;
+        } else if (op == OP_BEQ || op == OP_BNE) {
+            p->draw.branches++;
+            uint32_t taken = 0, live = mask & alive;
+            for (uint32_t l = 0; l < lanes; l++) {
+                if ((live >> l & 1) && p->lane_events[cursor[l]].pc == target) taken |= 1u << l;
+            }
+            if (taken && taken != live && target != pc + 1) {
+                p->pcs[pc].diverged++;
+                p->draw.diverged++;
+                if (!push_frame(p, &sp, live & ~taken, pc, NO_PC)) return false;
+                mask = taken;
+                origin = pc;
+            }
+        }
+    }
+    return true;
+}
+
+static void flush_warp(milo_prof_t *p) {
+    for (uint32_t i = 0; i < p->warp_touched_count; i++) {
+        uint32_t pc = p->warp_touched[i];
+        uint64_t *stall = &p->warp_stall[(size_t)pc * MILO_UNIT_COUNT];
+        for (int u = 0; u < MILO_UNIT_COUNT; u++) {
+            p->pcs[pc].stall[u] += stall[u];
+            stall[u] = 0;
+        }
+        p->warp_seen[pc] = false;
+    }
+    
+    if (p->trace && !reserve((void **)&p->warp_events, &p->warp_event_capacity,
+                             p->warps + 2, sizeof(uint64_t))) {
+        stop_trace(p);
+    }
+    if (p->trace) p->warp_events[p->warps] = p->event_count;
+    if (!p->lost && !replay_warp(p)) p->lost = true;
+    if (p->trace) p->warp_events[p->warps + 1] = p->event_count;
+    
+    p->warp_touched_count = 0;
+    p->warp_lanes = 0;
+    p->lane_event_count = 0;
+    p->warps++;
+    p->draw.warps++;
+}
+
+/* Fold the thread into its warp; the warp waits as long as its slowest lane */
+void milo_prof_thread_end(milo_prof_t *p) {
+    if (!p->in_thread) return;
+    p->in_thread = false;
+    
+    for (uint32_t i = 0; i < p->thread_touched_count; i++) {
+        uint32_t pc = p->thread_touched[i];
+        uint64_t *thread_stall = &p->thread_stall[(size_t)pc * MILO_UNIT_COUNT];
+        uint64_t *warp_stall = &p->warp_stall[(size_t)pc * MILO_UNIT_COUNT];
+        if (!p->warp_seen[pc]) {
+            p->warp_seen[pc] = true;
+            p->warp_touched[p->warp_touched_count++] = pc;
+        }
+        for (int u = 0; u < MILO_UNIT_COUNT; u++) {
+            if (thread_stall[u] > warp_stall[u]) warp_stall[u] = thread_stall[u];
+            thread_stall[u] = 0;
+        }
+        p->pcs[pc].exec += p->thread_exec[pc];
+        p->draw.exec += p->thread_exec[pc];
+        p->thread_exec[pc] = 0;
+    }
+    p->thread_touched_count = 0;
+    p->threads++;
+    p->draw.threads++;
+    p->lane_start[p->warp_lanes + 1] = p->lane_event_count;
+    
+    if (++p->warp_lanes >= lanes_per_warp(p)) flush_warp(p);
+}
+
+void milo_prof_finish(milo_prof_t *p) {
+    if (p->warp_lanes > 0) flush_warp(p);
+    if (p->draw.threads == 0) return;
+    if (reserve((void **)&p->draws, &p->draw_capacity, (uint64_t)p->draw_count + 1,
+                sizeof(milo_prof_draw_t))) {
+        p->draws[p->draw_count++] = p->draw;
+    }
+    memset(&p->draw, 0, sizeof(p->draw));
+}
+
+/*---------------------------------------------------------------------------
+ * Report
+ *---------------------------------------------------------------------------*/
+
+static uint64_t pc_stall(const milo_prof_pc_t *e) {
+    uint64_t total = 0;
+    for (int u = 0; u < MILO_UNIT_COUNT; u++) total += e->stall[u];
+    return total;
+}
+
+static uint64_t pc_cycles(const milo_prof_pc_t *e) {
+    return e->issues + pc_stall(e);
+}
+
+static int dominant_stall(const milo_prof_pc_t *e) {
+    int best = -1;
+    for (int u = 0; u < MILO_UNIT_COUNT; u++) {
+        if (e->stall[u] && (best < 0 || e->stall[u] > e->stall[best])) best = u;
+    }
+    return best;
+}
+
+/* Copy source line n (1-based), leading blanks trimmed */
+static void source_line(const char *source, int n, char *buf, size_t size) {
+    buf[0] = '\0';
+    if (!source || n <= 0) return;
+    const char *p = source;
+    for (int line = 1; line < n && *p; p++) {
+        if (*p == '\n') line++;
+    }
+    while (*p == ' ' || *p == '\t') p++;
+    size_t len = strcspn(p, "\r\n");
+    if (len >= size) len = size - 1;
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+}
+
+/* "<line>: <text>" for the instruction at pc, or "" */
+static void source_note(const int *lines, const char *source, uint32_t pc,
+                        char *buf, size_t size) {
+    buf[0] = '\0';
+    if (!lines || lines[pc] <= 0) return;
+    char text[96];
+    source_line(source, lines[pc], text, sizeof(text));
+    snprintf(buf, size, "%d: %s", lines[pc], text);
+}
+
+typedef struct {
+    uint64_t cycles;
+    uint32_t index;
+} ranked_t;
+
+static int compare_ranked(const void *a, const void *b) {
+    const ranked_t *ra = a, *rb = b;
+    if (ra->cycles != rb->cycles) return ra->cycles < rb->cycles ? 1 : -1;
+    return (ra->index > rb->index) - (ra->index < rb->index);
+}
+
+/* Block leaders: entry, branch and call targets, and after control transfers */
+static void find_leaders(const uint64_t *code, uint32_t size, bool *leader) {
+    memset(leader, 0, size * sizeof(bool));
+    if (size) leader[0] = true;
+    for (uint32_t pc = 0; pc < size; pc++) {
+        uint8_t op = (uint8_t)(code[pc] >> 56);
+        uint32_t target = (uint32_t)code[pc];
+        bool branch = op == OP_BRA || op == OP_BEQ || op == OP_BNE;
+        if ((branch || op == OP_CALL || op == OP_SSY) && target < size) leader[target] = true;
+        if ((branch || op == OP_RET || op == OP_EXIT) && pc + 1 < size) leader[pc + 1] = true;
+    }
+}
+
+typedef struct {
+    const milo_prof_t *p;
+    const int         *lines;
+    const char        *source;
+} annotate_ctx_t;
+
+static void annotate(void *ctx, uint32_t pc, char *prefix, size_t prefix_size,
+                     char *suffix, size_t suffix_size) {
+    const annotate_ctx_t *a = ctx;
+    const milo_prof_pc_t *e = &a->p->pcs[pc];
+    if (e->issues) {
+        int cause = dominant_stall(e);
+        snprintf(prefix, prefix_size, "%9llu %6.1f %7llu %-4s | ",
+                 (unsigned long long)e->issues, (double)e->exec / e->issues,
+                 (unsigned long long)pc_stall(e), cause >= 0 ? milo_unit_name(cause) : "");
+    } else {
+        snprintf(prefix, prefix_size, "%9s %6s %7s %-4s | ", ".", "", "", "");
+    }
+    source_note(a->lines, a->source, pc, suffix, suffix_size);
+}
+
+void milo_prof_report(const milo_prof_t *p, const uint64_t *code, uint32_t code_size,
+                      const int *lines, const char *source, uint32_t top, FILE *out) {
+    uint32_t n = code_size < p->size ? code_size : p->size;
+    uint64_t exec = 0, issues = 0, stall[MILO_UNIT_COUNT] = {0}, stalls = 0;
+    for (uint32_t pc = 0; pc < n; pc++) {
+        exec += p->pcs[pc].exec;
+        issues += p->pcs[pc].issues;
+        for (int u = 0; u < MILO_UNIT_COUNT; u++) stall[u] += p->pcs[pc].stall[u];
+    }
+    for (int u = 0; u < MILO_UNIT_COUNT; u++) stalls += stall[u];
+    uint64_t cycles = issues + stalls;
+    
+    fprintf(out, "Profile: %llu threads in %llu warps of %u, %u instructions\n",
+            (unsigned long long)p->threads, (unsigned long long)p->warps,
+            p->warp_size, code_size);
+    fprintf(out, "Thread instructions %llu, warp issues %llu, %.1f active lanes per issue\n",
+            (unsigned long long)exec, (unsigned long long)issues,
+            issues ? (double)exec / issues : 0.0);
+    fprintf(out, "Estimated warp cycles %llu: %llu issue + %llu stall (",
+            (unsigned long long)cycles, (unsigned long long)issues,
+            (unsigned long long)stalls);
+    for (int u = MILO_UNIT_FPU; u < MILO_UNIT_COUNT; u++) {
+        fprintf(out, "%s%s %llu", u > MILO_UNIT_FPU ? ", " : "",
+                u == MILO_UNIT_CTRL ? "branch" : milo_unit_name(u),
+                (unsigned long long)stall[u]);
+    }
+    fprintf(out, ")\n\n");
+    
+    ranked_t *ranked = malloc((n ? n : 1) * sizeof(ranked_t));
+    bool *leader = malloc((n ? n : 1) * sizeof(bool));
+    char text[128], note[128];
+    if (ranked && leader && cycles > 0) {
+        /* Hottest instructions */
+        for (uint32_t pc = 0; pc < n; pc++) {
+            ranked[pc].cycles = pc_cycles(&p->pcs[pc]);
+            ranked[pc].index = pc;
+        }
+        qsort(ranked, n, sizeof(ranked_t), compare_ranked);
+        fprintf(out, "Hottest instructions (cycles = issues + stalls):\n");
+        fprintf(out, "   Cycles  Share  Lanes   Stall  PC    %-32s  Source\n", "Instruction");
+        for (uint32_t i = 0; i < n && i < top && ranked[i].cycles; i++) {
+            const milo_prof_pc_t *e = &p->pcs[ranked[i].index];
+            milo_disasm_inst(code[ranked[i].index], text, sizeof(text));
+            source_note(lines, source, ranked[i].index, note, sizeof(note));
+            fprintf(out, "%9llu %5.1f%% %6.1f %7llu  %04X  %-32.32s  %s\n",
+                    (unsigned long long)ranked[i].cycles, 100.0 * ranked[i].cycles / cycles,
+                    e->issues ? (double)e->exec / e->issues : 0.0,
+                    (unsigned long long)pc_stall(e), ranked[i].index, text, note);
+        }
+        fprintf(out, "\n");
+        
+        /* Hottest blocks, ranked[].index holding each block's first PC */
+        find_leaders(code, n, leader);
+        uint32_t blocks = 0;
+        for (uint32_t pc = 0; pc < n; pc++) {
+            if (leader[pc]) ranked[blocks++] = (ranked_t){ 0, pc };
+            ranked[blocks - 1].cycles += pc_cycles(&p->pcs[pc]);
+        }
+        qsort(ranked, blocks, sizeof(ranked_t), compare_ranked);
+        fprintf(out, "Hottest blocks:\n");
+        fprintf(out, "   Cycles  Share  PC range   Instrs  Source lines\n");
+        for (uint32_t i = 0; i < blocks && i < top && ranked[i].cycles; i++) {
+            uint32_t start = ranked[i].index, end = start + 1;
+            while (end < n && !leader[end]) end++;
+            int lo = 0, hi = 0;
+            for (uint32_t pc = start; lines && pc < end; pc++) {
+                if (lines[pc] > 0 && (lo == 0 || lines[pc] < lo)) lo = lines[pc];
+                if (lines[pc] > hi) hi = lines[pc];
+            }
+            fprintf(out, "%9llu %5.1f%%  %04X-%04X  %6u  ",
+                    (unsigned long long)ranked[i].cycles, 100.0 * ranked[i].cycles / cycles,
+                    start, end - 1, end - start);
+            if (lo == 0) fprintf(out, "-\n");
+            else if (lo == hi) fprintf(out, "%d\n", lo);
+            else fprintf(out, "%d-%d\n", lo, hi);
+        }
+        fprintf(out, "\n");
+    }
+    free(ranked);
+    free(leader);
+    
+    fprintf(out, "Annotated listing:\n");
+    fprintf(out, "%9s %6s %7s %-4s |\n", "Issues", "Lanes", "Stall", "On");
+    annotate_ctx_t ctx = { p, lines, source };
+    milo_disasm_annotated(code, n, out, annotate, &ctx);
+}
+
+/*---------------------------------------------------------------------------
+ * Utilization
+ *---------------------------------------------------------------------------*/
+
+typedef struct {
+    uint64_t pos;
+    uint64_t end;
+    uint64_t ready;
+} slot_t;
+
+/* Start the next warp with instructions in slot s; false if none is left */
+static bool launch_warp(const milo_prof_t *p, uint64_t *next, slot_t *s, uint64_t cycle) {
+    while (*next < p->warps) {
+        uint64_t w = (*next)++;
+        s->pos = p->warp_events[w];
+        s->end = p->warp_events[w + 1];
+        if (s->pos < s->end) {
+            s->ready = cycle + p->events[s->pos].stall;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool milo_prof_utilization(const milo_prof_t *p, const uint64_t *code, uint32_t code_size,
+                           uint32_t resident, FILE *csv, milo_prof_util_t *util) {
+    memset(util, 0, sizeof(*util));
+    if (!p->trace || !p->warp_events || p->warp_lanes > 0 || resident == 0) return false;
+    slot_t *slots = calloc(resident, sizeof(slot_t));
+    bool *busy = calloc(resident, sizeof(bool));
+    if (!slots || !busy) {
+        free(slots);
+        free(busy);
+        return false;
+    }
+    
+    uint64_t next = 0;
+    uint32_t active = 0;
+    for (uint32_t i = 0; i < resident; i++) {
+        busy[i] = launch_warp(p, &next, &slots[i], 0);
+        if (busy[i]) active++;
+    }
+    
+    if (csv) {
+        fprintf(csv, "Cycle,ALU_Active,SFU_Active,LSU_Active,Active_Warps,"
+                     "FPU_Active,TEX_Active\n");
+    }
+    uint32_t rr = 0;
+    for (uint64_t cycle = 0; active > 0; cycle++) {
+        int unit = -1;
+        uint32_t warps = active;
+        for (uint32_t k = 0; k < resident; k++) {
+            uint32_t i = (rr + k) % resident;
+            if (!busy[i] || slots[i].ready > cycle) continue;
+            
+            slot_t *s = &slots[i];
+            uint32_t pc = p->events[s->pos++].pc;
+            unit = pc < code_size ? milo_op_unit((uint8_t)(code[pc] >> 56)) : MILO_UNIT_ALU;
+            util->issued[unit]++;
+            if (s->pos < s->end) {
+                s->ready = cycle + 1 + p->events[s->pos].stall;
+            } else if (!launch_warp(p, &next, s, cycle + 1)) {
+                busy[i] = false;
+                active--;
+            }
+            rr = i + 1;
+            break;
+        }
+        util->cycles++;
+        util->warp_cycles += warps;
+        
+        if (csv) {
+            fprintf(csv, "%llu,%d,%d,%d,%u,%d,%d\n", (unsigned long long)cycle,
+                    unit == MILO_UNIT_ALU,
+                    unit == MILO_UNIT_FPU || unit == MILO_UNIT_SFU,
+                    unit == MILO_UNIT_LSU || unit == MILO_UNIT_TEX,
+                    warps, unit == MILO_UNIT_FPU, unit == MILO_UNIT_TEX);
+        }
+    }
+    
+    free(slots);
+    free(busy);
+    return true;
+}
+
+void milo_prof_report_mix(const milo_prof_t *p, const uint64_t *code, uint32_t code_size,
+                          const milo_prof_util_t *util, FILE *out) {
+    uint64_t op_exec[256] = {0}, op_issues[256] = {0};
+    uint64_t unit_issues[MILO_UNIT_COUNT] = {0}, issues = 0;
+    uint32_t n = code_size < p->size ? code_size : p->size;
+    for (uint32_t pc = 0; pc < n; pc++) {
+        uint8_t op = (uint8_t)(code[pc] >> 56);
+        op_exec[op] += p->pcs[pc].exec;
+        op_issues[op] += p->pcs[pc].issues;
+        unit_issues[milo_op_unit(op)] += p->pcs[pc].issues;
+        issues += p->pcs[pc].issues;
+    }
+    
+    fprintf(out, "Opcode mix:\n");
+    fprintf(out, "  Op      Unit    Issues  Share  Thread exec  Lanes\n");
+    for (int u = 0; u < MILO_UNIT_COUNT; u++) {
+        for (int op = 0; op < 256; op++) {
+            if (!op_issues[op] || milo_op_unit((uint8_t)op) != (milo_unit_t)u) continue;
+            char text[64];
+            milo_disasm_inst((uint64_t)op << 56, text, sizeof(text));
+            text[strcspn(text, " ")] = '\0';
+            fprintf(out, "  %-7s %-4s %9llu %5.1f%% %12llu %6.1f\n", text, milo_unit_name(u),
+                    (unsigned long long)op_issues[op], 100.0 * op_issues[op] / issues,
+                    (unsigned long long)op_exec[op], (double)op_exec[op] / op_issues[op]);
+        }
+    }
+    fprintf(out, "\nIssues by unit:");
+    for (int u = 0; u < MILO_UNIT_COUNT; u++) {
+        fprintf(out, " %s %.1f%%", milo_unit_name(u),
+                issues ? 100.0 * unit_issues[u] / issues : 0.0);
+    }
+    fprintf(out, "\n");
+    
+    if (util && util->cycles) {
+        /* The unit taking the largest share of issue slots bounds the shader
+         * once latency is hidden */
+        int bound = 0;
+        for (int u = 1; u < MILO_UNIT_COUNT; u++) {
+            if (util->issued[u] > util->issued[bound]) bound = u;
+        }
+        fprintf(out, "Unit utilization over %llu cycles, %.1f warps active on average:",
+                (unsigned long long)util->cycles, (double)util->warp_cycles / util->cycles);
+        for (int u = 0; u < MILO_UNIT_COUNT; u++) {
+            fprintf(out, " %s %.1f%%", milo_unit_name(u), 100.0 * util->issued[u] / util->cycles);
+        }
+        uint64_t issued = 0;
+        for (int u = 0; u < MILO_UNIT_COUNT; u++) issued += util->issued[u];
+        fprintf(out, "\nIssue slots used %.1f%%, most issued unit %s\n",
+                100.0 * issued / util->cycles, milo_unit_name(bound));
+    }
+    fprintf(out, "\n");
+}
+
+/*---------------------------------------------------------------------------
+ * Divergence
+ *---------------------------------------------------------------------------*/
+
+static void print_draw(const char *label, const milo_prof_draw_t *d, FILE *out) {
+    fprintf(out, "  %-6s %9llu %7llu %9llu %6.1f %9llu %9llu %10llu %5.1f%%\n", label,
+            (unsigned long long)d->threads, (unsigned long long)d->warps,
+            (unsigned long long)d->issues, d->issues ? (double)d->exec / d->issues : 0.0,
+            (unsigned long long)d->branches, (unsigned long long)d->diverged,
+            (unsigned long long)d->serialized,
+            d->issues ? 100.0 * d->serialized / d->issues : 0.0);
+}
+
+void milo_prof_report_divergence(const milo_prof_t *p, const uint64_t *code,
+                                 uint32_t code_size, const int *lines, const char *source,
+                                 FILE *out) {
+    uint32_t n = code_size < p->size ? code_size : p->size;
+    milo_prof_draw_t total = {0};
+    for (uint32_t i = 0; i < p->draw_count; i++) {
+        total.threads += p->draws[i].threads;
+        total.warps += p->draws[i].warps;
+        total.exec += p->draws[i].exec;
+        total.issues += p->draws[i].issues;
+        total.branches += p->draws[i].branches;
+        total.diverged += p->draws[i].diverged;
+        total.serialized += p->draws[i].serialized;
+    }
+    
+    fprintf(out, "Divergence: %.1f%% SIMD efficiency (%.1f of %u lanes per issue), "
+            "%llu of %llu branches diverged, %llu issues serialized\n",
+            total.issues ? 100.0 * total.exec / ((double)total.issues * lanes_per_warp(p)) : 0.0,
+            total.issues ? (double)total.exec / total.issues : 0.0, lanes_per_warp(p),
+            (unsigned long long)total.diverged, (unsigned long long)total.branches,
+            (unsigned long long)total.serialized);
+    if (p->lost) fprintf(out, "(incomplete: out of memory replaying warps)\n");
+    
+    /* Conditional branches executed, with the issues their split paths took */
+    char text[128], note[128];
+    bool header = false;
+    for (uint32_t pc = 0; pc < n; pc++) {
+        uint8_t op = (uint8_t)(code[pc] >> 56);
+        const milo_prof_pc_t *e = &p->pcs[pc];
+        if ((op != OP_BEQ && op != OP_BNE) || !e->issues) continue;
+        if (!header) {
+            fprintf(out, "  PC    %-32s     Issues  Diverged   Rate  Serialized  Source\n",
+                    "Branch");
+            header = true;
+        }
+        milo_disasm_inst(code[pc], text, sizeof(text));
+        source_note(lines, source, pc, note, sizeof(note));
+        fprintf(out, "  %04X  %-32.32s %10llu %9llu %5.1f%% %11llu  %s\n", pc, text,
+                (unsigned long long)e->issues, (unsigned long long)e->diverged,
+                100.0 * e->diverged / e->issues, (unsigned long long)e->serialized, note);
+    }
+    
+    fprintf(out, "Per draw:\n");
+    fprintf(out, "  %-6s %9s %7s %9s %6s %9s %9s %10s %6s\n", "Draw", "Threads", "Warps",
+            "Issues", "Lanes", "Branches", "Diverged", "Serialized", "Share");
+    for (uint32_t i = 0; i < p->draw_count; i++) {
+        char label[16];
+        snprintf(label, sizeof(label), "%u", i);
+        print_draw(label, &p->draws[i], out);
+    }
+    if (p->draw_count > 1) print_draw("total", &total, out);
+    fprintf(out, "\n");
+}
+
+bool milo_prof_write_counts(const milo_prof_t *p, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "# Warp issues per PC (%llu threads, %llu warps)\n",
+            (unsigned long long)p->threads, (unsigned long long)p->warps);
+    for (uint32_t pc = 0; pc < p->size; pc++) {
+        if (p->pcs[pc].issues) {
+            fprintf(f, "%04X %llu\n", pc, (unsigned long long)p->pcs[pc].issues);
+        }
+    }
+    return fclose(f) == 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * milo_prof.h
+ * Milo832 Shader Profiler - Header
+ *
+ * Optional per-PC execution profile collected by the VM. Attach a profile
+ * to a VM (vm->profile) and every instruction executed is counted:
+ *   - thread executions, and warp issues: consecutive invocations are
+ *     grouped into warps of warp_size lanes, and each warp's lanes are
+ *     replayed in lockstep under an active lane mask. A branch whose lanes
+ *     disagree splits the warp: the taken lanes run first while the others
+ *     wait on a divergence stack, and the paths rejoin at the JOIN of the
+ *     enclosing SSY. executions / issues is the average number of active
+ *     lanes;
+ *   - estimated stall cycles before each issue, split by cause: waiting on
+ *     a result from the FPU, SFU, LSU or texture unit (scoreboard), or
+ *     refetching after a taken branch. Stalls are estimated for a warp
+ *     running alone, with no other warps to hide latency behind.
+ *
+ * The report is an annotated disassembly mapped back to GLSL source lines,
+ * with the hottest instructions and blocks listed first.
+ *
+ * Per-branch divergence (how often each branch split its warp, and the warp
+ * issues spent on the serialized paths) is reported per shader and per draw.
+ *
+ * With trace set, each warp's instruction stream is also kept, and replayed
+ * through an SM issuing one instruction per cycle from up to NUM_WARPS
+ * resident warps. That gives per-cycle unit activity in the CSV schema of
+ * TB/plot_utilization.py, next to the per-opcode histogram.
+ */
+
+#ifndef MILO_PROF_H
+#define MILO_PROF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/*---------------------------------------------------------------------------
+ * Functional Units
+ *---------------------------------------------------------------------------*/
+
+/* Units as classified by get_unit_type in RTL/Core/simt_pkg.vhd, with the
+ * SFU split out of the FPU and texture fetches out of the LSU */
+typedef enum {
+    MILO_UNIT_ALU,
+    MILO_UNIT_FPU,
+    MILO_UNIT_SFU,
+    MILO_UNIT_LSU,
+    MILO_UNIT_TEX,
+    MILO_UNIT_CTRL,
+    MILO_UNIT_COUNT
+} milo_unit_t;
+
+/* Result latencies in cycles (docs/architecture.md, Execution Units). LSU
+ * latency is variable in hardware; these are typical uncontended values. */
+#define MILO_LATENCY_ALU        1
+#define MILO_LATENCY_FPU        4
+#define MILO_LATENCY_SFU        8
+#define MILO_LATENCY_LSU        20
+#define MILO_LATENCY_TEX        40
+
+/* Cycles lost refetching after a taken branch (IF and ID refill) */
+#define MILO_BRANCH_PENALTY     2
+
+/* Warps resident on an SM (NUM_WARPS in RTL/Core/simt_pkg.vhd) */
+#define MILO_RESIDENT_WARPS     24
+
+/* Unit executing an opcode */
+milo_unit_t milo_op_unit(uint8_t op);
+
+/* Cycles until an opcode's result can be used */
+uint32_t milo_op_latency(uint8_t op);
+
+/* Registers written from rd on (TEX writes four) */
+int milo_op_writes(uint8_t op);
+
+/* Source registers an instruction waits on, r0 excluded; returns the count
+ * (at most 4) */
+int milo_op_sources(uint64_t inst, uint8_t regs[4]);
+
+/* Short lower case unit name ("alu", "fpu", ...) */
+const char *milo_unit_name(milo_unit_t unit);
+
+/*---------------------------------------------------------------------------
+ * Profile
+ *---------------------------------------------------------------------------*/
+
+typedef struct {
+    uint64_t exec;                      /* Thread executions */
+    uint64_t issues;                    /* Warp issues */
+    uint64_t stall[MILO_UNIT_COUNT];    /* Stall cycles before issue, by the
+                                         * unit waited on (CTRL: refetch) */
+    uint64_t diverged;                  /* Branch: issues that split the warp */
+    uint64_t serialized;                /* Branch: warp issues spent on the
+                                         * paths it split, until they rejoin */
+} milo_prof_pc_t;
+
+/* One issue of a warp's instruction stream */
+typedef struct {
+    uint32_t pc;
+    uint32_t stall;                     /* Cycles waited before issue */
+} milo_prof_event_t;
+
+/* Totals for one draw (invocations between milo_prof_finish calls) */
+typedef struct {
+    uint64_t threads;
+    uint64_t warps;
+    uint64_t exec;
+    uint64_t issues;
+    uint64_t branches;                  /* Conditional branch issues */
+    uint64_t diverged;
+    uint64_t serialized;
+} milo_prof_draw_t;
+
+/* SIMT divergence stack entry (private) */
+typedef struct {
+    uint32_t mask;                      /* Lanes to resume */
+    uint32_t origin;                    /* Branch that split the path */
+    uint32_t rpc;                       /* SSY target, UINT32_MAX: pending path */
+} milo_prof_frame_t;
+
+#define MILO_PROF_MAX_LANES     32
+
+typedef struct {
+    /* Options */
+    uint32_t        warp_size;          /* Invocations per warp (default and
+                                         * maximum MILO_PROF_MAX_LANES) */
+    bool            trace;              /* Keep warp instruction streams */
+    
+    /* Results */
+    milo_prof_pc_t *pcs;
+    uint32_t        size;               /* PCs covered */
+    uint64_t        threads;
+    uint64_t        warps;
+    milo_prof_draw_t *draws;
+    uint32_t        draw_count;
+    uint64_t        draw_capacity;
+    
+    /* Results with trace: warp w issued events[warp_events[w] ..
+     * warp_events[w + 1]). Tracing stops (trace cleared) if memory runs
+     * out. */
+    milo_prof_event_t *events;
+    uint64_t        event_count;
+    uint64_t        event_capacity;
+    uint64_t       *warp_events;
+    uint64_t        warp_event_capacity;
+    
+    /* Private: current thread and warp. Each lane's instruction stream is
+     * kept until the warp is complete, then replayed with lane masks. */
+    uint32_t       *thread_exec;
+    uint64_t       *thread_stall;       /* size x MILO_UNIT_COUNT */
+    uint32_t       *thread_touched;
+    uint32_t        thread_touched_count;
+    uint64_t       *warp_stall;         /* size x MILO_UNIT_COUNT */
+    uint32_t       *warp_touched;
+    uint32_t        warp_touched_count;
+    bool           *warp_seen;
+    uint32_t        warp_lanes;
+    uint64_t       *insts;              /* Instruction seen at each PC */
+    milo_prof_event_t *lane_events;
+    uint64_t        lane_event_count;
+    uint64_t        lane_event_capacity;
+    uint64_t        lane_start[MILO_PROF_MAX_LANES + 1];
+    milo_prof_frame_t *stack;
+    uint64_t        stack_capacity;
+    milo_prof_draw_t draw;
+    bool            lost;               /* Out of memory: results incomplete */
+    uint64_t        clock;
+    uint64_t        reg_ready[256];
+    uint8_t         reg_unit[256];
+    uint32_t        last_pc;
+    bool            in_thread;
+} milo_prof_t;
+
+/* Allocate a profile for code_size instructions */
+bool milo_prof_init(milo_prof_t *p, uint32_t code_size);
+
+void milo_prof_free(milo_prof_t *p);
+
+/* Zero all counts */
+void milo_prof_clear(milo_prof_t *p);
+
+/* VM hooks: one invocation's start, each instruction before it executes,
+ * and the invocation's end */
+void milo_prof_thread_begin(milo_prof_t *p);
+void milo_prof_step(milo_prof_t *p, uint32_t pc, uint64_t inst);
+void milo_prof_thread_end(milo_prof_t *p);
+
+/* End of a draw: close a partially filled warp and record the draw's
+ * totals. Renderers call it; call it before reading results otherwise. */
+void milo_prof_finish(milo_prof_t *p);
+
+/* Print the report: summary, the top hottest instructions and blocks, and
+ * the annotated listing. lines (from milo_glsl_get_lines) and source map
+ * PCs to GLSL; either may be NULL. */
+void milo_prof_report(const milo_prof_t *p, const uint64_t *code, uint32_t code_size,
+                      const int *lines, const char *source, uint32_t top, FILE *out);
+
+/* Issue the traced warp streams in order on one SM with up to resident
+ * warps in flight, round robin among the warps whose stall has elapsed.
+ * Writes one CSV row per cycle if csv is given:
+ *   Cycle,ALU_Active,SFU_Active,LSU_Active,Active_Warps,FPU_Active,TEX_Active
+ * The first five columns follow the RTL's unit classes: SFU_Active covers
+ * everything get_unit_type sends to UNIT_FPU (FPU and SFU), LSU_Active
+ * includes texture fetches. The last two break out those subsets. */
+typedef struct {
+    uint64_t cycles;
+    uint64_t issued[MILO_UNIT_COUNT];   /* Warp instructions per unit */
+    uint64_t warp_cycles;               /* Sum of active warps over cycles */
+} milo_prof_util_t;
+
+bool milo_prof_utilization(const milo_prof_t *p, const uint64_t *code, uint32_t code_size,
+                           uint32_t resident, FILE *csv, milo_prof_util_t *util);
+
+/* Print the opcode histogram (thread executions and warp issues per
+ * opcode, by unit), and unit utilization if util is given */
+void milo_prof_report_mix(const milo_prof_t *p, const uint64_t *code, uint32_t code_size,
+                          const milo_prof_util_t *util, FILE *out);
+
+/* Print branch divergence: per conditional branch executed, and per draw */
+void milo_prof_report_divergence(const milo_prof_t *p, const uint64_t *code,
+                                 uint32_t code_size, const int *lines, const char *source,
+                                 FILE *out);
+
+/* Write warp issues per PC as "<pc hex> <count>" lines, the profile format
+ * read by milo_layout_load_profile */
+bool milo_prof_write_counts(const milo_prof_t *p, const char *path);
+
+#endif /* MILO_PROF_H */
@@ -0,0 +1,256 @@
+/*
+ * milo_raster.c
+ * Milo832 Triangle Rasterizer - Implementation
+ */
+
+#include "milo_raster.h"
+#include <math.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define SUBPIXEL    (1 << MILO_RASTER_SUBPIXEL_BITS)
+#define HALF        (SUBPIXEL / 2)
+
+/* Pixel centers are at (x + 0.5, y + 0.5) */
+static int64_t center(int p) {
+    return (int64_t)p * SUBPIXEL + HALF;
+}
+
+/* First and last pixel whose center lies in [lo, hi] (fixed point) */
+static int first_pixel(int64_t lo) {
+    int64_t n = lo - HALF;
+    return (int)(n >= 0 ? (n + SUBPIXEL - 1) / SUBPIXEL : -((-n) / SUBPIXEL));
+}
+
+static int last_pixel(int64_t hi) {
+    int64_t n = hi - HALF;
+    return (int)(n >= 0 ? n / SUBPIXEL : -((-n + SUBPIXEL - 1) / SUBPIXEL));
+}
+
+/*---------------------------------------------------------------------------
+ * Triangle Setup
+ *---------------------------------------------------------------------------*/
+
+bool milo_raster_setup(milo_raster_tri_t *t, const milo_raster_vertex_t v[3],
+                       int width, int height, milo_cull_t cull) {
+    memset(t, 0, sizeof(*t));
+    int64_t x[3], y[3];
+    for (int i = 0; i < 3; i++) {
+        /* Also rejects NaN */
+        if (!(fabsf(v[i].x) < MILO_RASTER_GUARD_BAND) ||
+            !(fabsf(v[i].y) < MILO_RASTER_GUARD_BAND) || !(v[i].w > 0.0f)) {
+            return false;
+        }
+        x[i] = llroundf(v[i].x * SUBPIXEL);
+        y[i] = llroundf(v[i].y * SUBPIXEL);
+        t->z[i] = v[i].z;
+        t->inv_w[i] = 1.0f / v[i].w;
+    }
+    
+    /* Twice the signed area; negative is counter-clockwise once y points
+     * up again */
+    int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0) return false;
+    t->front = area < 0;
+    if ((cull == MILO_CULL_BACK && !t->front) || (cull == MILO_CULL_FRONT && t->front)) {
+        return false;
+    }
+    
+    /* Wind counter-clockwise so the inside is E >= 0 on all edges */
+    t->vertex[0] = 0;
+    t->vertex[1] = area < 0 ? 1 : 2;
+    t->vertex[2] = area < 0 ? 2 : 1;
+    t->inv_area = 1.0 / (double)(area < 0 ? -area : area);
+    
+    int64_t min_x = x[0], max_x = x[0], min_y = y[0], max_y = y[0];
+    for (int i = 0; i < 3; i++) {
+        int vi = t->vertex[i], vj = t->vertex[(i + 1) % 3];
+        int64_t a = y[vj] - y[vi];
+        int64_t b = -(x[vj] - x[vi]);
+        t->a[i] = a;
+        t->b[i] = b;
+        t->c[i] = -(a * x[vi] + b * y[vi]);
+        
+        /* Top-left rule: centers on other edges fall outside */
+        bool top_left = a > 0 || (a == 0 && b > 0);
+        t->bias[i] = top_left ? 0 : 1;
+        t->c[i] -= t->bias[i];
+        
+        if (x[i] < min_x) min_x = x[i];
+        if (x[i] > max_x) max_x = x[i];
+        if (y[i] < min_y) min_y = y[i];
+        if (y[i] > max_y) max_y = y[i];
+    }
+    
+    t->min_x = first_pixel(min_x);
+    t->max_x = last_pixel(max_x);
+    t->min_y = first_pixel(min_y);
+    t->max_y = last_pixel(max_y);
+    if (t->min_x < 0) t->min_x = 0;
+    if (t->min_y < 0) t->min_y = 0;
+    if (t->max_x > width - 1) t->max_x = width - 1;
+    if (t->max_y > height - 1) t->max_y = height - 1;
+    return t->min_x <= t->max_x && t->min_y <= t->max_y;
+}
+
+void milo_raster_weights(const milo_raster_tri_t *t, int x, int y,
+                         float linear[3], float perspective[3]) {
+    int64_t px = center(x), py = center(y);
+    double e[3];
+    for (int i = 0; i < 3; i++) {
+        e[i] = (double)(t->a[i] * px + t->b[i] * py + t->c[i] + t->bias[i]);
+    }
+    
+    /* A vertex's weight is the edge function of the opposite edge */
+    float sum = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        int v = t->vertex[k];
+        linear[v] = (float)(e[(k + 1) % 3] * t->inv_area);
+        perspective[v] = linear[v] * t->inv_w[v];
+        sum += perspective[v];
+    }
+    for (int k = 0; k < 3; k++) perspective[k] = sum != 0.0f ? perspective[k] / sum : linear[k];
+}
+
+/*---------------------------------------------------------------------------
+ * Traversal
+ *---------------------------------------------------------------------------*/
+
+enum { REJECT, PARTIAL, ACCEPT };
+
+/* Classify an n x n pixel block from its edge values e at the top left
+ * pixel center. An edge function is linear, so over the block it is
+ * smallest and largest at corners: outside if one edge is negative at all
+ * four, inside if every edge is non-negative at all four. */
+static int classify(const milo_raster_tri_t *t, const int64_t e[3], int n) {
+    int result = ACCEPT;
+    for (int i = 0; i < 3; i++) {
+        int64_t dx = t->a[i] * (n - 1) * SUBPIXEL, dy = t->b[i] * (n - 1) * SUBPIXEL;
+        int64_t lo = e[i] + (dx < 0 ? dx : 0) + (dy < 0 ? dy : 0);
+        int64_t hi = e[i] + (dx > 0 ? dx : 0) + (dy > 0 ? dy : 0);
+        if (hi < 0) return REJECT;
+        if (lo < 0) result = PARTIAL;
+    }
+    return result;
+}
+
+/* Per-pixel coverage of a 4x4 quarter block from its top left edge values,
+ * bit (py * MILO_RASTER_BLOCK + px). A pixel is inside when no edge is
+ * negative, i.e. the OR of the three has no sign bit; with SSE2/AVX2 the
+ * sign bits of 64-bit lanes come straight out of movemask_pd. */
+static uint64_t cover_4x4(const milo_raster_tri_t *t, const int64_t e[3]) {
+    const int n = MILO_RASTER_BLOCK;
+    uint64_t mask = 0;
+#if defined(__AVX2__)
+    __m256i edge[3], step[3];
+    for (int i = 0; i < 3; i++) {
+        int64_t a = t->a[i] * SUBPIXEL;
+        edge[i] = _mm256_setr_epi64x(e[i], e[i] + a, e[i] + 2 * a, e[i] + 3 * a);
+        step[i] = _mm256_set1_epi64x(t->b[i] * SUBPIXEL);
+    }
+    for (int py = 0; py < 4; py++) {
+        __m256i any = _mm256_or_si256(_mm256_or_si256(edge[0], edge[1]), edge[2]);
+        int outside = _mm256_movemask_pd(_mm256_castsi256_pd(any));
+        mask |= (uint64_t)(~outside & 0xF) << (py * n);
+        for (int i = 0; i < 3; i++) edge[i] = _mm256_add_epi64(edge[i], step[i]);
+    }
+#elif defined(__SSE2__)
+    __m128i left[3], right[3], step[3];
+    for (int i = 0; i < 3; i++) {
+        int64_t a = t->a[i] * SUBPIXEL;
+        left[i] = _mm_set_epi64x(e[i] + a, e[i]);
+        right[i] = _mm_set_epi64x(e[i] + 3 * a, e[i] + 2 * a);
+        step[i] = _mm_set1_epi64x(t->b[i] * SUBPIXEL);
+    }
+    for (int py = 0; py < 4; py++) {
+        __m128i lo = _mm_or_si128(_mm_or_si128(left[0], left[1]), left[2]);
+        __m128i hi = _mm_or_si128(_mm_or_si128(right[0], right[1]), right[2]);
+        int outside = _mm_movemask_pd(_mm_castsi128_pd(lo)) |
+                      _mm_movemask_pd(_mm_castsi128_pd(hi)) << 2;
+        mask |= (uint64_t)(~outside & 0xF) << (py * n);
+        for (int i = 0; i < 3; i++) {
+            left[i] = _mm_add_epi64(left[i], step[i]);
+            right[i] = _mm_add_epi64(right[i], step[i]);
+        }
+    }
+#else
+    int64_t row[3] = { e[0], e[1], e[2] };
+    for (int py = 0; py < 4; py++) {
+        int64_t e0 = row[0], e1 = row[1], e2 = row[2];
+        for (int px = 0; px < 4; px++) {
+            if ((e0 | e1 | e2) >= 0) mask |= 1ull << (py * n + px);
+            e0 += t->a[0] * SUBPIXEL;
+            e1 += t->a[1] * SUBPIXEL;
+            e2 += t->a[2] * SUBPIXEL;
+        }
+        for (int i = 0; i < 3; i++) row[i] += t->b[i] * SUBPIXEL;
+    }
+#endif
+    return mask;
+}
+
+/* Pixels of an 8x8 block at (bx, by) inside the inclusive rect */
+static uint64_t rect_mask(int bx, int by, int rx0, int ry0, int rx1, int ry1) {
+    const int n = MILO_RASTER_BLOCK;
+    int x0 = rx0 > bx ? rx0 - bx : 0, x1 = rx1 < bx + n - 1 ? rx1 - bx : n - 1;
+    int y0 = ry0 > by ? ry0 - by : 0, y1 = ry1 < by + n - 1 ? ry1 - by : n - 1;
+    uint64_t row = ((1ull << (x1 - x0 + 1)) - 1) << x0;
+    uint64_t mask = 0;
+    for (int y = y0; y <= y1; y++) mask |= row << (y * n);
+    return mask;
+}
+
+uint64_t milo_raster_blocks(const milo_raster_tri_t *t, int x0, int y0, int x1, int y1,
+                            milo_raster_block_fn fn, void *user) {
+    /* Pixel rect to cover, inclusive */
+    int rx0 = x0 > t->min_x ? x0 : t->min_x;
+    int ry0 = y0 > t->min_y ? y0 : t->min_y;
+    int rx1 = x1 - 1 < t->max_x ? x1 - 1 : t->max_x;
+    int ry1 = y1 - 1 < t->max_y ? y1 - 1 : t->max_y;
+    if (rx0 > rx1 || ry0 > ry1) return 0;
+    
+    const int n = MILO_RASTER_BLOCK, h = MILO_RASTER_BLOCK / 2;
+    static const uint64_t quarter = 0x0F0F0F0Full;
+    uint64_t covered = 0;
+    for (int by = ry0 - ry0 % n; by <= ry1; by += n) {
+        for (int bx = rx0 - rx0 % n; bx <= rx1; bx += n) {
+            int64_t e[3];
+            for (int i = 0; i < 3; i++) {
+                e[i] = t->a[i] * center(bx) + t->b[i] * center(by) + t->c[i];
+            }
+            
+            /* 8x8 block, then its 4x4 quarters, then pixels */
+            uint64_t mask = 0;
+            int block = classify(t, e, n);
+            if (block == ACCEPT) {
+                mask = ~0ull;
+            } else if (block == PARTIAL) {
+                for (int q = 0; q < 4; q++) {
+                    int qx = (q & 1) * h, qy = (q >> 1) * h;
+                    int64_t eq[3];
+                    for (int i = 0; i < 3; i++) {
+                        eq[i] = e[i] + (t->a[i] * qx + t->b[i] * qy) * SUBPIXEL;
+                    }
+                    int shift = qy * n + qx;
+                    int sub = classify(t, eq, h);
+                    if (sub == ACCEPT) {
+                        mask |= quarter << shift;
+                    } else if (sub == PARTIAL) {
+                        mask |= cover_4x4(t, eq) << shift;
+                    }
+                }
+            }
+            
+            mask &= rect_mask(bx, by, rx0, ry0, rx1, ry1);
+            if (mask) {
+                covered += (uint64_t)__builtin_popcountll(mask);
+                fn(user, bx, by, mask);
+            }
+        }
+    }
+    return covered;
+}
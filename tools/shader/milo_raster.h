@@ -0,0 +1,102 @@
+/*
+ * milo_raster.h
+ * Milo832 Triangle Rasterizer - Header
+ *
+ * Edge-function rasterization after RTL/graphics/tile_rasterizer.vhd: each
+ * edge v[i] -> v[i+1] gives E(x, y) = A * (x - xi) + B * (y - yi) with
+ * A = yi+1 - yi and B = -(xi+1 - xi), evaluated at pixel centers, and the
+ * barycentric weight of a vertex is the edge function of the opposite edge
+ * over twice the triangle area.
+ *
+ * Unlike the RTL, which accepts a pixel on an edge of either triangle,
+ * shared edges follow the top-left fill rule: a pixel center exactly on an
+ * edge belongs to the triangle only if that is a top or left edge, so a
+ * mesh covers every pixel once. Positions snap to MILO_RASTER_SUBPIXEL_BITS
+ * fractional bits (the RTL uses 16.16) so edge functions stay exact in 64
+ * bits across the guard band.
+ *
+ * Coverage is produced per MILO_RASTER_BLOCK square block, aligned to the
+ * screen, as a bit mask of the block's pixels. Blocks and then their 4x4
+ * quarters are accepted or rejected whole from the edge values at their
+ * corners; only quarters an edge crosses are tested per pixel, four pixels
+ * at a time with SSE2 (AVX2 when built with -mavx2).
+ */
+
+#ifndef MILO_RASTER_H
+#define MILO_RASTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*---------------------------------------------------------------------------
+ * Configuration
+ *---------------------------------------------------------------------------*/
+
+#define MILO_RASTER_SUBPIXEL_BITS   8
+#define MILO_RASTER_GUARD_BAND      16384   /* Pixels either side of the
+                                             * origin a vertex may lie */
+#define MILO_RASTER_BLOCK           8       /* Block edge; 64 pixels/mask */
+
+typedef enum {
+    MILO_CULL_NONE,
+    MILO_CULL_BACK,                 /* Drop clockwise (in NDC, y up) */
+    MILO_CULL_FRONT                 /* Drop counter-clockwise */
+} milo_cull_t;
+
+/*---------------------------------------------------------------------------
+ * Triangle Setup
+ *---------------------------------------------------------------------------*/
+
+/* Screen-space vertex: position in pixels (y down), NDC depth and clip w */
+typedef struct {
+    float x, y;
+    float z;
+    float w;
+} milo_raster_vertex_t;
+
+typedef struct {
+    /* Edge i runs from setup vertex i to i+1; E = a*X + b*Y + c at the
+     * fixed-point pixel center (X, Y), top-left bias included. Inside is
+     * E >= 0 for all three. */
+    int64_t a[3], b[3], c[3];
+    int64_t bias[3];                /* Subtracted from c: 1 unless top or
+                                     * left edge */
+    
+    /* Pixel bounding box, inclusive, clipped to the viewport */
+    int     min_x, min_y, max_x, max_y;
+    
+    /* Caller's vertex for each setup vertex (setup reorders to make the
+     * winding counter-clockwise) */
+    uint8_t vertex[3];
+    double  inv_area;               /* 1 / (2 x area), fixed-point units */
+    float   z[3];                   /* Per caller vertex */
+    float   inv_w[3];
+    bool    front;                  /* Counter-clockwise in NDC */
+} milo_raster_tri_t;
+
+/* Set up a triangle for a width x height viewport. False if it covers no
+ * pixel center (zero area, culled or off screen) or lies outside the guard
+ * band; such triangles need clipping first. */
+bool milo_raster_setup(milo_raster_tri_t *t, const milo_raster_vertex_t v[3],
+                       int width, int height, milo_cull_t cull);
+
+/* Barycentric weights of the caller's vertices at pixel (x, y): linear in
+ * screen space (for depth) and perspective-correct (for varyings) */
+void milo_raster_weights(const milo_raster_tri_t *t, int x, int y,
+                         float linear[3], float perspective[3]);
+
+/*---------------------------------------------------------------------------
+ * Traversal
+ *---------------------------------------------------------------------------*/
+
+/* Covered pixels of the block with top left pixel (x, y): bit
+ * (py * MILO_RASTER_BLOCK + px) for pixel (x + px, y + py) */
+typedef void (*milo_raster_block_fn)(void *user, int x, int y, uint64_t mask);
+
+/* Walk the blocks of the triangle's bounding box inside the pixel rect
+ * [x0, x1) x [y0, y1), row by row, calling fn for each block with coverage.
+ * Returns the number of pixels covered. */
+uint64_t milo_raster_blocks(const milo_raster_tri_t *t, int x0, int y0, int x1, int y1,
+                            milo_raster_block_fn fn, void *user);
+
+#endif /* MILO_RASTER_H */
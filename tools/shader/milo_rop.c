@@ -0,0 +1,283 @@
+/*
+ * milo_rop.c
+ * Milo832 Raster Operations - Implementation
+ */
+
+#include "milo_rop.h"
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define DEPTH_SCALE     16777216.0f     /* 2^24: z24 / 2^24 is exact in float */
+
+/*---------------------------------------------------------------------------
+ * Render State
+ *---------------------------------------------------------------------------*/
+
+void milo_render_state_preset(milo_render_state_t *state, milo_state_preset_t preset) {
+    memset(state, 0, sizeof(*state));
+    state->depth_test = true;
+    state->depth_write = true;
+    state->depth_func = MILO_DEPTH_LESS;
+    state->depth_clear = MILO_DEPTH_MAX;
+    state->src_rgb = MILO_BLEND_ONE;
+    state->dst_rgb = MILO_BLEND_ZERO;
+    state->src_a = MILO_BLEND_ONE;
+    state->dst_a = MILO_BLEND_ZERO;
+    state->color_mask = 0xF;
+    
+    switch (preset) {
+        case MILO_STATE_DEFAULT:
+            break;
+        case MILO_STATE_2D:
+            state->depth_test = false;
+            state->depth_func = MILO_DEPTH_ALWAYS;
+            /* fall through */
+        case MILO_STATE_ALPHA_BLEND:
+            state->depth_write = false;
+            state->blend = true;
+            state->src_rgb = MILO_BLEND_SRC_ALPHA;
+            state->dst_rgb = MILO_BLEND_INV_SRC_ALPHA;
+            state->dst_a = MILO_BLEND_INV_SRC_ALPHA;
+            break;
+        case MILO_STATE_ADDITIVE:
+            state->depth_write = false;
+            state->blend = true;
+            state->src_rgb = MILO_BLEND_SRC_ALPHA;
+            state->dst_rgb = MILO_BLEND_ONE;
+            state->src_a = MILO_BLEND_ZERO;
+            state->dst_a = MILO_BLEND_ONE;
+            break;
+    }
+}
+
+const char *milo_state_preset_name(milo_state_preset_t preset) {
+    switch (preset) {
+        case MILO_STATE_DEFAULT:        return "default";
+        case MILO_STATE_ALPHA_BLEND:    return "alpha";
+        case MILO_STATE_ADDITIVE:       return "additive";
+        case MILO_STATE_2D:             return "2d";
+    }
+    return "?";
+}
+
+/*---------------------------------------------------------------------------
+ * Depth
+ *---------------------------------------------------------------------------*/
+
+/* Clamped as the SSE min/max would, so NaN goes to the far plane */
+uint32_t milo_rop_depth24(float z) {
+    float v = z * DEPTH_SCALE;
+    v = v < (float)MILO_DEPTH_MAX ? v : (float)MILO_DEPTH_MAX;
+    v = v > 0.0f ? v : 0.0f;
+    return (uint32_t)v;
+}
+
+float milo_rop_depth_float(uint32_t z24) {
+    return (float)z24 * (1.0f / DEPTH_SCALE);
+}
+
+bool milo_rop_depth_compare(milo_depth_func_t func, uint32_t frag, uint32_t stored) {
+    switch (func) {
+        case MILO_DEPTH_NEVER:      return false;
+        case MILO_DEPTH_LESS:       return frag < stored;
+        case MILO_DEPTH_EQUAL:      return frag == stored;
+        case MILO_DEPTH_LEQUAL:     return frag <= stored;
+        case MILO_DEPTH_GREATER:    return frag > stored;
+        case MILO_DEPTH_NOTEQUAL:   return frag != stored;
+        case MILO_DEPTH_GEQUAL:     return frag >= stored;
+        case MILO_DEPTH_ALWAYS:     return true;
+    }
+    return true;
+}
+
+bool milo_rop_depth_test(const milo_rop_t *rop, float z, float stored) {
+    return !rop->state.depth_test ||
+           milo_rop_depth_compare(rop->state.depth_func, milo_rop_depth24(z),
+                                  milo_rop_depth24(stored));
+}
+
+/* Both tests pass for nearer fragments and nearer stored depths fail them,
+ * so comparing the triangle's nearest depth with the block's farthest (or
+ * its farthest with the block's nearest) bounds every pixel */
+bool milo_rop_hiz_cull(const milo_rop_t *rop, float zlo, float hi) {
+    const milo_render_state_t *st = &rop->state;
+    if (!st->depth_test) return false;
+    if (st->depth_func == MILO_DEPTH_NEVER) return true;
+    if (st->depth_func != MILO_DEPTH_LESS && st->depth_func != MILO_DEPTH_LEQUAL) return false;
+    return !milo_rop_depth_compare(st->depth_func, milo_rop_depth24(zlo), milo_rop_depth24(hi));
+}
+
+bool milo_rop_hiz_accept(const milo_rop_t *rop, float zhi, float lo) {
+    const milo_render_state_t *st = &rop->state;
+    if (!st->depth_test) return false;
+    if (st->depth_func != MILO_DEPTH_LESS && st->depth_func != MILO_DEPTH_LEQUAL) return false;
+    return milo_rop_depth_compare(st->depth_func, milo_rop_depth24(zhi), milo_rop_depth24(lo));
+}
+
+/*---------------------------------------------------------------------------
+ * Blending
+ *---------------------------------------------------------------------------*/
+
+/* Framebuffer byte order: red, green, blue, alpha */
+enum { R, G, B, A };
+
+void milo_rop_init(milo_rop_t *rop, const milo_render_state_t *state) {
+    const milo_render_state_t *s = state;
+    rop->state = *s;
+    rop->blend_color = __builtin_bswap32(s->blend_color);
+    rop->write_mask = (s->color_mask & 8 ? 0x000000FFu : 0) |
+                      (s->color_mask & 4 ? 0x0000FF00u : 0) |
+                      (s->color_mask & 2 ? 0x00FF0000u : 0) |
+                      (s->color_mask & 1 ? 0xFF000000u : 0);
+    
+    bool add = s->eq_rgb == MILO_BLEND_EQ_ADD && s->eq_a == MILO_BLEND_EQ_ADD;
+    if (!s->blend) {
+        rop->path = MILO_ROP_OPAQUE;
+    } else if (add && s->src_rgb == MILO_BLEND_SRC_ALPHA &&
+               s->dst_rgb == MILO_BLEND_INV_SRC_ALPHA && s->src_a == MILO_BLEND_ONE &&
+               s->dst_a == MILO_BLEND_INV_SRC_ALPHA) {
+        rop->path = MILO_ROP_ALPHA;
+    } else if (add && s->src_rgb == MILO_BLEND_SRC_ALPHA && s->dst_rgb == MILO_BLEND_ONE &&
+               s->src_a == MILO_BLEND_ZERO && s->dst_a == MILO_BLEND_ONE) {
+        rop->path = MILO_ROP_ADDITIVE;
+    } else {
+        rop->path = MILO_ROP_GENERIC;
+    }
+}
+
+static uint32_t channel(uint32_t c, int ch) {
+    return (c >> (ch * 8)) & 0xFF;
+}
+
+/* Factor for channel ch; the color factors read red as in rop.vhd */
+static uint32_t factor(milo_blend_factor_t f, uint32_t src, uint32_t dst, uint32_t k, int ch) {
+    switch (f) {
+        case MILO_BLEND_ZERO:               return 0;
+        case MILO_BLEND_ONE:                return 255;
+        case MILO_BLEND_SRC_COLOR:          return channel(src, R);
+        case MILO_BLEND_INV_SRC_COLOR:      return 255 - channel(src, R);
+        case MILO_BLEND_DST_COLOR:          return channel(dst, R);
+        case MILO_BLEND_INV_DST_COLOR:      return 255 - channel(dst, R);
+        case MILO_BLEND_SRC_ALPHA:          return channel(src, A);
+        case MILO_BLEND_INV_SRC_ALPHA:      return 255 - channel(src, A);
+        case MILO_BLEND_DST_ALPHA:          return channel(dst, A);
+        case MILO_BLEND_INV_DST_ALPHA:      return 255 - channel(dst, A);
+        case MILO_BLEND_CONST_COLOR:        return channel(k, ch);
+        case MILO_BLEND_INV_CONST_COLOR:    return 255 - channel(k, ch);
+        case MILO_BLEND_CONST_ALPHA:        return channel(k, A);
+        case MILO_BLEND_INV_CONST_ALPHA:    return 255 - channel(k, A);
+        case MILO_BLEND_SRC_ALPHA_SAT: {
+            uint32_t sat = 255 - channel(dst, A);
+            return ch == A ? 255 : (channel(src, A) < sat ? channel(src, A) : sat);
+        }
+    }
+    return 255;
+}
+
+static uint32_t equation(milo_blend_eq_t eq, uint32_t s, uint32_t d, uint32_t sf, uint32_t df) {
+    uint32_t st = s * sf, dt = d * df;
+    switch (eq) {
+        case MILO_BLEND_EQ_ADD:     return ((st + dt) & 0xFFFF) >> 8;
+        case MILO_BLEND_EQ_SUB:     return st > dt ? (st - dt) >> 8 : 0;
+        case MILO_BLEND_EQ_REV_SUB: return dt > st ? (dt - st) >> 8 : 0;
+        case MILO_BLEND_EQ_MIN:     return s < d ? s : d;
+        case MILO_BLEND_EQ_MAX:     return s > d ? s : d;
+    }
+    return 0;
+}
+
+static uint32_t blend_generic(const milo_rop_t *rop, uint32_t src, uint32_t dst) {
+    const milo_render_state_t *st = &rop->state;
+    uint32_t out = 0;
+    for (int ch = R; ch <= A; ch++) {
+        bool alpha = ch == A;
+        uint32_t sf = factor(alpha ? st->src_a : st->src_rgb, src, dst, rop->blend_color, ch);
+        uint32_t df = factor(alpha ? st->dst_a : st->dst_rgb, src, dst, rop->blend_color, ch);
+        uint32_t c = equation(alpha ? st->eq_a : st->eq_rgb, channel(src, ch), channel(dst, ch),
+                              sf, df);
+        out |= c << (ch * 8);
+    }
+    return out;
+}
+
+#if defined(__SSE2__)
+/* Two pixels as eight 16-bit channels. sf is src alpha on the color lanes
+ * and one_a (ONE or ZERO) on the alpha lanes; df is INV_SRC_ALPHA, or ONE
+ * when additive. The 16-bit multiply, add and shift wrap exactly like the
+ * sum in rop.vhd. */
+static __m128i blend_pair(__m128i s, __m128i d, __m128i rgb, __m128i one_a, bool additive) {
+    const __m128i full = _mm_set1_epi16(255);
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+    __m128i sf = _mm_or_si128(_mm_and_si128(a, rgb), one_a);
+    __m128i df = additive ? full : _mm_sub_epi16(full, a);
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(s, sf), _mm_mullo_epi16(d, df));
+    return _mm_srli_epi16(sum, 8);
+}
+
+static void blend_sse2(uint32_t *out, const uint32_t *src, const uint32_t *dst, bool additive) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rgb = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    const __m128i one_a = additive ? zero : _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+    for (int i = 0; i < MILO_ROP_SPAN; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)&src[i]);
+        __m128i d = _mm_loadu_si128((const __m128i *)&dst[i]);
+        __m128i lo = blend_pair(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero),
+                                rgb, one_a, additive);
+        __m128i hi = blend_pair(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero),
+                                rgb, one_a, additive);
+        _mm_storeu_si128((__m128i *)&out[i], _mm_packus_epi16(lo, hi));
+    }
+}
+#endif
+
+/*---------------------------------------------------------------------------
+ * Spans
+ *---------------------------------------------------------------------------*/
+
+uint32_t milo_rop_span(const milo_rop_t *rop, uint32_t *color, float *depth, uint32_t live,
+                       const uint32_t *src, const float *z) {
+    const milo_render_state_t *st = &rop->state;
+    
+    /* Depth test and write */
+    uint32_t pass = 0;
+    for (uint32_t m = live; m; m &= m - 1) {
+        int i = __builtin_ctz(m);
+        uint32_t z24 = milo_rop_depth24(z[i]);
+        if (st->depth_test &&
+            !milo_rop_depth_compare(st->depth_func, z24, milo_rop_depth24(depth[i]))) {
+            continue;
+        }
+        pass |= 1u << i;
+        if (st->depth_write) depth[i] = milo_rop_depth_float(z24);
+    }
+    if (!pass) return 0;
+    
+    /* Blend a whole span; only passing pixels are stored */
+    uint32_t s[MILO_ROP_SPAN] = { 0 }, d[MILO_ROP_SPAN] = { 0 }, out[MILO_ROP_SPAN];
+    for (uint32_t m = pass; m; m &= m - 1) {
+        int i = __builtin_ctz(m);
+        s[i] = src[i];
+        d[i] = color[i];
+    }
+    switch (rop->path) {
+        case MILO_ROP_OPAQUE:
+            memcpy(out, s, sizeof(out));
+            break;
+#if defined(__SSE2__)
+        case MILO_ROP_ALPHA:
+        case MILO_ROP_ADDITIVE:
+            blend_sse2(out, s, d, rop->path == MILO_ROP_ADDITIVE);
+            break;
+#endif
+        default:
+            for (int i = 0; i < MILO_ROP_SPAN; i++) out[i] = blend_generic(rop, s[i], d[i]);
+            break;
+    }
+    for (uint32_t m = pass; m; m &= m - 1) {
+        int i = __builtin_ctz(m);
+        color[i] = out[i] & rop->write_mask;
+    }
+    return pass;
+}
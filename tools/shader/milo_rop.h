@@ -0,0 +1,156 @@
+/*
+ * milo_rop.h
+ * Milo832 Raster Operations - Header
+ *
+ * Depth test, blending and color write after RTL/graphics/rop.vhd, driven
+ * by a render state that mirrors render_state_t of render_state_pkg.vhd.
+ * The renderers hand the ROP a span of shaded fragments along a row (a
+ * rasterizer block row) and it updates the target's color and depth.
+ *
+ * Results match rop.vhd bit for bit where it defines them, quirks included:
+ *   - depth is a 24-bit unsigned value; the float depth buffer holds
+ *     z24 / 2^24 exactly and 1.0 (the clear) reads as 0xFFFFFF;
+ *   - depth is written whenever depth_write is set and the test passes,
+ *     including with the test disabled;
+ *   - the color factors (SRC_COLOR, DST_COLOR and their inverses) take the
+ *     red channel for all four channels;
+ *   - ONE is 255, a channel is the high byte of s * sf + d * df, and that
+ *     sum wraps at 16 bits (full additive white comes out at 252);
+ *   - channels off in color_mask are written as 0, not preserved.
+ * The factors and equations rop.vhd lacks (CONST_*, SRC_ALPHA_SAT, SUB,
+ * REV_SUB, MIN, MAX) follow render_state_pkg.vhd with the same 8-bit math;
+ * SUB and REV_SUB clamp at 0, MIN and MAX ignore the factors.
+ *
+ * Opaque, alpha and additive states take fast paths that blend four pixels
+ * at a time with SSE2; everything else goes through the per-channel path.
+ */
+
+#ifndef MILO_ROP_H
+#define MILO_ROP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*---------------------------------------------------------------------------
+ * Render State
+ *---------------------------------------------------------------------------*/
+
+#define MILO_ROP_SPAN           8       /* Fragments per span */
+#define MILO_DEPTH_MAX          0xFFFFFF
+
+/* Encodings of render_state_pkg.vhd */
+typedef enum {
+    MILO_DEPTH_NEVER,
+    MILO_DEPTH_LESS,
+    MILO_DEPTH_EQUAL,
+    MILO_DEPTH_LEQUAL,
+    MILO_DEPTH_GREATER,
+    MILO_DEPTH_NOTEQUAL,
+    MILO_DEPTH_GEQUAL,
+    MILO_DEPTH_ALWAYS
+} milo_depth_func_t;
+
+typedef enum {
+    MILO_BLEND_ZERO,
+    MILO_BLEND_ONE,
+    MILO_BLEND_SRC_COLOR,
+    MILO_BLEND_INV_SRC_COLOR,
+    MILO_BLEND_DST_COLOR,
+    MILO_BLEND_INV_DST_COLOR,
+    MILO_BLEND_SRC_ALPHA,
+    MILO_BLEND_INV_SRC_ALPHA,
+    MILO_BLEND_DST_ALPHA,
+    MILO_BLEND_INV_DST_ALPHA,
+    MILO_BLEND_CONST_COLOR,
+    MILO_BLEND_INV_CONST_COLOR,
+    MILO_BLEND_CONST_ALPHA,
+    MILO_BLEND_INV_CONST_ALPHA,
+    MILO_BLEND_SRC_ALPHA_SAT            /* min(src alpha, 1 - dst alpha) */
+} milo_blend_factor_t;
+
+typedef enum {
+    MILO_BLEND_EQ_ADD,                  /* src * sf + dst * df */
+    MILO_BLEND_EQ_SUB,                  /* src * sf - dst * df */
+    MILO_BLEND_EQ_REV_SUB,              /* dst * df - src * sf */
+    MILO_BLEND_EQ_MIN,
+    MILO_BLEND_EQ_MAX
+} milo_blend_eq_t;
+
+/* Per-draw state. Colors are RTL RGBA, 0xRRGGBBAA (the framebuffer stores
+ * 0xAABBGGRR). Culling stays an argument of the draw calls. */
+typedef struct {
+    bool                depth_test;
+    bool                depth_write;
+    milo_depth_func_t   depth_func;
+    uint32_t            depth_clear;        /* 24 bits */
+    
+    bool                blend;
+    milo_blend_factor_t src_rgb, dst_rgb;
+    milo_blend_eq_t     eq_rgb;
+    milo_blend_factor_t src_a, dst_a;
+    milo_blend_eq_t     eq_a;
+    uint32_t            blend_color;        /* CONST_* factors */
+    
+    uint8_t             color_mask;         /* Bit 3 red ... bit 0 alpha */
+    uint32_t            color_clear;
+} milo_render_state_t;
+
+/* RENDER_STATE_* presets of render_state_pkg.vhd */
+typedef enum {
+    MILO_STATE_DEFAULT,                 /* Less-than test and write, no blend */
+    MILO_STATE_ALPHA_BLEND,             /* Test only; src alpha over dst */
+    MILO_STATE_ADDITIVE,                /* Test only; dst + src * src alpha */
+    MILO_STATE_2D                       /* No depth; alpha blend */
+} milo_state_preset_t;
+
+void milo_render_state_preset(milo_render_state_t *state, milo_state_preset_t preset);
+
+/* Short preset name ("default", "alpha", "additive", "2d") */
+const char *milo_state_preset_name(milo_state_preset_t preset);
+
+/*---------------------------------------------------------------------------
+ * ROP
+ *---------------------------------------------------------------------------*/
+
+typedef enum {
+    MILO_ROP_OPAQUE,                    /* Blend off */
+    MILO_ROP_ALPHA,                     /* The ALPHA_BLEND factors */
+    MILO_ROP_ADDITIVE,                  /* The ADDITIVE factors */
+    MILO_ROP_GENERIC
+} milo_rop_path_t;
+
+typedef struct {
+    milo_render_state_t state;
+    milo_rop_path_t     path;
+    uint32_t            write_mask;         /* color_mask, framebuffer layout */
+    uint32_t            blend_color;        /* Framebuffer layout */
+} milo_rop_t;
+
+/* Take a state and pick its path */
+void milo_rop_init(milo_rop_t *rop, const milo_render_state_t *state);
+
+/* 24-bit depth of a 0..1 depth, and the float the depth buffer holds */
+uint32_t milo_rop_depth24(float z);
+float milo_rop_depth_float(uint32_t z24);
+
+/* Depth comparison of rop.vhd */
+bool milo_rop_depth_compare(milo_depth_func_t func, uint32_t frag, uint32_t stored);
+
+/* True if a fragment at depth z would pass against the stored depth (or
+ * the test is off); for early-Z */
+bool milo_rop_depth_test(const milo_rop_t *rop, float z, float stored);
+
+/* Hierarchical-Z for a block whose stored depths lie in [lo, hi] and a
+ * triangle whose depths there lie in [zlo, zhi]: cull when no fragment can
+ * pass, trivially accept when every fragment does. Only the LESS and LEQUAL
+ * tests are modelled; otherwise neither holds. */
+bool milo_rop_hiz_cull(const milo_rop_t *rop, float zlo, float hi);
+bool milo_rop_hiz_accept(const milo_rop_t *rop, float zhi, float lo);
+
+/* Resolve the fragments of a span: fragment i (bit i of live) is src[i]
+ * (framebuffer layout) at depth z[i] for the pixel color[i] / depth[i].
+ * Returns the fragments written; the rest of live failed the depth test. */
+uint32_t milo_rop_span(const milo_rop_t *rop, uint32_t *color, float *depth, uint32_t live,
+                       const uint32_t *src, const float *z);
+
+#endif /* MILO_ROP_H */
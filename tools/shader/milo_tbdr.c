@@ -0,0 +1,196 @@
+/*
+ * milo_tbdr.c
+ * Milo832 Tile-Based Deferred Renderer - Implementation
+ */
+
+#include "milo_tbdr.h"
+#include <stdlib.h>
+#include <string.h>
+
+void milo_tbdr_defaults(milo_tbdr_config_t *cfg) {
+    cfg->tile_size = MILO_TBDR_TILE_SIZE;
+    cfg->max_tris_per_tile = MILO_TBDR_MAX_TRIS_PER_TILE;
+    cfg->clear_color = 0xFF000000;
+    cfg->clear_depth = 1.0f;
+    cfg->cull = MILO_CULL_BACK;
+}
+
+/*---------------------------------------------------------------------------
+ * Binning
+ *---------------------------------------------------------------------------*/
+
+typedef struct {
+    milo_raster_tri_t *tris;            /* Set up, in submission order */
+    uint32_t          *draw;            /* Draw of each */
+    uint32_t          *first_index;     /* Index list position in its draw */
+    uint32_t           tri_count;
+    uint32_t          *lists;           /* tiles x max_tris_per_tile */
+    uint32_t          *list_count;      /* Entries kept per tile */
+} bins_t;
+
+static void bins_free(bins_t *b) {
+    free(b->tris);
+    free(b->draw);
+    free(b->first_index);
+    free(b->lists);
+    free(b->list_count);
+}
+
+static bool bin_triangles(bins_t *b, const milo_tbdr_config_t *cfg, const milo_framebuffer_t *fb,
+                          const milo_tbdr_draw_t *draws, uint32_t draw_count,
+                          milo_tbdr_stats_t *stats) {
+    uint32_t tiles = stats->tiles_x * stats->tiles_y;
+    size_t max_tris = 1;
+    for (uint32_t d = 0; d < draw_count; d++) max_tris += draws[d].index_count / 3;
+    uint32_t *seen = calloc(tiles, sizeof(uint32_t));
+    b->tris = malloc(max_tris * sizeof(milo_raster_tri_t));
+    b->draw = malloc(max_tris * sizeof(uint32_t));
+    b->first_index = malloc(max_tris * sizeof(uint32_t));
+    b->lists = malloc((size_t)tiles * (cfg->max_tris_per_tile + 1) * sizeof(uint32_t));
+    b->list_count = calloc(tiles, sizeof(uint32_t));
+    if (!seen || !b->tris || !b->draw || !b->first_index || !b->lists || !b->list_count) {
+        free(seen);
+        return false;
+    }
+    
+    for (uint32_t d = 0; d < draw_count; d++) {
+        const milo_vertex_out_t *vertices = draws[d].vertices;
+        const uint32_t *indices = draws[d].indices;
+        for (uint32_t i = 0; i + 2 < draws[d].index_count; i += 3) {
+            stats->triangles++;
+            milo_raster_tri_t *t = &b->tris[b->tri_count];
+            if (!milo_triangle_setup(t, &vertices[indices[i]], &vertices[indices[i + 1]],
+                                     &vertices[indices[i + 2]], fb->width, fb->height,
+                                     draws[d].cull)) {
+                continue;
+            }
+            b->draw[b->tri_count] = d;
+            b->first_index[b->tri_count] = i;
+            stats->binned++;
+            
+            /* Bounding box in tiles, row by row (BIN_TILES / NEXT_TILE) */
+            uint32_t tx0 = (uint32_t)t->min_x / cfg->tile_size;
+            uint32_t tx1 = (uint32_t)t->max_x / cfg->tile_size;
+            uint32_t ty0 = (uint32_t)t->min_y / cfg->tile_size;
+            uint32_t ty1 = (uint32_t)t->max_y / cfg->tile_size;
+            for (uint32_t ty = ty0; ty <= ty1; ty++) {
+                for (uint32_t tx = tx0; tx <= tx1; tx++) {
+                    uint32_t tile = ty * stats->tiles_x + tx;
+                    stats->entries++;
+                    seen[tile]++;
+                    if (b->list_count[tile] < cfg->max_tris_per_tile) {
+                        b->lists[(size_t)tile * cfg->max_tris_per_tile +
+                                 b->list_count[tile]++] = b->tri_count;
+                    } else {
+                        stats->dropped++;
+                    }
+                }
+            }
+            b->tri_count++;
+        }
+    }
+    
+    for (uint32_t tile = 0; tile < tiles; tile++) {
+        if (seen[tile]) stats->tiles_used++;
+        if (seen[tile] > cfg->max_tris_per_tile) stats->tiles_overflowed++;
+        if (seen[tile] > stats->longest_list) stats->longest_list = seen[tile];
+    }
+    stats->list_bytes = (stats->entries - stats->dropped) * MILO_TBDR_INDEX_BYTES;
+    free(seen);
+    return true;
+}
+
+/*---------------------------------------------------------------------------
+ * Rendering
+ *---------------------------------------------------------------------------*/
+
+bool milo_tbdr_render(milo_vm_t *vm, milo_framebuffer_t *fb, const milo_tbdr_config_t *cfg,
+                      const milo_tbdr_draw_t *draws, uint32_t draw_count,
+                      milo_tbdr_bind_fn bind, void *user, milo_tbdr_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (cfg->tile_size == 0 || cfg->tile_size > MILO_TBDR_MAX_TILE_SIZE) return false;
+    int ts = (int)cfg->tile_size;
+    stats->tiles_x = (uint32_t)((fb->width + ts - 1) / ts);
+    stats->tiles_y = (uint32_t)((fb->height + ts - 1) / ts);
+    
+    bins_t bins;
+    memset(&bins, 0, sizeof(bins));
+    milo_framebuffer_t *tile = milo_fb_create(ts, ts);
+    if (!tile || !bin_triangles(&bins, cfg, fb, draws, draw_count, stats)) {
+        if (tile) milo_fb_free(tile);
+        bins_free(&bins);
+        return false;
+    }
+    
+    /* The VM keeps the state of the last draw it shaded across tiles */
+    uint32_t bound = draw_count;
+    for (uint32_t ty = 0; ty < stats->tiles_y; ty++) {
+        for (uint32_t tx = 0; tx < stats->tiles_x; tx++) {
+            uint32_t index = ty * stats->tiles_x + tx;
+            int x = (int)tx * ts, y = (int)ty * ts;
+            milo_fb_clear(tile, cfg->clear_color, cfg->clear_depth);
+            
+            const uint32_t *list = &bins.lists[(size_t)index * cfg->max_tris_per_tile];
+            for (uint32_t e = 0; e < bins.list_count[index]; e++) {
+                uint32_t d = bins.draw[list[e]];
+                if (bind && d != bound) {
+                    bind(user, vm, d);
+                    bound = d;
+                    stats->binds++;
+                }
+                const milo_vertex_out_t *vertices = draws[d].vertices;
+                const uint32_t *indices = &draws[d].indices[bins.first_index[list[e]]];
+                uint64_t covered = milo_shade_triangle(vm, tile, x, y, &bins.tris[list[e]],
+                                                       &vertices[indices[0]],
+                                                       &vertices[indices[1]],
+                                                       &vertices[indices[2]]);
+                if (covered == 0) stats->empty_entries++;
+                stats->covered += covered;
+            }
+            
+            /* Write back, clipped to the screen */
+            int w = fb->width - x < ts ? fb->width - x : ts;
+            int h = fb->height - y < ts ? fb->height - y : ts;
+            for (int row = 0; row < h; row++) {
+                memcpy(&fb->color[(y + row) * fb->width + x], &tile->color[row * ts],
+                       (size_t)w * sizeof(uint32_t));
+            }
+        }
+    }
+    
+    milo_fb_free(tile);
+    bins_free(&bins);
+    if (vm->profile) milo_prof_finish(vm->profile);
+    return true;
+}
+
+bool milo_tbdr_render_mesh(milo_vm_t *vm, milo_framebuffer_t *fb,
+                           const milo_tbdr_config_t *cfg, const milo_vertex_out_t *vertices,
+                           const uint32_t *indices, uint32_t index_count,
+                           milo_tbdr_stats_t *stats) {
+    milo_tbdr_draw_t draw = { vertices, indices, index_count, cfg->cull };
+    return milo_tbdr_render(vm, fb, cfg, &draw, 1, NULL, NULL, stats);
+}
+
+void milo_tbdr_report(const milo_tbdr_config_t *cfg, const milo_tbdr_stats_t *stats,
+                      FILE *out) {
+    uint32_t tiles = stats->tiles_x * stats->tiles_y;
+    fprintf(out, "Binning: %ux%u tiles of %u, %u per tile max\n", stats->tiles_x,
+            stats->tiles_y, cfg->tile_size, cfg->max_tris_per_tile);
+    fprintf(out, "  triangles    %llu submitted, %llu binned\n",
+            (unsigned long long)stats->triangles, (unsigned long long)stats->binned);
+    fprintf(out, "  entries      %llu (%.2f tiles per triangle), %llu empty (%.1f%%)\n",
+            (unsigned long long)stats->entries,
+            stats->binned ? (double)stats->entries / stats->binned : 0.0,
+            (unsigned long long)stats->empty_entries,
+            stats->entries ? 100.0 * stats->empty_entries / stats->entries : 0.0);
+    fprintf(out, "  tiles used   %u of %u, %.1f entries per used tile, longest list %u\n",
+            stats->tiles_used, tiles,
+            stats->tiles_used ? (double)stats->entries / stats->tiles_used : 0.0,
+            stats->longest_list);
+    fprintf(out, "  overflow     %u tiles, %llu entries dropped\n", stats->tiles_overflowed,
+            (unsigned long long)stats->dropped);
+    fprintf(out, "  list memory  %llu of %llu bytes\n", (unsigned long long)stats->list_bytes,
+            (unsigned long long)tiles * cfg->max_tris_per_tile * MILO_TBDR_INDEX_BYTES);
+    fprintf(out, "  fragments    %llu depth tested\n", (unsigned long long)stats->covered);
+}
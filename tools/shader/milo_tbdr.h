@@ -0,0 +1,104 @@
+/*
+ * milo_tbdr.h
+ * Milo832 Tile-Based Deferred Renderer - Header
+ *
+ * Host model of the tile pipeline in RTL/graphics/tile_renderer.vhd. A
+ * draw is first binned like triangle_binner.vhd: each triangle that
+ * survives setup is appended to the list of every tile its bounding box
+ * overlaps, and lists hold at most max_tris_per_tile entries
+ * (MAX_TRIS_PER_TILE); later entries are dropped, as the bin-list memory
+ * would. Each tile then renders its list in submission order into a
+ * tile-local color and depth buffer (tile_buffer.vhd), cleared at the start
+ * of the tile and written back to the framebuffer once at the end.
+ *
+ * Without overflow the image equals milo_render_mesh on a cleared
+ * framebuffer; the binning statistics show how the hardware's lists would
+ * fill on the same content. A pass may bin several draws (a tile pass of
+ * the command stream); their triangles share the lists in submission
+ * order and a callback switches the VM to each draw's shaders and state.
+ */
+
+#ifndef MILO_TBDR_H
+#define MILO_TBDR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "milo_vm.h"
+
+/*---------------------------------------------------------------------------
+ * Configuration
+ *---------------------------------------------------------------------------*/
+
+#define MILO_TBDR_TILE_SIZE          16     /* 16 on DE2-115, 32 on KV260 */
+#define MILO_TBDR_MAX_TILE_SIZE      32     /* tile_buffer.vhd addresses 32x32 */
+#define MILO_TBDR_MAX_TRIS_PER_TILE  64
+#define MILO_TBDR_INDEX_BYTES        2      /* 16-bit triangle index per entry */
+
+typedef struct {
+    uint32_t    tile_size;
+    uint32_t    max_tris_per_tile;
+    uint32_t    clear_color;
+    float       clear_depth;
+    milo_cull_t cull;
+} milo_tbdr_config_t;
+
+/* The RTL generics: 16x16 tiles, 64 triangles per tile, clear to opaque
+ * black at depth 1, back faces culled */
+void milo_tbdr_defaults(milo_tbdr_config_t *cfg);
+
+/*---------------------------------------------------------------------------
+ * Rendering
+ *---------------------------------------------------------------------------*/
+
+typedef struct {
+    uint32_t tiles_x, tiles_y;
+    uint64_t triangles;                 /* Submitted */
+    uint64_t binned;                    /* Survived setup (culled, zero area
+                                         * and off screen do not) */
+    uint64_t entries;                   /* List writes (tiles_touched) */
+    uint64_t dropped;                   /* Entries past max_tris_per_tile */
+    uint64_t empty_entries;             /* Entries covering no pixel of their
+                                         * tile (bounding box overlap only) or
+                                         * culled there by hi-Z */
+    uint32_t tiles_used;                /* Tiles with a non-empty list */
+    uint32_t tiles_overflowed;
+    uint32_t longest_list;              /* Before the cap */
+    uint64_t covered;                   /* Fragments depth tested */
+    uint64_t list_bytes;                /* Bin-list memory written */
+    uint64_t binds;                     /* Switches between draws in tiles */
+} milo_tbdr_stats_t;
+
+/* One draw of a pass: an indexed triangle list of clip-space vertices */
+typedef struct {
+    const milo_vertex_out_t *vertices;
+    const uint32_t          *indices;
+    uint32_t                 index_count;
+    milo_cull_t              cull;
+} milo_tbdr_draw_t;
+
+/* Set up vm for shading the triangles of draw */
+typedef void (*milo_tbdr_bind_fn)(void *user, milo_vm_t *vm, uint32_t draw);
+
+/* Bin the draws of a pass, then render every tile, calling bind whenever
+ * the next triangle of a tile comes from another draw than the VM was last
+ * set up for (never if bind is NULL), and write the color back to fb.
+ * cfg->cull is unused: each draw has its own. */
+bool milo_tbdr_render(milo_vm_t *vm, milo_framebuffer_t *fb, const milo_tbdr_config_t *cfg,
+                      const milo_tbdr_draw_t *draws, uint32_t draw_count,
+                      milo_tbdr_bind_fn bind, void *user, milo_tbdr_stats_t *stats);
+
+/* Bin and render an indexed triangle list of clip-space vertices as one
+ * draw with cfg->cull, then write every tile's color back to fb. fb->depth
+ * is left as it was: depth stays in the tile buffer. False if tile_size is
+ * out of range or out of memory. */
+bool milo_tbdr_render_mesh(milo_vm_t *vm, milo_framebuffer_t *fb,
+                           const milo_tbdr_config_t *cfg, const milo_vertex_out_t *vertices,
+                           const uint32_t *indices, uint32_t index_count,
+                           milo_tbdr_stats_t *stats);
+
+/* Print the binning statistics of a render */
+void milo_tbdr_report(const milo_tbdr_config_t *cfg, const milo_tbdr_stats_t *stats,
+                      FILE *out);
+
+#endif /* MILO_TBDR_H */
@@ -0,0 +1,608 @@
+/*
+ * milo_timing.c
+ * Milo832 SM Timing Model - Implementation
+ */
+
+#include "milo_timing.h"
+#include "milo_asm.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PENDING     UINT64_MAX      /* Producer issued, not dispatched yet */
+#define NO_STALL    (-1)
+
+/*---------------------------------------------------------------------------
+ * Configuration
+ *---------------------------------------------------------------------------*/
+
+void milo_timing_defaults(milo_timing_config_t *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->resident_warps = MILO_RESIDENT_WARPS;
+    cfg->collectors = 4;
+    cfg->reg_banks = 4;
+    cfg->mshr_entries = 64;
+    cfg->dual_issue = true;
+    cfg->latency[MILO_UNIT_ALU] = MILO_LATENCY_ALU;
+    cfg->latency[MILO_UNIT_FPU] = MILO_LATENCY_FPU;
+    cfg->latency[MILO_UNIT_SFU] = MILO_LATENCY_SFU;
+    cfg->latency[MILO_UNIT_LSU] = MILO_LATENCY_LSU;
+    cfg->latency[MILO_UNIT_TEX] = MILO_LATENCY_TEX;
+    cfg->latency[MILO_UNIT_CTRL] = 1;
+    cfg->mem_interval = 1;
+    cfg->launch_latency = 1;
+    cfg->scheduler = MILO_SCHED_RR;
+    cfg->active_warps = 8;
+    cfg->sm_count = 1;
+    cfg->distribution = MILO_DIST_WARP;
+    cfg->tile_warps = 8;
+    cfg->bus_interval = 1;
+}
+
+const char *milo_dist_name(milo_dist_t dist) {
+    return dist == MILO_DIST_TILE ? "tile" : "warp";
+}
+
+const char *milo_sched_name(milo_sched_t sched) {
+    static const char *names[MILO_SCHED_COUNT] = {
+        "rr", "gto", "two-level", "latency"
+    };
+    return sched < MILO_SCHED_COUNT ? names[sched] : "?";
+}
+
+const char *milo_stall_name(milo_stall_t stall) {
+    static const char *names[MILO_STALL_COUNT] = {
+        "compute", "memory", "branch", "collector", "mshr", "empty"
+    };
+    return stall < MILO_STALL_COUNT ? names[stall] : "?";
+}
+
+/*---------------------------------------------------------------------------
+ * Simulation
+ *---------------------------------------------------------------------------*/
+
+typedef struct {
+    bool     busy;
+    uint64_t pos, end;              /* Events left to issue */
+    uint64_t fetch;                 /* Cycle fetch may resume */
+    bool     branch;                /* Fetch waits on a control instruction */
+    uint32_t inflight;              /* Collectors held */
+    uint32_t mshr;                  /* Memory requests outstanding */
+    uint64_t age;                   /* Launch order */
+    bool     active;                /* Two-level: in the active set */
+    uint64_t reg_ready[256];
+    uint8_t  reg_unit[256];
+} warp_t;
+
+typedef struct {
+    bool     busy;
+    uint32_t warp;
+    uint64_t inst;
+    uint64_t issued;
+    uint64_t collected;             /* Cycle the last operand was read */
+    uint8_t  reads[4];
+    int      read_count;
+} collector_t;
+
+typedef struct {
+    uint64_t time;
+    uint32_t warp;
+} response_t;
+
+/* State shared by the SMs: the work distributor and the memory bus */
+typedef struct {
+    uint64_t        first_warp, end_warp;
+    uint64_t        next_warp;      /* MILO_DIST_WARP queue */
+    uint64_t        launched;       /* Warps started, for age */
+    uint64_t        bus_free;       /* Cycle the memory bus frees up */
+} gpu_t;
+
+/* One SM */
+typedef struct {
+    const milo_timing_config_t *cfg;
+    const milo_prof_t *p;
+    const uint64_t *code;
+    uint32_t        code_size;
+    gpu_t          *gpu;
+    uint64_t        tile;           /* MILO_DIST_TILE: current tile, and */
+    uint64_t        tile_pos;       /* warps taken from it */
+    
+    warp_t         *warps;
+    collector_t    *collectors;
+    uint32_t       *order;          /* Busy collectors, oldest first */
+    uint32_t        order_count;
+    response_t     *responses;
+    uint32_t        response_count;
+    uint64_t        mem_free;       /* Cycle the SM's memory port frees up */
+    uint32_t        rr;             /* Round robin start */
+    int             last;           /* Slot issued from last, or -1 */
+    int            *why;            /* Per slot: blocked() this cycle */
+    
+    milo_timing_stats_t *stats;
+} sim_t;
+
+static uint64_t event_inst(const sim_t *s, const warp_t *w, uint64_t offset) {
+    uint32_t pc = s->p->events[w->pos + offset].pc;
+    return pc < s->code_size ? s->code[pc] : 0;
+}
+
+static bool is_memory(milo_unit_t unit) {
+    return unit == MILO_UNIT_LSU || unit == MILO_UNIT_TEX;
+}
+
+/* Dual-issue pairing class: texture fetches share the LSU's issue port */
+static milo_unit_t pair_class(milo_unit_t unit) {
+    return unit == MILO_UNIT_TEX ? MILO_UNIT_LSU : unit;
+}
+
+/* Work distributor: the next warp for this SM, false when none is left.
+ * Warp level hands out warps in order to whichever SM has a free slot;
+ * tile level deals runs of tile_warps consecutive warps to the SMs in turn,
+ * each SM working through its own tiles. */
+static bool next_warp(sim_t *s, uint64_t *index) {
+    gpu_t *g = s->gpu;
+    if (s->cfg->distribution != MILO_DIST_TILE) {
+        if (g->next_warp >= g->end_warp) return false;
+        *index = g->next_warp++;
+        return true;
+    }
+    
+    uint64_t tile_warps = s->cfg->tile_warps ? s->cfg->tile_warps : 1;
+    for (;;) {
+        uint64_t start = g->first_warp + s->tile * tile_warps;
+        if (start >= g->end_warp) return false;
+        if (s->tile_pos < tile_warps && start + s->tile_pos < g->end_warp) {
+            *index = start + s->tile_pos++;
+            return true;
+        }
+        s->tile += s->cfg->sm_count;
+        s->tile_pos = 0;
+    }
+}
+
+static void launch(sim_t *s, warp_t *w, uint64_t cycle) {
+    const milo_prof_t *p = s->p;
+    uint64_t i;
+    w->busy = false;
+    while (next_warp(s, &i)) {
+        if (p->warp_events[i] == p->warp_events[i + 1]) continue;
+        memset(w, 0, sizeof(*w));
+        w->busy = true;
+        w->pos = p->warp_events[i];
+        w->end = p->warp_events[i + 1];
+        w->fetch = cycle;
+        w->age = s->gpu->launched++;
+        s->stats->warps++;
+        return;
+    }
+}
+
+/* Why warp w cannot issue inst this cycle, or NO_STALL */
+static int blocked(const sim_t *s, const warp_t *w, uint64_t inst, uint64_t cycle) {
+    if (!w->busy || w->pos >= w->end) return MILO_STALL_EMPTY;
+    if (w->fetch > cycle) return w->branch ? MILO_STALL_BRANCH : MILO_STALL_EMPTY;
+    
+    uint8_t op = (uint8_t)(inst >> 56);
+    uint8_t regs[4 + 4];
+    int n = milo_op_sources(inst, regs);
+    int writes = milo_op_writes(op);
+    for (int i = 0; i < writes; i++) regs[n++] = (uint8_t)((inst >> 48) + i);
+    for (int i = 0; i < n; i++) {
+        if (w->reg_ready[regs[i]] > cycle) {
+            return is_memory((milo_unit_t)w->reg_unit[regs[i]]) ? MILO_STALL_MEMORY
+                                                                 : MILO_STALL_COMPUTE;
+        }
+    }
+    
+    if (s->order_count >= s->cfg->collectors) return MILO_STALL_COLLECTOR;
+    if (is_memory(milo_op_unit(op)) && w->mshr >= s->cfg->mshr_entries) return MILO_STALL_MSHR;
+    return NO_STALL;
+}
+
+static void issue(sim_t *s, uint32_t slot, uint64_t cycle) {
+    warp_t *w = &s->warps[slot];
+    uint64_t inst = event_inst(s, w, 0);
+    uint8_t op = (uint8_t)(inst >> 56);
+    milo_unit_t unit = milo_op_unit(op);
+    w->pos++;
+    
+    /* Claim a free collector */
+    uint32_t c = 0;
+    while (s->collectors[c].busy) c++;
+    collector_t *col = &s->collectors[c];
+    col->busy = true;
+    col->warp = slot;
+    col->inst = inst;
+    col->issued = cycle;
+    col->collected = PENDING;
+    uint8_t srcs[4];
+    int n = milo_op_sources(inst, srcs);
+    col->read_count = 0;
+    for (int i = 0; i < n; i++) {
+        bool dup = false;
+        for (int j = 0; j < col->read_count; j++) dup |= col->reads[j] == srcs[i];
+        if (!dup) col->reads[col->read_count++] = srcs[i];
+    }
+    s->order[s->order_count++] = c;
+    w->inflight++;
+    
+    int writes = milo_op_writes(op);
+    for (int i = 0; i < writes; i++) {
+        uint8_t r = (uint8_t)((inst >> 48) + i);
+        w->reg_ready[r] = PENDING;
+        w->reg_unit[r] = (uint8_t)unit;
+    }
+    if (unit == MILO_UNIT_CTRL) {
+        w->branch = true;
+        w->fetch = PENDING;
+    }
+    if (is_memory(unit)) {
+        w->mshr++;
+        if (w->mshr > s->stats->mshr_peak) s->stats->mshr_peak = w->mshr;
+    }
+    s->stats->issued++;
+}
+
+/* EX: dispatch collected operands, oldest first, one per unit */
+static void dispatch(sim_t *s, uint64_t cycle) {
+    const milo_timing_config_t *cfg = s->cfg;
+    bool unit_busy[MILO_UNIT_COUNT] = {false};
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < s->order_count; i++) {
+        collector_t *col = &s->collectors[s->order[i]];
+        uint8_t op = (uint8_t)(col->inst >> 56);
+        milo_unit_t unit = milo_op_unit(op);
+        if (col->collected >= cycle || unit_busy[unit]) {
+            s->order[kept++] = s->order[i];
+            continue;
+        }
+        unit_busy[unit] = true;
+        col->busy = false;
+        s->stats->dispatched[unit]++;
+        
+        warp_t *w = &s->warps[col->warp];
+        uint64_t done = cycle + cfg->latency[unit];
+        if (is_memory(unit)) {
+            uint64_t start = s->mem_free > cycle ? s->mem_free : cycle;
+            if (s->gpu->bus_free > start) {
+                s->stats->bus_waits += s->gpu->bus_free - start;
+                start = s->gpu->bus_free;
+            }
+            s->mem_free = start + cfg->mem_interval;
+            s->gpu->bus_free = start + cfg->bus_interval;
+            done = start + cfg->latency[unit];
+            s->responses[s->response_count].time = done;
+            s->responses[s->response_count].warp = col->warp;
+            s->response_count++;
+            s->stats->mem_requests++;
+        }
+        int writes = milo_op_writes(op);
+        for (int r = 0; r < writes; r++) {
+            w->reg_ready[(uint8_t)((col->inst >> 48) + r)] = done;
+        }
+        if (unit == MILO_UNIT_CTRL) {
+            w->branch = false;
+            w->fetch = cycle + 1;
+        }
+        w->inflight--;
+    }
+    s->order_count = kept;
+}
+
+/* OC: one read per register bank per cycle, oldest collector first */
+static void collect(sim_t *s, uint64_t cycle) {
+    uint32_t banks = s->cfg->reg_banks;
+    if (banks == 0) banks = 1;
+    if (banks > 64) banks = 64;
+    uint64_t bank_used = 0;
+    for (uint32_t i = 0; i < s->order_count; i++) {
+        collector_t *col = &s->collectors[s->order[i]];
+        if (col->collected != PENDING || col->issued >= cycle) continue;
+        int left = 0;
+        for (int k = 0; k < col->read_count; k++) {
+            uint32_t bank = col->reads[k] % banks;
+            if (bank_used & (1ull << bank)) {
+                col->reads[left++] = col->reads[k];
+                s->stats->bank_conflicts++;
+            } else {
+                bank_used |= 1ull << bank;
+            }
+        }
+        col->read_count = left;
+        if (left == 0) col->collected = cycle;
+    }
+}
+
+/*---------------------------------------------------------------------------
+ * Warp Schedulers
+ *---------------------------------------------------------------------------*/
+
+/* Two-level: warps waiting on memory leave the active set, and the oldest
+ * pending warps not waiting on memory refill it */
+static void update_active_set(sim_t *s, const int *why) {
+    uint32_t resident = s->cfg->resident_warps;
+    uint32_t active = 0;
+    for (uint32_t i = 0; i < resident; i++) {
+        warp_t *w = &s->warps[i];
+        if (w->active && (!w->busy || w->pos >= w->end || why[i] == MILO_STALL_MEMORY)) {
+            w->active = false;
+        }
+        if (w->active) active++;
+    }
+    while (active < s->cfg->active_warps) {
+        int oldest = -1;
+        for (uint32_t i = 0; i < resident; i++) {
+            const warp_t *w = &s->warps[i];
+            if (w->active || !w->busy || w->pos >= w->end || why[i] == MILO_STALL_MEMORY) {
+                continue;
+            }
+            if (oldest < 0 || w->age < s->warps[oldest].age) oldest = (int)i;
+        }
+        if (oldest < 0) break;
+        s->warps[oldest].active = true;
+        active++;
+    }
+}
+
+/* Warp to issue from this cycle, or -1 with *reason set to why the first
+ * waiting warp in round robin order could not issue */
+static int select_warp(sim_t *s, uint64_t cycle, int *reason) {
+    uint32_t resident = s->cfg->resident_warps;
+    int *why = s->why;
+    for (uint32_t i = 0; i < resident; i++) {
+        const warp_t *w = &s->warps[i];
+        why[i] = (w->busy && w->pos < w->end) ? blocked(s, w, event_inst(s, w, 0), cycle)
+                                              : MILO_STALL_EMPTY;
+    }
+    if (s->cfg->scheduler == MILO_SCHED_TWO_LEVEL) update_active_set(s, why);
+    if (s->cfg->scheduler == MILO_SCHED_GTO && s->last >= 0 && why[s->last] == NO_STALL) {
+        return s->last;
+    }
+    
+    int pick = -1;
+    uint32_t best = 0;
+    for (uint32_t k = 0; k < resident; k++) {
+        uint32_t i = (s->rr + k) % resident;
+        const warp_t *w = &s->warps[i];
+        if (why[i] != NO_STALL) {
+            if (*reason == MILO_STALL_EMPTY) *reason = why[i];
+            continue;
+        }
+        switch (s->cfg->scheduler) {
+            case MILO_SCHED_GTO:
+                if (pick < 0 || w->age < s->warps[pick].age) pick = (int)i;
+                break;
+            
+            case MILO_SCHED_TWO_LEVEL:
+                if (w->active) return (int)i;
+                break;
+            
+            case MILO_SCHED_LATENCY: {
+                uint8_t op = (uint8_t)(event_inst(s, w, 0) >> 56);
+                uint32_t latency = s->cfg->latency[milo_op_unit(op)];
+                if (pick < 0 || latency > best) {
+                    pick = (int)i;
+                    best = latency;
+                }
+                break;
+            }
+            
+            default:
+                return (int)i;
+        }
+    }
+    return pick;
+}
+
+static void free_sm(sim_t *s) {
+    free(s->warps);
+    free(s->collectors);
+    free(s->order);
+    free(s->responses);
+    free(s->why);
+}
+
+/* One cycle of an SM; false once it has no warp left */
+static bool step_sm(sim_t *s, uint64_t cycle) {
+    const milo_timing_config_t *cfg = s->cfg;
+    uint32_t resident = cfg->resident_warps;
+    
+    /* WB: memory responses free their MSHR entries */
+    for (uint32_t i = 0; i < s->response_count;) {
+        if (s->responses[i].time <= cycle) {
+            s->warps[s->responses[i].warp].mshr--;
+            s->responses[i] = s->responses[--s->response_count];
+        } else {
+            i++;
+        }
+    }
+    
+    dispatch(s, cycle);
+    collect(s, cycle);
+    
+    /* Retire warps with nothing left in flight; start the next */
+    bool running = false;
+    for (uint32_t i = 0; i < resident; i++) {
+        warp_t *w = &s->warps[i];
+        if (w->busy && w->pos >= w->end && w->inflight == 0 && w->mshr == 0) {
+            launch(s, w, cycle + cfg->launch_latency);
+        }
+        running |= w->busy;
+    }
+    
+    /* IF/ID: the scheduler picks one of the ready warps. An SM out of
+     * work idles until the others finish. */
+    int reason = MILO_STALL_EMPTY;
+    int slot = running ? select_warp(s, cycle, &reason) : -1;
+    if (slot < 0) {
+        s->stats->stall[reason]++;
+        return running;
+    }
+    
+    warp_t *w = &s->warps[slot];
+    uint64_t inst = event_inst(s, w, 0);
+    issue(s, (uint32_t)slot, cycle);
+    milo_unit_t first = milo_op_unit((uint8_t)(inst >> 56));
+    if (cfg->dual_issue && first != MILO_UNIT_CTRL && w->pos < w->end) {
+        uint64_t next = event_inst(s, w, 0);
+        milo_unit_t second = milo_op_unit((uint8_t)(next >> 56));
+        if (second != MILO_UNIT_CTRL && pair_class(second) != pair_class(first) &&
+            blocked(s, w, next, cycle) == NO_STALL) {
+            issue(s, (uint32_t)slot, cycle);
+            s->stats->dual_issued++;
+        }
+    }
+    s->rr = (uint32_t)slot + 1;
+    s->last = slot;
+    return true;
+}
+
+bool milo_timing_run(const milo_timing_config_t *cfg, const milo_prof_t *p,
+                     const uint64_t *code, uint32_t code_size, uint64_t first_warp,
+                     uint64_t warp_count, milo_timing_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!p->trace || !p->warp_events || p->warp_lanes > 0) return false;
+    if (first_warp > p->warps) return false;
+    if (warp_count > p->warps - first_warp) warp_count = p->warps - first_warp;
+    if (cfg->sm_count == 0 || cfg->resident_warps == 0 || cfg->collectors == 0 ||
+        cfg->mshr_entries == 0) {
+        return false;
+    }
+    
+    gpu_t gpu;
+    memset(&gpu, 0, sizeof(gpu));
+    gpu.first_warp = first_warp;
+    gpu.next_warp = first_warp;
+    gpu.end_warp = first_warp + warp_count;
+    
+    uint32_t resident = cfg->resident_warps;
+    sim_t *sms = calloc(cfg->sm_count, sizeof(sim_t));
+    bool ok = sms != NULL;
+    for (uint32_t n = 0; ok && n < cfg->sm_count; n++) {
+        sim_t *s = &sms[n];
+        s->cfg = cfg;
+        s->p = p;
+        s->code = code;
+        s->code_size = code_size;
+        s->gpu = &gpu;
+        s->tile = n;
+        s->stats = stats;
+        s->last = -1;
+        s->warps = calloc(resident, sizeof(warp_t));
+        s->collectors = calloc(cfg->collectors, sizeof(collector_t));
+        s->order = calloc(cfg->collectors, sizeof(uint32_t));
+        s->responses = calloc((size_t)resident * cfg->mshr_entries, sizeof(response_t));
+        s->why = calloc(resident, sizeof(int));
+        ok = s->warps && s->collectors && s->order && s->responses && s->why;
+    }
+    
+    if (ok) {
+        for (uint32_t n = 0; n < cfg->sm_count; n++) {
+            for (uint32_t i = 0; i < resident; i++) launch(&sms[n], &sms[n].warps[i], 0);
+        }
+        uint64_t cycle = 0;
+        for (;; cycle++) {
+            bool running = false;
+            for (uint32_t n = 0; n < cfg->sm_count; n++) running |= step_sm(&sms[n], cycle);
+            if (!running) break;
+        }
+        stats->cycles = cycle;
+        
+        /* The last cycle only found every SM empty */
+        stats->stall[MILO_STALL_EMPTY] -= cfg->sm_count;
+    }
+    
+    for (uint32_t n = 0; sms && n < cfg->sm_count; n++) free_sm(&sms[n]);
+    free(sms);
+    return ok;
+}
+
+/*---------------------------------------------------------------------------
+ * Report
+ *---------------------------------------------------------------------------*/
+
+static void add_stats(milo_timing_stats_t *total, const milo_timing_stats_t *st) {
+    total->cycles += st->cycles;
+    total->warps += st->warps;
+    total->issued += st->issued;
+    total->dual_issued += st->dual_issued;
+    for (int i = 0; i < MILO_STALL_COUNT; i++) total->stall[i] += st->stall[i];
+    for (int i = 0; i < MILO_UNIT_COUNT; i++) total->dispatched[i] += st->dispatched[i];
+    total->bank_conflicts += st->bank_conflicts;
+    total->mem_requests += st->mem_requests;
+    total->bus_waits += st->bus_waits;
+    if (st->mshr_peak > total->mshr_peak) total->mshr_peak = st->mshr_peak;
+}
+
+bool milo_timing_run_draws(const milo_timing_config_t *cfg, const milo_prof_t *p,
+                           const uint64_t *code, uint32_t code_size,
+                           milo_timing_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    uint32_t draws = p->draw_count ? p->draw_count : 1;
+    uint64_t first = 0;
+    for (uint32_t d = 0; d < draws; d++) {
+        milo_timing_stats_t st;
+        uint64_t count = p->draw_count ? p->draws[d].warps : p->warps;
+        if (!milo_timing_run(cfg, p, code, code_size, first, count, &st)) return false;
+        first += count;
+        add_stats(stats, &st);
+    }
+    return true;
+}
+
+static double ratio(uint64_t num, uint64_t den) {
+    return den ? (double)num / (double)den : 0.0;
+}
+
+bool milo_timing_report(const milo_timing_config_t *cfg, const milo_prof_t *p,
+                        const uint64_t *code, uint32_t code_size, uint64_t rtl_cycles,
+                        FILE *out) {
+    fprintf(out, "Timing model: %u warps, %u collectors, %u banks, %u MSHR entries, %s, "
+            "%s scheduler\n", cfg->resident_warps, cfg->collectors, cfg->reg_banks,
+            cfg->mshr_entries, cfg->dual_issue ? "dual issue" : "single issue",
+            milo_sched_name(cfg->scheduler));
+    fprintf(out, "  Draw   Warps    Cycles    Issued   IPC  Dual\n");
+    
+    /* Draws run back to back; a profile without draws is one run */
+    milo_timing_stats_t total, st;
+    memset(&total, 0, sizeof(total));
+    uint32_t draws = p->draw_count ? p->draw_count : 1;
+    uint64_t first = 0;
+    for (uint32_t d = 0; d < draws; d++) {
+        uint64_t count = p->draw_count ? p->draws[d].warps : p->warps;
+        if (!milo_timing_run(cfg, p, code, code_size, first, count, &st)) return false;
+        first += count;
+        fprintf(out, "  %4u  %6llu  %8llu  %8llu  %4.2f  %4.1f%%\n", d,
+                (unsigned long long)st.warps, (unsigned long long)st.cycles,
+                (unsigned long long)st.issued, ratio(st.issued, st.cycles),
+                100.0 * ratio(st.dual_issued, st.cycles));
+        add_stats(&total, &st);
+    }
+    
+    fprintf(out, "Total: %llu cycles, %llu warp instructions, IPC %.2f\n",
+            (unsigned long long)total.cycles, (unsigned long long)total.issued,
+            ratio(total.issued, total.cycles));
+    fprintf(out, "Idle cycles:");
+    for (int i = 0; i < MILO_STALL_COUNT; i++) {
+        fprintf(out, " %s %.1f%%%s", milo_stall_name((milo_stall_t)i),
+                100.0 * ratio(total.stall[i], total.cycles * cfg->sm_count),
+                i + 1 < MILO_STALL_COUNT ? "," : "\n");
+    }
+    fprintf(out, "Dispatches:");
+    for (int i = 0; i < MILO_UNIT_COUNT; i++) {
+        fprintf(out, " %s %llu%s", milo_unit_name((milo_unit_t)i),
+                (unsigned long long)total.dispatched[i], i + 1 < MILO_UNIT_COUNT ? "," : "\n");
+    }
+    fprintf(out, "Bank conflicts %llu, memory requests %llu, MSHR peak %u of %u\n",
+            (unsigned long long)total.bank_conflicts, (unsigned long long)total.mem_requests,
+            total.mshr_peak, cfg->mshr_entries);
+    if (cfg->sm_count > 1) {
+        fprintf(out, "%u SMs, %s distribution: %llu cycles of request delay on the "
+                "shared bus\n", cfg->sm_count, milo_dist_name(cfg->distribution),
+                (unsigned long long)total.bus_waits);
+    }
+    if (rtl_cycles) {
+        fprintf(out, "RTL: %llu cycles, model error %+.1f%%\n", (unsigned long long)rtl_cycles,
+                100.0 * ((double)total.cycles - (double)rtl_cycles) / (double)rtl_cycles);
+    }
+    return true;
+}
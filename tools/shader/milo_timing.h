@@ -0,0 +1,158 @@
+/*
+ * milo_timing.h
+ * Milo832 SM Timing Model - Header
+ *
+ * Cycle-approximate model of a streaming multiprocessor, or of several
+ * sharing a memory bus, run over the warp instruction streams kept by a
+ * tracing profile (milo_prof_t with trace set). Warp schedulers, pipeline
+ * parameters and SM counts can be compared in software before they are
+ * built. The stages follow RTL/Core/streaming_multiprocessor.vhd and the
+ * pipeline section of docs/architecture.md:
+ *   IF/ID  round robin (or another milo_sched_t policy) over the resident
+ *          warps. A warp issues when its scoreboard has no pending source
+ *          or destination register, a collector unit is free and, for
+ *          memory operations, one of its MSHR entries is free. The next
+ *          instruction of the same warp may dual-issue if it runs on
+ *          another unit class, neither is a control instruction and there
+ *          is no RAW or WAW hazard between the two;
+ *   OC     collector units read operands from a banked register file (bank
+ *          = register % banks), one read per bank per cycle, oldest
+ *          collector first;
+ *   EX     one dispatch per unit per cycle with the fixed unit latencies.
+ *          Control instructions resolve here: a warp fetches past a branch
+ *          only after it dispatches;
+ *   WB     results clear the scoreboard. Memory requests share one port and
+ *          complete out of order, each holding an MSHR entry of its warp
+ *          until the response arrives.
+ *
+ * The streams come from the functional VM, so the model only decides when
+ * each instruction issues, never what runs.
+ */
+
+#ifndef MILO_TIMING_H
+#define MILO_TIMING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "milo_prof.h"
+
+/*---------------------------------------------------------------------------
+ * Configuration
+ *---------------------------------------------------------------------------*/
+
+/* Warp selection among the warps ready to issue */
+typedef enum {
+    MILO_SCHED_RR,                      /* Round robin from the warp after the
+                                         * last issued (the RTL scheduler) */
+    MILO_SCHED_GTO,                     /* Greedy then oldest: stay on the last
+                                         * warp until it stalls, then take the
+                                         * longest resident */
+    MILO_SCHED_TWO_LEVEL,               /* Round robin over an active set of
+                                         * active_warps; warps waiting on
+                                         * memory drop out and the oldest
+                                         * pending warps refill it */
+    MILO_SCHED_LATENCY,                 /* Longest latency instruction first,
+                                         * round robin among equals */
+    MILO_SCHED_COUNT
+} milo_sched_t;
+
+/* How warps are handed to the SMs of a multi-SM model */
+typedef enum {
+    MILO_DIST_WARP,                     /* Each warp to the first SM with a free
+                                         * slot */
+    MILO_DIST_TILE,                     /* Runs of tile_warps consecutive warps
+                                         * (screen bands) dealt to the SMs in
+                                         * turn */
+} milo_dist_t;
+
+typedef struct {
+    uint32_t resident_warps;            /* Warp slots (NUM_WARPS) */
+    uint32_t collectors;                /* Operand collector units */
+    uint32_t reg_banks;                 /* Register file banks */
+    uint32_t mshr_entries;              /* Outstanding memory ops per warp */
+    bool     dual_issue;
+    uint32_t latency[MILO_UNIT_COUNT];  /* Dispatch to writeback, cycles */
+    uint32_t mem_interval;              /* Cycles the memory port is busy per
+                                         * request */
+    uint32_t launch_latency;            /* Cycles to start a warp in a freed
+                                         * slot */
+    milo_sched_t scheduler;
+    uint32_t active_warps;              /* MILO_SCHED_TWO_LEVEL set size */
+    
+    /* Several SMs run in lockstep, fed by one work distributor, and their
+     * memory ports share one bus */
+    uint32_t sm_count;
+    milo_dist_t distribution;
+    uint32_t tile_warps;                /* MILO_DIST_TILE run length */
+    uint32_t bus_interval;              /* Cycles the bus is busy per request */
+} milo_timing_config_t;
+
+/* The RTL configuration: 24 warps, 4 collectors over 4 banks, 64 MSHR
+ * entries, dual issue, the MILO_LATENCY_* unit latencies, round robin, one
+ * SM */
+void milo_timing_defaults(milo_timing_config_t *cfg);
+
+/* Short distributor name ("warp", "tile") */
+const char *milo_dist_name(milo_dist_t dist);
+
+/* Short scheduler name ("rr", "gto", "two-level", "latency") */
+const char *milo_sched_name(milo_sched_t sched);
+
+/*---------------------------------------------------------------------------
+ * Simulation
+ *---------------------------------------------------------------------------*/
+
+/* Why a cycle issued nothing, taken from the first warp in round robin
+ * order */
+typedef enum {
+    MILO_STALL_COMPUTE,                 /* Operand pending on ALU/FPU/SFU */
+    MILO_STALL_MEMORY,                  /* Operand pending on LSU/TEX */
+    MILO_STALL_BRANCH,                  /* Control instruction unresolved */
+    MILO_STALL_COLLECTOR,               /* No free collector unit */
+    MILO_STALL_MSHR,                    /* Warp's MSHR entries all in use */
+    MILO_STALL_EMPTY,                   /* No warp ready to fetch (launch,
+                                         * drain, SM out of work) */
+    MILO_STALL_COUNT
+} milo_stall_t;
+
+typedef struct {
+    uint64_t cycles;
+    uint64_t warps;
+    uint64_t issued;                    /* Warp instructions */
+    uint64_t dual_issued;               /* Cycles that issued two */
+    uint64_t stall[MILO_STALL_COUNT];   /* SM cycles that issued none, by
+                                         * cause */
+    uint64_t dispatched[MILO_UNIT_COUNT];
+    uint64_t bank_conflicts;            /* Operand reads deferred a cycle */
+    uint64_t mem_requests;
+    uint64_t bus_waits;                 /* Request cycles lost to the shared
+                                         * bus */
+    uint32_t mshr_peak;                 /* Most entries one warp held */
+} milo_timing_stats_t;
+
+/* Short lower case stall name ("compute", "memory", ...) */
+const char *milo_stall_name(milo_stall_t stall);
+
+/* Run warps [first_warp, first_warp + warp_count) of a traced profile,
+ * launched in order as slots free up. cycles runs until the last SM is
+ * done; the other counters are summed over the SMs. False if the profile
+ * has no trace or out of memory. */
+bool milo_timing_run(const milo_timing_config_t *cfg, const milo_prof_t *p,
+                     const uint64_t *code, uint32_t code_size, uint64_t first_warp,
+                     uint64_t warp_count, milo_timing_stats_t *stats);
+
+/* Run each draw of the profile in turn (all warps if it has no draws) and
+ * sum the stats */
+bool milo_timing_run_draws(const milo_timing_config_t *cfg, const milo_prof_t *p,
+                           const uint64_t *code, uint32_t code_size,
+                           milo_timing_stats_t *stats);
+
+/* Run each draw of the profile separately and print its cycles, IPC, stall
+ * breakdown and pipeline counters. If rtl_cycles is non-zero, also print
+ * the error of the total against that measured RTL cycle count. */
+bool milo_timing_report(const milo_timing_config_t *cfg, const milo_prof_t *p,
+                        const uint64_t *code, uint32_t code_size, uint64_t rtl_cycles,
+                        FILE *out);
+
+#endif /* MILO_TIMING_H */
@@ -0,0 +1,183 @@
+/*
+ * milo_vcache.c
+ * Milo832 Post-Transform Vertex Cache - Implementation
+ */
+
+#include "milo_vcache.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*---------------------------------------------------------------------------
+ * Cache
+ *---------------------------------------------------------------------------*/
+
+void milo_vcache_init(milo_vcache_t *cache, uint32_t size, milo_vcache_policy_t policy) {
+    memset(cache, 0, sizeof(*cache));
+    cache->size = size < MILO_VCACHE_MAX ? size : MILO_VCACHE_MAX;
+    cache->policy = policy;
+}
+
+void milo_vcache_flush(milo_vcache_t *cache) {
+    cache->count = 0;
+    cache->next = 0;
+}
+
+bool milo_vcache_lookup(milo_vcache_t *cache, uint32_t index, uint32_t *value) {
+    for (uint32_t i = 0; i < cache->count; i++) {
+        if (cache->tags[i] == index) {
+            cache->used[i] = ++cache->clock;
+            *value = cache->values[i];
+            cache->hits++;
+            return true;
+        }
+    }
+    cache->misses++;
+    return false;
+}
+
+void milo_vcache_insert(milo_vcache_t *cache, uint32_t index, uint32_t value) {
+    if (cache->size == 0) return;
+    uint32_t slot;
+    if (cache->count < cache->size) {
+        slot = cache->count++;
+    } else if (cache->policy == MILO_VCACHE_FIFO) {
+        slot = cache->next;
+        cache->next = (cache->next + 1) % cache->size;
+    } else {
+        slot = 0;
+        for (uint32_t i = 1; i < cache->count; i++) {
+            if (cache->used[i] < cache->used[slot]) slot = i;
+        }
+    }
+    cache->tags[slot] = index;
+    cache->values[slot] = value;
+    cache->used[slot] = ++cache->clock;
+}
+
+uint64_t milo_vcache_misses(const uint32_t *indices, uint32_t count, uint32_t size,
+                            milo_vcache_policy_t policy) {
+    milo_vcache_t cache;
+    milo_vcache_init(&cache, size, policy);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t value;
+        if (!milo_vcache_lookup(&cache, indices[i], &value)) {
+            milo_vcache_insert(&cache, indices[i], 0);
+        }
+    }
+    return cache.misses;
+}
+
+/*---------------------------------------------------------------------------
+ * Tipsify
+ *---------------------------------------------------------------------------*/
+
+typedef struct {
+    uint32_t *first;                    /* vertex_count + 1: triangles of
+                                         * each vertex in tris */
+    uint32_t *tris;
+    uint32_t *live;                     /* Triangles not yet emitted */
+    uint64_t *stamp;                    /* Time each entered the cache */
+    bool     *emitted;                  /* Per triangle */
+    uint32_t *dead_end;                 /* Stack of emitted vertices */
+    uint32_t  dead_end_count;
+    uint32_t *candidates;               /* Vertices of the current fan */
+} tipsify_t;
+
+static void tipsify_free(tipsify_t *t) {
+    free(t->first);
+    free(t->tris);
+    free(t->live);
+    free(t->stamp);
+    free(t->emitted);
+    free(t->dead_end);
+    free(t->candidates);
+}
+
+/* A vertex with triangles left from the dead-end stack, else the next
+ * in order after *cursor; -1 when all are emitted */
+static int64_t skip_dead_end(tipsify_t *t, uint32_t *cursor, uint32_t vertex_count) {
+    while (t->dead_end_count > 0) {
+        uint32_t v = t->dead_end[--t->dead_end_count];
+        if (t->live[v] > 0) return v;
+    }
+    while (*cursor < vertex_count) {
+        if (t->live[*cursor] > 0) return *cursor;
+        (*cursor)++;
+    }
+    return -1;
+}
+
+bool milo_vcache_optimize(const uint32_t *indices, uint32_t count, uint32_t vertex_count,
+                          uint32_t cache_size, uint32_t *out) {
+    uint32_t tri_count = count / 3;
+    for (uint32_t i = 0; i < tri_count * 3; i++) {
+        if (indices[i] >= vertex_count) return false;
+    }
+    
+    /* Triangles of each vertex */
+    tipsify_t t = { 0 };
+    t.first = calloc((size_t)vertex_count + 1, sizeof(uint32_t));
+    t.tris = malloc(((size_t)tri_count * 3 + 1) * sizeof(uint32_t));
+    t.live = calloc((size_t)vertex_count + 1, sizeof(uint32_t));
+    t.stamp = calloc((size_t)vertex_count + 1, sizeof(uint64_t));
+    t.emitted = calloc((size_t)tri_count + 1, sizeof(bool));
+    t.dead_end = malloc(((size_t)tri_count * 3 + 1) * sizeof(uint32_t));
+    t.candidates = malloc(((size_t)tri_count * 3 + 1) * sizeof(uint32_t));
+    uint32_t *source = malloc(((size_t)tri_count * 3 + 1) * sizeof(uint32_t));
+    uint32_t *fill = malloc(((size_t)vertex_count + 1) * sizeof(uint32_t));
+    if (!t.first || !t.tris || !t.live || !t.stamp || !t.emitted || !t.dead_end ||
+        !t.candidates || !source || !fill) {
+        tipsify_free(&t);
+        free(source);
+        free(fill);
+        return false;
+    }
+    memcpy(source, indices, (size_t)tri_count * 3 * sizeof(uint32_t));
+    for (uint32_t i = 0; i < tri_count * 3; i++) t.live[source[i]]++;
+    for (uint32_t v = 0; v < vertex_count; v++) t.first[v + 1] = t.first[v] + t.live[v];
+    memcpy(fill, t.first, (size_t)vertex_count * sizeof(uint32_t));
+    for (uint32_t i = 0; i < tri_count * 3; i++) t.tris[fill[source[i]]++] = i / 3;
+    free(fill);
+    
+    /* Fan out from a vertex, emitting its triangles, then move to the
+     * vertex of the fan that stays longest in the cache while its
+     * triangles are emitted */
+    uint64_t now = (uint64_t)cache_size + 1;
+    uint32_t cursor = 0, n = 0;
+    int64_t fan = skip_dead_end(&t, &cursor, vertex_count);
+    while (fan >= 0) {
+        uint32_t candidate_count = 0;
+        for (uint32_t a = t.first[fan]; a < t.first[fan + 1]; a++) {
+            uint32_t tri = t.tris[a];
+            if (t.emitted[tri]) continue;
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = source[tri * 3 + k];
+                out[n++] = v;
+                t.dead_end[t.dead_end_count++] = v;
+                t.candidates[candidate_count++] = v;
+                t.live[v]--;
+                if (now - t.stamp[v] > cache_size) t.stamp[v] = now++;
+            }
+            t.emitted[tri] = true;
+        }
+        
+        int64_t best = -1, best_priority = -1;
+        for (uint32_t c = 0; c < candidate_count; c++) {
+            uint32_t v = t.candidates[c];
+            if (t.live[v] == 0) continue;
+            int64_t priority = 0;
+            if (now - t.stamp[v] + 2 * (uint64_t)t.live[v] <= cache_size) {
+                priority = (int64_t)(now - t.stamp[v]);
+            }
+            if (priority > best_priority) {
+                best_priority = priority;
+                best = v;
+            }
+        }
+        fan = best >= 0 ? best : skip_dead_end(&t, &cursor, vertex_count);
+    }
+    
+    tipsify_free(&t);
+    free(source);
+    return true;
+}
@@ -0,0 +1,69 @@
+/*
+ * milo_vcache.h
+ * Milo832 Post-Transform Vertex Cache - Header
+ *
+ * A cache of shaded vertices keyed by vertex index, between vertex fetch
+ * and primitive assembly: an index that hits reuses the vertex shaded for
+ * it, one that misses is shaded and replaces an entry, the oldest (FIFO)
+ * or the least recently used (LRU). The command processor (milo_cmd.h)
+ * runs draws through it when it is given a size, emptying it at each
+ * draw.
+ *
+ * The quality of an index order for a cache is its ACMR, average cache
+ * miss ratio: vertex shader runs per triangle, 3 for no reuse and about
+ * 0.5 at best for a regular mesh. milo_vcache_optimize reorders the
+ * triangles of an index buffer for a cache size with Tipsify (Sander,
+ * Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and
+ * Reduced Overdraw", 2007), which walks the mesh in fans around vertices
+ * still in the cache, in time linear in the triangles.
+ */
+
+#ifndef MILO_VCACHE_H
+#define MILO_VCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MILO_VCACHE_MAX         64      /* Entries */
+
+typedef enum {
+    MILO_VCACHE_FIFO,
+    MILO_VCACHE_LRU
+} milo_vcache_policy_t;
+
+typedef struct {
+    uint32_t             size;          /* Entries; 0 turns the cache off */
+    milo_vcache_policy_t policy;
+    uint32_t             count;         /* Entries in use */
+    uint32_t             next;          /* FIFO: the entry replaced next */
+    uint32_t             tags[MILO_VCACHE_MAX];     /* Vertex index */
+    uint32_t             values[MILO_VCACHE_MAX];   /* The shaded vertex */
+    uint64_t             used[MILO_VCACHE_MAX];     /* LRU: last access */
+    uint64_t             clock;
+    uint64_t             hits, misses;  /* Since init */
+} milo_vcache_t;
+
+/* An empty cache of size entries (at most MILO_VCACHE_MAX) */
+void milo_vcache_init(milo_vcache_t *cache, uint32_t size, milo_vcache_policy_t policy);
+
+/* Empty it, the counters kept */
+void milo_vcache_flush(milo_vcache_t *cache);
+
+/* Look index up: true with its value on a hit. A miss is counted, and
+ * milo_vcache_insert should follow with the value shaded for it. */
+bool milo_vcache_lookup(milo_vcache_t *cache, uint32_t index, uint32_t *value);
+void milo_vcache_insert(milo_vcache_t *cache, uint32_t index, uint32_t value);
+
+/* Misses of count indices through an empty cache: the vertex shader runs
+ * of a draw. ACMR is this over count / 3. */
+uint64_t milo_vcache_misses(const uint32_t *indices, uint32_t count, uint32_t size,
+                            milo_vcache_policy_t policy);
+
+/* Reorder the count / 3 triangles of a triangle list of vertex_count
+ * vertices for a cache of cache_size, each keeping its vertex order, into
+ * out (which may be indices). False if an index is out of range or out
+ * of memory. */
+bool milo_vcache_optimize(const uint32_t *indices, uint32_t count, uint32_t vertex_count,
+                          uint32_t cache_size, uint32_t *out);
+
+#endif /* MILO_VCACHE_H */
@@ -177,6 +177,17 @@ uint32_t milo_texture_sample(const milo_texture_t *tex, float u, float v) {
 void milo_vm_init(milo_vm_t *vm) {
     memset(vm, 0, sizeof(*vm));
     vm->max_cycles = 100000;  /* Prevent infinite loops */
+    vm->early_z = true;
+    vm->hiz = true;
+    
+    milo_render_state_t state;
+    milo_render_state_preset(&state, MILO_STATE_DEFAULT);
+    milo_rop_init(&vm->rop, &state);
+}
+
+void milo_vm_set_render_state(milo_vm_t *vm, const milo_render_state_t *state) {
+    milo_rop_init(&vm->rop, state);
+    vm->quad_depth = true;
 }
 
 /* Helper to load a hex LUT file (one 16-bit value per line) */
@@ -250,8 +261,35 @@ bool milo_vm_load_binary(milo_vm_t *vm, const uint64_t *code, uint32_t size) {
         snprintf(vm->error, sizeof(vm->error), "Code too large (%u > %d)", size, VM_MAX_CODE);
         return false;
     }
-    memcpy(vm->code, code, size * sizeof(uint64_t));
+    memcpy(vm->code_store, code, size * sizeof(uint64_t));
+    vm->code = vm->code_store;
     vm->code_size = size;
+    vm->entry = 0;
+    return true;
+}
+
+bool milo_vm_load_object(milo_vm_t *vm, const milo_obj_t *obj, const char *entry_name) {
+    for (uint32_t i = 0; i < obj->symbol_count; i++) {
+        if (obj->symbols[i].flags & MILO_SYMF_UNDEF) {
+            snprintf(vm->error, sizeof(vm->error), "Unresolved symbol '%s' (link first)",
+                     milo_obj_symbol_name(obj, i));
+            return false;
+        }
+    }
+    
+    uint32_t entry = obj->header->entry;
+    if (entry_name && !milo_obj_find_symbol(obj, entry_name, &entry)) {
+        snprintf(vm->error, sizeof(vm->error), "No entry point '%s'", entry_name);
+        return false;
+    }
+    if (!milo_vm_load_constants(vm, obj->const_base, obj->constants, obj->const_count)) {
+        return false;
+    }
+    
+    /* Execute in place */
+    vm->code = obj->code;
+    vm->code_size = obj->code_size;
+    vm->entry = entry;
     return true;
 }
 
@@ -261,59 +299,39 @@ bool milo_vm_load_asm(milo_vm_t *vm, const char *asm_text) {
     
     if (!milo_asm_source(&as, asm_text)) {
         snprintf(vm->error, sizeof(vm->error), "Assembly error: %s", milo_asm_get_error(&as));
+        milo_asm_free(&as);
         return false;
     }
     
-    uint32_t size;
-    const uint64_t *code = milo_asm_get_code(&as, &size);
-    if (!milo_vm_load_binary(vm, code, size)) {
+    const char *undefined = milo_asm_get_undefined(&as);
+    if (undefined) {
+        snprintf(vm->error, sizeof(vm->error), "Unresolved symbol '%s' (link first)", undefined);
+        milo_asm_free(&as);
         return false;
     }
     
-    /* Parse .data directives to load constant table into memory */
-    const char *p = asm_text;
-    while ((p = strstr(p, ".data ")) != NULL) {
-        /* Format: .data 0xADDR, 0xVALUE */
-        p += 6;  /* Skip ".data " */
-        
-        /* Skip whitespace */
-        while (*p == ' ' || *p == '\t') p++;
-        
-        /* Parse address */
-        uint32_t addr = 0;
-        if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
-            p += 2;
-            while ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F')) {
-                addr = addr * 16;
-                if (*p >= '0' && *p <= '9') addr += *p - '0';
-                else if (*p >= 'a' && *p <= 'f') addr += *p - 'a' + 10;
-                else addr += *p - 'A' + 10;
-                p++;
-            }
-        }
-        
-        /* Skip comma and whitespace */
-        while (*p == ',' || *p == ' ' || *p == '\t') p++;
-        
-        /* Parse value */
-        uint32_t value = 0;
-        if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
-            p += 2;
-            while ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F')) {
-                value = value * 16;
-                if (*p >= '0' && *p <= '9') value += *p - '0';
-                else if (*p >= 'a' && *p <= 'f') value += *p - 'a' + 10;
-                else value += *p - 'A' + 10;
-                p++;
-            }
-        }
-        
-        /* Store in memory */
-        if (addr < VM_MEM_SIZE) {
-            vm->mem[addr / 4] = value;
+    uint32_t size, data_count;
+    const uint64_t *code = milo_asm_get_code(&as, &size);
+    bool loaded = milo_vm_load_binary(vm, code, size);
+    
+    /* Constant table from .data directives */
+    const milo_asm_data_t *data = milo_asm_get_data(&as, &data_count);
+    for (uint32_t i = 0; loaded && i < data_count; i++) {
+        if (data[i].address < VM_MEM_SIZE) {
+            vm->mem[data[i].address / 4] = data[i].value;
         }
     }
     
+    milo_asm_free(&as);
+    return loaded;
+}
+
+bool milo_vm_load_constants(milo_vm_t *vm, uint32_t base, const uint32_t *values, uint32_t count) {
+    if (base % 4 != 0 || base + (uint64_t)count * 4 > VM_MEM_SIZE) {
+        snprintf(vm->error, sizeof(vm->error), "Constant table out of range (0x%X + %u words)", base, count);
+        return false;
+    }
+    if (count) memcpy(&vm->mem[base / 4], values, count * sizeof(uint32_t));
     return true;
 }
 
@@ -815,10 +833,34 @@ static bool vm_step(milo_vm_t *vm) {
     return true;
 }
 
+/* Run one invocation until exit, error or the cycle limit */
+static void vm_run(milo_vm_t *vm) {
+    milo_prof_t *prof = vm->profile;
+    if (!prof) {
+        while (vm->running && vm->cycle_count < vm->max_cycles) {
+            if (!vm_step(vm)) {
+                break;
+            }
+        }
+        return;
+    }
+    
+    milo_prof_thread_begin(prof);
+    while (vm->running && vm->cycle_count < vm->max_cycles) {
+        if (vm->pc < vm->code_size) {
+            milo_prof_step(prof, vm->pc, vm->code[vm->pc]);
+        }
+        if (!vm_step(vm)) {
+            break;
+        }
+    }
+    milo_prof_thread_end(prof);
+}
+
 bool milo_vm_exec_fragment(milo_vm_t *vm, const milo_fragment_in_t *in, milo_fragment_out_t *out) {
     /* Reset state */
     memset(vm->regs, 0, sizeof(vm->regs));
-    vm->pc = 0;
+    vm->pc = vm->entry;
     vm->div_sp = 0;
     vm->ret_sp = 0;
     vm->running = true;
@@ -842,11 +884,7 @@ bool milo_vm_exec_fragment(milo_vm_t *vm, const milo_fragment_in_t *in, milo_fra
     vm->regs[10].f = in->a;
     
     /* Run until exit or error */
-    while (vm->running && vm->cycle_count < vm->max_cycles) {
-        if (!vm_step(vm)) {
-            break;
-        }
-    }
+    vm_run(vm);
     
     if (vm->cycle_count >= vm->max_cycles) {
         snprintf(vm->error, sizeof(vm->error), "Exceeded max cycles (%d)", vm->max_cycles);
@@ -868,15 +906,33 @@ bool milo_vm_exec_fragment(milo_vm_t *vm, const milo_fragment_in_t *in, milo_fra
     return vm->error[0] == '\0';
 }
 
-bool milo_vm_exec_vertex(milo_vm_t *vm, const milo_vertex_in_t *in, milo_vertex_out_t *out) {
+/* Reset for a vertex; the caller loads the inputs into r2-r13 */
+static void vertex_begin(milo_vm_t *vm) {
     /* Similar to fragment shader, but different register mapping */
     memset(vm->regs, 0, sizeof(vm->regs));
-    vm->pc = 0;
+    vm->pc = vm->entry;
     vm->div_sp = 0;
     vm->ret_sp = 0;
     vm->running = true;
     vm->cycle_count = 0;
     vm->error[0] = '\0';
+}
+
+/* Run, and extract the clip position */
+static bool vertex_end(milo_vm_t *vm, milo_vertex_out_t *out) {
+    vm_run(vm);
+    
+    /* Extract output */
+    out->x = vm->regs[1].f;  /* Return value */
+    out->y = vm->regs[2].f;
+    out->z = vm->regs[3].f;
+    out->w = vm->regs[4].f;
+    
+    return vm->error[0] == '\0';
+}
+
+bool milo_vm_exec_vertex(milo_vm_t *vm, const milo_vertex_in_t *in, milo_vertex_out_t *out) {
+    vertex_begin(vm);
     
     /* Set up input registers */
     vm->regs[2].f = in->x;
@@ -892,19 +948,30 @@ bool milo_vm_exec_vertex(milo_vm_t *vm, const milo_vertex_in_t *in, milo_vertex_
     vm->regs[12].f = in->ny;
     vm->regs[13].f = in->nz;
     
-    while (vm->running && vm->cycle_count < vm->max_cycles) {
-        if (!vm_step(vm)) {
-            break;
-        }
+    return vertex_end(vm, out);
+}
+
+bool milo_vm_exec_vertex_warp(milo_vm_t *vm, const milo_vertex_warp_t *warp,
+                              milo_vertex_out_t *out) {
+    for (uint32_t lane = 0; lane < warp->count; lane++) {
+        vertex_begin(vm);
+        for (int i = 0; i < MILO_VERTEX_INPUTS; i++) vm->regs[2 + i].f = warp->in[i][lane];
+        
+        milo_vertex_out_t *o = &out[lane];
+        if (!vertex_end(vm, o)) return false;
+        
+        /* The other inputs pass through */
+        o->u = warp->in[3][lane];
+        o->v = warp->in[4][lane];
+        o->r = warp->in[5][lane];
+        o->g = warp->in[6][lane];
+        o->b = warp->in[7][lane];
+        o->a = warp->in[8][lane];
+        o->nx = warp->in[9][lane];
+        o->ny = warp->in[10][lane];
+        o->nz = warp->in[11][lane];
     }
-    
-    /* Extract output */
-    out->x = vm->regs[1].f;  /* Return value */
-    out->y = vm->regs[2].f;
-    out->z = vm->regs[3].f;
-    out->w = vm->regs[4].f;
-    
-    return vm->error[0] == '\0';
+    return true;
 }
 
 const char *milo_vm_get_error(const milo_vm_t *vm) {
@@ -976,29 +1043,49 @@ void milo_texture_free(milo_texture_t *tex) {
  * Framebuffer API
  *---------------------------------------------------------------------------*/
 
-milo_framebuffer_t *milo_fb_create(int width, int height) {
+static milo_framebuffer_t *fb_alloc(uint32_t *color, int width, int height) {
     milo_framebuffer_t *fb = calloc(1, sizeof(milo_framebuffer_t));
     if (!fb) return NULL;
     
     fb->width = width;
     fb->height = height;
-    fb->color = calloc(width * height, sizeof(uint32_t));
+    fb->wrapped = color != NULL;
+    fb->color = color ? color : calloc(width * height, sizeof(uint32_t));
     fb->depth = calloc(width * height, sizeof(float));
+    fb->hiz_stride = (width + MILO_RASTER_BLOCK - 1) / MILO_RASTER_BLOCK;
+    int blocks = fb->hiz_stride * ((height + MILO_RASTER_BLOCK - 1) / MILO_RASTER_BLOCK);
+    fb->hiz_min = calloc(blocks, sizeof(float));
+    fb->hiz_max = calloc(blocks, sizeof(float));
     
-    if (!fb->color || !fb->depth) {
-        free(fb->color);
-        free(fb->depth);
-        free(fb);
+    if (!fb->color || !fb->depth || !fb->hiz_min || !fb->hiz_max) {
+        milo_fb_free(fb);
         return NULL;
     }
+    return fb;
+}
+
+milo_framebuffer_t *milo_fb_create(int width, int height) {
+    milo_framebuffer_t *fb = fb_alloc(NULL, width, height);
+    if (fb) milo_fb_clear(fb, 0, 1.0f);
+    return fb;
+}
+
+milo_framebuffer_t *milo_fb_wrap(uint32_t *color, int width, int height) {
+    milo_framebuffer_t *fb = fb_alloc(color, width, height);
+    if (!fb) return NULL;
     
+    int blocks = fb->hiz_stride * ((height + MILO_RASTER_BLOCK - 1) / MILO_RASTER_BLOCK);
+    for (int i = 0; i < width * height; i++) fb->depth[i] = 1.0f;
+    for (int i = 0; i < blocks; i++) fb->hiz_min[i] = fb->hiz_max[i] = 1.0f;
     return fb;
 }
 
 void milo_fb_free(milo_framebuffer_t *fb) {
     if (fb) {
-        free(fb->color);
+        if (!fb->wrapped) free(fb->color);
         free(fb->depth);
+        free(fb->hiz_min);
+        free(fb->hiz_max);
         free(fb);
     }
 }
@@ -1008,6 +1095,20 @@ void milo_fb_clear(milo_framebuffer_t *fb, uint32_t color, float depth) {
         fb->color[i] = color;
         fb->depth[i] = depth;
     }
+    int blocks = fb->hiz_stride * ((fb->height + MILO_RASTER_BLOCK - 1) / MILO_RASTER_BLOCK);
+    for (int i = 0; i < blocks; i++) {
+        fb->hiz_min[i] = depth;
+        fb->hiz_max[i] = depth;
+    }
+}
+
+/* Widen the bounds of the block holding pixel (x, y) to its depth; a lower
+ * max must be recomputed */
+static void hiz_widen(milo_framebuffer_t *fb, int x, int y) {
+    float depth = fb->depth[y * fb->width + x];
+    int block = (y / MILO_RASTER_BLOCK) * fb->hiz_stride + x / MILO_RASTER_BLOCK;
+    if (depth < fb->hiz_min[block]) fb->hiz_min[block] = depth;
+    if (depth > fb->hiz_max[block]) fb->hiz_max[block] = depth;
 }
 
 void milo_fb_write(milo_framebuffer_t *fb, int x, int y, uint32_t color, float depth) {
@@ -1015,6 +1116,7 @@ void milo_fb_write(milo_framebuffer_t *fb, int x, int y, uint32_t color, float d
         int idx = y * fb->width + x;
         fb->color[idx] = color;
         fb->depth[idx] = depth;
+        hiz_widen(fb, x, y);
     }
 }
 
@@ -1060,6 +1162,10 @@ void milo_render_quad(milo_vm_t *vm, milo_framebuffer_t *fb, const milo_quad_t *
     if (x0 > x1) { int t = x0; x0 = x1; x1 = t; }
     if (y0 > y1) { int t = y0; y0 = y1; y1 = t; }
     
+    /* Overwrite what is drawn until the caller sets a render state */
+    milo_rop_t rop = vm->rop;
+    if (!vm->quad_depth) rop.state.depth_func = MILO_DEPTH_ALWAYS;
+    
     for (int y = y0; y < y1; y++) {
         for (int x = x0; x < x1; x++) {
             /* Compute interpolation factors */
@@ -1084,16 +1190,36 @@ void milo_render_quad(milo_vm_t *vm, milo_framebuffer_t *fb, const milo_quad_t *
             frag_in.ny = 0.0f;
             frag_in.nz = 1.0f;
             
+            /* Early depth test; off the screen the shader runs but nothing
+             * is written */
+            bool on_screen = x >= 0 && x < fb->width && y >= 0 && y < fb->height;
+            int idx = on_screen ? y * fb->width + x : 0;
+            vm->depth_stats.tested++;
+            if (vm->early_z && on_screen &&
+                !milo_rop_depth_test(&rop, frag_in.z, fb->depth[idx])) {
+                vm->depth_stats.early_killed++;
+                continue;
+            }
+            
             /* Execute fragment shader */
             milo_fragment_out_t frag_out;
-            if (milo_vm_exec_fragment(vm, &frag_in, &frag_out)) {
-                if (!frag_out.discard) {
-                    uint32_t color = float4_to_rgba(frag_out.r, frag_out.g, frag_out.b, frag_out.a);
-                    milo_fb_write(fb, x, y, color, frag_out.depth);
+            vm->depth_stats.shaded++;
+            if (milo_vm_exec_fragment(vm, &frag_in, &frag_out) && !frag_out.discard &&
+                on_screen) {
+                uint32_t color = float4_to_rgba(frag_out.r, frag_out.g, frag_out.b, frag_out.a);
+                if (milo_rop_span(&rop, &fb->color[idx], &fb->depth[idx], 1, &color,
+                                  &frag_out.depth)) {
+                    vm->depth_stats.written++;
+                    if (rop.state.depth_write) hiz_widen(fb, x, y);
+                } else {
+                    vm->depth_stats.late_killed++;
                 }
             }
         }
     }
+    
+    /* Warps do not span draws */
+    if (vm->profile) milo_prof_finish(vm->profile);
 }
 
 void milo_render_fullscreen(milo_vm_t *vm, milo_framebuffer_t *fb) {
@@ -1105,3 +1231,243 @@ void milo_render_fullscreen(milo_vm_t *vm, milo_framebuffer_t *fb) {
     };
     milo_render_quad(vm, fb, &quad);
 }
+
+/*---------------------------------------------------------------------------
+ * Triangle Renderer
+ *---------------------------------------------------------------------------*/
+
+typedef struct {
+    milo_vm_t                *vm;
+    milo_framebuffer_t       *target;
+    int                       x, y;         /* Screen pixel of target (0, 0) */
+    bool                      hiz;          /* Target blocks are screen blocks */
+    double                    z, dzdx, dzdy; /* Depth plane at screen (0, 0) */
+    float                     zmin, zmax;
+    const milo_raster_tri_t  *tri;
+    const milo_vertex_out_t  *v[3];
+    uint64_t                  tested;
+} tri_shader_t;
+
+#define VARYING(w, s, f)    ((w)[0] * (s)->v[0]->f + (w)[1] * (s)->v[1]->f + \
+                             (w)[2] * (s)->v[2]->f)
+
+/* Depth is interpolated in float, so plane bounds get a margin before they
+ * are compared with stored depths */
+#define HIZ_MARGIN          1e-6f
+
+static float tri_depth(const milo_raster_tri_t *tri, const float w[3]) {
+    return w[0] * tri->z[0] + w[1] * tri->z[1] + w[2] * tri->z[2];
+}
+
+/* Depth plane of the triangle in pixels, from three pixels' weights */
+static void depth_plane(tri_shader_t *s) {
+    const milo_raster_tri_t *tri = s->tri;
+    float w[3][3], perspective[3];
+    milo_raster_weights(tri, tri->min_x, tri->min_y, w[0], perspective);
+    milo_raster_weights(tri, tri->min_x + 1, tri->min_y, w[1], perspective);
+    milo_raster_weights(tri, tri->min_x, tri->min_y + 1, w[2], perspective);
+    double z = tri_depth(tri, w[0]);
+    s->dzdx = tri_depth(tri, w[1]) - z;
+    s->dzdy = tri_depth(tri, w[2]) - z;
+    s->z = z - s->dzdx * tri->min_x - s->dzdy * tri->min_y;
+    s->zmin = fminf(fminf(tri->z[0], tri->z[1]), tri->z[2]);
+    s->zmax = fmaxf(fmaxf(tri->z[0], tri->z[1]), tri->z[2]);
+}
+
+/* Depth range of the triangle over the block at screen pixel (bx, by): the
+ * plane at the block's corner pixels, within the vertex depths */
+static void block_depth(const tri_shader_t *s, int bx, int by, float *lo, float *hi) {
+    const int n = MILO_RASTER_BLOCK - 1;
+    double z = s->z + s->dzdx * bx + s->dzdy * by;
+    double dx = s->dzdx * n, dy = s->dzdy * n;
+    double zlo = z + (dx < 0 ? dx : 0) + (dy < 0 ? dy : 0);
+    double zhi = z + (dx > 0 ? dx : 0) + (dy > 0 ? dy : 0);
+    *lo = fmaxf((float)zlo, s->zmin) - HIZ_MARGIN;
+    *hi = fminf((float)zhi, s->zmax) + HIZ_MARGIN;
+}
+
+/* Recompute a block's bounds from its depths */
+static void hiz_update(milo_framebuffer_t *fb, int bx, int by) {
+    int x1 = bx + MILO_RASTER_BLOCK < fb->width ? bx + MILO_RASTER_BLOCK : fb->width;
+    int y1 = by + MILO_RASTER_BLOCK < fb->height ? by + MILO_RASTER_BLOCK : fb->height;
+    float lo = fb->depth[by * fb->width + bx], hi = lo;
+    for (int y = by; y < y1; y++) {
+        for (int x = bx; x < x1; x++) {
+            lo = fminf(lo, fb->depth[y * fb->width + x]);
+            hi = fmaxf(hi, fb->depth[y * fb->width + x]);
+        }
+    }
+    int block = (by / MILO_RASTER_BLOCK) * fb->hiz_stride + bx / MILO_RASTER_BLOCK;
+    fb->hiz_min[block] = lo;
+    fb->hiz_max[block] = hi;
+}
+
+/* The ROP takes a block row at a time */
+#if MILO_ROP_SPAN < MILO_RASTER_BLOCK
+#error "MILO_ROP_SPAN must cover a raster block row"
+#endif
+
+static void shade_block(void *user, int bx, int by, uint64_t mask) {
+    const int n = MILO_RASTER_BLOCK;
+    tri_shader_t *s = user;
+    milo_framebuffer_t *fb = s->target;
+    const milo_rop_t *rop = &s->vm->rop;
+    milo_depth_stats_t *stats = &s->vm->depth_stats;
+    int tbx = bx - s->x, tby = by - s->y;
+    
+    /* Whole block failing the depth test, or whole block passing */
+    bool test = s->vm->early_z && rop->state.depth_test;
+    float block_max = INFINITY;
+    if (s->hiz) {
+        int block = (tby / n) * fb->hiz_stride + tbx / n;
+        float lo, hi;
+        block_max = fb->hiz_max[block];
+        block_depth(s, bx, by, &lo, &hi);
+        if (milo_rop_hiz_cull(rop, lo, block_max)) {
+            stats->hiz_blocks++;
+            stats->hiz_pixels += (uint64_t)__builtin_popcountll(mask);
+            return;
+        }
+        if (milo_rop_hiz_accept(rop, hi, fb->hiz_min[block])) test = false;
+    }
+    
+    bool lowered = false;
+    for (int row = 0; row < n; row++) {
+        uint32_t live = (uint32_t)(mask >> (row * n)) & ((1u << n) - 1);
+        if (!live) continue;
+        int y = by + row, ty = y - s->y;
+        
+        /* Shade the row's fragments, then resolve them as one span
+         * starting at the first */
+        int first = __builtin_ctz(live);
+        uint32_t *color = &fb->color[ty * fb->width + tbx + first];
+        float *depth = &fb->depth[ty * fb->width + tbx + first];
+        uint32_t src[MILO_ROP_SPAN], shaded = 0;
+        float z[MILO_ROP_SPAN], old[MILO_ROP_SPAN];
+        for (uint32_t m = live >> first; m; m &= m - 1) {
+            int i = __builtin_ctz(m);
+            int x = bx + first + i;
+            
+            float linear[3], w[3];
+            milo_raster_weights(s->tri, x, y, linear, w);
+            milo_fragment_in_t frag_in;
+            frag_in.x = (float)x;
+            frag_in.y = (float)y;
+            frag_in.z = tri_depth(s->tri, linear);
+            s->tested++;
+            stats->tested++;
+            if (test && !milo_rop_depth_test(rop, frag_in.z, depth[i])) {
+                stats->early_killed++;
+                continue;
+            }
+            
+            frag_in.u = VARYING(w, s, u);
+            frag_in.v = VARYING(w, s, v);
+            frag_in.r = VARYING(w, s, r);
+            frag_in.g = VARYING(w, s, g);
+            frag_in.b = VARYING(w, s, b);
+            frag_in.a = VARYING(w, s, a);
+            frag_in.nx = VARYING(w, s, nx);
+            frag_in.ny = VARYING(w, s, ny);
+            frag_in.nz = VARYING(w, s, nz);
+            
+            milo_fragment_out_t frag_out;
+            stats->shaded++;
+            if (milo_vm_exec_fragment(s->vm, &frag_in, &frag_out) && !frag_out.discard) {
+                src[i] = float4_to_rgba(frag_out.r, frag_out.g, frag_out.b, frag_out.a);
+                z[i] = frag_out.depth;
+                old[i] = depth[i];
+                shaded |= 1u << i;
+            }
+        }
+        if (!shaded) continue;
+        
+        uint32_t written = milo_rop_span(rop, color, depth, shaded, src, z);
+        stats->written += (uint64_t)__builtin_popcount(written);
+        stats->late_killed += (uint64_t)__builtin_popcount(shaded & ~written);
+        if (!rop->state.depth_write) continue;
+        for (uint32_t m = written; m; m &= m - 1) {
+            int i = __builtin_ctz(m);
+            hiz_widen(fb, tbx + first + i, ty);
+            lowered |= old[i] >= block_max && depth[i] < old[i];
+        }
+    }
+    
+    /* Once a pixel at the block's max is lowered the max may drop */
+    if (s->hiz && lowered) hiz_update(fb, tbx, tby);
+}
+
+bool milo_triangle_setup(milo_raster_tri_t *tri, const milo_vertex_out_t *v0,
+                         const milo_vertex_out_t *v1, const milo_vertex_out_t *v2,
+                         int width, int height, milo_cull_t cull) {
+    const milo_vertex_out_t *v[3] = { v0, v1, v2 };
+    milo_raster_vertex_t screen[3];
+    for (int i = 0; i < 3; i++) {
+        float inv_w = v[i]->w != 0.0f ? 1.0f / v[i]->w : 0.0f;
+        screen[i].x = (v[i]->x * inv_w * 0.5f + 0.5f) * width;
+        screen[i].y = (0.5f - v[i]->y * inv_w * 0.5f) * height;
+        screen[i].z = v[i]->z * inv_w * 0.5f + 0.5f;
+        screen[i].w = v[i]->w;
+    }
+    return milo_raster_setup(tri, screen, width, height, cull);
+}
+
+uint64_t milo_shade_triangle(milo_vm_t *vm, milo_framebuffer_t *target, int x, int y,
+                             const milo_raster_tri_t *tri, const milo_vertex_out_t *v0,
+                             const milo_vertex_out_t *v1, const milo_vertex_out_t *v2) {
+    tri_shader_t s = { vm, target, x, y, false, 0.0, 0.0, 0.0, 0.0f, 0.0f, tri,
+                       { v0, v1, v2 }, 0 };
+    s.hiz = vm->hiz && x % MILO_RASTER_BLOCK == 0 && y % MILO_RASTER_BLOCK == 0;
+    
+    /* Whole triangle behind every block its bounding box touches */
+    if (s.hiz) {
+        const int n = MILO_RASTER_BLOCK;
+        int x0 = (tri->min_x > x ? tri->min_x : x) - x;
+        int y0 = (tri->min_y > y ? tri->min_y : y) - y;
+        int x1 = (tri->max_x < x + target->width - 1 ? tri->max_x : x + target->width - 1) - x;
+        int y1 = (tri->max_y < y + target->height - 1 ? tri->max_y : y + target->height - 1) - y;
+        depth_plane(&s);
+        float zmin = s.zmin - HIZ_MARGIN;
+        bool hidden = x0 <= x1 && y0 <= y1;
+        for (int by = y0 / n; hidden && by <= y1 / n; by++) {
+            for (int bx = x0 / n; hidden && bx <= x1 / n; bx++) {
+                hidden = milo_rop_hiz_cull(&vm->rop, zmin,
+                                           target->hiz_max[by * target->hiz_stride + bx]);
+            }
+        }
+        if (hidden) {
+            vm->depth_stats.hiz_triangles++;
+            return 0;
+        }
+    }
+    
+    milo_raster_blocks(tri, x, y, x + target->width, y + target->height, shade_block, &s);
+    return s.tested;
+}
+
+static uint64_t draw_triangle(milo_vm_t *vm, milo_framebuffer_t *fb,
+                              const milo_vertex_out_t *v0, const milo_vertex_out_t *v1,
+                              const milo_vertex_out_t *v2, milo_cull_t cull) {
+    milo_raster_tri_t tri;
+    if (!milo_triangle_setup(&tri, v0, v1, v2, fb->width, fb->height, cull)) return 0;
+    return milo_shade_triangle(vm, fb, 0, 0, &tri, v0, v1, v2);
+}
+
+uint64_t milo_render_triangle(milo_vm_t *vm, milo_framebuffer_t *fb,
+                              const milo_vertex_out_t v[3], milo_cull_t cull) {
+    uint64_t covered = draw_triangle(vm, fb, &v[0], &v[1], &v[2], cull);
+    if (vm->profile) milo_prof_finish(vm->profile);
+    return covered;
+}
+
+uint64_t milo_render_mesh(milo_vm_t *vm, milo_framebuffer_t *fb,
+                          const milo_vertex_out_t *vertices, const uint32_t *indices,
+                          uint32_t index_count, milo_cull_t cull) {
+    uint64_t covered = 0;
+    for (uint32_t i = 0; i + 2 < index_count; i += 3) {
+        covered += draw_triangle(vm, fb, &vertices[indices[i]], &vertices[indices[i + 1]],
+                                 &vertices[indices[i + 2]], cull);
+    }
+    if (vm->profile) milo_prof_finish(vm->profile);
+    return covered;
+}
@@ -11,6 +11,10 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "milo_asm.h"
+#include "milo_obj.h"
+#include "milo_prof.h"
+#include "milo_raster.h"
+#include "milo_rop.h"
 
 /*---------------------------------------------------------------------------
  * VM Configuration
@@ -82,6 +86,16 @@ typedef struct {
     float nx, ny, nz;       /* Normal (to interpolate) */
 } milo_vertex_out_t;
 
+/* Inputs of a warp of vertices, one array of lanes per input register
+ * (r2-r13, in milo_vertex_in_t order) */
+#define MILO_VERTEX_WARP    32
+#define MILO_VERTEX_INPUTS  12
+
+typedef struct {
+    uint32_t count;                                 /* Lanes in use */
+    float    in[MILO_VERTEX_INPUTS][MILO_VERTEX_WARP];
+} milo_vertex_warp_t;
+
 /*---------------------------------------------------------------------------
  * Uniform Data
  *---------------------------------------------------------------------------*/
@@ -101,6 +115,19 @@ typedef union {
  * VM State
  *---------------------------------------------------------------------------*/
 
+/* Depth test counters of the quad and triangle renderers, summed over
+ * draws until cleared */
+typedef struct {
+    uint64_t tested;                /* Fragments reaching the depth test */
+    uint64_t early_killed;          /* Failed before the fragment shader */
+    uint64_t late_killed;           /* Shaded, then failed in the ROP */
+    uint64_t shaded;                /* Fragment shader runs */
+    uint64_t written;               /* Passed the ROP */
+    uint64_t hiz_triangles;         /* Triangles culled whole by hi-Z */
+    uint64_t hiz_blocks;            /* Blocks culled by hi-Z */
+    uint64_t hiz_pixels;            /* Covered pixels in those blocks */
+} milo_depth_stats_t;
+
 typedef struct {
     /* Registers (as float/int union) */
     union {
@@ -109,10 +136,12 @@ typedef struct {
         uint32_t u;
     } regs[VM_MAX_REGS];
     
-    /* Program */
-    uint64_t    code[VM_MAX_CODE];
+    /* Program: code points at code_store, or into a mapped object */
+    const uint64_t *code;
     uint32_t    code_size;
+    uint32_t    entry;
     uint32_t    pc;
+    uint64_t    code_store[VM_MAX_CODE];
     
     /* Divergence stack (for SIMT simulation) */
     uint32_t    div_stack[VM_STACK_SIZE];
@@ -138,6 +167,24 @@ typedef struct {
     int         cycle_count;
     int         max_cycles;
     
+    /* Execution profile to collect into, or NULL (sized for the program) */
+    milo_prof_t *profile;
+    
+    /* Depth test before the fragment shader, and hierarchical-Z culling of
+     * triangles and blocks (both on after init). The VM has no depth
+     * output and discard ends the program like exit, so early-Z never
+     * changes the image; clear early_z to model a shader that does. */
+    bool        early_z;
+    bool        hiz;
+    milo_depth_stats_t depth_stats;
+    
+    /* Depth test, blending and color write of the draws (the DEFAULT
+     * state after init); see milo_vm_set_render_state */
+    milo_rop_t  rop;
+    bool        quad_depth;     /* Quads test depth under rop; clear after
+                                 * init, so they overwrite, and set by
+                                 * milo_vm_set_render_state */
+    
     /* SFU strict mode - replicates VHDL 1.15 fixed-point LUT exactly */
     bool        sfu_strict;
     int16_t     sfu_lut_sin[256];
@@ -159,6 +206,9 @@ typedef struct {
 /* Initialize VM */
 void milo_vm_init(milo_vm_t *vm);
 
+/* Set the render state of the following draws */
+void milo_vm_set_render_state(milo_vm_t *vm, const milo_render_state_t *state);
+
 /* Enable SFU strict mode - loads LUT tables to match VHDL 1.15 fixed-point exactly
  * table_dir: path to directory containing SFU_Tables (*.hex files)
  * Returns false if tables cannot be loaded */
@@ -167,9 +217,17 @@ bool milo_vm_set_sfu_strict(milo_vm_t *vm, const char *table_dir);
 /* Load program from binary */
 bool milo_vm_load_binary(milo_vm_t *vm, const uint64_t *code, uint32_t size);
 
+/* Load a linked (or self-contained) object without copying its code; the
+ * object must stay mapped while the VM executes it. Entry is the named
+ * symbol's address, or the object's entry point if name is NULL. */
+bool milo_vm_load_object(milo_vm_t *vm, const milo_obj_t *obj, const char *entry_name);
+
 /* Load program from assembly text */
 bool milo_vm_load_asm(milo_vm_t *vm, const char *asm_text);
 
+/* Load constant table words into memory starting at byte address base */
+bool milo_vm_load_constants(milo_vm_t *vm, uint32_t base, const uint32_t *values, uint32_t count);
+
 /* Set uniform value */
 void milo_vm_set_uniform_float(milo_vm_t *vm, int index, float value);
 void milo_vm_set_uniform_vec2(milo_vm_t *vm, int index, float x, float y);
@@ -186,6 +244,12 @@ bool milo_vm_exec_fragment(milo_vm_t *vm, const milo_fragment_in_t *in, milo_fra
 /* Execute vertex shader */
 bool milo_vm_exec_vertex(milo_vm_t *vm, const milo_vertex_in_t *in, milo_vertex_out_t *out);
 
+/* Execute vertex shader on each lane of a warp, its registers loaded from
+ * the lane; out[lane] gets the clip position and the other inputs passed
+ * through. Stops at the first lane that fails. */
+bool milo_vm_exec_vertex_warp(milo_vm_t *vm, const milo_vertex_warp_t *warp,
+                              milo_vertex_out_t *out);
+
 /* Get error message */
 const char *milo_vm_get_error(const milo_vm_t *vm);
 
@@ -218,11 +282,24 @@ typedef struct {
     float    *depth;        /* Depth buffer */
     int       width;
     int       height;
+    
+    /* Hierarchical-Z: depth bounds of each MILO_RASTER_BLOCK square block,
+     * row major, hiz_stride blocks per row. hiz_min is exact; hiz_max may
+     * be high until the triangle renderer tightens it. */
+    float    *hiz_min;
+    float    *hiz_max;
+    int       hiz_stride;
+    
+    bool      wrapped;      /* color belongs to the caller */
 } milo_framebuffer_t;
 
-/* Create framebuffer */
+/* Create framebuffer, cleared to 0 at depth 1 (far) */
 milo_framebuffer_t *milo_fb_create(int width, int height);
 
+/* Create a framebuffer over caller memory: color is kept as it is (and
+ * not freed with the framebuffer), depth starts at 1 (far) */
+milo_framebuffer_t *milo_fb_wrap(uint32_t *color, int width, int height);
+
 /* Free framebuffer */
 void milo_fb_free(milo_framebuffer_t *fb);
 
@@ -251,10 +328,46 @@ typedef struct {
     float r1, g1, b1, a1;
 } milo_quad_t;
 
-/* Render a quad using the fragment shader */
+/* Render a quad using the fragment shader. Fragments are at depth 0.5 and
+ * go through the ROP with vm->rop's state, its depth test passing them
+ * all unless vm->quad_depth is set. */
 void milo_render_quad(milo_vm_t *vm, milo_framebuffer_t *fb, const milo_quad_t *quad);
 
 /* Render fullscreen quad */
 void milo_render_fullscreen(milo_vm_t *vm, milo_framebuffer_t *fb);
 
+/*---------------------------------------------------------------------------
+ * Triangle Renderer
+ *---------------------------------------------------------------------------*/
+
+/* Render a triangle of clip-space vertices (vertex shader outputs): divide
+ * by w, map NDC onto the framebuffer (y up, depth -1..1 to 0..1), and run
+ * the fragment shader on each covered pixel with perspective-correct
+ * varyings. The ROP resolves the fragments with vm->rop's state; with
+ * vm->hiz and a LESS or LEQUAL test, triangles and blocks entirely behind
+ * the hi-Z bounds are dropped first. There is no clipper: triangles with
+ * a vertex at w <= 0 or past the guard band are dropped. Returns the
+ * fragments that reached the per-pixel depth test. */
+uint64_t milo_render_triangle(milo_vm_t *vm, milo_framebuffer_t *fb,
+                              const milo_vertex_out_t v[3], milo_cull_t cull);
+
+/* Viewport transform and setup of a clip-space triangle for a width x
+ * height screen; false if it is culled or covers no pixel */
+bool milo_triangle_setup(milo_raster_tri_t *tri, const milo_vertex_out_t *v0,
+                         const milo_vertex_out_t *v1, const milo_vertex_out_t *v2,
+                         int width, int height, milo_cull_t cull);
+
+/* Shade a set-up triangle into target, whose pixel (0, 0) is screen pixel
+ * (x, y): a tile buffer, or the framebuffer at (0, 0). Only the pixels
+ * inside the target are depth tested and shaded; returns the count tested.
+ * Hi-Z is used when x and y are multiples of MILO_RASTER_BLOCK. */
+uint64_t milo_shade_triangle(milo_vm_t *vm, milo_framebuffer_t *target, int x, int y,
+                             const milo_raster_tri_t *tri, const milo_vertex_out_t *v0,
+                             const milo_vertex_out_t *v1, const milo_vertex_out_t *v2);
+
+/* Render an indexed triangle list as one draw */
+uint64_t milo_render_mesh(milo_vm_t *vm, milo_framebuffer_t *fb,
+                          const milo_vertex_out_t *vertices, const uint32_t *indices,
+                          uint32_t index_count, milo_cull_t cull);
+
 #endif /* MILO_VM_H */
@@ -3,42 +3,75 @@
  * Milo832 Shader Compiler - Main Driver
  * 
  * Usage:
- *   miloc [options] <input.glsl>
+ *   miloc [options] <input.glsl> [<input.glsl> ...]
+ * 
+ * Inputs ending in .s or .asm are assembled (streamed from an mmap of the
+ * file) instead of compiled; they require -c.
  * 
  * Options:
- *   -o <file>   Output file (default: stdout)
+ *   -o <file>   Output file (default: stdout); with several inputs, an
+ *               output directory receiving <name>.s or <name>.mlo
  *   -S          Output assembly (default)
- *   -c          Output binary
+ *   -c          Output relocatable object (see milo_obj.h; link with milold)
  *   -v          Vertex shader
  *   -f          Fragment shader (default)
+ *   -j <n>      Compile up to n inputs in parallel (default: all cores)
+ *   --spec <id>=<value>
+ *               Set specialization constant for all variants; the value
+ *               is a number, true or false
+ *   --variant <id>=<value>[,<id>=<value>...]
+ *               Add a variant; all variants share one parse and are
+ *               written to <file>.<n> (or stdout in sequence)
+ *   --cache <dir>
+ *               Use the compiled shader cache in <dir> (default:
+ *               $MILO_SHADER_CACHE); hits skip compilation entirely
  *   --dump-ast  Dump AST
  *   --help      Show help
+ * 
+ * Inputs are compiled on a thread pool, one compiler per worker. Output
+ * and diagnostics for each input are buffered and emitted in command line
+ * order, so results do not depend on scheduling.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "milo_glsl.h"
 #include "milo_asm.h"
+#include "milo_cache.h"
+#include "milo_obj.h"
 
 static void print_usage(const char *prog) {
     fprintf(stderr, "Milo832 Shader Compiler\n\n");
-    fprintf(stderr, "Usage: %s [options] <input.glsl>\n\n", prog);
+    fprintf(stderr, "Usage: %s [options] <input.glsl> [<input.glsl> ...]\n", prog);
+    fprintf(stderr, "       %s -c [options] <input.s> ...\n\n", prog);
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -o <file>   Output file (default: stdout)\n");
+    fprintf(stderr, "              With several inputs: output directory\n");
     fprintf(stderr, "  -S          Output assembly (default)\n");
-    fprintf(stderr, "  -c          Output binary\n");
+    fprintf(stderr, "  -c          Output object file\n");
     fprintf(stderr, "  -v          Vertex shader\n");
     fprintf(stderr, "  -f          Fragment shader (default)\n");
+    fprintf(stderr, "  -j <n>      Parallel compile jobs (default: all cores)\n");
+    fprintf(stderr, "  --spec <id>=<value>\n");
+    fprintf(stderr, "              Set specialization constant for all variants\n");
+    fprintf(stderr, "  --variant <id>=<value>[,<id>=<value>...]\n");
+    fprintf(stderr, "              Add a variant (output written to <file>.<n>)\n");
+    fprintf(stderr, "  --cache <dir>\n");
+    fprintf(stderr, "              Use compiled shader cache (default: $%s)\n", MILO_CACHE_ENV);
     fprintf(stderr, "  --dump-ast  Dump AST\n");
     fprintf(stderr, "  --help      Show this help\n");
 }
 
-static char *read_file(const char *path) {
+static char *read_file(const char *path, FILE *log) {
     FILE *f = fopen(path, "rb");
     if (!f) {
-        fprintf(stderr, "Error: Cannot open '%s'\n", path);
+        fprintf(log, "Error: Cannot open '%s'\n", path);
         return NULL;
     }
     
@@ -48,7 +81,7 @@ static char *read_file(const char *path) {
     
     char *buf = malloc(size + 1);
     if (!buf) {
-        fprintf(stderr, "Error: Out of memory\n");
+        fprintf(log, "Error: Out of memory\n");
         fclose(f);
         return NULL;
     }
@@ -60,12 +93,360 @@ static char *read_file(const char *path) {
     return buf;
 }
 
+#define MAX_VARIANTS 64
+
+/* Parse "<id>=<value>[,<id>=<value>...]" into the compiler's spec table */
+static bool apply_spec_list(milo_compiler_t *compiler, const char *list, FILE *log) {
+    const char *p = list;
+    while (*p) {
+        char *endp;
+        long id = strtol(p, &endp, 10);
+        if (endp == p || *endp != '=') {
+            fprintf(log, "Error: Bad specialization '%s' (expected id=value)\n", list);
+            return false;
+        }
+        p = endp + 1;
+        
+        double value;
+        if (strncmp(p, "true", 4) == 0) {
+            value = 1.0;
+            endp = (char *)p + 4;
+        } else if (strncmp(p, "false", 5) == 0) {
+            value = 0.0;
+            endp = (char *)p + 5;
+        } else {
+            value = strtod(p, &endp);
+            if (endp == p) {
+                fprintf(log, "Error: Bad specialization value in '%s'\n", list);
+                return false;
+            }
+        }
+        milo_glsl_set_spec_constant(compiler, (int)id, value);
+        
+        p = endp;
+        if (*p == ',') p++;
+        else if (*p) {
+            fprintf(log, "Error: Bad specialization '%s'\n", list);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*---------------------------------------------------------------------------
+ * Compile Jobs
+ *---------------------------------------------------------------------------*/
+
+/* Options shared read-only by all jobs */
+typedef struct {
+    const char *output_file;
+    bool        output_dir;         /* output_file names a directory */
+    bool        output_binary;
+    bool        is_vertex;
+    bool        dump_ast;
+    const char *cache_dir;
+    const char *specs[MAX_VARIANTS];
+    int         spec_count;
+    const char *variants[MAX_VARIANTS];
+    int         variant_count;
+} options_t;
+
+/* One input file; stdout output and diagnostics are buffered in memory */
+typedef struct {
+    const char *input;
+    char        output[1024];       /* Output path, empty for stdout */
+    char       *out_buf;
+    size_t      out_len;
+    char       *log_buf;
+    size_t      log_len;
+    bool        ok;
+    bool        run;                /* False if memory ran out before it */
+} job_t;
+
+/* Write an assembly listing or object image to output_file (or out) */
+static bool write_result(const char *output_file, FILE *out, FILE *log,
+                         bool output_binary, const char *asm_code,
+                         const void *object, size_t object_size) {
+    if (output_file) {
+        out = fopen(output_file, output_binary ? "wb" : "w");
+        if (!out) {
+            fprintf(log, "Error: Cannot create '%s'\n", output_file);
+            return false;
+        }
+    }
+    
+    if (output_binary) {
+        fwrite(object, 1, object_size, out);
+        
+        milo_obj_t obj;
+        milo_obj_bind(&obj, object, object_size);
+        fprintf(log, "Generated %u instructions (%lu bytes)\n", 
+                obj.code_size, (unsigned long)object_size);
+    } else {
+        /* Output assembly */
+        fputs(asm_code, out);
+    }
+    
+    if (output_file) {
+        fclose(out);
+    }
+    return true;
+}
+
+/* Serialize b and write it as the job's result */
+static bool write_object(const char *output_file, FILE *out, FILE *log,
+                         const milo_obj_builder_t *b) {
+    size_t size;
+    void *image = milo_obj_serialize(b, &size);
+    if (!image) {
+        fprintf(log, "Error: Out of memory\n");
+        return false;
+    }
+    bool ok = write_result(output_file, out, log, true, NULL, image, size);
+    free(image);
+    return ok;
+}
+
+static bool is_asm_input(const char *path) {
+    const char *dot = strrchr(path, '.');
+    return dot && (strcmp(dot, ".s") == 0 || strcmp(dot, ".asm") == 0);
+}
+
+/* Assemble a .s/.asm input, streamed from the mapped file */
+static bool assemble_job(const options_t *opt, job_t *job, FILE *out, FILE *log) {
+    if (!opt->output_binary) {
+        fprintf(log, "Error: Assembly input '%s' requires -c\n", job->input);
+        return false;
+    }
+    
+    milo_asm_t as;
+    milo_obj_builder_t b;
+    milo_asm_init(&as);
+    milo_obj_builder_init(&b);
+    bool ok = milo_asm_file(&as, job->input);
+    if (!ok) {
+        fprintf(log, "%s: %s\n", job->input, milo_asm_get_error(&as));
+    } else if (!(ok = milo_obj_from_asm(&b, &as))) {
+        fprintf(log, "%s: %s\n", job->input, b.error);
+    } else {
+        ok = write_object(job->output[0] ? job->output : NULL, out, log, &b);
+    }
+    milo_obj_builder_free(&b);
+    milo_asm_free(&as);
+    return ok;
+}
+
+/* Compile one input with all of its variants */
+static bool compile_job(const options_t *opt, job_t *job, milo_compiler_t *compiler,
+                        FILE *out, FILE *log) {
+    if (is_asm_input(job->input)) {
+        return assemble_job(opt, job, out, log);
+    }
+    
+    char *source = read_file(job->input, log);
+    if (!source) {
+        return false;
+    }
+    
+    const char *output_file = job->output[0] ? job->output : NULL;
+    
+    /* Parse once; every variant is generated from the same AST. With a
+     * cache (and no AST dump) each variant is looked up first and only
+     * compiled on a miss. */
+    bool use_cache = opt->cache_dir && !opt->dump_ast;
+    bool ok = use_cache || milo_glsl_parse(compiler, source, opt->is_vertex);
+    
+    /* The listing is only needed for -S output and cache entries */
+    milo_glsl_set_listing(compiler, !opt->output_binary || use_cache);
+    
+    int n_out = opt->variant_count > 0 ? opt->variant_count : 1;
+    for (int v = 0; ok && v < n_out; v++) {
+        milo_glsl_clear_spec_constants(compiler);
+        for (int i = 0; ok && i < opt->spec_count; i++) {
+            ok = apply_spec_list(compiler, opt->specs[i], log);
+        }
+        if (ok && opt->variant_count > 0) {
+            ok = apply_spec_list(compiler, opt->variants[v], log);
+        }
+        if (!ok) break;
+        
+        char path[1100];
+        const char *out_path = output_file;
+        if (opt->variant_count > 0 && output_file) {
+            snprintf(path, sizeof(path), "%s.%d", output_file, v);
+            out_path = path;
+        } else if (opt->variant_count > 0 && !opt->output_binary) {
+            fprintf(out, "; Variant %d: %s\n", v, opt->variants[v]);
+        }
+        
+        if (use_cache) {
+            milo_cache_entry_t entry;
+            ok = milo_cache_compile(opt->cache_dir, compiler, source,
+                                    opt->is_vertex, &entry);
+            if (ok) {
+                ok = write_result(out_path, out, log, opt->output_binary,
+                                  entry.listing, entry.object, entry.object_size);
+                milo_cache_release(&entry);
+            }
+            continue;
+        }
+        
+        ok = milo_glsl_generate(compiler);
+        if (!ok) break;
+        
+        if (opt->dump_ast && v == 0) {
+            milo_glsl_dump_ast(compiler, log);
+        }
+        
+        if (!opt->output_binary) {
+            ok = write_result(out_path, out, log, false, milo_glsl_get_asm(compiler), NULL, 0);
+            continue;
+        }
+        
+        milo_obj_builder_t b;
+        milo_obj_builder_init(&b);
+        ok = milo_obj_from_compiler(&b, compiler) && write_object(out_path, out, log, &b);
+        milo_obj_builder_free(&b);
+    }
+    
+    if (!ok) {
+        const char *errors[32];
+        int n = milo_glsl_get_errors(compiler, errors, 32);
+        for (int i = 0; i < n; i++) {
+            fprintf(log, "%s: %s\n", job->input, errors[i]);
+        }
+    }
+    
+    free(source);
+    return ok;
+}
+
+static void run_job(const options_t *opt, job_t *job, milo_compiler_t *compiler) {
+    FILE *out = open_memstream(&job->out_buf, &job->out_len);
+    FILE *log = open_memstream(&job->log_buf, &job->log_len);
+    if (!out || !log) {
+        if (out) fclose(out);
+        if (log) fclose(log);
+        job->ok = false;
+        return;
+    }
+    job->ok = compile_job(opt, job, compiler, out, log);
+    job->run = true;
+    fclose(out);
+    fclose(log);
+}
+
+/*---------------------------------------------------------------------------
+ * Thread Pool
+ *---------------------------------------------------------------------------*/
+
+typedef struct {
+    const options_t *opt;
+    job_t           *jobs;
+    int              job_count;
+    int              next_job;
+    pthread_mutex_t  lock;
+} pool_t;
+
+static void *worker_main(void *arg) {
+    pool_t *pool = arg;
+    
+    milo_compiler_t *compiler = malloc(sizeof(*compiler));
+    if (!compiler) return NULL;
+    milo_glsl_init(compiler);
+    
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        int j = pool->next_job++;
+        pthread_mutex_unlock(&pool->lock);
+        if (j >= pool->job_count) break;
+        
+        run_job(pool->opt, &pool->jobs[j], compiler);
+    }
+    
+    milo_glsl_free(compiler);
+    free(compiler);
+    return NULL;
+}
+
+/* Run all jobs on up to thread_count workers (inline if one) */
+static void run_jobs(const options_t *opt, job_t *jobs, int job_count, int thread_count) {
+    pool_t pool = { opt, jobs, job_count, 0, PTHREAD_MUTEX_INITIALIZER };
+    
+    if (thread_count > job_count) thread_count = job_count;
+    if (thread_count <= 1) {
+        worker_main(&pool);
+        return;
+    }
+    
+    pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+    int started = 0;
+    if (threads) {
+        for (; started < thread_count; started++) {
+            if (pthread_create(&threads[started], NULL, worker_main, &pool) != 0) break;
+        }
+    }
+    if (started == 0) {
+        worker_main(&pool);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+/*---------------------------------------------------------------------------
+ * Main
+ *---------------------------------------------------------------------------*/
+
+static int compare_job_outputs(const void *a, const void *b) {
+    return strcmp((*(const job_t *const *)a)->output, (*(const job_t *const *)b)->output);
+}
+
+/* Report inputs that would write the same output file */
+static bool check_outputs(job_t *jobs, int job_count) {
+    job_t **sorted = malloc(job_count * sizeof(job_t *));
+    if (!sorted) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return false;
+    }
+    for (int i = 0; i < job_count; i++) sorted[i] = &jobs[i];
+    qsort(sorted, job_count, sizeof(job_t *), compare_job_outputs);
+    
+    bool ok = true;
+    for (int i = 1; i < job_count; i++) {
+        if (strcmp(sorted[i - 1]->output, sorted[i]->output) == 0) {
+            fprintf(stderr, "Error: '%s' and '%s' both write '%s'\n", sorted[i - 1]->input,
+                    sorted[i]->input, sorted[i]->output);
+            ok = false;
+        }
+    }
+    free(sorted);
+    return ok;
+}
+
+/* "<dir>/<base name without extension><ext>" */
+static void dir_output_path(char *buf, size_t size, const char *dir,
+                            const char *input, const char *ext) {
+    const char *base = strrchr(input, '/');
+    base = base ? base + 1 : input;
+    const char *dot = strrchr(base, '.');
+    int len = dot ? (int)(dot - base) : (int)strlen(base);
+    snprintf(buf, size, "%s/%.*s%s", dir, len, base, ext);
+}
+
 int main(int argc, char **argv) {
-    const char *input_file = NULL;
-    const char *output_file = NULL;
-    bool output_binary = false;
-    bool is_vertex = false;
-    bool dump_ast = false;
+    options_t opt;
+    memset(&opt, 0, sizeof(opt));
+    opt.cache_dir = milo_cache_dir_from_env();
+    
+    const char **inputs = malloc(argc * sizeof(char *));
+    int input_count = 0;
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (!inputs) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
     
     /* Parse arguments */
     for (int i = 1; i < argc; i++) {
@@ -77,109 +458,100 @@ int main(int argc, char **argv) {
                 fprintf(stderr, "Error: -o requires an argument\n");
                 return 1;
             }
-            output_file = argv[i];
+            opt.output_file = argv[i];
         } else if (strcmp(argv[i], "-S") == 0) {
-            output_binary = false;
+            opt.output_binary = false;
         } else if (strcmp(argv[i], "-c") == 0) {
-            output_binary = true;
+            opt.output_binary = true;
         } else if (strcmp(argv[i], "-v") == 0) {
-            is_vertex = true;
+            opt.is_vertex = true;
         } else if (strcmp(argv[i], "-f") == 0) {
-            is_vertex = false;
+            opt.is_vertex = false;
+        } else if (strcmp(argv[i], "-j") == 0) {
+            if (++i >= argc || (thread_count = strtol(argv[i], NULL, 10)) < 1) {
+                fprintf(stderr, "Error: -j requires a positive count\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--spec") == 0 || strcmp(argv[i], "--variant") == 0) {
+            bool is_variant = argv[i][2] == 'v';
+            if (++i >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", argv[i - 1]);
+                return 1;
+            }
+            if ((is_variant ? opt.variant_count : opt.spec_count) >= MAX_VARIANTS) {
+                fprintf(stderr, "Error: Too many %s options\n", argv[i - 1]);
+                return 1;
+            }
+            if (is_variant) opt.variants[opt.variant_count++] = argv[i];
+            else opt.specs[opt.spec_count++] = argv[i];
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            if (++i >= argc) {
+                fprintf(stderr, "Error: --cache requires an argument\n");
+                return 1;
+            }
+            opt.cache_dir = argv[i];
         } else if (strcmp(argv[i], "--dump-ast") == 0) {
-            dump_ast = true;
+            opt.dump_ast = true;
         } else if (argv[i][0] == '-') {
             fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
             return 1;
         } else {
-            input_file = argv[i];
+            inputs[input_count++] = argv[i];
         }
     }
     
-    if (!input_file) {
+    if (input_count == 0) {
         fprintf(stderr, "Error: No input file specified\n");
         print_usage(argv[0]);
         return 1;
     }
     
-    /* Read input */
-    char *source = read_file(input_file);
-    if (!source) {
+    opt.output_dir = input_count > 1 && opt.output_file;
+    if (input_count > 1 && opt.output_binary && !opt.output_file) {
+        fprintf(stderr, "Error: Binary output of several inputs requires -o <dir>\n");
         return 1;
     }
     
-    /* Compile */
-    milo_compiler_t compiler;
-    milo_glsl_init(&compiler);
-    
-    bool ok = milo_glsl_compile(&compiler, source, is_vertex);
-    
-    if (!ok) {
-        const char *errors[32];
-        int n = milo_glsl_get_errors(&compiler, errors, 32);
-        for (int i = 0; i < n; i++) {
-            fprintf(stderr, "%s: %s\n", input_file, errors[i]);
-        }
-        free(source);
+    job_t *jobs = calloc(input_count, sizeof(job_t));
+    if (!jobs) {
+        fprintf(stderr, "Error: Out of memory\n");
         return 1;
     }
-    
-    if (dump_ast) {
-        milo_glsl_dump_ast(&compiler, stderr);
-    }
-    
-    /* Get generated assembly */
-    const char *asm_code = milo_glsl_get_asm(&compiler);
-    
-    /* Output */
-    FILE *out = stdout;
-    if (output_file) {
-        out = fopen(output_file, output_binary ? "wb" : "w");
-        if (!out) {
-            fprintf(stderr, "Error: Cannot create '%s'\n", output_file);
-            free(source);
-            return 1;
+    for (int i = 0; i < input_count; i++) {
+        jobs[i].input = inputs[i];
+        if (opt.output_dir) {
+            dir_output_path(jobs[i].output, sizeof(jobs[i].output), opt.output_file,
+                            inputs[i], opt.output_binary ? ".mlo" : ".s");
+        } else if (opt.output_file) {
+            snprintf(jobs[i].output, sizeof(jobs[i].output), "%s", opt.output_file);
         }
     }
     
-    if (output_binary) {
-        /* Assemble to binary */
-        milo_asm_t as;
-        milo_asm_init(&as);
-        
-        if (!milo_asm_source(&as, asm_code)) {
-            fprintf(stderr, "Assembly error: %s\n", milo_asm_get_error(&as));
-            if (output_file) fclose(out);
-            free(source);
-            return 1;
-        }
-        
-        uint32_t size;
-        const uint64_t *code = milo_asm_get_code(&as, &size);
-        
-        /* Write binary header */
-        uint32_t magic = 0x4D494C4F;  /* "MILO" */
-        uint32_t version = 1;
-        fwrite(&magic, 4, 1, out);
-        fwrite(&version, 4, 1, out);
-        fwrite(&size, 4, 1, out);
-        
-        /* Write code */
-        fwrite(code, 8, size, out);
-        
-        fprintf(stderr, "Generated %u instructions (%lu bytes)\n", 
-                size, (unsigned long)(size * 8 + 12));
-    } else {
-        /* Output assembly */
-        fputs(asm_code, out);
+    if (opt.output_dir && !check_outputs(jobs, input_count)) {
+        free(jobs);
+        free(inputs);
+        return 1;
     }
     
-    if (output_file) {
-        fclose(out);
-    }
+    run_jobs(&opt, jobs, input_count, (int)thread_count);
     
-    milo_glsl_free(&compiler);
-    free(source);
+    /* Emit results in input order */
+    int failed = 0;
+    for (int i = 0; i < input_count; i++) {
+        job_t *job = &jobs[i];
+        if (input_count > 1 && !opt.output_file && !opt.output_binary && job->out_len) {
+            printf("; File: %s\n", job->input);
+        }
+        if (job->out_len) fwrite(job->out_buf, 1, job->out_len, stdout);
+        fflush(stdout);
+        if (job->log_len) fwrite(job->log_buf, 1, job->log_len, stderr);
+        if (!job->run) fprintf(stderr, "%s: Error: Out of memory\n", job->input);
+        if (!job->ok) failed++;
+        free(job->out_buf);
+        free(job->log_buf);
+    }
     
-    return 0;
+    free(jobs);
+    free(inputs);
+    return failed ? 1 : 0;
 }
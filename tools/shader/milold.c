@@ -0,0 +1,298 @@
+/*
+ * milold.c
+ * Milo832 Shader Linker - Main Driver
+ *
+ * Usage:
+ *   milold [options] <input.mlo> [<input.mlo> ...]
+ *
+ * Merges objects written by "miloc -c" into one image with a single
+ * constant table. Each object's entry point is exported as a global named
+ * after its file (e.g. shaders/sky.mlo -> "sky"), so one image can hold
+ * many shaders; the first object's entry is the image entry.
+ *
+ * Options:
+ *   -o <file>   Output image (default: a.mlo)
+ *   -l <file>   Helper library object; only linked if it defines a symbol
+ *               some linked object imports (".extern" in assembly)
+ *   --package   Packaging for the GPU's shader program storage: merge the
+ *               constant tables of all shaders into one deduplicated pool
+ *               (rewriting every ldr address), report the memory saved and
+ *               fail if the image exceeds the 256 KB region
+ *   --layout    Reorder basic blocks after linking: hot paths fall through,
+ *               early exits (discard) move out of line, and each shader's
+ *               helper routines follow it
+ *   --profile <file>
+ *               Execution profile of the linked image ("<pc hex> <count>"
+ *               per line); drives --layout, which it implies
+ *   --frame <file>
+ *               Shader names in the order a frame uses them; packed first
+ *               and adjacent in that order (implies --layout)
+ *   --info      Print header, sections and symbols of each input instead
+ *               of linking; with -d also disassemble the code
+ *   -d          Disassemble (with --info)
+ *   --help      Show help
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "milo_obj.h"
+#include "milo_layout.h"
+#include "milo_asm.h"
+
+#define MAX_FRAME_SHADERS 256
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Milo832 Shader Linker\n\n");
+    fprintf(stderr, "Usage: %s [options] <input.mlo> [<input.mlo> ...]\n\n", prog);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -o <file>   Output image (default: a.mlo)\n");
+    fprintf(stderr, "  -l <file>   Helper library (linked only if referenced)\n");
+    fprintf(stderr, "  --package   Deduplicate constants across shaders, check region size\n");
+    fprintf(stderr, "  --layout    Reorder blocks for fetch locality (hot paths fall through)\n");
+    fprintf(stderr, "  --profile <file>\n");
+    fprintf(stderr, "              Execution profile driving --layout (implies --layout)\n");
+    fprintf(stderr, "  --frame <file>\n");
+    fprintf(stderr, "              Shader names in frame order, packed adjacent (implies --layout)\n");
+    fprintf(stderr, "  --info      Describe inputs instead of linking\n");
+    fprintf(stderr, "  -d          Disassemble (with --info)\n");
+    fprintf(stderr, "  --help      Show this help\n");
+}
+
+/* Entry symbol name: file name without directory and extension */
+static void entry_name(char *buf, size_t size, const char *path) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    const char *dot = strrchr(base, '.');
+    int len = dot ? (int)(dot - base) : (int)strlen(base);
+    snprintf(buf, size, "%.*s", len, base);
+}
+
+/* Read whitespace separated shader names; returns the count or -1. The
+ * names point into *buf, which the caller frees. */
+static int read_frame(const char *path, char **buf, const char **names, int max) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open '%s'\n", path);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    *buf = malloc(size + 1);
+    if (!*buf) {
+        fprintf(stderr, "Error: Out of memory\n");
+        fclose(f);
+        return -1;
+    }
+    size_t n = fread(*buf, 1, size, f);
+    (*buf)[n] = '\0';
+    fclose(f);
+    
+    int count = 0;
+    for (char *tok = strtok(*buf, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+        if (count == max) {
+            fprintf(stderr, "Error: More than %d shaders in '%s'\n", max, path);
+            return -1;
+        }
+        names[count++] = tok;
+    }
+    return count;
+}
+
+/* Lay out the linked image in place of ld->out */
+static bool run_layout(milo_link_t *ld, milo_layout_t *lo) {
+    size_t size;
+    void *image = milo_obj_serialize(&ld->out, &size);
+    if (!image) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return false;
+    }
+    milo_obj_t linked;
+    bool ok = milo_obj_bind(&linked, image, size);
+    if (!ok) {
+        fprintf(stderr, "Error: %s\n", milo_obj_get_error(&linked));
+    } else if (!(ok = milo_layout_run(lo, &linked))) {
+        fprintf(stderr, "Error: %s\n", milo_layout_get_error(lo));
+    }
+    free(image);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    const char *output_file = "a.mlo";
+    bool info = false;
+    bool disasm = false;
+    bool package = false;
+    bool layout = false;
+    const char *profile_file = NULL;
+    const char *frame_file = NULL;
+    
+    /* Inputs in command line order; libraries flagged */
+    const char **paths = malloc(argc * sizeof(char *));
+    bool *is_lib = calloc(argc, sizeof(bool));
+    int path_count = 0;
+    if (!paths || !is_lib) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "-l") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", argv[i]);
+                return 1;
+            }
+            if (argv[i][1] == 'o') {
+                output_file = argv[++i];
+            } else {
+                is_lib[path_count] = true;
+                paths[path_count++] = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--profile") == 0 || strcmp(argv[i], "--frame") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires an argument\n", argv[i]);
+                return 1;
+            }
+            if (argv[i][2] == 'p') profile_file = argv[++i];
+            else frame_file = argv[++i];
+            layout = true;
+        } else if (strcmp(argv[i], "--layout") == 0) {
+            layout = true;
+        } else if (strcmp(argv[i], "--package") == 0) {
+            package = true;
+        } else if (strcmp(argv[i], "--info") == 0) {
+            info = true;
+        } else if (strcmp(argv[i], "-d") == 0) {
+            disasm = true;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            return 1;
+        } else {
+            paths[path_count++] = argv[i];
+        }
+    }
+    
+    if (path_count == 0) {
+        fprintf(stderr, "Error: No input file specified\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    milo_obj_t *objs = calloc(path_count, sizeof(milo_obj_t));
+    char (*names)[256] = calloc(path_count, sizeof(*names));
+    if (!objs || !names) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+    
+    int status = 0;
+    int mapped = 0;
+    for (; mapped < path_count; mapped++) {
+        if (!milo_obj_map(&objs[mapped], paths[mapped])) {
+            fprintf(stderr, "Error: %s\n", milo_obj_get_error(&objs[mapped]));
+            status = 1;
+            break;
+        }
+    }
+    
+    if (status == 0 && info) {
+        for (int i = 0; i < path_count; i++) {
+            printf("%s:\n", paths[i]);
+            milo_obj_dump(&objs[i], stdout);
+            if (disasm) {
+                printf("Code:\n");
+                milo_disasm_program(objs[i].code, objs[i].code_size, stdout);
+            }
+            printf("\n");
+        }
+    } else if (status == 0) {
+        milo_link_t ld;
+        milo_link_init(&ld);
+        ld.dedup_constants = package;
+        milo_layout_t lo;
+        milo_layout_init(&lo);
+        const char *frame[MAX_FRAME_SHADERS];
+        char *frame_buf = NULL;
+        
+        bool ok = true;
+        if (profile_file && !milo_layout_load_profile(&lo, profile_file)) {
+            fprintf(stderr, "Error: %s\n", milo_layout_get_error(&lo));
+            ok = false;
+        }
+        if (ok && frame_file) {
+            int count = read_frame(frame_file, &frame_buf, frame, MAX_FRAME_SHADERS);
+            ok = count >= 0;
+            lo.frame = frame;
+            lo.frame_count = ok ? (uint32_t)count : 0;
+        }
+        
+        for (int i = 0; ok && i < path_count; i++) {
+            if (is_lib[i]) {
+                ok = milo_link_add_library(&ld, &objs[i]);
+            } else {
+                entry_name(names[i], sizeof(names[i]), paths[i]);
+                ok = milo_link_add_object(&ld, &objs[i], names[i]);
+            }
+            if (!ok) fprintf(stderr, "Error: %s\n", milo_link_get_error(&ld));
+        }
+        if (ok && !milo_link_run(&ld)) {
+            fprintf(stderr, "Error: %s\n", milo_link_get_error(&ld));
+            ok = false;
+        }
+        ok = ok && (!layout || run_layout(&ld, &lo));
+        
+        const milo_obj_builder_t *image = layout ? &lo.out : &ld.out;
+        size_t image_bytes = ok ? milo_link_image_bytes(&ld) + lo.jumps_added * sizeof(uint64_t)
+                                : 0;
+        if (!ok) {
+            status = 1;
+        } else if (package && image_bytes > MILO_SHADER_REGION_SIZE) {
+            fprintf(stderr, "Error: Image needs %zu bytes, shader region holds %d\n",
+                    image_bytes, MILO_SHADER_REGION_SIZE);
+            status = 1;
+        } else if (!milo_obj_write(image, output_file)) {
+            fprintf(stderr, "Error: Cannot write '%s'\n", output_file);
+            status = 1;
+        } else {
+            fprintf(stderr, "Linked %u instructions, %u constants, %u symbols\n",
+                    image->code_size, image->const_count, image->symbol_count);
+            if (layout) {
+                fprintf(stderr, "Layout: %u blocks in %u procedures, %u cold, "
+                        "%u branches inverted, %u jumps added\n",
+                        lo.block_count, lo.proc_count, lo.cold_count,
+                        lo.inverted, lo.jumps_added);
+                fprintf(stderr, "Estimated fetch breaks (%s): %.0f -> %.0f\n",
+                        lo.profile ? "profile" : "static",
+                        lo.breaks_before, lo.breaks_after);
+            }
+            if (package) {
+                uint32_t saved = ld.const_words_in - ld.const_words_out;
+                fprintf(stderr, "Constant pool: %u -> %u words, %u bytes saved (%.1f%%)\n",
+                        ld.const_words_in, ld.const_words_out, saved * 4,
+                        ld.const_words_in ? 100.0 * saved / ld.const_words_in : 0.0);
+                fprintf(stderr, "Shader region: %zu of %d bytes used (%.1f%%)\n",
+                        image_bytes, MILO_SHADER_REGION_SIZE,
+                        100.0 * image_bytes / MILO_SHADER_REGION_SIZE);
+            }
+        }
+        free(frame_buf);
+        milo_layout_free(&lo);
+        milo_link_free(&ld);
+    }
+    
+    for (int i = 0; i < mapped; i++) {
+        milo_obj_release(&objs[i]);
+    }
+    free(objs);
+    free(names);
+    free(paths);
+    free(is_lib);
+    return status;
+}
@@ -12,6 +12,18 @@
 #include "milo_glsl.h"
 #include "milo_asm.h"
 #include "milo_vm.h"
+#include "milo_cache.h"
+#include "milo_obj.h"
+#include "milo_layout.h"
+#include "milo_prof.h"
+#include "milo_timing.h"
+#include "milo_mesh.h"
+#include "milo_tbdr.h"
+#include "milo_fetch.h"
+#include "milo_vcache.h"
+#include "milo_cmd.h"
+#include "milo_cmdbuf.h"
+#include "milo_capture.h"
 
 /*---------------------------------------------------------------------------
  * Test Shaders
@@ -82,6 +94,62 @@ static const char *circle_shader =
     "    fragColor = vec4(1.0 - dist * 2.0, 0.3, dist * 2.0, 1.0);\n"
     "}\n";
 
+/* Specialization constant shader - vignette toggled per variant */
+static const char *spec_shader =
+    "// Specialization constant shader\n"
+    "layout(constant_id = 0) const int VIGNETTE = 1;\n"
+    "layout(constant_id = 1) const float STRENGTH = 2.0;\n"
+    "in vec2 v_texcoord;\n"
+    "uniform float u_time;\n"
+    "out vec4 fragColor;\n"
+    "\n"
+    "void main() {\n"
+    "    float c = 0.8;\n"
+    "    if (VIGNETTE == 1) {\n"
+    "        float x = v_texcoord.x - 0.5;\n"
+    "        float y = v_texcoord.y - 0.5;\n"
+    "        c = c - (x * x + y * y) * STRENGTH + u_time * 0.0;\n"
+    "    }\n"
+    "    fragColor = vec4(c, c * 0.8, c * 0.5, 1.0);\n"
+    "}\n";
+
+/* Discard shader - early exit outside the circle, then a loop */
+static const char *discard_shader =
+    "// Discard shader\n"
+    "in vec2 v_texcoord;\n"
+    "out vec4 fragColor;\n"
+    "\n"
+    "void main() {\n"
+    "    float x = v_texcoord.x - 0.5;\n"
+    "    float y = v_texcoord.y - 0.5;\n"
+    "    if (x * x + y * y > 0.2) {\n"
+    "        discard;\n"
+    "    }\n"
+    "    float c = 0.0;\n"
+    "    for (int i = 0; i < 4; i++) {\n"
+    "        c = c + 0.2;\n"
+    "    }\n"
+    "    fragColor = vec4(c, x + 0.5, y + 0.5, 1.0);\n"
+    "}\n";
+
+/* Divergent if/else in assembly: the left half of the screen takes one
+ * path, the right half the other */
+static const char *divergent_asm =
+    "    ldr r20, r0, 0x1000\n"
+    "    fslt r21, r2, r20\n"
+    "    ssy done\n"
+    "    beq r0, r21, right\n"
+    "    ldr r4, r0, 0x1004\n"
+    "    bra done\n"
+    "right:\n"
+    "    ldr r5, r0, 0x1004\n"
+    "done:\n"
+    "    join\n"
+    "    ldr r7, r0, 0x1004\n"
+    "    exit\n"
+    ".data 0x1000, 0x3F000000\n"
+    ".data 0x1004, 0x3F800000\n";
+
 /*---------------------------------------------------------------------------
  * Test Helpers
  *---------------------------------------------------------------------------*/
@@ -91,6 +159,31 @@ static bool compile_and_load(milo_compiler_t *compiler, milo_vm_t *vm,
     printf("Compiling %s...\n", name);
     
     milo_glsl_init(compiler);
+    
+    /* Go through the shader cache when MILO_SHADER_CACHE is set */
+    const char *cache_dir = milo_cache_dir_from_env();
+    if (cache_dir) {
+        milo_cache_entry_t entry;
+        if (!milo_cache_compile(cache_dir, compiler, source, false, &entry)) {
+            const char *errors[8];
+            int n = milo_glsl_get_errors(compiler, errors, 8);
+            for (int i = 0; i < n; i++) {
+                fprintf(stderr, "  Error: %s\n", errors[i]);
+            }
+            return false;
+        }
+        printf("Generated assembly:\n%s\n", entry.listing);
+        bool ok = milo_vm_load_binary(vm, entry.code, entry.code_size) &&
+                  milo_vm_load_constants(vm, entry.const_base, entry.constants, entry.const_count);
+        milo_cache_release(&entry);
+        if (!ok) {
+            fprintf(stderr, "  VM load error: %s\n", milo_vm_get_error(vm));
+            return false;
+        }
+        printf("Loaded %u instructions\n\n", vm->code_size);
+        return true;
+    }
+    
     if (!milo_glsl_compile(compiler, source, false)) {
         const char *errors[8];
         int n = milo_glsl_get_errors(compiler, errors, 8);
@@ -100,10 +193,13 @@ static bool compile_and_load(milo_compiler_t *compiler, milo_vm_t *vm,
         return false;
     }
     
-    const char *asm_code = milo_glsl_get_asm(compiler);
-    printf("Generated assembly:\n%s\n", asm_code);
+    printf("Generated assembly:\n%s\n", milo_glsl_get_asm(compiler));
     
-    if (!milo_vm_load_asm(vm, asm_code)) {
+    uint32_t code_size, const_count;
+    const uint64_t *code = milo_glsl_get_code(compiler, &code_size);
+    const uint32_t *constants = milo_glsl_get_constants(compiler, &const_count);
+    if (!milo_vm_load_binary(vm, code, code_size) ||
+        !milo_vm_load_constants(vm, MILO_CONST_BASE_ADDR, constants, const_count)) {
         fprintf(stderr, "  VM load error: %s\n", milo_vm_get_error(vm));
         return false;
     }
@@ -161,6 +257,1583 @@ static void run_test(const char *name, const char *source,
     milo_glsl_free(&compiler);
 }
 
+/* Build every variant of the spec shader from one parse and render each */
+static void run_variant_test(const char *name, const char *source,
+                             const char *const *variants, int variant_count) {
+    milo_compiler_t compiler;
+    milo_glsl_init(&compiler);
+    
+    printf("Parsing %s...\n", name);
+    if (!milo_glsl_parse(&compiler, source, false)) {
+        fprintf(stderr, "  Parse error\n");
+        return;
+    }
+    
+    for (int v = 0; v < variant_count; v++) {
+        milo_glsl_clear_spec_constants(&compiler);
+        for (const char *p = variants[v]; *p; ) {
+            char *endp;
+            int id = (int)strtol(p, &endp, 10);
+            double value = strtod(endp + 1, &endp);
+            milo_glsl_set_spec_constant(&compiler, id, value);
+            p = (*endp == ',') ? endp + 1 : endp;
+        }
+        
+        if (!milo_glsl_generate(&compiler)) {
+            fprintf(stderr, "  Variant %d: generate error\n", v);
+            continue;
+        }
+        
+        milo_vm_t vm;
+        milo_vm_init(&vm);
+        const char *asm_code = milo_glsl_get_asm(&compiler);
+        if (!milo_vm_load_asm(&vm, asm_code)) {
+            fprintf(stderr, "  VM load error: %s\n", milo_vm_get_error(&vm));
+            continue;
+        }
+        printf("Variant %d (%s): %u instructions\n", v, variants[v], vm.code_size);
+        
+        /* The listing must assemble to exactly the code emitted directly */
+        uint32_t code_size;
+        const uint64_t *code = milo_glsl_get_code(&compiler, &code_size);
+        if (code_size != vm.code_size ||
+            memcmp(code, vm.code, code_size * sizeof(uint64_t)) != 0) {
+            fprintf(stderr, "  Variant %d: listing does not match emitted code\n", v);
+        }
+        
+        milo_framebuffer_t *fb = milo_fb_create(256, 256);
+        if (!fb) continue;
+        milo_fb_clear(fb, 0xFF000000, 1.0f);
+        milo_render_fullscreen(&vm, fb);
+        
+        char filename[64];
+        snprintf(filename, sizeof(filename), "test_%s_%d.ppm", name, v);
+        if (milo_fb_save_ppm(fb, filename)) {
+            printf("Saved %s\n", filename);
+        }
+        milo_fb_free(fb);
+    }
+    
+    /* Constants fold by name, so a local taking the name of one must be
+     * refused rather than read as the constant */
+    static const char *shadowed = "layout(constant_id = 1) const float K = 2.0;\n"
+                                  "out vec4 fragColor;\n"
+                                  "void main() {\n"
+                                  "    float K = 5.0;\n"
+                                  "    fragColor = vec4(K, 0.0, 0.0, 1.0);\n"
+                                  "}\n";
+    const char *error = NULL;
+    if (milo_glsl_parse(&compiler, shadowed, false) ||
+        milo_glsl_get_errors(&compiler, &error, 1) == 0) {
+        printf("Shadowed constant accepted\n");
+    } else {
+        printf("Shadowed constant: %s\n", error);
+    }
+    
+    /* Int spec constants keep their exact value past 2^24, and a bool one
+     * decides its branch */
+    static const char *typed = "layout(constant_id = 2) const int SEED = 16777217;\n"
+                               "layout(constant_id = 3) const bool FOG = true;\n"
+                               "out vec4 fragColor;\n"
+                               "void main() {\n"
+                               "    int s = SEED;\n"
+                               "    fragColor = vec4(0.0, 0.0, 0.0, 1.0);\n"
+                               "    if (FOG) fragColor = vec4(0.5, 0.5, 0.5, 1.0);\n"
+                               "}\n";
+    uint32_t fog_size[2] = {0, 0};
+    bool seed_exact = false;
+    if (milo_glsl_parse(&compiler, typed, false)) {
+        for (int fog = 0; fog < 2; fog++) {
+            milo_glsl_clear_spec_constants(&compiler);
+            milo_glsl_set_spec_constant(&compiler, 3, fog);
+            if (!milo_glsl_generate(&compiler)) break;
+            milo_glsl_get_code(&compiler, &fog_size[fog]);
+            for (int i = 0; i < compiler.const_count; i++) {
+                if (compiler.constants[i] == 16777217u) seed_exact = true;
+            }
+        }
+    }
+    printf("Typed spec constants: SEED %s, FOG off %u / on %u instructions\n",
+           seed_exact ? "exact" : "rounded", fog_size[0], fog_size[1]);
+    printf("\n");
+    
+    milo_glsl_free(&compiler);
+}
+
+/* Compile the same shaders many times with one compiler; the arena and
+ * code buffers must reach a steady size after the first round */
+static void run_reuse_test(const char *const *sources, int source_count, int rounds) {
+    milo_compiler_t compiler;
+    milo_glsl_init(&compiler);
+    milo_glsl_set_listing(&compiler, false);
+    
+    printf("Recompiling %d shaders x %d with one compiler...\n", source_count, rounds);
+    size_t warm_reserved = 0;
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < source_count; i++) {
+            if (!milo_glsl_compile(&compiler, sources[i], false)) {
+                fprintf(stderr, "  Compile error in round %d\n", r);
+                milo_glsl_free(&compiler);
+                return;
+            }
+        }
+        if (r == 0) warm_reserved = compiler.arena.reserved;
+    }
+    
+    if (compiler.arena.reserved != warm_reserved) {
+        fprintf(stderr, "  Arena grew from %zu to %zu bytes\n",
+                warm_reserved, compiler.arena.reserved);
+    } else {
+        printf("Arena steady at %zu bytes\n\n", warm_reserved);
+    }
+    milo_glsl_free(&compiler);
+}
+
+/* Helper library and a caller importing from it */
+static const char *helper_library =
+    ".global half\n"
+    "half:\n"
+    "    ldr r20, r0, 0x1000\n"
+    "    fmul r1, r1, r20\n"
+    "    ret\n"
+    ".data 0x1000, 0x3F000000\n";
+
+static const char *helper_caller =
+    ".extern half\n"
+    "    ldr r1, r0, 0x1000\n"
+    "    call half\n"
+    "    mov r4, r1\n"
+    "    exit\n"
+    ".data 0x1000, 0x40800000\n";
+
+/* Bind a view to a serialized copy of b; the image is returned for freeing */
+static void *object_image(const milo_obj_builder_t *b, milo_obj_t *obj) {
+    size_t size;
+    void *image = milo_obj_serialize(b, &size);
+    if (image && !milo_obj_bind(obj, image, size)) {
+        free(image);
+        return NULL;
+    }
+    return image;
+}
+
+static void *assemble_object(const char *source, milo_obj_t *obj) {
+    milo_asm_t as;
+    milo_obj_builder_t b;
+    milo_asm_init(&as);
+    milo_obj_builder_init(&b);
+    void *image = NULL;
+    if (milo_asm_source(&as, source) && milo_obj_from_asm(&b, &as)) {
+        image = object_image(&b, obj);
+    }
+    milo_obj_builder_free(&b);
+    milo_asm_free(&as);
+    return image;
+}
+
+static bool render_matches(milo_vm_t *a, milo_vm_t *b) {
+    milo_framebuffer_t *fa = milo_fb_create(64, 64);
+    milo_framebuffer_t *fb = milo_fb_create(64, 64);
+    bool same = fa && fb;
+    if (same) {
+        milo_fb_clear(fa, 0xFF000000, 1.0f);
+        milo_fb_clear(fb, 0xFF000000, 1.0f);
+        milo_render_fullscreen(a, fa);
+        milo_render_fullscreen(b, fb);
+        same = memcmp(fa->color, fb->color, 64 * 64 * sizeof(uint32_t)) == 0;
+    }
+    if (fa) milo_fb_free(fa);
+    if (fb) milo_fb_free(fb);
+    return same;
+}
+
+/* True if the shader named entry renders the same from both images */
+static bool entry_matches(const milo_obj_t *a, const milo_obj_t *b, const char *entry) {
+    milo_vm_t *va = malloc(sizeof(milo_vm_t));
+    milo_vm_t *vb = malloc(sizeof(milo_vm_t));
+    bool same = va && vb;
+    if (same) {
+        milo_vm_init(va);
+        milo_vm_init(vb);
+        same = milo_vm_load_object(va, a, entry) && milo_vm_load_object(vb, b, entry) &&
+               render_matches(va, vb);
+    }
+    free(va);
+    free(vb);
+    return same;
+}
+
+/* Reorder a linked image's blocks with the shaders packed in reverse frame
+ * order, and a discard shader on its own; every shader must render as
+ * before, and the discard path must move out of line */
+static void run_layout_test(const milo_obj_t *linked, char names[][16], int count) {
+    const char *frame[16];
+    for (int i = 0; i < count; i++) frame[i] = names[count - 1 - i];
+    
+    printf("Laying out linked image in reverse frame order...\n");
+    milo_layout_t lo;
+    milo_layout_init(&lo);
+    lo.frame = frame;
+    lo.frame_count = (uint32_t)count;
+    
+    milo_obj_t out;
+    void *image = NULL;
+    if (!milo_layout_run(&lo, linked) || !(image = object_image(&lo.out, &out))) {
+        fprintf(stderr, "  Layout error: %s\n", milo_layout_get_error(&lo));
+        milo_layout_free(&lo);
+        return;
+    }
+    int matched = 0;
+    uint32_t first = 0;
+    milo_obj_find_symbol(&out, frame[0], &first);
+    for (int i = 0; i < count; i++) {
+        if (entry_matches(linked, &out, names[i])) matched++;
+        else fprintf(stderr, "  %s differs after layout\n", names[i]);
+    }
+    printf("%u blocks, %u procedures; %s first at 0x%04X; %d/%d shaders match\n",
+           lo.block_count, lo.proc_count, frame[0], first, matched, count);
+    free(image);
+    image = NULL;
+    
+    /* Discard shader alone: the early exit is cold */
+    milo_compiler_t compiler;
+    milo_obj_builder_t b;
+    milo_obj_t obj;
+    void *obj_image = NULL;
+    milo_glsl_init(&compiler);
+    milo_obj_builder_init(&b);
+    lo.frame_count = 0;
+    if (milo_glsl_compile(&compiler, discard_shader, false) &&
+        milo_obj_from_compiler(&b, &compiler) &&
+        (obj_image = object_image(&b, &obj)) != NULL &&
+        milo_layout_run(&lo, &obj) && (image = object_image(&lo.out, &out)) != NULL) {
+        printf("Discard shader: %u cold, %u branches inverted, %u jumps added; "
+               "fetch breaks %.0f -> %.0f; render %s\n\n",
+               lo.cold_count, lo.inverted, lo.jumps_added, lo.breaks_before,
+               lo.breaks_after, entry_matches(&obj, &out, NULL) ? "matches" : "differs");
+    } else {
+        fprintf(stderr, "  Discard layout error: %s\n", milo_layout_get_error(&lo));
+    }
+    free(image);
+    free(obj_image);
+    milo_obj_builder_free(&b);
+    milo_glsl_free(&compiler);
+    milo_layout_free(&lo);
+}
+
+/* Compile shaders to objects, link them with a helper library into one
+ * image file, map it and run every shader in place from the mapping. With
+ * dedup, the shaders share one deduplicated constant pool. */
+static void run_link_test(const char *const *sources, int source_count, bool dedup) {
+    enum { MAX_LINK = 8 };
+    milo_obj_t objs[MAX_LINK + 2];
+    void *images[MAX_LINK + 2] = {0};
+    char names[MAX_LINK][16];
+    const char *path = "test_link.mlo";
+    
+    printf("Linking %d shaders with a helper library%s...\n", source_count,
+           dedup ? " (shared constant pool)" : "");
+    
+    milo_compiler_t compiler;
+    milo_obj_builder_t b;
+    milo_glsl_init(&compiler);
+    milo_glsl_set_listing(&compiler, false);
+    milo_obj_builder_init(&b);
+    
+    milo_link_t ld;
+    milo_link_init(&ld);
+    ld.dedup_constants = dedup;
+    bool ok = true;
+    for (int i = 0; ok && i < source_count && i < MAX_LINK; i++) {
+        ok = milo_glsl_compile(&compiler, sources[i], false) &&
+             milo_obj_from_compiler(&b, &compiler) &&
+             (images[i] = object_image(&b, &objs[i])) != NULL;
+        snprintf(names[i], sizeof(names[i]), "shader%d", i);
+        ok = ok && milo_link_add_object(&ld, &objs[i], names[i]);
+    }
+    ok = ok && (images[MAX_LINK] = assemble_object(helper_caller, &objs[MAX_LINK])) != NULL &&
+         (images[MAX_LINK + 1] = assemble_object(helper_library, &objs[MAX_LINK + 1])) != NULL &&
+         milo_link_add_object(&ld, &objs[MAX_LINK], "caller") &&
+         milo_link_add_library(&ld, &objs[MAX_LINK + 1]);
+    if (!ok) {
+        fprintf(stderr, "  Object build error\n");
+    } else if (!milo_link_run(&ld)) {
+        fprintf(stderr, "  Link error: %s\n", milo_link_get_error(&ld));
+        ok = false;
+    } else if (!milo_obj_write(&ld.out, path)) {
+        fprintf(stderr, "  Cannot write %s\n", path);
+        ok = false;
+    }
+    
+    milo_obj_t image;
+    if (ok && !milo_obj_map(&image, path)) {
+        fprintf(stderr, "  %s\n", milo_obj_get_error(&image));
+        ok = false;
+    }
+    
+    /* Each shader runs from the shared image exactly as when loaded alone */
+    int matched = 0;
+    for (int i = 0; ok && i < source_count && i < MAX_LINK; i++) {
+        milo_vm_t *alone = malloc(sizeof(milo_vm_t));
+        milo_vm_t *linked = malloc(sizeof(milo_vm_t));
+        if (alone && linked) {
+            milo_vm_init(alone);
+            milo_vm_init(linked);
+            if (milo_vm_load_object(alone, &objs[i], NULL) &&
+                milo_vm_load_object(linked, &image, names[i]) &&
+                render_matches(alone, linked)) {
+                matched++;
+            } else {
+                fprintf(stderr, "  shader%d differs when linked\n", i);
+            }
+        }
+        free(alone);
+        free(linked);
+    }
+    
+    /* The caller reaches the library routine through its import */
+    if (ok) {
+        milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+        milo_fragment_in_t in = {0};
+        milo_fragment_out_t out;
+        if (vm) {
+            milo_vm_init(vm);
+            if (milo_vm_load_object(vm, &image, "caller") && milo_vm_exec_fragment(vm, &in, &out) &&
+                out.r == 2.0f) {
+                printf("Linked %u instructions, %u of %u constants; %d/%d shaders match, "
+                       "library call ok\n\n", image.code_size, image.const_count,
+                       ld.const_words_in, matched, source_count);
+            } else {
+                fprintf(stderr, "  Library call failed: %s\n", milo_vm_get_error(vm));
+            }
+            free(vm);
+        }
+        if (dedup) run_layout_test(&image, names, source_count);
+        milo_obj_release(&image);
+    }
+    remove(path);
+    
+    milo_link_free(&ld);
+    for (int i = 0; i < MAX_LINK + 2; i++) free(images[i]);
+    milo_obj_builder_free(&b);
+    milo_glsl_free(&compiler);
+}
+
+/* Profile the discard shader: every pixel executes the entry once, and the
+ * lanes reaching the end show how much of each warp survives the discard */
+static void run_profile_test(void) {
+    printf("Profiling discard shader...\n");
+    milo_compiler_t compiler;
+    milo_glsl_init(&compiler);
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    milo_framebuffer_t *fb = milo_fb_create(64, 64);
+    milo_prof_t prof;
+    memset(&prof, 0, sizeof(prof));
+    if (vm && fb && milo_glsl_compile(&compiler, discard_shader, false)) {
+        uint32_t code_size, const_count;
+        const uint64_t *code = milo_glsl_get_code(&compiler, &code_size);
+        const uint32_t *constants = milo_glsl_get_constants(&compiler, &const_count);
+        milo_vm_init(vm);
+        if (milo_prof_init(&prof, code_size) &&
+            milo_vm_load_binary(vm, code, code_size) &&
+            milo_vm_load_constants(vm, MILO_CONST_BASE_ADDR, constants, const_count)) {
+            prof.trace = true;
+            vm->profile = &prof;
+            milo_render_fullscreen(vm, fb);
+            milo_prof_finish(&prof);
+            
+            uint64_t last = prof.pcs[code_size - 1].exec;
+            uint64_t issues = 0, exec = 0;
+            for (uint32_t pc = 0; pc < code_size; pc++) {
+                issues += prof.pcs[pc].issues;
+                exec += prof.pcs[pc].exec;
+            }
+            printf("%llu threads in %llu warps, entry %s, %llu reach the end; "
+                   "%.1f lanes per issue\n",
+                   (unsigned long long)prof.threads, (unsigned long long)prof.warps,
+                   prof.pcs[0].exec == prof.threads ? "ok" : "MISMATCH",
+                   (unsigned long long)last, issues ? (double)exec / issues : 0.0);
+            
+            /* Replaying the warp streams issues every warp instruction once */
+            milo_prof_util_t util;
+            if (milo_prof_utilization(&prof, code, code_size, MILO_RESIDENT_WARPS, NULL, &util)) {
+                uint64_t issued = 0;
+                for (int u = 0; u < MILO_UNIT_COUNT; u++) issued += util.issued[u];
+                printf("Utilization: %llu cycles, %s; alu %.1f%%, fpu %.1f%%, lsu %.1f%%\n",
+                       (unsigned long long)util.cycles,
+                       issued == issues ? "all issues replayed" : "MISMATCH",
+                       100.0 * util.issued[MILO_UNIT_ALU] / util.cycles,
+                       100.0 * util.issued[MILO_UNIT_FPU] / util.cycles,
+                       100.0 * util.issued[MILO_UNIT_LSU] / util.cycles);
+            }
+            
+            /* The timing model issues the same stream; a lone warp cannot
+             * hide any latency */
+            milo_timing_config_t cfg;
+            milo_timing_defaults(&cfg);
+            milo_timing_stats_t full, lone;
+            bool timed = milo_timing_run(&cfg, &prof, code, code_size, 0, prof.warps, &full);
+            cfg.resident_warps = 1;
+            if (timed && milo_timing_run(&cfg, &prof, code, code_size, 0, prof.warps, &lone)) {
+                printf("Timing model: %llu cycles, IPC %.2f, %s; %llu cycles with one "
+                       "resident warp\n",
+                       (unsigned long long)full.cycles, (double)full.issued / full.cycles,
+                       full.issued == issues ? "all issues timed" : "MISMATCH",
+                       (unsigned long long)lone.cycles);
+            }
+            
+            /* Every scheduler issues the whole stream */
+            cfg.resident_warps = MILO_RESIDENT_WARPS;
+            bool all = true;
+            printf("Schedulers:");
+            for (int sched = 0; sched < MILO_SCHED_COUNT; sched++) {
+                cfg.scheduler = (milo_sched_t)sched;
+                milo_timing_stats_t st;
+                all &= milo_timing_run_draws(&cfg, &prof, code, code_size, &st) &&
+                       st.issued == issues;
+                printf(" %s %llu,", milo_sched_name(cfg.scheduler),
+                       (unsigned long long)st.cycles);
+            }
+            printf(" %s\n", all ? "all issues timed" : "MISMATCH");
+            
+            /* Two SMs split the warps between them under either distributor */
+            cfg.scheduler = MILO_SCHED_RR;
+            cfg.sm_count = 2;
+            all = true;
+            printf("2 SMs:");
+            for (int dist = MILO_DIST_WARP; dist <= MILO_DIST_TILE; dist++) {
+                cfg.distribution = (milo_dist_t)dist;
+                milo_timing_stats_t st;
+                all &= milo_timing_run_draws(&cfg, &prof, code, code_size, &st) &&
+                       st.issued == issues && st.warps == prof.warps &&
+                       st.cycles < full.cycles;
+                printf(" %s %llu,", milo_dist_name(cfg.distribution),
+                       (unsigned long long)st.cycles);
+            }
+            printf(" %s\n\n", all ? "faster, all issues timed" : "MISMATCH");
+        }
+    }
+    milo_prof_free(&prof);
+    if (fb) milo_fb_free(fb);
+    free(vm);
+    milo_glsl_free(&compiler);
+}
+
+/* 48 pixel rows put both halves of the screen in every warp of 32: each
+ * warp splits at the branch and runs the two paths one after the other */
+static void run_divergence_test(void) {
+    printf("Replaying divergent warps...\n");
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    milo_framebuffer_t *fb = milo_fb_create(48, 8);
+    milo_prof_t prof;
+    memset(&prof, 0, sizeof(prof));
+    if (vm && fb) {
+        milo_vm_init(vm);
+        if (milo_vm_load_asm(vm, divergent_asm) && milo_prof_init(&prof, vm->code_size)) {
+            vm->profile = &prof;
+            milo_render_fullscreen(vm, fb);
+            milo_render_fullscreen(vm, fb);
+            
+            /* 4 shared, 2 on the taken path, 3 on the other, 2 after join */
+            const milo_prof_draw_t *d = &prof.draws[0];
+            printf("%u draws; draw 0: %llu warps, %llu diverged, %llu issues (%s), "
+                   "%llu serialized, %.1f lanes per issue\n\n",
+                   prof.draw_count, (unsigned long long)d->warps,
+                   (unsigned long long)d->diverged, (unsigned long long)d->issues,
+                   d->issues == 11 * d->warps ? "ok" : "MISMATCH",
+                   (unsigned long long)d->serialized, (double)d->exec / d->issues);
+        } else {
+            fprintf(stderr, "  Load error: %s\n", milo_vm_get_error(vm));
+        }
+    }
+    milo_prof_free(&prof);
+    if (fb) milo_fb_free(fb);
+    free(vm);
+}
+
+static void count_block(void *user, int x, int y, uint64_t mask) {
+    uint8_t *hits = user;
+    for (int i = 0; i < 64; i++) {
+        if (mask & (1ull << i)) hits[(y + i / 8) * 64 + x + i % 8]++;
+    }
+}
+
+/* A jittered grid of triangles in both windings, with shared edges at every
+ * slope, must cover each pixel of the 64x64 screen exactly once */
+static void run_raster_test(milo_texture_t *tex) {
+    printf("Rasterizing a jittered 8x8 grid...\n");
+    static uint8_t hits[64 * 64];
+    memset(hits, 0, sizeof(hits));
+    float gx[9][9], gy[9][9];
+    for (int j = 0; j <= 8; j++) {
+        for (int i = 0; i <= 8; i++) {
+            bool border_x = i == 0 || i == 8, border_y = j == 0 || j == 8;
+            gx[j][i] = i * 8.0f + (border_x ? 0.0f : (float)((i * 7 + j * 3) % 5) - 2.0f);
+            gy[j][i] = j * 8.0f + (border_y ? 0.0f : (float)((i * 5 + j * 11) % 7) * 0.5f - 1.5f);
+        }
+    }
+    int triangles = 0;
+    for (int j = 0; j < 8; j++) {
+        for (int i = 0; i < 8; i++) {
+            int quad[4][2] = { { i, j }, { i + 1, j }, { i + 1, j + 1 }, { i, j + 1 } };
+            int tris[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
+            for (int k = 0; k < 2; k++) {
+                milo_raster_vertex_t v[3];
+                for (int c = 0; c < 3; c++) {
+                    /* Odd cells reverse their winding */
+                    int q = tris[k][(i + j) % 2 ? 2 - c : c];
+                    v[c].x = gx[quad[q][1]][quad[q][0]];
+                    v[c].y = gy[quad[q][1]][quad[q][0]];
+                    v[c].z = 0.5f;
+                    v[c].w = 1.0f;
+                }
+                milo_raster_tri_t t;
+                if (milo_raster_setup(&t, v, 64, 64, MILO_CULL_NONE)) {
+                    milo_raster_blocks(&t, 0, 0, 64, 64, count_block, hits);
+                    triangles++;
+                }
+            }
+        }
+    }
+    int once = 0;
+    for (int i = 0; i < 64 * 64; i++) once += hits[i] == 1;
+    printf("%d triangles, %d of %d pixels covered once (%s)\n", triangles, once, 64 * 64,
+           once == 64 * 64 ? "ok" : "MISMATCH");
+    
+    /* Block accept/reject against the edge functions at every pixel, on
+     * triangles from slivers to several times the screen */
+    uint32_t seed = 12345;
+    int checked = 0, wrong = 0;
+    for (int n = 0; n < 200; n++) {
+        milo_raster_vertex_t v[3];
+        float scale = (float)(8 << (n % 6));
+        for (int c = 0; c < 3; c++) {
+            seed = seed * 1103515245u + 12345u;
+            v[c].x = 32.0f + ((float)(seed >> 16 & 0xFFFF) / 65535.0f - 0.5f) * scale;
+            seed = seed * 1103515245u + 12345u;
+            v[c].y = 32.0f + ((float)(seed >> 16 & 0xFFFF) / 65535.0f - 0.5f) * scale;
+            v[c].z = 0.5f;
+            v[c].w = 1.0f;
+        }
+        milo_raster_tri_t t;
+        if (!milo_raster_setup(&t, v, 64, 64, MILO_CULL_NONE)) continue;
+        memset(hits, 0, sizeof(hits));
+        milo_raster_blocks(&t, 0, 0, 64, 64, count_block, hits);
+        for (int y = 0; y < 64; y++) {
+            for (int x = 0; x < 64; x++) {
+                const int64_t one = 1 << MILO_RASTER_SUBPIXEL_BITS;
+                int64_t px = x * one + one / 2, py = y * one + one / 2;
+                bool inside = x >= t.min_x && x <= t.max_x && y >= t.min_y && y <= t.max_y;
+                for (int i = 0; i < 3; i++) inside &= t.a[i] * px + t.b[i] * py + t.c[i] >= 0;
+                wrong += hits[y * 64 + x] != inside;
+            }
+        }
+        checked++;
+    }
+    printf("%d random triangles, %d pixels differ from per-pixel edge tests (%s)\n\n",
+           checked, wrong, wrong == 0 ? "ok" : "MISMATCH");
+    
+    milo_compiler_t compiler;
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    milo_framebuffer_t *fb = milo_fb_create(256, 256);
+    milo_mesh_t cube;
+    if (vm && fb && milo_mesh_cube(&cube)) {
+        milo_vm_init(vm);
+        milo_vertex_out_t *out = malloc(cube.vertex_count * sizeof(milo_vertex_out_t));
+        if (out && compile_and_load(&compiler, vm, texture_shader, "cube")) {
+            milo_vm_bind_texture(vm, 0, tex);
+            vm->regs[11].i = 0;
+            milo_mesh_view_t view = { 0.5f, 0.6f, 4.0f, 1.0f, 1.0f };
+            milo_mesh_transform(&cube, &view, out);
+            milo_fb_clear(fb, 0xFF000000, 1.0f);
+            printf("Rendering cube...\n");
+            uint64_t covered = milo_render_mesh(vm, fb, out, cube.indices, cube.index_count,
+                                                MILO_CULL_BACK);
+            printf("%llu pixels shaded\n", (unsigned long long)covered);
+            if (milo_fb_save_ppm(fb, "test_cube.ppm")) printf("Saved test_cube.ppm\n\n");
+            milo_glsl_free(&compiler);
+        }
+        free(out);
+        milo_mesh_free(&cube);
+    }
+    if (fb) milo_fb_free(fb);
+    free(vm);
+}
+
+/* The torus drawn tile by tile must match the immediate render (hi-Z
+ * culls more per tile, so only the images are compared) */
+static void run_tbdr_test(void) {
+    printf("Rendering torus in 16x16 tiles...\n");
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    milo_framebuffer_t *immediate = milo_fb_create(100, 76);
+    milo_framebuffer_t *tiled = milo_fb_create(100, 76);
+    milo_mesh_t torus;
+    milo_vertex_out_t *out = NULL;
+    if (vm && immediate && tiled && milo_mesh_torus(&torus, 32, 16)) {
+        milo_vm_init(vm);
+        out = malloc(torus.vertex_count * sizeof(milo_vertex_out_t));
+        if (out && milo_vm_load_asm(vm, "main:\n"
+                                        "    mov r4, r7\n"
+                                        "    mov r5, r8\n"
+                                        "    mov r6, r9\n"
+                                        "    mov r7, r10\n"
+                                        "    exit\n")) {
+            milo_mesh_view_t view = { 0.4f, 0.9f, 56.0f, 0.8f, 100.0f / 76.0f };
+            milo_mesh_transform(&torus, &view, out);
+            milo_tbdr_config_t cfg;
+            milo_tbdr_defaults(&cfg);
+            milo_tbdr_stats_t st;
+            milo_fb_clear(immediate, cfg.clear_color, cfg.clear_depth);
+            milo_fb_clear(tiled, 0xFFFFFFFF, 0.0f);
+            
+            /* Hi-Z culls depend on the order triangles reach a block, which
+             * binning changes, so the fragments tested only match without */
+            vm->hiz = false;
+            uint64_t covered = milo_render_mesh(vm, immediate, out, torus.indices,
+                                                torus.index_count, cfg.cull);
+            
+            /* 1024 triangles on a small screen overflow the RTL's 64 entries
+             * per tile; the lists need 128 to match */
+            uint64_t dropped = 0;
+            if (milo_tbdr_render_mesh(vm, tiled, &cfg, out, torus.indices, torus.index_count,
+                                      &st)) {
+                dropped = st.dropped;
+            }
+            cfg.max_tris_per_tile = 128;
+            milo_fb_clear(tiled, 0xFFFFFFFF, 0.0f);
+            if (milo_tbdr_render_mesh(vm, tiled, &cfg, out, torus.indices, torus.index_count,
+                                      &st)) {
+                bool same = memcmp(immediate->color, tiled->color,
+                                   100 * 76 * sizeof(uint32_t)) == 0;
+                printf("%u of %u tiles used, %llu entries, longest list %u (%llu dropped at "
+                       "%u); %llu pixels, %s\n\n", st.tiles_used, st.tiles_x * st.tiles_y,
+                       (unsigned long long)st.entries, st.longest_list,
+                       (unsigned long long)dropped, MILO_TBDR_MAX_TRIS_PER_TILE,
+                       (unsigned long long)st.covered,
+                       same && st.covered == covered && st.dropped == 0 ?
+                       "matches immediate" : "MISMATCH");
+            }
+        }
+        milo_mesh_free(&torus);
+    }
+    free(out);
+    if (tiled) milo_fb_free(tiled);
+    if (immediate) milo_fb_free(immediate);
+    free(vm);
+}
+
+/* A wall over the left half of the screen, drawn first, hides half of a
+ * torus drawn without culling: early-Z and hi-Z must skip the hidden
+ * fragments without changing the image */
+static void run_depth_test(void) {
+    printf("Rendering a torus behind a wall...\n");
+    static const char *color_asm = "main:\n"
+                                   "    mov r4, r7\n"
+                                   "    mov r5, r8\n"
+                                   "    mov r6, r9\n"
+                                   "    mov r7, r10\n"
+                                   "    exit\n";
+    static const uint32_t wall_indices[6] = { 0, 1, 2, 0, 2, 3 };
+    milo_vertex_out_t wall[4];
+    memset(wall, 0, sizeof(wall));
+    for (int i = 0; i < 4; i++) {
+        wall[i].x = (i == 1 || i == 2) ? 0.0f : -1.0f;
+        wall[i].y = i < 2 ? -1.0f : 1.0f;
+        wall[i].z = -0.9f;
+        wall[i].w = 1.0f;
+        wall[i].r = wall[i].a = 1.0f;
+    }
+    
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    milo_framebuffer_t *fb[2] = { milo_fb_create(128, 128), milo_fb_create(128, 128) };
+    milo_mesh_t torus;
+    milo_vertex_out_t *out = NULL;
+    if (vm && fb[0] && fb[1] && milo_mesh_torus(&torus, 32, 16)) {
+        milo_vm_init(vm);
+        out = malloc(torus.vertex_count * sizeof(milo_vertex_out_t));
+        if (out && milo_vm_load_asm(vm, color_asm)) {
+            milo_mesh_view_t view = { 0.4f, 0.9f, 56.0f, 0.8f, 1.0f };
+            milo_mesh_transform(&torus, &view, out);
+            milo_depth_stats_t st[2];
+            for (int on = 0; on < 2; on++) {
+                vm->early_z = vm->hiz = on;
+                memset(&vm->depth_stats, 0, sizeof(vm->depth_stats));
+                milo_fb_clear(fb[on], 0xFF000000, 1.0f);
+                milo_render_mesh(vm, fb[on], wall, wall_indices, 6, MILO_CULL_NONE);
+                milo_render_mesh(vm, fb[on], out, torus.indices, torus.index_count,
+                                 MILO_CULL_NONE);
+                st[on] = vm->depth_stats;
+            }
+            bool same = memcmp(fb[0]->color, fb[1]->color, 128 * 128 * sizeof(uint32_t)) == 0;
+            printf("Shaded %llu -> %llu; %llu killed early, %llu late, hi-Z culled %llu "
+                   "triangles and %llu blocks (%llu pixels), %s\n\n",
+                   (unsigned long long)st[0].shaded, (unsigned long long)st[1].shaded,
+                   (unsigned long long)st[1].early_killed, (unsigned long long)st[1].late_killed,
+                   (unsigned long long)st[1].hiz_triangles, (unsigned long long)st[1].hiz_blocks,
+                   (unsigned long long)st[1].hiz_pixels, same ? "image matches" : "MISMATCH");
+        }
+        milo_mesh_free(&torus);
+    }
+    free(out);
+    for (int i = 0; i < 2; i++) {
+        if (fb[i]) milo_fb_free(fb[i]);
+    }
+    free(vm);
+}
+
+/* rop.vhd transcribed per fragment, on RTL 0xRRGGBBAA colors and 24-bit
+ * depths: the reference the ROP's paths must match bit for bit */
+static uint32_t rtl_factor(int f, uint32_t src, uint32_t dst) {
+    switch (f) {
+        case 0: return 0x00;
+        case 1: return 0xFF;
+        case 2: return src >> 24;
+        case 3: return 0xFF - (src >> 24);
+        case 4: return dst >> 24;
+        case 5: return 0xFF - (dst >> 24);
+        case 6: return src & 0xFF;
+        case 7: return 0xFF - (src & 0xFF);
+        case 8: return dst & 0xFF;
+        case 9: return 0xFF - (dst & 0xFF);
+        default: return 0xFF;
+    }
+}
+
+static bool rtl_rop(const milo_render_state_t *st, uint32_t frag_color, uint32_t frag_z,
+                    uint32_t *color, uint32_t *depth) {
+    if (st->depth_test && !milo_rop_depth_compare(st->depth_func, frag_z, *depth)) return false;
+    uint32_t blended = frag_color;
+    if (st->blend) {
+        uint32_t dst = *color;
+        blended = 0;
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            bool alpha = shift == 0;
+            uint32_t sf = rtl_factor(alpha ? st->src_a : st->src_rgb, frag_color, dst);
+            uint32_t df = rtl_factor(alpha ? st->dst_a : st->dst_rgb, frag_color, dst);
+            uint32_t sum = (frag_color >> shift & 0xFF) * sf + (dst >> shift & 0xFF) * df;
+            sum &= 0xFFFF;
+            blended |= (sum > 0xFF00 ? 0xFF : sum >> 8) << shift;
+        }
+    }
+    if (st->depth_write) *depth = frag_z;
+    uint32_t out = 0;
+    for (int c = 0; c < 4; c++) {
+        if (st->color_mask & (1 << c)) out |= blended & (0xFFu << (c * 8));
+    }
+    *color = out;
+    return true;
+}
+
+static uint32_t next_random(uint32_t *seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+/* Random states within what rop.vhd decodes, the presets among them, on
+ * random spans; then an alpha blended wall over the torus */
+static void run_rop_test(void) {
+    printf("Checking the ROP against rop.vhd...\n");
+    uint32_t seed = 4242;
+#define NEXT()  next_random(&seed)
+    int spans = 0, differ = 0, paths[4] = { 0 };
+    for (int n = 0; n < 400; n++) {
+        milo_render_state_t st;
+        milo_render_state_preset(&st, (milo_state_preset_t)(n % 4));
+        if (n >= 4) {
+            st.depth_test = NEXT() & 1;
+            st.depth_write = NEXT() & 1;
+            st.depth_func = (milo_depth_func_t)(NEXT() % 8);
+            st.color_mask = NEXT() % 3 ? 0xF : NEXT() & 0xF;
+            if (n % 4 == 3) {
+                st.blend = true;
+                st.src_rgb = (milo_blend_factor_t)(NEXT() % 10);
+                st.dst_rgb = (milo_blend_factor_t)(NEXT() % 10);
+                st.src_a = (milo_blend_factor_t)(NEXT() % 10);
+                st.dst_a = (milo_blend_factor_t)(NEXT() % 10);
+            }
+        }
+        milo_rop_t rop;
+        milo_rop_init(&rop, &st);
+        paths[rop.path]++;
+        
+        for (int k = 0; k < 32; k++, spans++) {
+            uint32_t color[MILO_ROP_SPAN], src[MILO_ROP_SPAN], rtl_color[MILO_ROP_SPAN];
+            uint32_t rtl_depth[MILO_ROP_SPAN];
+            float depth[MILO_ROP_SPAN], z[MILO_ROP_SPAN];
+            uint32_t live = NEXT() & 0xFF;
+            for (int i = 0; i < MILO_ROP_SPAN; i++) {
+                /* Alpha often 0 or 255; depths often equal */
+                uint32_t alpha = NEXT() % 4 ? NEXT() & 0xFF : (NEXT() & 1) * 0xFF;
+                src[i] = NEXT() << 8 | alpha;
+                color[i] = NEXT();
+                rtl_depth[i] = NEXT() & MILO_DEPTH_MAX;
+                uint32_t z24 = NEXT() % 4 ? NEXT() & MILO_DEPTH_MAX : rtl_depth[i];
+                depth[i] = milo_rop_depth_float(rtl_depth[i]);
+                z[i] = milo_rop_depth_float(z24);
+                rtl_color[i] = __builtin_bswap32(color[i]);
+            }
+            uint32_t written = milo_rop_span(&rop, color, depth, live, src, z);
+            for (int i = 0; i < MILO_ROP_SPAN; i++) {
+                bool rtl_written = (live >> i & 1) &&
+                                   rtl_rop(&st, __builtin_bswap32(src[i]), milo_rop_depth24(z[i]),
+                                           &rtl_color[i], &rtl_depth[i]);
+                if (rtl_written != (bool)(written >> i & 1) ||
+                    __builtin_bswap32(color[i]) != rtl_color[i] ||
+                    milo_rop_depth24(depth[i]) != rtl_depth[i]) {
+                    differ++;
+                }
+            }
+        }
+    }
+#undef NEXT
+    printf("%d spans over 400 states (%d opaque, %d alpha, %d additive, %d generic), "
+           "%d pixels differ (%s)\n", spans, paths[MILO_ROP_OPAQUE], paths[MILO_ROP_ALPHA],
+           paths[MILO_ROP_ADDITIVE], paths[MILO_ROP_GENERIC], differ, differ ? "FAIL" : "ok");
+    
+    static const char *color_asm = "main:\n"
+                                   "    mov r4, r7\n"
+                                   "    mov r5, r8\n"
+                                   "    mov r6, r9\n"
+                                   "    mov r7, r10\n"
+                                   "    exit\n";
+    static const uint32_t wall_indices[6] = { 0, 1, 2, 0, 2, 3 };
+    milo_vertex_out_t wall[4];
+    memset(wall, 0, sizeof(wall));
+    for (int i = 0; i < 4; i++) {
+        wall[i].x = (i == 1 || i == 2) ? 0.5f : -0.5f;
+        wall[i].y = i < 2 ? -0.8f : 0.8f;
+        wall[i].z = -0.9f;
+        wall[i].w = 1.0f;
+        wall[i].r = 1.0f;
+        wall[i].a = 0.5f;
+    }
+    
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    milo_framebuffer_t *fb = milo_fb_create(128, 128);
+    milo_mesh_t torus;
+    milo_vertex_out_t *out = NULL;
+    if (vm && fb && milo_mesh_torus(&torus, 32, 16)) {
+        milo_vm_init(vm);
+        out = malloc(torus.vertex_count * sizeof(milo_vertex_out_t));
+        if (out && milo_vm_load_asm(vm, color_asm)) {
+            milo_mesh_view_t view = { 0.4f, 0.9f, 56.0f, 0.8f, 1.0f };
+            milo_mesh_transform(&torus, &view, out);
+            milo_fb_clear(fb, 0xFF000000, 1.0f);
+            milo_render_mesh(vm, fb, out, torus.indices, torus.index_count, MILO_CULL_BACK);
+            
+            milo_render_state_t st;
+            milo_render_state_preset(&st, MILO_STATE_ALPHA_BLEND);
+            milo_vm_set_render_state(vm, &st);
+            memset(&vm->depth_stats, 0, sizeof(vm->depth_stats));
+            milo_render_mesh(vm, fb, wall, wall_indices, 6, MILO_CULL_NONE);
+            printf("Alpha blended wall: %llu pixels written, %llu killed\n\n",
+                   (unsigned long long)vm->depth_stats.written,
+                   (unsigned long long)vm->depth_stats.late_killed);
+            milo_fb_save_ppm(fb, "test_rop.ppm");
+        }
+        milo_mesh_free(&torus);
+    }
+    free(out);
+    if (fb) milo_fb_free(fb);
+    free(vm);
+}
+
+/* The clip positions of milo_mesh_mvp_asm, rounded as it rounds them */
+static void mvp_reference(const milo_mesh_t *mesh, const float m[16], milo_vertex_out_t *out) {
+    for (uint32_t i = 0; i < mesh->vertex_count; i++) {
+        const milo_vertex_in_t *v = &mesh->vertices[i];
+        float clip[4];
+        for (int row = 0; row < 4; row++) {
+            float t = m[12 + row];
+            t = m[8 + row] * v->z + t;
+            t = m[4 + row] * v->y + t;
+            clip[row] = m[row] * v->x + t;
+        }
+        milo_vertex_out_t o = {
+            clip[0], clip[1], clip[2], clip[3], v->u, v->v, 1.0f, 1.0f, 1.0f, 1.0f,
+            v->nx, v->ny, v->nz
+        };
+        out[i] = o;
+    }
+}
+
+/* A textured torus frame as a command buffer, state set up in a called
+ * buffer: executed immediately and in a tile pass, it must match a direct
+ * render of the same vertices */
+static void run_cmd_test(milo_texture_t *tex) {
+    printf("Replaying a torus frame from a command buffer...\n");
+    static const char *tex_asm = "main:\n"
+                                 "    tex r4, r0, r2\n"
+                                 "    exit\n";
+    enum { W = 100, H = 76 };
+    const uint32_t vs_addr = MILO_GPU_SHADER_BASE, fs_addr = MILO_GPU_SHADER_BASE + 0x1000;
+    const uint32_t setup = MILO_GPU_CMD_BASE + 0x400;
+    milo_gpu_t gpu;
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    milo_framebuffer_t *fb = milo_fb_create(W, H);
+    milo_mesh_t torus;
+    milo_vertex_out_t *out = NULL;
+    if (!milo_gpu_init(&gpu, MILO_GPU_MEM_SIZE)) {
+        free(vm);
+        if (fb) milo_fb_free(fb);
+        return;
+    }
+    if (vm && fb && milo_mesh_torus(&torus, 32, 16)) {
+        milo_vm_init(vm);
+        out = malloc(torus.vertex_count * sizeof(milo_vertex_out_t));
+        milo_mesh_view_t view = { 0.4f, 0.9f, 56.0f, 0.8f, (float)W / H };
+        float mvp[16];
+        milo_mesh_view_matrix(&view, mvp);
+        bool uploaded = out && milo_vm_load_asm(vm, milo_mesh_mvp_asm()) &&
+                        milo_gpu_upload(&gpu, vs_addr, vm->code, vm->code_size * 8);
+        uint32_t vs_bytes = vm->code_size * 8;
+        uploaded = uploaded && milo_vm_load_asm(vm, tex_asm) &&
+                   milo_gpu_upload(&gpu, fs_addr, vm->code, vm->code_size * 8) &&
+                   milo_gpu_upload(&gpu, MILO_GPU_UNIFORM_BASE, mvp, sizeof(mvp)) &&
+                   milo_gpu_upload(&gpu, MILO_GPU_TEXTURE_BASE, tex->pixels,
+                                   (uint32_t)(tex->width * tex->height * 4)) &&
+                   milo_gpu_upload_vertices(&gpu, MILO_GPU_VERTEX_BASE, torus.vertices,
+                                            torus.vertex_count) &&
+                   milo_gpu_upload_indices(&gpu, MILO_GPU_INDEX_BASE, torus.indices,
+                                           torus.index_count, MILO_INDEX_U16);
+        const uint32_t state[] = {
+            MILO_CMD_HEADER(MILO_CMD_BIND_VERTEX_SHADER, 2), vs_addr, vs_bytes,
+            MILO_CMD_HEADER(MILO_CMD_BIND_FRAGMENT_SHADER, 2), fs_addr, vm->code_size * 8,
+            MILO_CMD_HEADER(MILO_CMD_SET_TEXTURE, 4), 0, MILO_GPU_TEXTURE_BASE,
+            (uint32_t)tex->width | (uint32_t)tex->height << 16, MILO_TEX_RGBA8,
+            MILO_CMD_HEADER(MILO_CMD_SET_UNIFORM_BUFFER, 2), MILO_GPU_UNIFORM_BASE, sizeof(mvp),
+            MILO_CMD_HEADER(MILO_CMD_SET_VERTEX_BUFFER, 2), MILO_GPU_VERTEX_BASE,
+            MILO_CMD_VERTEX_BYTES,
+            MILO_CMD_HEADER(MILO_CMD_SET_INDEX_BUFFER, 2), MILO_GPU_INDEX_BASE, MILO_INDEX_U16,
+            MILO_CMD_HEADER(MILO_CMD_END, 0)
+        };
+        uint32_t frame[] = {
+            MILO_CMD_HEADER(MILO_CMD_SET_RENDER_TARGET, 2), MILO_GPU_FRAMEBUFFER_BASE,
+            W | H << 16,
+            MILO_CMD_HEADER(MILO_CMD_SET_VIEWPORT, 4), 0, 0, W, H,
+            MILO_CMD_HEADER(MILO_CMD_CLEAR, 3), MILO_CLEAR_COLOR | MILO_CLEAR_DEPTH,
+            0x000000FF, MILO_DEPTH_MAX,
+            MILO_CMD_HEADER(MILO_CMD_BEGIN_TILE_PASS, 0),
+            MILO_CMD_HEADER(MILO_CMD_CALL, 1), setup,
+            MILO_CMD_HEADER(MILO_CMD_DRAW_INDEXED, 2), torus.index_count, 0,
+            MILO_CMD_HEADER(MILO_CMD_END_TILE_PASS, 0),
+            MILO_CMD_HEADER(MILO_CMD_IRQ, 1), 0,
+            MILO_CMD_HEADER(MILO_CMD_END, 0)
+        };
+        const uint32_t begin = 12, end = 18;
+        
+        if (uploaded && milo_gpu_upload(&gpu, setup, state, sizeof(state))) {
+            mvp_reference(&torus, mvp, out);
+            milo_vm_bind_texture(vm, 0, tex);
+            milo_fb_clear(fb, 0xFF000000, 1.0f);
+            milo_render_mesh(vm, fb, out, torus.indices, torus.index_count, MILO_CULL_BACK);
+            
+            /* Immediate (the pass commands turned into NOPs), then tiled */
+            bool same[2] = { false, false };
+            gpu.tbdr.max_tris_per_tile = 128;
+            for (int tiled = 0; tiled < 2; tiled++) {
+                uint32_t op = tiled ? MILO_CMD_BEGIN_TILE_PASS : MILO_CMD_NOP;
+                frame[begin] = MILO_CMD_HEADER(op, 0);
+                frame[end] = MILO_CMD_HEADER(tiled ? MILO_CMD_END_TILE_PASS : MILO_CMD_NOP, 0);
+                memset(&gpu.stats, 0, sizeof(gpu.stats));
+                if (milo_gpu_upload(&gpu, MILO_GPU_CMD_BASE, frame, sizeof(frame)) &&
+                    milo_gpu_execute(&gpu, MILO_GPU_CMD_BASE)) {
+                    same[tiled] = memcmp(gpu.mem + MILO_GPU_FRAMEBUFFER_BASE, fb->color,
+                                         W * H * sizeof(uint32_t)) == 0;
+                } else {
+                    printf("Fault at 0x%08X: %s\n", gpu.fault_addr, gpu.error);
+                }
+            }
+            const milo_gpu_stats_t *st = &gpu.stats;
+            printf("%llu commands, %llu vertices in %llu VS warps, %llu triangles, %llu tiles, "
+                   "%llu FS warps, IRQ status 0x%X; immediate %s, tiled %s\n",
+                   (unsigned long long)st->commands, (unsigned long long)st->vertices,
+                   (unsigned long long)st->vs_warps, (unsigned long long)st->triangles,
+                   (unsigned long long)st->tiles, (unsigned long long)st->fs_warps,
+                   gpu.irq_status, same[0] ? "matches" : "MISMATCH",
+                   same[1] ? "matches" : "MISMATCH");
+            
+            const uint32_t bad[] = {
+                MILO_CMD_HEADER(MILO_CMD_FENCE, 0), MILO_CMD_HEADER(0x7E, 0)
+            };
+            if (milo_gpu_upload(&gpu, MILO_GPU_CMD_BASE, bad, sizeof(bad)) &&
+                !milo_gpu_execute(&gpu, MILO_GPU_CMD_BASE)) {
+                printf("Fault at 0x%08X: %s\n", gpu.fault_addr, gpu.error);
+            }
+            
+            /* A layout fetching nothing at stride 0 must fault, not wrap the
+             * vertex range of indices 0..0xFFFFFFFF */
+            const uint32_t ib = MILO_GPU_CMD_BASE + 0x200;
+            const uint32_t indices[] = { 0, 0xFFFFFFFF, 1 };
+            const uint32_t malformed[] = {
+                MILO_CMD_HEADER(MILO_CMD_SET_VERTEX_LAYOUT, 4), 0, 0, 0, 0,
+                MILO_CMD_HEADER(MILO_CMD_SET_VERTEX_BUFFER, 2), MILO_GPU_VERTEX_BASE, 0,
+                MILO_CMD_HEADER(MILO_CMD_SET_INDEX_BUFFER, 2), ib, MILO_INDEX_U32,
+                MILO_CMD_HEADER(MILO_CMD_DRAW_INDEXED, 2), 3, 0,
+                MILO_CMD_HEADER(MILO_CMD_END, 0)
+            };
+            if (milo_gpu_upload(&gpu, ib, indices, sizeof(indices)) &&
+                milo_gpu_upload(&gpu, MILO_GPU_CMD_BASE, malformed, sizeof(malformed)) &&
+                !milo_gpu_execute(&gpu, MILO_GPU_CMD_BASE)) {
+                printf("Fault at 0x%08X: %s\n\n", gpu.fault_addr, gpu.error);
+            } else {
+                printf("Malformed vertex buffer did not fault\n\n");
+            }
+        }
+        milo_mesh_free(&torus);
+    }
+    free(out);
+    if (fb) milo_fb_free(fb);
+    free(vm);
+    milo_gpu_free(&gpu);
+}
+
+/* The torus as eight draws alternating two textures, every draw setting
+ * all of its state as a naive driver would: built through a small ring,
+ * in submission order and sorted, both frames must render alike. The
+ * frames are captured, and replays must reproduce them. */
+static void run_cmdbuf_test(milo_texture_t *tex) {
+    printf("Building torus frames with the command buffer builder...\n");
+    static const char *tex_asm = "main:\n"
+                                 "    tex r4, r0, r2\n"
+                                 "    exit\n";
+    enum { W = 100, H = 76, DRAWS = 8, FRAMES = 6, RING = 256 };
+    const uint32_t vs_addr = MILO_GPU_SHADER_BASE, fs_addr = MILO_GPU_SHADER_BASE + 0x1000;
+    const uint32_t tex_addr[2] = { MILO_GPU_TEXTURE_BASE, MILO_GPU_TEXTURE_BASE + 0x4000 };
+    milo_gpu_t gpu;
+    milo_cmdbuf_t cb;
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    milo_texture_t *dots = milo_texture_create_checker(64, 64, 0xFF2060E0, 0xFFE0E0E0, 4);
+    uint32_t *image = malloc(W * H * sizeof(uint32_t));
+    milo_mesh_t torus;
+    bool ready = milo_gpu_init(&gpu, MILO_GPU_MEM_SIZE);
+    if (ready && !milo_cmdbuf_init(&cb, (uint32_t *)(gpu.mem + MILO_GPU_CMD_BASE),
+                                   MILO_GPU_CMD_BASE, RING, DRAWS)) {
+        milo_gpu_free(&gpu);
+        ready = false;
+    }
+    if (ready && vm && dots && image && milo_mesh_torus(&torus, 32, 16)) {
+        milo_vm_init(vm);
+        milo_mesh_view_t view = { 0.4f, 0.9f, 56.0f, 0.8f, (float)W / H };
+        float mvp[16];
+        milo_mesh_view_matrix(&view, mvp);
+        bool uploaded = milo_vm_load_asm(vm, milo_mesh_mvp_asm()) &&
+                        milo_gpu_upload(&gpu, vs_addr, vm->code, vm->code_size * 8);
+        uint32_t vs_bytes = vm->code_size * 8;
+        uploaded = uploaded && milo_vm_load_asm(vm, tex_asm) &&
+                   milo_gpu_upload(&gpu, fs_addr, vm->code, vm->code_size * 8) &&
+                   milo_gpu_upload(&gpu, MILO_GPU_UNIFORM_BASE, mvp, sizeof(mvp)) &&
+                   milo_gpu_upload(&gpu, tex_addr[0], tex->pixels, 64 * 64 * 4) &&
+                   milo_gpu_upload(&gpu, tex_addr[1], dots->pixels, 64 * 64 * 4) &&
+                   milo_gpu_upload_vertices(&gpu, MILO_GPU_VERTEX_BASE, torus.vertices,
+                                            torus.vertex_count) &&
+                   milo_gpu_upload_indices(&gpu, MILO_GPU_INDEX_BASE, torus.indices,
+                                           torus.index_count, MILO_INDEX_U16);
+        uint32_t fs_bytes = vm->code_size * 8;
+        uint32_t chunk = torus.index_count / 3 / DRAWS * 3;
+        
+        /* Frames alternate submission order and sorting; no bin overflows,
+         * which would drop different triangles */
+        milo_capture_t cap = { 0 };
+        gpu.tbdr.max_tris_per_tile = 128;
+        bool ok = uploaded && milo_capture_open(&cap, "test_capture.mcap", &gpu), same = true;
+        uint64_t loads[2] = { 0, 0 }, calls[2] = { 0, 0 }, written[2] = { 0, 0 };
+        for (int f = 0; f < FRAMES && ok; f++) {
+            bool sorted = f % 2;
+            milo_cmdbuf_stats_t before = cb.stats;
+            uint64_t texture_loads = gpu.stats.texture_loads;
+            uint32_t addr = milo_cmdbuf_begin(&cb);
+            milo_cmdbuf_set_render_target(&cb, MILO_GPU_FRAMEBUFFER_BASE, W, H);
+            milo_cmdbuf_set_viewport(&cb, 0, 0, W, H);
+            milo_cmdbuf_clear(&cb, MILO_CLEAR_COLOR | MILO_CLEAR_DEPTH, 0x000000FF,
+                              MILO_DEPTH_MAX);
+            milo_cmdbuf_begin_tile_pass(&cb);
+            milo_cmdbuf_set_sort(&cb, sorted);
+            for (uint32_t d = 0; d < DRAWS; d++) {
+                uint32_t count = d == DRAWS - 1 ? torus.index_count - d * chunk : chunk;
+                milo_cmdbuf_bind_vertex_shader(&cb, vs_addr, vs_bytes);
+                milo_cmdbuf_bind_fragment_shader(&cb, fs_addr, fs_bytes);
+                milo_cmdbuf_set_texture(&cb, 0, tex_addr[d % 2], 64, 64, MILO_TEX_RGBA8);
+                milo_cmdbuf_set_uniform_buffer(&cb, MILO_GPU_UNIFORM_BASE, sizeof(mvp));
+                milo_cmdbuf_set_vertex_buffer(&cb, MILO_GPU_VERTEX_BASE, MILO_CMD_VERTEX_BYTES);
+                milo_cmdbuf_set_index_buffer(&cb, MILO_GPU_INDEX_BASE, MILO_INDEX_U16);
+                milo_cmdbuf_draw_indexed(&cb, count, d * chunk);
+            }
+            milo_cmdbuf_set_sort(&cb, false);
+            milo_cmdbuf_end_tile_pass(&cb);
+            milo_cmdbuf_irq(&cb, 0);
+            ok = milo_cmdbuf_end(&cb);
+            if (ok && !milo_capture_execute(&cap, addr)) {
+                printf("Fault at 0x%08X: %s\n", gpu.fault_addr, gpu.error);
+                ok = false;
+            }
+            ok = ok && milo_capture_frame(&cap);
+            milo_cmdbuf_retire(&cb, gpu.read_ptr);
+            
+            const uint32_t *color = (const uint32_t *)(gpu.mem + MILO_GPU_FRAMEBUFFER_BASE);
+            if (f == 0) memcpy(image, color, W * H * sizeof(uint32_t));
+            same = same && memcmp(image, color, W * H * sizeof(uint32_t)) == 0;
+            loads[sorted] += gpu.stats.texture_loads - texture_loads;
+            calls[sorted] += cb.stats.state_calls - before.state_calls;
+            written[sorted] += cb.stats.state_commands - before.state_commands;
+        }
+        
+        /* A frame binding nothing after the host rewrites the texture still
+         * bound: the capture must hold the texels the draw read */
+        const uint32_t redraw_addr = MILO_GPU_CMD_BASE + RING * 4;
+        const uint32_t redraw[] = {
+            MILO_CMD_HEADER(MILO_CMD_CLEAR, 3), MILO_CLEAR_COLOR | MILO_CLEAR_DEPTH,
+            0x000000FF, MILO_DEPTH_MAX,
+            MILO_CMD_HEADER(MILO_CMD_DRAW_INDEXED, 2), torus.index_count, 0,
+            MILO_CMD_HEADER(MILO_CMD_END, 0)
+        };
+        if (ok && milo_gpu_upload(&gpu, tex_addr[(DRAWS - 1) % 2], tex->pixels, 64 * 64 * 4) &&
+            milo_gpu_upload(&gpu, redraw_addr, redraw, sizeof(redraw))) {
+            if (!milo_capture_execute(&cap, redraw_addr)) {
+                printf("Fault at 0x%08X: %s\n", gpu.fault_addr, gpu.error);
+                ok = false;
+            }
+            ok = ok && milo_capture_frame(&cap);
+        }
+        if (ok) {
+            printf("%d frames through a %d-byte ring, %llu wraps; state commands written "
+                   "%llu of %llu, sorted %llu of %llu\n", FRAMES, RING * 4,
+                   (unsigned long long)cb.stats.wraps, (unsigned long long)written[0],
+                   (unsigned long long)calls[0], (unsigned long long)written[1],
+                   (unsigned long long)calls[1]);
+            printf("Texture loads in order %llu, sorted %llu; images %s\n",
+                   (unsigned long long)loads[0], (unsigned long long)loads[1],
+                   same ? "match" : "MISMATCH");
+        } else if (!gpu.fault) {
+            printf("Command buffer overflowed the ring\n");
+        }
+        if (cap.file && milo_capture_close(&cap) && ok) {
+            milo_replay_t rp;
+            milo_replay_stats_t st = { 0 };
+            if (milo_replay_map(&rp, "test_capture.mcap")) {
+                bool replayed = milo_replay_run(&rp, &gpu, 0, &st) &&
+                                milo_replay_threads(&rp, 2, 3, 2, &st) >= 0.0;
+                printf("Capture of %zu bytes (%llu of memory) replayed %llu frames%s, "
+                       "%llu checksum mismatches\n", rp.map_size,
+                       (unsigned long long)cap.memory_bytes, (unsigned long long)st.frames,
+                       replayed ? "" : " then FAULTED", (unsigned long long)st.mismatches);
+                milo_replay_release(&rp);
+            } else {
+                printf("Capture unreadable: %s\n", rp.error);
+            }
+        }
+        
+        /* A buffer that cannot fit is dropped whole */
+        milo_cmdbuf_begin(&cb);
+        for (int i = 0; i < RING; i++) milo_cmdbuf_fence(&cb);
+        printf("Oversized buffer %s\n\n", milo_cmdbuf_end(&cb) ? "KEPT" : "dropped");
+        milo_mesh_free(&torus);
+    }
+    if (ready) {
+        milo_cmdbuf_free(&cb);
+        milo_gpu_free(&gpu);
+    }
+    free(image);
+    if (dots) milo_texture_free(dots);
+    free(vm);
+}
+
+/* Vertices in a layout of their own: normal, color, texture coordinates,
+ * then position */
+#define FETCH_STRIDE 36
+
+static bool upload_fetch_vertices(milo_gpu_t *gpu, uint32_t addr, const milo_mesh_t *mesh) {
+    for (uint32_t i = 0; i < mesh->vertex_count; i++) {
+        const milo_vertex_in_t *v = &mesh->vertices[i];
+        uint8_t packed[FETCH_STRIDE];
+        const float normal[3] = { v->nx, v->ny, v->nz }, uv[2] = { v->u, v->v };
+        const float position[3] = { v->x, v->y, v->z };
+        uint32_t color = (uint32_t)(v->r * 255.0f + 0.5f) << 24 |
+                         (uint32_t)(v->g * 255.0f + 0.5f) << 16 |
+                         (uint32_t)(v->b * 255.0f + 0.5f) << 8 | (uint32_t)(v->a * 255.0f + 0.5f);
+        memcpy(packed, normal, 12);
+        memcpy(packed + 12, &color, 4);
+        memcpy(packed + 16, uv, 8);
+        memcpy(packed + 24, position, 12);
+        if (!milo_gpu_upload(gpu, addr + i * FETCH_STRIDE, packed, FETCH_STRIDE)) return false;
+    }
+    return true;
+}
+
+/* Primitive assembly against hand-written triangle lists, packed formats
+ * against their source, and the torus drawn as fans (U32 indices) and as
+ * strips (U8 indices and a base vertex) in another layout against the
+ * same triangles drawn as a list */
+static void run_fetch_test(milo_texture_t *tex) {
+    printf("Fetching vertices in other layouts and primitive types...\n");
+    static const char *tex_asm = "main:\n"
+                                 "    tex r4, r0, r2\n"
+                                 "    exit\n";
+    enum { W = 100, H = 76, RING = 4096, RINGS = 32, TUBE = 16, COLUMNS = TUBE + 1 };
+    const uint32_t vs_addr = MILO_GPU_SHADER_BASE, fs_addr = MILO_GPU_SHADER_BASE + 0x1000;
+    const uint32_t packed_addr = MILO_GPU_VERTEX_BASE + 0x8000;
+    const uint32_t fan_addr = MILO_GPU_INDEX_BASE + 0x4000;
+    const uint32_t strip_addr = MILO_GPU_INDEX_BASE + 0x8000;
+    const uint32_t strip_list_addr = MILO_GPU_INDEX_BASE + 0xA000;
+    const uint32_t restart = 0xFFFFFFFF;
+    
+    /* Assembly */
+    static const uint32_t seq[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    static const uint32_t strip[12] = { 0, 1, 2, 2, 1, 3, 2, 3, 4, 4, 3, 5 };
+    static const uint32_t fan[9] = { 0, 1, 2, 0, 2, 3, 0, 3, 4 };
+    const uint32_t restarted[8] = { 0, 1, 2, restart, 3, 4, 5, 6 };
+    static const uint32_t restarted_strip[9] = { 0, 1, 2, 3, 4, 5, 5, 4, 6 };
+    const uint32_t broken_list[6] = { 0, 1, restart, 2, 3, 4 };
+    uint32_t tris[24];
+    bool assembled =
+        milo_assemble(MILO_PRIM_TRIANGLE_STRIP, seq, 6, false, 0, tris) == 12 &&
+        memcmp(tris, strip, sizeof(strip)) == 0 &&
+        milo_assemble(MILO_PRIM_TRIANGLE_FAN, seq, 5, false, 0, tris) == 9 &&
+        memcmp(tris, fan, sizeof(fan)) == 0 &&
+        milo_assemble(MILO_PRIM_TRIANGLE_STRIP, restarted, 8, true, restart, tris) == 9 &&
+        memcmp(tris, restarted_strip, sizeof(restarted_strip)) == 0 &&
+        milo_assemble(MILO_PRIM_TRIANGLES, broken_list, 6, true, restart, tris) == 3 &&
+        memcmp(tris, seq + 2, 3 * sizeof(uint32_t)) == 0 &&
+        milo_assemble(MILO_PRIM_TRIANGLES, seq, 8, false, 0, tris) == 6 &&
+        milo_assemble(MILO_PRIM_POINTS, seq, 8, false, 0, tris) == 0 &&
+        milo_assemble(MILO_PRIM_LINES, seq, 8, false, 0, tris) == 0;
+    
+    /* Formats: a vertex of each, then one with only x, the rest defaults */
+    const float position[4] = { 1.0f, -2.0f, 3.5f, 9.0f };
+    const uint16_t uv[2] = { 0, 65535 };
+    const int16_t normal[4] = { -32768, 32767, 0, 5 };
+    const uint32_t color = 0xFF800040;
+    uint8_t vertex[32];
+    memcpy(vertex, position, 16);
+    memcpy(vertex + 16, uv, 4);
+    memcpy(vertex + 20, normal, 8);
+    memcpy(vertex + 28, &color, 4);
+    milo_vertex_layout_t layout = { 32, {
+        { 0, MILO_FMT_FLOAT4 }, { 16, MILO_FMT_UNORM16X2 }, { 28, MILO_FMT_UNORM8X4 },
+        { 20, MILO_FMT_SNORM16X4 }
+    } };
+    const float expect[2][MILO_VERTEX_INPUTS] = {
+        { 1, -2, 3.5f, 0, 1, 1, 128 / 255.0f, 0, 64 / 255.0f, -1, 1, 0 },
+        { 1, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0 }
+    };
+    milo_vertex_warp_t warp;
+    bool decoded = milo_fetch_layout_valid(&layout);
+    for (int pass = 0; pass < 2 && decoded; pass++) {
+        milo_fetch_warp(&layout, vertex, NULL, 0, 1, &warp);
+        for (int i = 0; i < MILO_VERTEX_INPUTS; i++) {
+            decoded = decoded && fabsf(warp.in[i][0] - expect[pass][i]) < 1e-6f;
+        }
+        memset(layout.attrs, 0, sizeof(layout.attrs));
+        layout.attrs[MILO_ATTR_POSITION].format = MILO_FMT_FLOAT1;
+    }
+    printf("Strip, fan, restart and list assembly %s; packed formats %s\n",
+           assembled ? "match" : "MISMATCH", decoded ? "match" : "MISMATCH");
+    
+    milo_gpu_t gpu;
+    milo_cmdbuf_t cb;
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    uint32_t *images = malloc(2 * W * H * sizeof(uint32_t));
+    uint32_t *indices = malloc(RINGS * TUBE * 6 * sizeof(uint32_t));
+    milo_mesh_t torus;
+    bool ready = milo_gpu_init(&gpu, MILO_GPU_MEM_SIZE);
+    if (ready && !milo_cmdbuf_init(&cb, (uint32_t *)(gpu.mem + MILO_GPU_CMD_BASE),
+                                   MILO_GPU_CMD_BASE, RING, 0)) {
+        milo_gpu_free(&gpu);
+        ready = false;
+    }
+    if (ready && vm && images && indices && milo_mesh_torus(&torus, RINGS, TUBE)) {
+        milo_vm_init(vm);
+        milo_mesh_view_t view = { 0.4f, 0.9f, 56.0f, 0.8f, (float)W / H };
+        float mvp[16];
+        milo_mesh_view_matrix(&view, mvp);
+        bool uploaded = milo_vm_load_asm(vm, milo_mesh_mvp_asm()) &&
+                        milo_gpu_upload(&gpu, vs_addr, vm->code, vm->code_size * 8);
+        uint32_t vs_bytes = vm->code_size * 8;
+        uploaded = uploaded && milo_vm_load_asm(vm, tex_asm) &&
+                   milo_gpu_upload(&gpu, fs_addr, vm->code, vm->code_size * 8) &&
+                   milo_gpu_upload(&gpu, MILO_GPU_UNIFORM_BASE, mvp, sizeof(mvp)) &&
+                   milo_gpu_upload(&gpu, MILO_GPU_TEXTURE_BASE, tex->pixels, 64 * 64 * 4) &&
+                   milo_gpu_upload_vertices(&gpu, MILO_GPU_VERTEX_BASE, torus.vertices,
+                                            torus.vertex_count) &&
+                   upload_fetch_vertices(&gpu, packed_addr, &torus) &&
+                   milo_gpu_upload_indices(&gpu, MILO_GPU_INDEX_BASE, torus.indices,
+                                           torus.index_count, MILO_INDEX_U16);
+        uint32_t fs_bytes = vm->code_size * 8;
+        
+        /* Each quad (a, b, b + 1, a + 1) of the list is a fan; each ring is
+         * a strip a0 b0 a1 b1 ..., whose triangles as a list go with it */
+        uint32_t quads = torus.index_count / 6, n = 0;
+        for (uint32_t q = 0; q < quads; q++) {
+            const uint32_t *t = &torus.indices[q * 6];
+            indices[n++] = t[0];
+            indices[n++] = t[1];
+            indices[n++] = t[2];
+            indices[n++] = t[5];
+        }
+        uploaded = uploaded && milo_gpu_upload_indices(&gpu, fan_addr, indices, n,
+                                                       MILO_INDEX_U32);
+        n = 0;
+        for (uint32_t j = 0; j <= TUBE; j++) {
+            indices[n++] = j;
+            indices[n++] = COLUMNS + j;
+        }
+        uploaded = uploaded && milo_gpu_upload_indices(&gpu, strip_addr, indices, n,
+                                                       MILO_INDEX_U8);
+        n = 0;
+        for (uint32_t i = 0; i < RINGS; i++) {
+            for (uint32_t j = 0; j < TUBE; j++) {
+                uint32_t a = i * COLUMNS + j, b = a + COLUMNS;
+                const uint32_t quad[6] = { a, b, a + 1, a + 1, b, b + 1 };
+                memcpy(&indices[n], quad, sizeof(quad));
+                n += 6;
+            }
+        }
+        uploaded = uploaded && milo_gpu_upload_indices(&gpu, strip_list_addr, indices, n,
+                                                       MILO_INDEX_U16);
+        
+        const uint32_t float_layout[MILO_ATTR_COUNT] = {
+            MILO_VERTEX_ATTR(0, MILO_FMT_FLOAT3), MILO_VERTEX_ATTR(12, MILO_FMT_FLOAT2),
+            MILO_VERTEX_ATTR(0, MILO_FMT_NONE), MILO_VERTEX_ATTR(20, MILO_FMT_FLOAT3)
+        };
+        const uint32_t packed_layout[MILO_ATTR_COUNT] = {
+            MILO_VERTEX_ATTR(24, MILO_FMT_FLOAT3), MILO_VERTEX_ATTR(16, MILO_FMT_FLOAT2),
+            MILO_VERTEX_ATTR(12, MILO_FMT_UNORM8X4), MILO_VERTEX_ATTR(0, MILO_FMT_FLOAT3)
+        };
+        
+        /* Frames: the list, its fans, the strip list, its strips, points */
+        bool ok = uploaded, same[2] = { false, false }, blank = true;
+        uint64_t points = 0;
+        for (int f = 0; f < 5 && ok; f++) {
+            bool packed = f % 2 == 1 || f == 4;
+            const uint32_t *l = packed ? packed_layout : float_layout;
+            uint32_t addr = milo_cmdbuf_begin(&cb);
+            milo_cmdbuf_set_render_target(&cb, MILO_GPU_FRAMEBUFFER_BASE, W, H);
+            milo_cmdbuf_set_viewport(&cb, 0, 0, W, H);
+            milo_cmdbuf_clear(&cb, MILO_CLEAR_COLOR | MILO_CLEAR_DEPTH, 0x000000FF,
+                              MILO_DEPTH_MAX);
+            milo_cmdbuf_bind_vertex_shader(&cb, vs_addr, vs_bytes);
+            milo_cmdbuf_bind_fragment_shader(&cb, fs_addr, fs_bytes);
+            milo_cmdbuf_set_texture(&cb, 0, MILO_GPU_TEXTURE_BASE, 64, 64, MILO_TEX_RGBA8);
+            milo_cmdbuf_set_uniform_buffer(&cb, MILO_GPU_UNIFORM_BASE, sizeof(mvp));
+            milo_cmdbuf_set_vertex_buffer(&cb, packed ? packed_addr : MILO_GPU_VERTEX_BASE,
+                                          packed ? FETCH_STRIDE : MILO_CMD_VERTEX_BYTES);
+            milo_cmdbuf_set_vertex_layout(&cb, l[0], l[1], l[2], l[3]);
+            switch (f) {
+                case 0:
+                    milo_cmdbuf_set_index_buffer(&cb, MILO_GPU_INDEX_BASE, MILO_INDEX_U16);
+                    milo_cmdbuf_draw_indexed(&cb, torus.index_count, 0);
+                    break;
+                case 1:
+                    milo_cmdbuf_set_index_buffer(&cb, fan_addr, MILO_INDEX_U32);
+                    for (uint32_t q = 0; q < quads; q++) {
+                        milo_cmdbuf_draw_indexed_primitives(&cb, MILO_PRIM_TRIANGLE_FAN, 4,
+                                                            q * 4, 0);
+                    }
+                    break;
+                case 2:
+                    milo_cmdbuf_set_index_buffer(&cb, strip_list_addr, MILO_INDEX_U16);
+                    milo_cmdbuf_draw_indexed(&cb, n, 0);
+                    break;
+                case 3:
+                    milo_cmdbuf_set_index_buffer(&cb, strip_addr, MILO_INDEX_U8);
+                    for (uint32_t i = 0; i < RINGS; i++) {
+                        milo_cmdbuf_draw_indexed_primitives(&cb, MILO_PRIM_TRIANGLE_STRIP,
+                                                            2 * COLUMNS, 0, i * COLUMNS);
+                    }
+                    break;
+                default:
+                    milo_cmdbuf_draw_primitives(&cb, MILO_PRIM_POINTS, torus.vertex_count, 0);
+                    break;
+            }
+            ok = milo_cmdbuf_end(&cb);
+            uint64_t vertices = gpu.stats.vertices;
+            if (ok && !milo_gpu_execute(&gpu, addr)) {
+                printf("Fault at 0x%08X: %s\n", gpu.fault_addr, gpu.error);
+                ok = false;
+            }
+            milo_cmdbuf_retire(&cb, gpu.read_ptr);
+            
+            const uint32_t *color = (const uint32_t *)(gpu.mem + MILO_GPU_FRAMEBUFFER_BASE);
+            uint32_t *image = &images[(f / 2) % 2 * W * H];
+            if (f == 0 || f == 2) {
+                memcpy(image, color, W * H * sizeof(uint32_t));
+            } else if (f < 4) {
+                same[f / 2] = memcmp(image, color, W * H * sizeof(uint32_t)) == 0;
+            } else {
+                for (int i = 0; i < W * H; i++) blank = blank && color[i] == 0xFF000000;
+                points = gpu.stats.vertices - vertices;
+            }
+        }
+        if (ok) {
+            printf("Torus as fans (U32, stride %d) %s, as strips (U8, base vertex) %s; "
+                   "points shaded %llu vertices, drew %s\n\n", FETCH_STRIDE,
+                   same[0] ? "matches" : "MISMATCH", same[1] ? "matches" : "MISMATCH",
+                   (unsigned long long)points, blank ? "nothing" : "PIXELS");
+        } else if (!gpu.fault) {
+            printf("Command buffer overflowed the ring\n\n");
+        }
+        milo_mesh_free(&torus);
+    }
+    if (ready) {
+        milo_cmdbuf_free(&cb);
+        milo_gpu_free(&gpu);
+    }
+    free(indices);
+    free(images);
+    free(vm);
+}
+
+static int compare_triangles(const void *a, const void *b) {
+    return memcmp(a, b, 3 * sizeof(uint32_t));
+}
+
+/* The eviction policies on a short sequence, the torus's ACMR in its own
+ * order and reordered for each cache, and the torus drawn through the
+ * processor's cache against shading its index range */
+static void run_vcache_test(milo_texture_t *tex) {
+    printf("Running the torus through the post-transform vertex cache...\n");
+    static const char *tex_asm = "main:\n"
+                                 "    tex r4, r0, r2\n"
+                                 "    exit\n";
+    enum { W = 100, H = 76, RING = 256 };
+    const uint32_t vs_addr = MILO_GPU_SHADER_BASE, fs_addr = MILO_GPU_SHADER_BASE + 0x1000;
+    const uint32_t reordered_addr = MILO_GPU_INDEX_BASE + 0x4000;
+    
+    /* 0 is evicted by FIFO but kept by LRU, as it was just used */
+    static const uint32_t seq[5] = { 0, 1, 0, 2, 0 };
+    bool policies = milo_vcache_misses(seq, 5, 2, MILO_VCACHE_FIFO) == 4 &&
+                    milo_vcache_misses(seq, 5, 2, MILO_VCACHE_LRU) == 3;
+    
+    milo_mesh_t torus;
+    uint32_t *reordered = NULL, *sorted[2] = { NULL, NULL };
+    if (!milo_mesh_torus(&torus, 32, 16)) return;
+    size_t bytes = torus.index_count * sizeof(uint32_t);
+    reordered = malloc(bytes);
+    sorted[0] = malloc(bytes);
+    sorted[1] = malloc(bytes);
+    uint32_t tris = torus.index_count / 3;
+    if (!reordered || !sorted[0] || !sorted[1]) {
+        free(reordered);
+        free(sorted[0]);
+        free(sorted[1]);
+        milo_mesh_free(&torus);
+        return;
+    }
+    
+    /* Tipsify must only reorder the triangles, and lower the ACMR */
+    static const struct { uint32_t size; milo_vcache_policy_t policy; } caches[3] = {
+        { 8, MILO_VCACHE_FIFO }, { 16, MILO_VCACHE_FIFO }, { 16, MILO_VCACHE_LRU }
+    };
+    bool same_triangles = true;
+    printf("FIFO and LRU eviction %s; ACMR of %u triangles in order -> reordered:\n ",
+           policies ? "as expected" : "MISMATCH", tris);
+    for (int c = 0; c < 3; c++) {
+        uint32_t size = caches[c].size;
+        milo_vcache_policy_t policy = caches[c].policy;
+        bool optimized = milo_vcache_optimize(torus.indices, torus.index_count,
+                                              torus.vertex_count, size, reordered);
+        memcpy(sorted[0], torus.indices, bytes);
+        memcpy(sorted[1], reordered, bytes);
+        qsort(sorted[0], tris, 3 * sizeof(uint32_t), compare_triangles);
+        qsort(sorted[1], tris, 3 * sizeof(uint32_t), compare_triangles);
+        same_triangles = same_triangles && optimized && memcmp(sorted[0], sorted[1], bytes) == 0;
+        printf("%s %u-entry %s %.3f -> %.3f", c ? "," : "", size,
+               policy == MILO_VCACHE_LRU ? "LRU" : "FIFO",
+               (double)milo_vcache_misses(torus.indices, torus.index_count, size, policy) / tris,
+               (double)milo_vcache_misses(reordered, torus.index_count, size, policy) / tris);
+    }
+    printf("; triangles %s\n", same_triangles ? "match" : "MISMATCH");
+    
+    /* Range shading, then the cache in the torus's order and reordered */
+    milo_gpu_t gpu;
+    milo_cmdbuf_t cb;
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    uint32_t *image = malloc(W * H * sizeof(uint32_t));
+    bool ready = milo_gpu_init(&gpu, MILO_GPU_MEM_SIZE);
+    if (ready && !milo_cmdbuf_init(&cb, (uint32_t *)(gpu.mem + MILO_GPU_CMD_BASE),
+                                   MILO_GPU_CMD_BASE, RING, 0)) {
+        milo_gpu_free(&gpu);
+        ready = false;
+    }
+    if (ready && vm && image &&
+        milo_vcache_optimize(torus.indices, torus.index_count, torus.vertex_count, 16,
+                             reordered)) {
+        milo_vm_init(vm);
+        milo_mesh_view_t view = { 0.4f, 0.9f, 56.0f, 0.8f, (float)W / H };
+        float mvp[16];
+        milo_mesh_view_matrix(&view, mvp);
+        bool uploaded = milo_vm_load_asm(vm, milo_mesh_mvp_asm()) &&
+                        milo_gpu_upload(&gpu, vs_addr, vm->code, vm->code_size * 8);
+        uint32_t vs_bytes = vm->code_size * 8;
+        uploaded = uploaded && milo_vm_load_asm(vm, tex_asm) &&
+                   milo_gpu_upload(&gpu, fs_addr, vm->code, vm->code_size * 8) &&
+                   milo_gpu_upload(&gpu, MILO_GPU_UNIFORM_BASE, mvp, sizeof(mvp)) &&
+                   milo_gpu_upload(&gpu, MILO_GPU_TEXTURE_BASE, tex->pixels, 64 * 64 * 4) &&
+                   milo_gpu_upload_vertices(&gpu, MILO_GPU_VERTEX_BASE, torus.vertices,
+                                            torus.vertex_count) &&
+                   milo_gpu_upload_indices(&gpu, MILO_GPU_INDEX_BASE, torus.indices,
+                                           torus.index_count, MILO_INDEX_U16) &&
+                   milo_gpu_upload_indices(&gpu, reordered_addr, reordered,
+                                           torus.index_count, MILO_INDEX_U16);
+        uint32_t fs_bytes = vm->code_size * 8;
+        
+        bool ok = uploaded, same = false;
+        uint64_t shaded[3] = { 0, 0, 0 }, misses = 0;
+        for (int f = 0; f < 3 && ok; f++) {
+            milo_vcache_init(&gpu.vcache, f ? 16 : 0, MILO_VCACHE_FIFO);
+            uint32_t addr = milo_cmdbuf_begin(&cb);
+            milo_cmdbuf_set_render_target(&cb, MILO_GPU_FRAMEBUFFER_BASE, W, H);
+            milo_cmdbuf_set_viewport(&cb, 0, 0, W, H);
+            milo_cmdbuf_clear(&cb, MILO_CLEAR_COLOR | MILO_CLEAR_DEPTH, 0x000000FF,
+                              MILO_DEPTH_MAX);
+            milo_cmdbuf_bind_vertex_shader(&cb, vs_addr, vs_bytes);
+            milo_cmdbuf_bind_fragment_shader(&cb, fs_addr, fs_bytes);
+            milo_cmdbuf_set_texture(&cb, 0, MILO_GPU_TEXTURE_BASE, 64, 64, MILO_TEX_RGBA8);
+            milo_cmdbuf_set_uniform_buffer(&cb, MILO_GPU_UNIFORM_BASE, sizeof(mvp));
+            milo_cmdbuf_set_vertex_buffer(&cb, MILO_GPU_VERTEX_BASE, MILO_CMD_VERTEX_BYTES);
+            milo_cmdbuf_set_index_buffer(&cb, f == 2 ? reordered_addr : MILO_GPU_INDEX_BASE,
+                                         MILO_INDEX_U16);
+            milo_cmdbuf_draw_indexed(&cb, torus.index_count, 0);
+            ok = milo_cmdbuf_end(&cb);
+            uint64_t vertices = gpu.stats.vertices;
+            if (ok && !milo_gpu_execute(&gpu, addr)) {
+                printf("Fault at 0x%08X: %s\n", gpu.fault_addr, gpu.error);
+                ok = false;
+            }
+            milo_cmdbuf_retire(&cb, gpu.read_ptr);
+            shaded[f] = gpu.stats.vertices - vertices;
+            
+            const uint32_t *color = (const uint32_t *)(gpu.mem + MILO_GPU_FRAMEBUFFER_BASE);
+            if (f == 0) memcpy(image, color, W * H * sizeof(uint32_t));
+            if (f == 1) {
+                same = memcmp(image, color, W * H * sizeof(uint32_t)) == 0;
+                misses = gpu.stats.vcache_misses;
+            }
+        }
+        if (ok) {
+            uint64_t expected = milo_vcache_misses(torus.indices, torus.index_count, 16,
+                                                   MILO_VCACHE_FIFO);
+            printf("Vertex shader runs: index range %llu, 16-entry FIFO %llu (%s the "
+                   "simulation), reordered %llu; image %s\n\n",
+                   (unsigned long long)shaded[0], (unsigned long long)shaded[1],
+                   misses == expected ? "as" : "NOT AS", (unsigned long long)shaded[2],
+                   same ? "matches" : "MISMATCH");
+        } else if (!gpu.fault) {
+            printf("Command buffer overflowed the ring\n\n");
+        }
+    }
+    if (ready) {
+        milo_cmdbuf_free(&cb);
+        milo_gpu_free(&gpu);
+    }
+    free(image);
+    free(vm);
+    free(reordered);
+    free(sorted[0]);
+    free(sorted[1]);
+    milo_mesh_free(&torus);
+}
+
 /*---------------------------------------------------------------------------
  * Main
  *---------------------------------------------------------------------------*/
@@ -181,6 +1854,26 @@ int main(int argc, char **argv) {
     run_test("wave", wave_shader, NULL, 1.5f);
     run_test("texture", texture_shader, checker_tex, 0.0f);
     
+    static const char *const spec_variants[] = { "0=1,1=2.0", "0=0" };
+    run_variant_test("spec", spec_shader, spec_variants, 2);
+    
+    const char *const reuse_sources[] = {
+        gradient_shader, checker_shader, circle_shader, wave_shader, texture_shader
+    };
+    run_reuse_test(reuse_sources, 5, 1000);
+    run_link_test(reuse_sources, 5, false);
+    run_link_test(reuse_sources, 5, true);
+    run_profile_test();
+    run_divergence_test();
+    run_raster_test(checker_tex);
+    run_tbdr_test();
+    run_depth_test();
+    run_rop_test();
+    run_cmd_test(checker_tex);
+    run_cmdbuf_test(checker_tex);
+    run_fetch_test(checker_tex);
+    run_vcache_test(checker_tex);
+    
     /* Cleanup */
     milo_texture_free(checker_tex);
     
@@ -11,6 +11,14 @@
 #include "milo_glsl.h"
 #include "milo_asm.h"
 #include "milo_vm.h"
+#include "milo_timing.h"
+#include "milo_mesh.h"
+#include "milo_tbdr.h"
+#include "milo_cmd.h"
+#include "milo_vcache.h"
+#include "milo_cmdbuf.h"
+#include "milo_capture.h"
+#include <time.h>
 
 /*---------------------------------------------------------------------------
  * Test Case Structure
@@ -206,12 +214,16 @@ static bool generate_test_files(const char *output_dir) {
             continue;
         }
         
-        /* Get assembly and assemble to binary */
+        /* Load the emitted code and constant table */
         const char *asm_code = milo_glsl_get_asm(&compiler);
+        uint32_t code_size, const_count;
+        const uint64_t *code = milo_glsl_get_code(&compiler, &code_size);
+        const uint32_t *constants = milo_glsl_get_constants(&compiler, &const_count);
         
         milo_vm_init(&vm);
-        if (!milo_vm_load_asm(&vm, asm_code)) {
-            fprintf(stderr, "  Assembly error: %s\n", milo_vm_get_error(&vm));
+        if (!milo_vm_load_binary(&vm, code, code_size) ||
+            !milo_vm_load_constants(&vm, MILO_CONST_BASE_ADDR, constants, const_count)) {
+            fprintf(stderr, "  Load error: %s\n", milo_vm_get_error(&vm));
             milo_glsl_free(&compiler);
             continue;
         }
@@ -234,45 +246,15 @@ static bool generate_test_files(const char *output_dir) {
         }
         
         /* Write constant data hex file (memory values at constant table addresses) */
-        /* Parse .data directives from assembly */
         snprintf(path, sizeof(path), "%s/%s_const.hex", output_dir, name);
         f = fopen(path, "w");
         if (f) {
-            const char *p = asm_code;
-            int const_count = 0;
-            while ((p = strstr(p, ".data ")) != NULL) {
-                p += 6;
-                while (*p == ' ' || *p == '\t') p++;
-                
-                /* Parse address and value */
-                uint32_t addr = 0, value = 0;
-                if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
-                    p += 2;
-                    while ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F')) {
-                        addr = addr * 16;
-                        if (*p >= '0' && *p <= '9') addr += *p - '0';
-                        else if (*p >= 'a' && *p <= 'f') addr += *p - 'a' + 10;
-                        else addr += *p - 'A' + 10;
-                        p++;
-                    }
-                }
-                while (*p == ',' || *p == ' ' || *p == '\t') p++;
-                if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
-                    p += 2;
-                    while ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F')) {
-                        value = value * 16;
-                        if (*p >= '0' && *p <= '9') value += *p - '0';
-                        else if (*p >= 'a' && *p <= 'f') value += *p - 'a' + 10;
-                        else value += *p - 'A' + 10;
-                        p++;
-                    }
-                }
-                fprintf(f, "%04X %08X\n", addr, value);
-                const_count++;
+            for (uint32_t i = 0; i < const_count; i++) {
+                fprintf(f, "%04X %08X\n", MILO_CONST_BASE_ADDR + i * 4, constants[i]);
             }
             fclose(f);
             if (const_count > 0) {
-                printf("  Wrote %s (%d constants)\n", path, const_count);
+                printf("  Wrote %s (%u constants)\n", path, const_count);
             }
         }
         
@@ -362,6 +344,864 @@ static int verify_vhdl_output(const char *test_dir, float tolerance) {
     return failed_tests;
 }
 
+/*---------------------------------------------------------------------------
+ * Profiling
+ *---------------------------------------------------------------------------*/
+
+static char *read_source(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *source = malloc(size + 1);
+    if (source) {
+        size_t n = fread(source, 1, size, f);
+        source[n] = '\0';
+    }
+    fclose(f);
+    return source;
+}
+
+/* Load a GLSL shader, or assembly (".s") with ".data" constants. lines
+ * receives the compiler's GLSL line map, NULL for assembly. */
+static bool load_shader(milo_vm_t *vm, milo_compiler_t *compiler, const char *path,
+                        const char *source, const int **lines) {
+    size_t len = strlen(path);
+    bool assembly = len > 2 && strcmp(path + len - 2, ".s") == 0;
+    bool loaded = false;
+    *lines = NULL;
+    if (assembly) {
+        loaded = milo_vm_load_asm(vm, source);
+    } else if (milo_glsl_compile(compiler, source, false)) {
+        uint32_t code_size, const_count;
+        const uint64_t *code = milo_glsl_get_code(compiler, &code_size);
+        const uint32_t *constants = milo_glsl_get_constants(compiler, &const_count);
+        *lines = milo_glsl_get_lines(compiler, NULL);
+        loaded = milo_vm_load_binary(vm, code, code_size) &&
+                 milo_vm_load_constants(vm, MILO_CONST_BASE_ADDR, constants, const_count);
+    } else {
+        fprintf(stderr, "%s: compile error\n", path);
+    }
+    if (!loaded && milo_vm_get_error(vm)) {
+        fprintf(stderr, "%s: load error: %s\n", path, milo_vm_get_error(vm));
+    }
+    return loaded;
+}
+
+/* profile <shader.glsl|.s> [-s WxH] [-n top] [-o counts] [-u util.csv]
+ *         [-t] [-r rtl_cycles]:
+ * render a fullscreen quad with a profile attached and print the annotated
+ * report, opcode mix and branch divergence. -t adds the SM timing model's
+ * cycle estimate; -r compares it against a cycle count measured on the RTL
+ * for the same render. */
+static int profile_shader(int argc, char **argv) {
+    const char *path = NULL;
+    const char *counts_file = NULL;
+    const char *util_file = NULL;
+    int width = 64, height = 64;
+    unsigned top = 10;
+    bool timing = false;
+    unsigned long long rtl_cycles = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                fprintf(stderr, "Bad size '%s' (expected WxH)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            top = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            counts_file = argv[++i];
+        } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            util_file = argv[++i];
+        } else if (strcmp(argv[i], "-t") == 0) {
+            timing = true;
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rtl_cycles = strtoull(argv[++i], NULL, 10);
+            timing = true;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "Usage: %s profile <shader.glsl|.s> [-s WxH] [-n top] [-o counts] "
+                "[-u util.csv] [-t] [-r rtl_cycles]\n", argv[0]);
+        return 1;
+    }
+    
+    char *source = read_source(path);
+    if (!source) return 1;
+    
+    milo_compiler_t compiler;
+    milo_glsl_init(&compiler);
+    milo_glsl_set_listing(&compiler, false);
+    
+    int status = 1;
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    milo_texture_t *tex = milo_texture_create_checker(64, 64, 0xFFFFFFFF, 0xFF404040, 8);
+    milo_framebuffer_t *fb = milo_fb_create(width, height);
+    milo_prof_t prof;
+    memset(&prof, 0, sizeof(prof));
+    bool loaded = false;
+    const int *lines = NULL;
+    if (vm && tex && fb) {
+        milo_vm_init(vm);
+        loaded = load_shader(vm, &compiler, path, source, &lines);
+    }
+    
+    if (loaded && !milo_prof_init(&prof, vm->code_size)) {
+        fprintf(stderr, "Out of memory\n");
+    } else if (loaded) {
+        const uint64_t *code = vm->code;
+        uint32_t code_size = vm->code_size;
+        milo_vm_bind_texture(vm, 0, tex);
+        prof.trace = true;
+        vm->profile = &prof;
+        milo_fb_clear(fb, 0xFF000000, 1.0f);
+        milo_render_fullscreen(vm, fb);
+        milo_prof_finish(&prof);
+        
+        printf("%s, %dx%d fullscreen\n", path, width, height);
+        milo_prof_report(&prof, code, code_size, lines, source, top, stdout);
+        
+        milo_prof_util_t util;
+        FILE *csv = NULL;
+        if (util_file && !(csv = fopen(util_file, "w"))) {
+            fprintf(stderr, "Cannot write %s\n", util_file);
+        }
+        bool traced = milo_prof_utilization(&prof, code, code_size, MILO_RESIDENT_WARPS,
+                                            csv, &util);
+        if (csv) fclose(csv);
+        printf("\n");
+        milo_prof_report_mix(&prof, code, code_size, traced ? &util : NULL, stdout);
+        milo_prof_report_divergence(&prof, code, code_size, lines, source, stdout);
+        status = (util_file && !csv) ? 1 : 0;
+        if (timing) {
+            milo_timing_config_t cfg;
+            milo_timing_defaults(&cfg);
+            printf("\n");
+            if (!milo_timing_report(&cfg, &prof, code, code_size, rtl_cycles, stdout)) {
+                fprintf(stderr, "Timing model needs the full trace (out of memory?)\n");
+                status = 1;
+            }
+        }
+        if (counts_file && !milo_prof_write_counts(&prof, counts_file)) {
+            fprintf(stderr, "Cannot write %s\n", counts_file);
+            status = 1;
+        }
+    }
+    milo_prof_free(&prof);
+    if (fb) milo_fb_free(fb);
+    if (tex) milo_texture_free(tex);
+    free(vm);
+    free(source);
+    milo_glsl_free(&compiler);
+    return status;
+}
+
+/* sweep <shader.glsl|.s>... [-s WxH] [-a active_warps]: trace each
+ * shader's fullscreen render once and time it under every warp scheduler,
+ * with IPC and the cause of idle issue cycles */
+static int sweep_schedulers(int argc, char **argv) {
+    int width = 64, height = 64;
+    milo_timing_config_t cfg;
+    milo_timing_defaults(&cfg);
+    int first_path = 0, path_count = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                fprintf(stderr, "Bad size '%s' (expected WxH)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            cfg.active_warps = (uint32_t)atoi(argv[++i]);
+        } else {
+            /* Paths come last */
+            first_path = i;
+            path_count = argc - i;
+            break;
+        }
+    }
+    if (path_count == 0) {
+        fprintf(stderr, "Usage: %s sweep [-s WxH] [-a active_warps] <shader.glsl|.s>...\n",
+                argv[0]);
+        return 1;
+    }
+    
+    milo_texture_t *tex = milo_texture_create_checker(64, 64, 0xFFFFFFFF, 0xFF404040, 8);
+    milo_framebuffer_t *fb = milo_fb_create(width, height);
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    if (!tex || !fb || !vm) {
+        fprintf(stderr, "Out of memory\n");
+        if (fb) milo_fb_free(fb);
+        if (tex) milo_texture_free(tex);
+        free(vm);
+        return 1;
+    }
+    
+    printf("Scheduler sweep, %dx%d fullscreen, %u resident warps, active set %u\n",
+           width, height, cfg.resident_warps, cfg.active_warps);
+    printf("%-20s %-10s %9s %5s %7s", "Shader", "Scheduler", "Cycles", "IPC", "vs rr");
+    for (int i = 0; i < MILO_STALL_COUNT; i++) printf(" %9s", milo_stall_name((milo_stall_t)i));
+    printf("\n");
+    
+    int status = 0;
+    for (int n = first_path; n < first_path + path_count; n++) {
+        const char *path = argv[n];
+        char *source = read_source(path);
+        if (!source) {
+            status = 1;
+            continue;
+        }
+        milo_compiler_t compiler;
+        milo_glsl_init(&compiler);
+        milo_glsl_set_listing(&compiler, false);
+        milo_prof_t prof;
+        memset(&prof, 0, sizeof(prof));
+        const int *lines;
+        milo_vm_init(vm);
+        if (!load_shader(vm, &compiler, path, source, &lines) ||
+            !milo_prof_init(&prof, vm->code_size)) {
+            status = 1;
+        } else {
+            milo_vm_bind_texture(vm, 0, tex);
+            prof.trace = true;
+            vm->profile = &prof;
+            milo_fb_clear(fb, 0xFF000000, 1.0f);
+            milo_render_fullscreen(vm, fb);
+            milo_prof_finish(&prof);
+            
+            uint64_t rr_cycles = 0;
+            for (int sched = 0; sched < MILO_SCHED_COUNT; sched++) {
+                milo_timing_stats_t st;
+                cfg.scheduler = (milo_sched_t)sched;
+                if (!milo_timing_run_draws(&cfg, &prof, vm->code, vm->code_size, &st)) {
+                    fprintf(stderr, "%s: timing model needs the full trace\n", path);
+                    status = 1;
+                    break;
+                }
+                if (sched == MILO_SCHED_RR) rr_cycles = st.cycles;
+                printf("%-20s %-10s %9llu %5.2f %+6.1f%%", sched == 0 ? path : "",
+                       milo_sched_name((milo_sched_t)sched), (unsigned long long)st.cycles,
+                       st.cycles ? (double)st.issued / st.cycles : 0.0,
+                       rr_cycles ? 100.0 * ((double)rr_cycles / st.cycles - 1.0) : 0.0);
+                for (int i = 0; i < MILO_STALL_COUNT; i++) {
+                    printf(" %8.1f%%", st.cycles ? 100.0 * st.stall[i] / st.cycles : 0.0);
+                }
+                printf("\n");
+            }
+        }
+        milo_prof_free(&prof);
+        milo_glsl_free(&compiler);
+        free(source);
+    }
+    
+    milo_fb_free(fb);
+    milo_texture_free(tex);
+    free(vm);
+    return status;
+}
+
+/* scale <shader.glsl|.s> [-s WxH] [-m max_sms] [-w tile_warps] [-b bus]
+ *       [-c MHz] [-o curve.csv]: trace a fullscreen render and time it on
+ * 1 to max_sms SMs under both work distributors, printing frame time and
+ * scaling efficiency */
+static int scale_shader(int argc, char **argv) {
+    const char *path = NULL;
+    const char *csv_file = NULL;
+    int width = 64, height = 64;
+    unsigned max_sms = 8;
+    double mhz = 100.0;
+    milo_timing_config_t cfg;
+    milo_timing_defaults(&cfg);
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                fprintf(stderr, "Bad size '%s' (expected WxH)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            max_sms = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            cfg.tile_warps = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            cfg.bus_interval = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            mhz = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            csv_file = argv[++i];
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path || max_sms == 0 || mhz <= 0.0) {
+        fprintf(stderr, "Usage: %s scale <shader.glsl|.s> [-s WxH] [-m max_sms] "
+                "[-w tile_warps] [-b bus] [-c MHz] [-o curve.csv]\n", argv[0]);
+        return 1;
+    }
+    
+    char *source = read_source(path);
+    if (!source) return 1;
+    milo_compiler_t compiler;
+    milo_glsl_init(&compiler);
+    milo_glsl_set_listing(&compiler, false);
+    
+    int status = 1;
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    milo_texture_t *tex = milo_texture_create_checker(64, 64, 0xFFFFFFFF, 0xFF404040, 8);
+    milo_framebuffer_t *fb = milo_fb_create(width, height);
+    milo_prof_t prof;
+    memset(&prof, 0, sizeof(prof));
+    const int *lines;
+    bool loaded = false;
+    if (vm && tex && fb) {
+        milo_vm_init(vm);
+        loaded = load_shader(vm, &compiler, path, source, &lines);
+    }
+    
+    FILE *csv = NULL;
+    if (loaded && !milo_prof_init(&prof, vm->code_size)) {
+        fprintf(stderr, "Out of memory\n");
+    } else if (loaded && csv_file && !(csv = fopen(csv_file, "w"))) {
+        fprintf(stderr, "Cannot write %s\n", csv_file);
+    } else if (loaded) {
+        milo_vm_bind_texture(vm, 0, tex);
+        prof.trace = true;
+        vm->profile = &prof;
+        milo_fb_clear(fb, 0xFF000000, 1.0f);
+        milo_render_fullscreen(vm, fb);
+        milo_prof_finish(&prof);
+        
+        printf("%s, %dx%d fullscreen, %llu warps, %u warps per tile, bus %u cycles "
+               "per request, %.0f MHz\n", path, width, height,
+               (unsigned long long)prof.warps, cfg.tile_warps, cfg.bus_interval, mhz);
+        printf("  SMs   Dist     Cycles  Frame (us)  Speedup  Efficiency  Bus delay\n");
+        if (csv) fprintf(csv, "SMs,Warp_Cycles,Tile_Cycles,Warp_Frame_us,Tile_Frame_us\n");
+        
+        status = 0;
+        uint64_t base[2] = {0, 0};
+        for (unsigned n = 1; n <= max_sms && status == 0; n++) {
+            uint64_t cycles[2];
+            for (int d = 0; d < 2; d++) {
+                milo_timing_stats_t st;
+                cfg.sm_count = n;
+                cfg.distribution = d ? MILO_DIST_TILE : MILO_DIST_WARP;
+                if (!milo_timing_run_draws(&cfg, &prof, vm->code, vm->code_size, &st)) {
+                    fprintf(stderr, "Timing model needs the full trace (out of memory?)\n");
+                    status = 1;
+                    break;
+                }
+                cycles[d] = st.cycles;
+                if (n == 1) base[d] = st.cycles;
+                double speedup = st.cycles ? (double)base[d] / st.cycles : 0.0;
+                printf("  %3u   %-4s  %9llu  %10.1f  %6.2fx  %9.1f%%  %9llu\n", n,
+                       milo_dist_name(cfg.distribution), (unsigned long long)st.cycles,
+                       st.cycles / mhz, speedup, 100.0 * speedup / n,
+                       (unsigned long long)st.bus_waits);
+            }
+            if (csv && status == 0) {
+                fprintf(csv, "%u,%llu,%llu,%.3f,%.3f\n", n, (unsigned long long)cycles[0],
+                        (unsigned long long)cycles[1], cycles[0] / mhz, cycles[1] / mhz);
+            }
+        }
+    }
+    if (csv) fclose(csv);
+    milo_prof_free(&prof);
+    if (fb) milo_fb_free(fb);
+    if (tex) milo_texture_free(tex);
+    free(vm);
+    free(source);
+    milo_glsl_free(&compiler);
+    return status;
+}
+
+/*---------------------------------------------------------------------------
+ * Scenes
+ *---------------------------------------------------------------------------*/
+
+/* A TB scene mesh by name; false for an unknown name, built false if out
+ * of memory */
+static bool build_mesh(const char *name, milo_mesh_t *mesh, bool *built) {
+    *built = false;
+    if (name && strcmp(name, "cube") == 0) {
+        *built = milo_mesh_cube(mesh);
+    } else if (name && strcmp(name, "pyramid") == 0) {
+        *built = milo_mesh_pyramid(mesh);
+    } else if (name && strcmp(name, "torus") == 0) {
+        *built = milo_mesh_torus(mesh, 32, 16);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* scene <cube|pyramid|torus> <shader.glsl|.s> [-s WxH] [-f frames]
+ *       [-t tile_size] [-m max_tris_per_tile] [-z] [-r state] [-o last.ppm]:
+ * spin a TB
+ * scene mesh 6 degrees about x and y per frame (as TB/tb_render_torus.vhd),
+ * render it with the triangle rasterizer and print the host frame rate.
+ * -t renders through the tile-based deferred renderer instead and prints
+ * the binning statistics of the last frame. -z turns off early-Z and
+ * hierarchical-Z; -r draws with a render state preset (default, alpha,
+ * additive, 2d). */
+static int render_scene(int argc, char **argv) {
+    const char *name = NULL, *path = NULL, *out_file = NULL;
+    int width = 256, height = 256, frames = 60;
+    bool tiled = false, depth_culling = true, state_ok = true;
+    milo_render_state_t state;
+    milo_render_state_preset(&state, MILO_STATE_DEFAULT);
+    milo_tbdr_config_t cfg;
+    milo_tbdr_defaults(&cfg);
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                fprintf(stderr, "Bad size '%s' (expected WxH)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            cfg.tile_size = (uint32_t)atoi(argv[++i]);
+            tiled = true;
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            cfg.max_tris_per_tile = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-z") == 0) {
+            depth_culling = false;
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            const char *preset = argv[++i];
+            state_ok = false;
+            for (int p = MILO_STATE_DEFAULT; p <= MILO_STATE_2D; p++) {
+                if (strcmp(preset, milo_state_preset_name((milo_state_preset_t)p)) == 0) {
+                    milo_render_state_preset(&state, (milo_state_preset_t)p);
+                    state_ok = true;
+                }
+            }
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_file = argv[++i];
+        } else if (!name) {
+            name = argv[i];
+        } else {
+            path = argv[i];
+        }
+    }
+    
+    milo_mesh_t mesh;
+    bool built = false;
+    if (!build_mesh(name, &mesh, &built)) path = NULL;
+    if (!path || frames <= 0 || !state_ok || cfg.tile_size == 0 ||
+        cfg.tile_size > MILO_TBDR_MAX_TILE_SIZE) {
+        fprintf(stderr, "Usage: %s scene <cube|pyramid|torus> <shader.glsl|.s> [-s WxH] "
+                "[-f frames] [-t tile_size] [-m max_tris_per_tile] [-z] "
+                "[-r default|alpha|additive|2d] [-o last.ppm]\n", argv[0]);
+        if (built) milo_mesh_free(&mesh);
+        return 1;
+    }
+    if (!built) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    
+    char *source = read_source(path);
+    if (!source) {
+        milo_mesh_free(&mesh);
+        return 1;
+    }
+    milo_compiler_t compiler;
+    milo_glsl_init(&compiler);
+    milo_glsl_set_listing(&compiler, false);
+    
+    int status = 1;
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    milo_texture_t *tex = milo_texture_create_checker(64, 64, 0xFFFFFFFF, 0xFF404040, 8);
+    milo_framebuffer_t *fb = milo_fb_create(width, height);
+    milo_vertex_out_t *clip = malloc(mesh.vertex_count * sizeof(milo_vertex_out_t));
+    const int *lines;
+    if (vm && tex && fb && clip) {
+        milo_vm_init(vm);
+        if (load_shader(vm, &compiler, path, source, &lines)) {
+            milo_vm_bind_texture(vm, 0, tex);
+            vm->early_z = vm->hiz = depth_culling;
+            milo_vm_set_render_state(vm, &state);
+            milo_mesh_view_t view = {
+                0.0f, 0.0f, mesh.radius * 3.0f, 45.0f * 3.14159265f / 180.0f,
+                (float)width / (float)height
+            };
+            uint64_t covered = 0;
+            milo_tbdr_stats_t st;
+            status = 0;
+            clock_t start = clock();
+            for (int f = 0; f < frames && status == 0; f++) {
+                view.angle_x = view.angle_y = f * 6.0f * 3.14159265f / 180.0f;
+                milo_mesh_transform(&mesh, &view, clip);
+                if (!tiled) {
+                    milo_fb_clear(fb, cfg.clear_color, cfg.clear_depth);
+                    covered += milo_render_mesh(vm, fb, clip, mesh.indices, mesh.index_count,
+                                                cfg.cull);
+                } else if (milo_tbdr_render_mesh(vm, fb, &cfg, clip, mesh.indices,
+                                                 mesh.index_count, &st)) {
+                    covered += st.covered;
+                } else {
+                    fprintf(stderr, "Out of memory\n");
+                    status = 1;
+                }
+            }
+            double ms = 1000.0 * (double)(clock() - start) / CLOCKS_PER_SEC / frames;
+            printf("%s: %u triangles, %dx%d, %d frames%s, %.0f fragments per frame\n",
+                   name, mesh.index_count / 3, width, height, frames,
+                   tiled ? " tiled" : "", (double)covered / frames);
+            printf("%.3f ms per frame (%.1f fps)\n", ms, ms > 0.0 ? 1000.0 / ms : 0.0);
+            const milo_depth_stats_t *ds = &vm->depth_stats;
+            printf("Depth: %.0f shaded, %.0f killed early, %.0f late, %.0f written; hi-Z "
+                   "%.1f triangles, %.1f blocks (%.0f pixels) per frame\n",
+                   (double)ds->shaded / frames, (double)ds->early_killed / frames,
+                   (double)ds->late_killed / frames, (double)ds->written / frames,
+                   (double)ds->hiz_triangles / frames, (double)ds->hiz_blocks / frames,
+                   (double)ds->hiz_pixels / frames);
+            if (tiled && status == 0) milo_tbdr_report(&cfg, &st, stdout);
+            if (status == 0 && out_file && !milo_fb_save_ppm(fb, out_file)) {
+                fprintf(stderr, "Cannot write %s\n", out_file);
+                status = 1;
+            }
+        }
+    }
+    free(clip);
+    if (fb) milo_fb_free(fb);
+    if (tex) milo_texture_free(tex);
+    free(vm);
+    free(source);
+    milo_glsl_free(&compiler);
+    milo_mesh_free(&mesh);
+    return status;
+}
+
+/* frame <cube|pyramid|torus> <shader.glsl|.s> [-s WxH] [-f frames]
+ *       [-t tile_size] [-m max_tris_per_tile] [-d draws] [-k] [-i] [-z]
+ *       [-v size[,lru]] [-r] [-c capture] [-o last.ppm]:
+ * the scene spin as a command buffer per frame (target, clear, a tile
+ * pass with the mesh drawn by milo_mesh_mvp_asm and the shader, IRQ)
+ * built with milo_cmdbuf and replayed on the command processor; prints
+ * the host frame rate, the builder's and the processor's counters. -d
+ * splits the mesh into draws alternating two textures, each setting all
+ * of its state, -k sorts them, -i draws outside a tile pass, -c
+ * captures the frames for replay. -v shades through a post-transform
+ * cache of size entries (FIFO unless ,lru) and prints each draw's ACMR;
+ * -r first reorders each draw's triangles for it. */
+static int render_frame(int argc, char **argv) {
+    const char *name = NULL, *path = NULL, *out_file = NULL, *capture_file = NULL;
+    int width = 256, height = 256, frames = 60, draws = 1;
+    bool tiled = true, depth_culling = true, sort = false, reorder = false;
+    uint32_t cache_size = 0;
+    milo_vcache_policy_t policy = MILO_VCACHE_FIFO;
+    milo_tbdr_config_t cfg;
+    milo_tbdr_defaults(&cfg);
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 ||
+                height <= 0 || width > 0xFFFF || height > 0xFFFF) {
+                fprintf(stderr, "Bad size '%s' (expected WxH)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            cfg.tile_size = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            cfg.max_tris_per_tile = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            draws = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-k") == 0) {
+            sort = true;
+        } else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+            char lru[8] = "";
+            int fields = sscanf(argv[++i], "%u,%7s", &cache_size, lru);
+            if (fields < 1 || cache_size == 0 || cache_size > MILO_VCACHE_MAX ||
+                (fields == 2 && strcmp(lru, "lru") != 0)) {
+                fprintf(stderr, "Bad cache '%s' (expected 1..%d[,lru])\n", argv[i],
+                        MILO_VCACHE_MAX);
+                return 1;
+            }
+            if (fields == 2) policy = MILO_VCACHE_LRU;
+        } else if (strcmp(argv[i], "-r") == 0) {
+            reorder = true;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            capture_file = argv[++i];
+        } else if (strcmp(argv[i], "-i") == 0) {
+            tiled = false;
+        } else if (strcmp(argv[i], "-z") == 0) {
+            depth_culling = false;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_file = argv[++i];
+        } else if (!name) {
+            name = argv[i];
+        } else {
+            path = argv[i];
+        }
+    }
+    
+    milo_mesh_t mesh;
+    bool built = false;
+    if (!build_mesh(name, &mesh, &built)) path = NULL;
+    uint64_t target_bytes = (uint64_t)width * height * 4;
+    if (!path || frames <= 0 || draws <= 0 || (built && (uint32_t)draws > mesh.index_count / 3) ||
+        cfg.tile_size == 0 || cfg.tile_size > MILO_TBDR_MAX_TILE_SIZE ||
+        target_bytes > MILO_GPU_MEM_SIZE - MILO_GPU_FRAMEBUFFER_BASE || (reorder && !cache_size)) {
+        fprintf(stderr, "Usage: %s frame <cube|pyramid|torus> <shader.glsl|.s> [-s WxH] "
+                "[-f frames] [-t tile_size] [-m max_tris_per_tile] [-d draws] [-k] [-i] [-z] "
+                "[-v size[,lru]] [-r] [-c capture] [-o last.ppm]\n", argv[0]);
+        if (built) milo_mesh_free(&mesh);
+        return 1;
+    }
+    if (!built) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    
+    char *source = read_source(path);
+    if (!source) {
+        milo_mesh_free(&mesh);
+        return 1;
+    }
+    milo_compiler_t compiler;
+    milo_glsl_init(&compiler);
+    milo_glsl_set_listing(&compiler, false);
+    
+    /* Memory: the shaders, the uniform buffer (the fragment shader's VM
+     * memory with the matrix at byte 0), textures, mesh and the command
+     * ring up to the vertices */
+    int status = 1;
+    const uint32_t vs_addr = MILO_GPU_SHADER_BASE, fs_addr = MILO_GPU_SHADER_BASE + 0x8000;
+    const uint32_t tex_addr[2] = { MILO_GPU_TEXTURE_BASE, MILO_GPU_TEXTURE_BASE + 0x4000 };
+    milo_gpu_t gpu;
+    milo_cmdbuf_t cb;
+    bool gpu_ok = milo_gpu_init(&gpu, MILO_GPU_MEM_SIZE);
+    bool cb_ok = gpu_ok && milo_cmdbuf_init(&cb, (uint32_t *)(gpu.mem + MILO_GPU_CMD_BASE),
+                                            MILO_GPU_CMD_BASE,
+                                            (MILO_GPU_VERTEX_BASE - MILO_GPU_CMD_BASE) / 4,
+                                            (uint32_t)draws);
+    milo_vm_t *vm = malloc(sizeof(milo_vm_t));
+    milo_texture_t *tex = milo_texture_create_checker(64, 64, 0xFFFFFFFF, 0xFF404040, 8);
+    milo_texture_t *dots = milo_texture_create_checker(64, 64, 0xFF2060E0, 0xFFE0E0E0, 4);
+    const int *lines;
+    if (cb_ok && vm && tex && dots) {
+        milo_vm_init(vm);
+        bool uploaded = milo_vm_load_asm(vm, milo_mesh_mvp_asm()) &&
+                        milo_gpu_upload(&gpu, vs_addr, vm->code, vm->code_size * 8);
+        uint32_t vs_bytes = vm->code_size * 8;
+        milo_vm_init(vm);
+        uploaded = uploaded && load_shader(vm, &compiler, path, source, &lines) &&
+                   milo_gpu_upload(&gpu, fs_addr, vm->code, vm->code_size * 8) &&
+                   milo_gpu_upload(&gpu, MILO_GPU_UNIFORM_BASE, vm->mem, VM_MEM_SIZE) &&
+                   milo_gpu_upload(&gpu, tex_addr[0], tex->pixels, 64 * 64 * 4) &&
+                   milo_gpu_upload(&gpu, tex_addr[1], dots->pixels, 64 * 64 * 4) &&
+                   milo_gpu_upload_vertices(&gpu, MILO_GPU_VERTEX_BASE, mesh.vertices,
+                                            mesh.vertex_count);
+        uint32_t chunk = mesh.index_count / 3 / (uint32_t)draws * 3;
+        for (uint32_t d = 0; d < (uint32_t)draws && reorder && uploaded; d++) {
+            uint32_t count = d == (uint32_t)draws - 1 ? mesh.index_count - d * chunk : chunk;
+            uploaded = milo_vcache_optimize(mesh.indices + d * chunk, count, mesh.vertex_count,
+                                            cache_size, mesh.indices + d * chunk);
+        }
+        uploaded = uploaded && milo_gpu_upload_indices(&gpu, MILO_GPU_INDEX_BASE, mesh.indices,
+                                                       mesh.index_count, MILO_INDEX_U32);
+        uint32_t fs_bytes = vm->code_size * 8;
+        
+        if (uploaded) {
+            gpu.tbdr = cfg;
+            milo_vcache_init(&gpu.vcache, cache_size, policy);
+            gpu.fs_vm->early_z = gpu.fs_vm->hiz = depth_culling;
+            milo_mesh_view_t view = {
+                0.0f, 0.0f, mesh.radius * 3.0f, 45.0f * 3.14159265f / 180.0f,
+                (float)width / (float)height
+            };
+            milo_capture_t cap;
+            status = 0;
+            if (capture_file && !milo_capture_open(&cap, capture_file, &gpu)) {
+                fprintf(stderr, "%s\n", cap.error);
+                status = 1;
+            }
+            clock_t building = 0, start = clock();
+            for (int f = 0; f < frames && status == 0; f++) {
+                float mvp[16];
+                view.angle_x = view.angle_y = f * 6.0f * 3.14159265f / 180.0f;
+                milo_mesh_view_matrix(&view, mvp);
+                milo_gpu_upload(&gpu, MILO_GPU_UNIFORM_BASE, mvp, sizeof(mvp));
+                
+                clock_t build = clock();
+                uint32_t addr = milo_cmdbuf_begin(&cb);
+                milo_cmdbuf_set_render_target(&cb, MILO_GPU_FRAMEBUFFER_BASE, (uint32_t)width,
+                                              (uint32_t)height);
+                milo_cmdbuf_clear(&cb, MILO_CLEAR_COLOR | MILO_CLEAR_DEPTH, 0x000000FF,
+                                  MILO_DEPTH_MAX);
+                if (tiled) milo_cmdbuf_begin_tile_pass(&cb);
+                milo_cmdbuf_set_sort(&cb, sort);
+                for (uint32_t d = 0; d < (uint32_t)draws; d++) {
+                    uint32_t count = d == (uint32_t)draws - 1 ? mesh.index_count - d * chunk
+                                                              : chunk;
+                    milo_cmdbuf_bind_vertex_shader(&cb, vs_addr, vs_bytes);
+                    milo_cmdbuf_bind_fragment_shader(&cb, fs_addr, fs_bytes);
+                    milo_cmdbuf_set_texture(&cb, 0, tex_addr[d % 2], 64, 64, MILO_TEX_RGBA8);
+                    milo_cmdbuf_set_uniform_buffer(&cb, MILO_GPU_UNIFORM_BASE, VM_MEM_SIZE);
+                    milo_cmdbuf_set_vertex_buffer(&cb, MILO_GPU_VERTEX_BASE,
+                                                  MILO_CMD_VERTEX_BYTES);
+                    milo_cmdbuf_set_index_buffer(&cb, MILO_GPU_INDEX_BASE, MILO_INDEX_U32);
+                    milo_cmdbuf_draw_indexed(&cb, count, d * chunk);
+                }
+                milo_cmdbuf_set_sort(&cb, false);
+                if (tiled) milo_cmdbuf_end_tile_pass(&cb);
+                milo_cmdbuf_irq(&cb, 0);
+                bool built_ok = milo_cmdbuf_end(&cb);
+                building += clock() - build;
+                
+                if (!built_ok) {
+                    fprintf(stderr, "Frame overflows the %u-byte command ring\n", cb.size * 4);
+                    status = 1;
+                } else if (!(capture_file ? milo_capture_execute(&cap, addr)
+                                          : milo_gpu_execute(&gpu, addr))) {
+                    fprintf(stderr, "Fault at 0x%08X: %s\n", gpu.fault_addr, gpu.error);
+                    status = 1;
+                }
+                if (capture_file && status == 0) milo_capture_frame(&cap);
+                milo_cmdbuf_retire(&cb, gpu.read_ptr);
+            }
+            if (capture_file && status == 0) {
+                if (milo_capture_close(&cap)) {
+                    printf("Captured %d frames to %s: %llu bytes, %llu of them memory\n",
+                           frames, capture_file, (unsigned long long)cap.file_bytes,
+                           (unsigned long long)cap.memory_bytes);
+                } else {
+                    fprintf(stderr, "%s: %s\n", capture_file, cap.error);
+                    status = 1;
+                }
+            } else if (capture_file && cap.file) {
+                milo_capture_close(&cap);
+            }
+            double ms = 1000.0 * (double)(clock() - start) / CLOCKS_PER_SEC / frames;
+            double build_us = 1e6 * (double)building / CLOCKS_PER_SEC / frames;
+            printf("%s: %u triangles in %d draws%s, %dx%d, %d frames%s\n",
+                   name, mesh.index_count / 3, draws, sort ? " sorted" : "", width, height,
+                   frames, tiled ? " tiled" : "");
+            printf("%.3f ms per frame (%.1f fps), %.2f us building the commands\n",
+                   ms, ms > 0.0 ? 1000.0 / ms : 0.0, build_us);
+            milo_cmdbuf_report(&cb, stdout);
+            milo_gpu_report(&gpu, (uint32_t)frames, stdout);
+            for (uint32_t d = 0; d < (uint32_t)draws && cache_size; d++) {
+                uint32_t count = d == (uint32_t)draws - 1 ? mesh.index_count - d * chunk : chunk;
+                uint64_t misses = milo_vcache_misses(mesh.indices + d * chunk, count, cache_size,
+                                                     policy);
+                printf("  draw %-3u     %u triangles, %llu vertex shader runs, ACMR %.3f\n", d,
+                       count / 3, (unsigned long long)misses, (double)misses / (count / 3));
+            }
+            if (status == 0 && out_file) {
+                milo_framebuffer_t *fb = milo_fb_wrap(
+                    (uint32_t *)(gpu.mem + MILO_GPU_FRAMEBUFFER_BASE), width, height);
+                if (!fb || !milo_fb_save_ppm(fb, out_file)) {
+                    fprintf(stderr, "Cannot write %s\n", out_file);
+                    status = 1;
+                }
+                if (fb) milo_fb_free(fb);
+            }
+        } else if (!gpu.error[0]) {
+            fprintf(stderr, "Cannot load %s into GPU memory\n", path);
+        }
+    } else {
+        fprintf(stderr, "Out of memory\n");
+    }
+    if (dots) milo_texture_free(dots);
+    if (tex) milo_texture_free(tex);
+    free(vm);
+    if (cb_ok) milo_cmdbuf_free(&cb);
+    if (gpu_ok) milo_gpu_free(&gpu);
+    free(source);
+    milo_glsl_free(&compiler);
+    milo_mesh_free(&mesh);
+    return status;
+}
+
+/* replay <capture> [--frames N] [--threads T] [--repeat R] [-d]
+ *        [-o last.ppm]:
+ * replay a frame capture R times on each of T threads, each with a
+ * processor of its own, checking every frame's checksum; prints the
+ * frame rate. -d lists the frames of the capture. */
+static int replay_capture(int argc, char **argv) {
+    const char *path = NULL, *out_file = NULL;
+    int frames = 0, threads = 1, repeat = 1;
+    bool dump = false;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            dump = true;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_file = argv[++i];
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path || frames < 0 || threads <= 0 || repeat <= 0) {
+        fprintf(stderr, "Usage: %s replay <capture> [--frames N] [--threads T] [--repeat R] "
+                "[-d] [-o last.ppm]\n", argv[0]);
+        return 1;
+    }
+    
+    milo_replay_t rp;
+    if (!milo_replay_map(&rp, path)) {
+        fprintf(stderr, "%s\n", rp.error);
+        return 1;
+    }
+    if (dump) milo_replay_dump(&rp, stdout);
+    
+    int status = 0;
+    milo_replay_stats_t st = { 0 };
+    double seconds = milo_replay_threads(&rp, threads, (uint32_t)frames, (uint32_t)repeat, &st);
+    if (seconds < 0.0) {
+        fprintf(stderr, "%s\n", rp.error);
+        status = 1;
+    } else {
+        uint32_t per_run = frames && (uint32_t)frames < rp.header->frame_count
+                         ? (uint32_t)frames : rp.header->frame_count;
+        double ms = seconds > 0.0 && st.frames ? 1000.0 * seconds * threads / st.frames : 0.0;
+        printf("%s: %u frames x %d repeats on %d threads in %.3f s: %.1f fps, "
+               "%.3f ms per frame per thread\n", path, per_run, repeat, threads, seconds,
+               seconds > 0.0 ? st.frames / seconds : 0.0, ms);
+        printf("%llu executions, %.1f KB of memory copied per frame, %llu checksum "
+               "mismatches\n", (unsigned long long)st.executions,
+               st.frames ? st.memory_bytes / 1024.0 / st.frames : 0.0,
+               (unsigned long long)st.mismatches);
+        if (st.mismatches) status = 1;
+    }
+    
+    if (status == 0 && out_file) {
+        milo_gpu_t gpu;
+        milo_replay_stats_t one = { 0 };
+        milo_framebuffer_t *fb = NULL;
+        if (milo_gpu_init(&gpu, rp.header->mem_size)) {
+            if (milo_replay_run(&rp, &gpu, (uint32_t)frames, &one) && gpu.target) {
+                fb = milo_fb_wrap((uint32_t *)(gpu.mem + gpu.target_addr), gpu.target_width,
+                                  gpu.target_height);
+            }
+            if (!fb || !milo_fb_save_ppm(fb, out_file)) {
+                fprintf(stderr, "Cannot write %s\n", out_file);
+                status = 1;
+            }
+            if (fb) milo_fb_free(fb);
+            milo_gpu_free(&gpu);
+        } else {
+            fprintf(stderr, "Out of memory\n");
+            status = 1;
+        }
+    }
+    milo_replay_release(&rp);
+    return status;
+}
+
 /*---------------------------------------------------------------------------
  * Main
  *---------------------------------------------------------------------------*/
@@ -372,6 +1212,29 @@ static void usage(const char *prog) {
     fprintf(stderr, "  generate <output_dir>  - Generate test files for VHDL simulation\n");
     fprintf(stderr, "  verify <test_dir> [tolerance] - Verify VHDL output against VM\n");
     fprintf(stderr, "  run <shader.glsl> <u> <v> - Run single shader test\n");
+    fprintf(stderr, "  profile <shader.glsl|.s> [-s WxH] [-n top] [-o counts] [-u util.csv]\n"
+                    "          [-t] [-r rtl_cycles]\n"
+                    "      - Profile a fullscreen render; -t/-r add the SM timing model\n");
+    fprintf(stderr, "  sweep [-s WxH] [-a active_warps] <shader.glsl|.s>...\n"
+                    "      - Compare warp schedulers in the SM timing model\n");
+    fprintf(stderr, "  scale <shader.glsl|.s> [-s WxH] [-m max_sms] [-w tile_warps] [-b bus]\n"
+                    "          [-c MHz] [-o curve.csv]\n"
+                    "      - Frame time against SM count in the timing model\n");
+    fprintf(stderr, "  scene <cube|pyramid|torus> <shader.glsl|.s> [-s WxH] [-f frames]\n"
+                    "          [-t tile_size] [-m max_tris_per_tile] [-z] [-r state]\n"
+                    "          [-o last.ppm]\n"
+                    "      - Render a spinning TB scene mesh; -t bins it into tiles, -z\n"
+                    "        turns off early-Z and hi-Z, -r picks a render state preset\n");
+    fprintf(stderr, "  frame <cube|pyramid|torus> <shader.glsl|.s> [-s WxH] [-f frames]\n"
+                    "          [-t tile_size] [-m max_tris_per_tile] [-d draws] [-k] [-i] [-z]\n"
+                    "          [-v size[,lru]] [-r] [-c capture] [-o last.ppm]\n"
+                    "      - Replay the spinning scene as command buffers on the command\n"
+                    "        processor; -d splits it into draws, -k sorts them, -i draws\n"
+                    "        outside a tile pass, -v shades through a vertex cache, -r\n"
+                    "        reorders the triangles for it, -c captures the frames\n");
+    fprintf(stderr, "  replay <capture> [--frames N] [--threads T] [--repeat R] [-d]\n"
+                    "          [-o last.ppm]\n"
+                    "      - Replay a frame capture, checking each frame's checksum\n");
 }
 
 int main(int argc, char **argv) {
@@ -429,12 +1292,16 @@ int main(int argc, char **argv) {
             return 1;
         }
         
-        const char *asm_code = milo_glsl_get_asm(&compiler);
-        printf("Assembly:\n%s\n", asm_code);
+        printf("Assembly:\n%s\n", milo_glsl_get_asm(&compiler));
+        
+        uint32_t code_size, const_count;
+        const uint64_t *code = milo_glsl_get_code(&compiler, &code_size);
+        const uint32_t *constants = milo_glsl_get_constants(&compiler, &const_count);
         
         milo_vm_init(&vm);
-        if (!milo_vm_load_asm(&vm, asm_code)) {
-            fprintf(stderr, "Assembly error: %s\n", milo_vm_get_error(&vm));
+        if (!milo_vm_load_binary(&vm, code, code_size) ||
+            !milo_vm_load_constants(&vm, MILO_CONST_BASE_ADDR, constants, const_count)) {
+            fprintf(stderr, "Load error: %s\n", milo_vm_get_error(&vm));
             free(source);
             milo_glsl_free(&compiler);
             return 1;
@@ -454,6 +1321,24 @@ int main(int argc, char **argv) {
         milo_glsl_free(&compiler);
         return 0;
     }
+    else if (strcmp(cmd, "profile") == 0) {
+        return profile_shader(argc, argv);
+    }
+    else if (strcmp(cmd, "sweep") == 0) {
+        return sweep_schedulers(argc, argv);
+    }
+    else if (strcmp(cmd, "scale") == 0) {
+        return scale_shader(argc, argv);
+    }
+    else if (strcmp(cmd, "scene") == 0) {
+        return render_scene(argc, argv);
+    }
+    else if (strcmp(cmd, "frame") == 0) {
+        return render_frame(argc, argv);
+    }
+    else if (strcmp(cmd, "replay") == 0) {
+        return replay_capture(argc, argv);
+    }
     else {
         fprintf(stderr, "Unknown command: %s\n", cmd);
         usage(argv[0]);